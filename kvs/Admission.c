@@ -0,0 +1,223 @@
+/*
+ * Copyright (C) 2020 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "Admission.h"
+#include "AsyncLog.h"
+#include "Pacer.h"
+
+static const PCHAR gAdmissionReasonNames[ADMISSION_REASON_COUNT] = {
+    (PCHAR) "none",
+    (PCHAR) "storage pressure",
+    (PCHAR) "buffer duration pressure",
+};
+
+// pacerGetTime in ms the way the signals store it, 0 is left for no signal
+#define ADMISSION_TICK(t)                   ((UINT32) MAX((t) / HUNDREDS_OF_NANOS_IN_A_MILLISECOND, 1))
+
+/**
+ * Returns the most recent reason signalled within the window before now, ADMISSION_REASON_NONE if there is none.
+ * Signals older than the window and the hold time are cleared so a wrapped tick never reads as recent again.
+ */
+STATIC ADMISSION_REASON admissionGetPressure(PAdmissionController pAdmission, UINT64 now, UINT64 window)
+{
+    ADMISSION_REASON reason = ADMISSION_REASON_NONE;
+    SIZE_T tick;
+    INT32 age, latest = MAX_INT32;
+    UINT32 i;
+
+    for (i = ADMISSION_REASON_NONE + 1; i < ADMISSION_REASON_COUNT; i++) {
+        if ((tick = ATOMIC_LOAD(&pAdmission->lastPressureTick[i])) == 0) {
+            continue;
+        }
+
+        // a signal stored after now was read comes out negative
+        age = MAX((INT32) (ADMISSION_TICK(now) - (UINT32) tick), 0);
+        if ((UINT64) age * HUNDREDS_OF_NANOS_IN_A_MILLISECOND <= window) {
+            if (age <= latest) {
+                latest = age;
+                reason = (ADMISSION_REASON) i;
+            }
+        } else if ((UINT64) age * HUNDREDS_OF_NANOS_IN_A_MILLISECOND > pAdmission->holdTime) {
+            // a fresh signal racing in is kept
+            ATOMIC_COMPARE_EXCHANGE(&pAdmission->lastPressureTick[i], &tick, 0);
+        }
+    }
+
+    return reason;
+}
+
+STATIC BOOL admissionHasHeadroom(PAdmissionController pAdmission)
+{
+    return pAdmission->headroomFn == NULL || pAdmission->headroomFn(pAdmission->customData, pAdmission->dropReason);
+}
+
+STATIC VOID admissionStartDrop(PAdmissionController pAdmission, ADMISSION_REASON reason, PFrame pFrame)
+{
+    PAdmissionSpan pSpan;
+
+    // a new span, the audio of the earlier ones may still be arriving
+    pAdmission->spanIndex = (pAdmission->spanIndex + 1) % ADMISSION_SPAN_COUNT;
+    pSpan = &pAdmission->spans[pAdmission->spanIndex];
+    pSpan->reason = reason;
+    pSpan->start = pFrame->presentationTs;
+    pSpan->end = MAX_UINT64;
+    pAdmission->dropReason = reason;
+    pAdmission->stats.droppedGops[reason]++;
+    ALOGW("Dropping video up to the next key frame on %s", gAdmissionReasonNames[reason]);
+}
+
+STATUS admissionInit(PAdmissionController pAdmission, UINT64 holdTime, AdmissionHeadroomFunc headroomFn, UINT64 customData)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    UINT32 i;
+
+    CHK(pAdmission != NULL, STATUS_NULL_ARG);
+
+    MEMSET(pAdmission, 0x00, SIZEOF(AdmissionController));
+    pAdmission->holdTime = holdTime;
+    pAdmission->headroomFn = headroomFn;
+    pAdmission->customData = customData;
+    for (i = 0; i < ADMISSION_SPAN_COUNT; i++) {
+        pAdmission->spans[i].start = MAX_UINT64;
+        pAdmission->spans[i].end = MAX_UINT64;
+    }
+
+CleanUp:
+
+    return retStatus;
+}
+
+VOID admissionSignalPressure(PAdmissionController pAdmission, ADMISSION_REASON reason)
+{
+    if (pAdmission == NULL || reason <= ADMISSION_REASON_NONE || reason >= ADMISSION_REASON_COUNT) {
+        return;
+    }
+
+    ATOMIC_STORE(&pAdmission->lastPressureTick[reason], (SIZE_T) ADMISSION_TICK(pacerGetTime()));
+    ATOMIC_INCREMENT(&pAdmission->pressureEvents[reason]);
+}
+
+BOOL admissionAdmitVideoFrame(PAdmissionController pAdmission, PFrame pFrame, UINT64 now)
+{
+    ADMISSION_REASON reason;
+
+    if ((pFrame->flags & FRAME_FLAG_KEY_FRAME) != 0) {
+        // GOP boundary, drop the whole GOP while any pressure is recent
+        reason = admissionGetPressure(pAdmission, now, pAdmission->holdTime);
+        if (reason == ADMISSION_REASON_NONE && pAdmission->dropReason != ADMISSION_REASON_NONE && !admissionHasHeadroom(pAdmission)) {
+            // the signals stopped with the puts, the content store or the stream buffer is still full
+            reason = pAdmission->dropReason;
+            pAdmission->stats.headroomWaits[reason]++;
+        }
+
+        if (reason != ADMISSION_REASON_NONE && pAdmission->dropReason != ADMISSION_REASON_NONE) {
+            // still dropping, the span carries on
+            pAdmission->dropReason = reason;
+            pAdmission->stats.droppedGops[reason]++;
+        } else if (reason != ADMISSION_REASON_NONE) {
+            admissionStartDrop(pAdmission, reason, pFrame);
+        } else if (pAdmission->dropReason != ADMISSION_REASON_NONE) {
+            ALOGI("Pressure relieved, resuming at key frame");
+            pAdmission->dropReason = ADMISSION_REASON_NONE;
+            pAdmission->spans[pAdmission->spanIndex].end = pFrame->presentationTs;
+        }
+
+        pAdmission->gopStartTime = now;
+        pAdmission->headroomTime = 0;
+    } else if (pAdmission->dropReason == ADMISSION_REASON_NONE) {
+        // pressure in the middle of a GOP drops its tail, the frames already put still decode
+        reason = admissionGetPressure(pAdmission, now, now - MIN(pAdmission->gopStartTime, now));
+        if (reason != ADMISSION_REASON_NONE) {
+            admissionStartDrop(pAdmission, reason, pFrame);
+        }
+    }
+
+    if (pAdmission->dropReason == ADMISSION_REASON_NONE) {
+        return TRUE;
+    }
+
+    pAdmission->stats.droppedVideoFrames[pAdmission->dropReason]++;
+    pAdmission->stats.droppedBytes[pAdmission->dropReason] += pFrame->size;
+
+    return FALSE;
+}
+
+BOOL admissionAwaitingKeyFrame(PAdmissionController pAdmission, UINT64 now)
+{
+    if (pAdmission->dropReason == ADMISSION_REASON_NONE || admissionGetPressure(pAdmission, now, pAdmission->holdTime) != ADMISSION_REASON_NONE) {
+        return FALSE;
+    }
+
+    // asked on every dropped frame, the measurement is reused for the hold time
+    if (pAdmission->headroomTime == 0 || now >= pAdmission->headroomTime + pAdmission->holdTime) {
+        pAdmission->headroom = admissionHasHeadroom(pAdmission);
+        pAdmission->headroomTime = MAX(now, 1);
+    }
+
+    return pAdmission->headroom;
+}
+
+BOOL admissionAdmitAudioFrame(PAdmissionController pAdmission, PFrame pFrame)
+{
+    PAdmissionSpan pSpan;
+    UINT32 i;
+
+    for (i = 0; i < ADMISSION_SPAN_COUNT; i++) {
+        pSpan = &pAdmission->spans[i];
+        if (pFrame->presentationTs >= pSpan->start && pFrame->presentationTs < pSpan->end) {
+            pAdmission->audioDropReason = pSpan->reason;
+            pAdmission->stats.droppedAudioFrames[pSpan->reason]++;
+            pAdmission->stats.droppedBytes[pSpan->reason] += pFrame->size;
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+VOID admissionGetStats(PAdmissionController pAdmission, PAdmissionStats pStats)
+{
+    UINT32 i;
+
+    *pStats = pAdmission->stats;
+    for (i = 0; i < ADMISSION_REASON_COUNT; i++) {
+        pStats->pressureEvents[i] = (UINT64) ATOMIC_LOAD(&pAdmission->pressureEvents[i]);
+    }
+}
+
+VOID admissionPrintStats(PAdmissionController pAdmission)
+{
+    AdmissionStats stats;
+    UINT32 i;
+
+    admissionGetStats(pAdmission, &stats);
+    for (i = ADMISSION_REASON_NONE + 1; i < ADMISSION_REASON_COUNT; i++) {
+        if (stats.pressureEvents[i] == 0 && stats.droppedGops[i] == 0) {
+            continue;
+        }
+
+        printf("Admission on %s: %" PRIu64 " signals, %" PRIu64 " GOPs dropped, %" PRIu64 " video and %" PRIu64
+               " audio frames, %" PRIu64 " KB, %" PRIu64 " key frames waited for headroom\n",
+               gAdmissionReasonNames[i], stats.pressureEvents[i], stats.droppedGops[i], stats.droppedVideoFrames[i],
+               stats.droppedAudioFrames[i], stats.droppedBytes[i] >> 10, stats.headroomWaits[i]);
+    }
+}
@@ -0,0 +1,134 @@
+/*
+ * Copyright (C) 2020 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __KVS_ADMISSION_H__
+#define __KVS_ADMISSION_H__
+
+#include "KvsApp.h"
+
+/**
+ * How long a pressure signal keeps the channel dropping, in 100ns. The SDK signals pressure on puts, so once frames
+ * are dropped the signals stop and the channel only resumes at a key frame after this long if it has headroom again.
+ */
+#define DEFAULT_ADMISSION_HOLD_TIME         (1 * HUNDREDS_OF_NANOS_IN_A_SECOND)
+
+// share of the content store, or of the buffer duration of the stream, which has to be free before a channel resumes
+#define ADMISSION_RESUME_HEADROOM_PERCENT   20
+
+// video drops remembered for the audio, which trails the video by up to the buffering of the audio source
+#define ADMISSION_SPAN_COUNT                4
+
+typedef enum {
+    ADMISSION_REASON_NONE,
+    // content store of the client is running out, storageOverflowPressureFn
+    ADMISSION_REASON_STORAGE_PRESSURE,
+    // the stream buffers close to its buffer duration, bufferDurationOverflowPressureFn
+    ADMISSION_REASON_BUFFER_DURATION_PRESSURE,
+    ADMISSION_REASON_COUNT,
+} ADMISSION_REASON;
+
+/**
+ * Measures whether the channel has room again for what it dropped on. The signals stop once the channel drops, so their
+ * absence says nothing about the content store or the buffered duration.
+ */
+typedef BOOL (*AdmissionHeadroomFunc)(UINT64, ADMISSION_REASON);
+
+typedef struct {
+    UINT64 pressureEvents[ADMISSION_REASON_COUNT];
+    UINT64 droppedGops[ADMISSION_REASON_COUNT];
+    UINT64 droppedVideoFrames[ADMISSION_REASON_COUNT];
+    UINT64 droppedAudioFrames[ADMISSION_REASON_COUNT];
+    UINT64 droppedBytes[ADMISSION_REASON_COUNT];
+    // key frames the channel kept dropping at with the signals over, for lack of headroom
+    UINT64 headroomWaits[ADMISSION_REASON_COUNT];
+} AdmissionStats, *PAdmissionStats;
+
+// presentation time span of a video drop, the end is MAX_UINT64 while still dropping
+typedef struct {
+    ADMISSION_REASON reason;
+    UINT64 start;
+    UINT64 end;
+} AdmissionSpan, *PAdmissionSpan;
+
+/**
+ * Decides per frame whether a channel puts it, based on the pressure callbacks of the SDK.
+ *
+ * Under pressure video is dropped a whole GOP at a time, from the key frame or from the frame the pressure hit up to
+ * the next key frame, so what reaches the stream always decodes. Audio is dropped over the same presentation time
+ * span. Nothing is polled, the decisions only read what the callbacks stored.
+ */
+typedef struct {
+    // written from the SDK callbacks, pacerGetTime in ms of the last signal per reason, 0 for none. The ms wrap in a
+    // 32 bit SIZE_T after 49 days, the put thread clears the signals older than the hold time long before.
+    volatile SIZE_T lastPressureTick[ADMISSION_REASON_COUNT];
+    volatile SIZE_T pressureEvents[ADMISSION_REASON_COUNT];
+    UINT64 holdTime;
+    // NULL resumes on the hold time alone
+    AdmissionHeadroomFunc headroomFn;
+    UINT64 customData;
+
+    // owned by the put thread
+    UINT64 gopStartTime;
+    ADMISSION_REASON dropReason;
+    // the last video drops, spanIndex is the latest one
+    AdmissionSpan spans[ADMISSION_SPAN_COUNT];
+    UINT32 spanIndex;
+    // span of the last audio frame dropped
+    ADMISSION_REASON audioDropReason;
+    // pacerGetTime of the last headroom measurement of admissionAwaitingKeyFrame and its outcome
+    UINT64 headroomTime;
+    BOOL headroom;
+    AdmissionStats stats;
+} AdmissionController, *PAdmissionController;
+
+/**
+ * The headroom function is asked at the key frames of a drop once the hold time passed without a signal
+ */
+STATUS admissionInit(PAdmissionController, UINT64, AdmissionHeadroomFunc, UINT64);
+
+/**
+ * Records a pressure signal. Safe to call from any thread, including the SDK callbacks.
+ */
+VOID admissionSignalPressure(PAdmissionController, ADMISSION_REASON);
+
+/**
+ * Returns whether the video frame is put. Frames are expected in decoding order.
+ */
+BOOL admissionAdmitVideoFrame(PAdmissionController, PFrame, UINT64);
+
+/**
+ * Returns whether video is being dropped with the pressure over and room to resume, the channel resumes at the next
+ * key frame. The headroom is measured at most once per hold time.
+ */
+BOOL admissionAwaitingKeyFrame(PAdmissionController, UINT64);
+
+/**
+ * Returns whether the audio frame is put, audio inside one of the last spans of dropped video is dropped too and
+ * audioDropReason tells which span.
+ */
+BOOL admissionAdmitAudioFrame(PAdmissionController, PFrame);
+
+VOID admissionGetStats(PAdmissionController, PAdmissionStats);
+
+VOID admissionPrintStats(PAdmissionController);
+
+#endif /* __KVS_ADMISSION_H__ */
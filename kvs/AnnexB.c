@@ -0,0 +1,844 @@
+/*
+ * Copyright (C) 2020 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+#include "AnnexB.h"
+#include "AsyncLog.h"
+#include "Pacer.h"
+
+// Start code prefix, NAL header and the first slice header byte
+#define ANNEXB_NAL_PREFIX_LOOKAHEAD         5
+
+PBYTE annexBFindStartCode(PBYTE pStart, PBYTE pEnd)
+{
+    PBYTE p = pStart;
+
+    // Lane i of the three loads holds p[i], p[i + 1] and p[i + 2], so a block of 16 candidates reads 18 bytes
+#if defined(__SSE2__)
+    __m128i zero = _mm_setzero_si128(), one = _mm_set1_epi8(1);
+    INT32 mask;
+
+    for (; pEnd - p >= 18; p += 16) {
+        mask = _mm_movemask_epi8(_mm_and_si128(_mm_and_si128(_mm_cmpeq_epi8(_mm_loadu_si128((__m128i*) p), zero),
+                                                              _mm_cmpeq_epi8(_mm_loadu_si128((__m128i*) (p + 1)), zero)),
+                                               _mm_cmpeq_epi8(_mm_loadu_si128((__m128i*) (p + 2)), one)));
+        if (mask != 0) {
+            return p + __builtin_ctz((UINT32) mask);
+        }
+    }
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    uint8x16_t zero = vdupq_n_u8(0), one = vdupq_n_u8(1), match;
+    UINT64 mask;
+
+    for (; pEnd - p >= 18; p += 16) {
+        match = vandq_u8(vandq_u8(vceqq_u8(vld1q_u8(p), zero), vceqq_u8(vld1q_u8(p + 1), zero)), vceqq_u8(vld1q_u8(p + 2), one));
+        // Narrow every lane to a nibble, NEON has no movemask
+        mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(match), 4)), 0);
+        if (mask != 0) {
+            return p + (__builtin_ctzll(mask) >> 2);
+        }
+    }
+#endif
+
+    for (; pEnd - p >= 3; p++) {
+        if (p[0] == 0x00 && p[1] == 0x00 && p[2] == 0x01) {
+            return p;
+        }
+    }
+
+    return pEnd;
+}
+
+STATIC UINT32 readBe32(PBYTE p)
+{
+    return ((UINT32) p[0] << 24) | ((UINT32) p[1] << 16) | ((UINT32) p[2] << 8) | (UINT32) p[3];
+}
+
+STATIC VOID writeBe16(PBYTE p, UINT32 value)
+{
+    p[0] = (BYTE) (value >> 8);
+    p[1] = (BYTE) value;
+}
+
+STATIC VOID writeBe32(PBYTE p, UINT32 value)
+{
+    p[0] = (BYTE) (value >> 24);
+    p[1] = (BYTE) (value >> 16);
+    p[2] = (BYTE) (value >> 8);
+    p[3] = (BYTE) value;
+}
+
+/**
+ * Finds the NAL unit after pStart, its payload starts after the start code and ends before the zeros in front of the
+ * next one. Returns FALSE when there is none left.
+ */
+STATIC BOOL annexBNextNal(PBYTE pStart, PBYTE pEnd, PBYTE* ppPayload, PBYTE* ppPayloadEnd)
+{
+    PBYTE pStartCode = annexBFindStartCode(pStart, pEnd), pNext;
+
+    if (pStartCode == pEnd) {
+        return FALSE;
+    }
+
+    *ppPayload = pStartCode + 3;
+    pNext = annexBFindStartCode(*ppPayload, pEnd);
+    // a NAL unit never ends with a zero byte, those are the leading zero of the next start code or trailing zeros
+    while (pNext > *ppPayload && pNext[-1] == 0x00) {
+        pNext--;
+    }
+
+    *ppPayloadEnd = pNext;
+
+    return TRUE;
+}
+
+STATUS annexBConvertToAvcc(PBYTE pBuffer, UINT32 size, UINT32 capacity, PUINT32 pSize)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    PBYTE pEnd = pBuffer + size, pCur = pBuffer, pPayload, pPayloadEnd, pOut;
+    INT64 growth = 0, shift = 0;
+    UINT32 length;
+
+    CHK(pBuffer != NULL && pSize != NULL, STATUS_NULL_ARG);
+
+    // The length prefix of a NAL unit replaces everything from the end of the previous one to its payload. Where
+    // that is less than 4 bytes the output runs ahead of the input, so the unit is moved up by the most it ever
+    // runs ahead first and then written from the start without overwriting what is still to be read.
+    while (annexBNextNal(pCur, pEnd, &pPayload, &pPayloadEnd)) {
+        if (pPayloadEnd > pPayload) {
+            growth += ANNEXB_AVCC_LENGTH_SIZE - (pPayload - pCur);
+            shift = MAX(shift, growth);
+        } else {
+            growth -= pPayload - pCur;
+        }
+        pCur = pPayloadEnd;
+    }
+
+    CHK(pCur != pBuffer, STATUS_INVALID_ARG);
+    CHK((UINT64) size + shift <= capacity, STATUS_BUFFER_TOO_SMALL);
+
+    if (shift != 0) {
+        MEMMOVE(pBuffer + shift, pBuffer, size);
+        pEnd += shift;
+    }
+
+    pOut = pBuffer;
+    for (pCur = pBuffer + shift; annexBNextNal(pCur, pEnd, &pPayload, &pPayloadEnd); pCur = pPayloadEnd) {
+        if (pPayloadEnd == pPayload) {
+            continue;
+        }
+
+        length = (UINT32) (pPayloadEnd - pPayload);
+        writeBe32(pOut, length);
+        pOut += ANNEXB_AVCC_LENGTH_SIZE;
+        if (pOut != pPayload) {
+            MEMMOVE(pOut, pPayload, length);
+        }
+        pOut += length;
+    }
+
+    *pSize = (UINT32) (pOut - pBuffer);
+
+CleanUp:
+
+    return retStatus;
+}
+
+STATUS annexBGetAvccCpd(PBYTE pBuffer, UINT32 size, PBYTE pCpd, PUINT32 pCpdSize)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    PBYTE pCur = pBuffer, pEnd = pBuffer + size, pSps = NULL, pPps = NULL, pOut = pCpd;
+    UINT32 length, spsLength = 0, ppsLength = 0;
+
+    CHK(pBuffer != NULL && pCpd != NULL && pCpdSize != NULL, STATUS_NULL_ARG);
+
+    while (pEnd - pCur > ANNEXB_AVCC_LENGTH_SIZE && (pSps == NULL || pPps == NULL)) {
+        length = readBe32(pCur);
+        pCur += ANNEXB_AVCC_LENGTH_SIZE;
+        CHK(length != 0 && length <= (UINT64) (pEnd - pCur), STATUS_INVALID_ARG);
+
+        // the SPS has to reach profile_idc, constraint flags and level_idc
+        if ((pCur[0] & H264_NAL_TYPE_MASK) == H264_NAL_TYPE_SPS && pSps == NULL && length >= 4) {
+            pSps = pCur;
+            spsLength = length;
+        } else if ((pCur[0] & H264_NAL_TYPE_MASK) == H264_NAL_TYPE_PPS && pPps == NULL) {
+            pPps = pCur;
+            ppsLength = length;
+        }
+
+        pCur += length;
+    }
+
+    CHK(pSps != NULL && pPps != NULL, STATUS_ANNEXB_MISSING_PARAMETER_SETS);
+    CHK(spsLength <= 0xffff && ppsLength <= 0xffff, STATUS_INVALID_ARG);
+    CHK(11 + spsLength + ppsLength <= *pCpdSize, STATUS_BUFFER_TOO_SMALL);
+
+    // ISO/IEC 14496-15 AVCDecoderConfigurationRecord with one SPS and one PPS
+    *pOut++ = 1;
+    *pOut++ = pSps[1];
+    *pOut++ = pSps[2];
+    *pOut++ = pSps[3];
+    *pOut++ = 0xfc | (ANNEXB_AVCC_LENGTH_SIZE - 1);
+    *pOut++ = 0xe0 | 1;
+    writeBe16(pOut, spsLength);
+    pOut += 2;
+    MEMCPY(pOut, pSps, spsLength);
+    pOut += spsLength;
+    *pOut++ = 1;
+    writeBe16(pOut, ppsLength);
+    pOut += 2;
+    MEMCPY(pOut, pPps, ppsLength);
+    pOut += ppsLength;
+
+    *pCpdSize = (UINT32) (pOut - pCpd);
+
+CleanUp:
+
+    return retStatus;
+}
+
+STATIC UINT64 getClockNs(clockid_t clockId)
+{
+    struct timespec now;
+
+    clock_gettime(clockId, &now);
+
+    return (UINT64) now.tv_sec * 1000000000ULL + (UINT64) now.tv_nsec;
+}
+
+STATIC BOOL isVclNal(UINT8 nalType)
+{
+    return nalType == H264_NAL_TYPE_NON_IDR_SLICE || nalType == H264_NAL_TYPE_IDR_SLICE;
+}
+
+/**
+ * NAL units which, when they follow a coded picture, start the next access unit (H.264 7.4.1.2.3)
+ */
+STATIC BOOL isAccessUnitPrefixNal(UINT8 nalType)
+{
+    return nalType == H264_NAL_TYPE_SEI || nalType == H264_NAL_TYPE_SPS || nalType == H264_NAL_TYPE_PPS ||
+        nalType == H264_NAL_TYPE_AUD || (nalType >= 14 && nalType <= 18);
+}
+
+/**
+ * Takes a pool buffer for the unit being filled, or a larger one when it is full. Never called with the reader
+ * lock held, the put side has to be able to release units meanwhile.
+ */
+STATIC STATUS getFillBuffer(PAnnexBReader pReader, UINT32 size, PBYTE* ppBuffer, PUINT32 pCapacity)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+
+    while (TRUE) {
+        CHK(!ATOMIC_LOAD_BOOL(&pReader->shutdown), STATUS_ANNEXB_END_OF_STREAM);
+
+        if (*ppBuffer == NULL) {
+            retStatus = framePoolGet(pReader->pPool, MAX(size, 1), ANNEXB_READER_POOL_WAIT, ppBuffer, pCapacity);
+        } else {
+            retStatus = framePoolGrow(pReader->pPool, size, ANNEXB_READER_POOL_WAIT, ppBuffer, pCapacity);
+        }
+
+        CHK(retStatus == STATUS_OPERATION_TIMED_OUT, retStatus);
+    }
+
+CleanUp:
+
+    return retStatus;
+}
+
+/**
+ * Converts the first size bytes of the unit being filled to length prefixed NAL units, moving them to a larger buffer
+ * when three byte start codes grow them past their own. STATUS_BUFFER_TOO_SMALL when they outgrow the largest one.
+ */
+STATIC STATUS convertAccessUnit(PAnnexBReader pReader, PAnnexBAccessUnit pUnit, UINT32 size)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+
+    while ((retStatus = annexBConvertToAvcc(pUnit->buffer, size, pUnit->capacity, &pUnit->size)) == STATUS_BUFFER_TOO_SMALL &&
+           pUnit->capacity < pReader->maxFrameSize) {
+        CHK_STATUS(getFillBuffer(pReader, size, &pUnit->buffer, &pUnit->capacity));
+    }
+
+CleanUp:
+
+    return retStatus;
+}
+
+/**
+ * Publishes the first auSize bytes of the unit being filled and moves the remainder into the next buffer. A unit
+ * which is dropped instead keeps the remainder in its own buffer.
+ */
+STATIC STATUS completeAccessUnit(PAnnexBReader pReader, UINT32 auSize)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    PAnnexBAccessUnit pUnit = &pReader->units[pReader->fillIndex], pNext;
+    UINT32 spillSize = pUnit->size - auSize, nextIndex, nextCapacity = 0;
+    PBYTE pNextBuffer = NULL;
+    BOOL locked = FALSE;
+
+    if (pUnit->keyFrame) {
+        pReader->awaitingKeyFrame = FALSE;
+    }
+
+    if (!pReader->oversized && !pReader->awaitingKeyFrame) {
+        CHK_STATUS(getFillBuffer(pReader, spillSize, &pNextBuffer, &nextCapacity));
+        // moved out first, the conversion may grow the unit over it
+        MEMCPY(pNextBuffer, pUnit->buffer + auSize, spillSize);
+        retStatus = convertAccessUnit(pReader, pUnit, auSize);
+        CHK(retStatus == STATUS_SUCCESS || retStatus == STATUS_BUFFER_TOO_SMALL, retStatus);
+        pReader->oversized = retStatus == STATUS_BUFFER_TOO_SMALL;
+        retStatus = STATUS_SUCCESS;
+    }
+
+    if (pReader->oversized || pReader->awaitingKeyFrame) {
+        // Larger than any buffer, the beginning is gone already or the conversion does not fit, or it references a
+        // unit dropped before, so drop it and reuse the buffer. A conversion which moved to a larger buffer left the
+        // spill in the next one only.
+        if (pReader->oversized) {
+            pReader->stats.droppedOversizedFrames++;
+        } else {
+            pReader->stats.droppedDependentFrames++;
+        }
+
+        MEMMOVE(pUnit->buffer, pNextBuffer != NULL ? pNextBuffer : pUnit->buffer + auSize, spillSize);
+        pUnit->size = spillSize;
+        pUnit->keyFrame = FALSE;
+        pUnit->captureTime = pacerGetTime();
+        pUnit->segment = pReader->segment;
+        pReader->oversized = FALSE;
+        pReader->awaitingKeyFrame = TRUE;
+        pReader->hasVcl = FALSE;
+        CHK(FALSE, retStatus);
+    }
+
+    MUTEX_LOCK(pReader->lock);
+    locked = TRUE;
+
+    // The unit being filled and the one receiving the spill both have to be free
+    while (pReader->readyCount + 2 > ANNEXB_READER_BUFFER_COUNT && !ATOMIC_LOAD_BOOL(&pReader->shutdown)) {
+        CVAR_WAIT(pReader->freeCvar, pReader->lock, INFINITE_TIME_VALUE);
+    }
+
+    CHK(!ATOMIC_LOAD_BOOL(&pReader->shutdown), STATUS_ANNEXB_END_OF_STREAM);
+
+    nextIndex = (pReader->fillIndex + 1) % ANNEXB_READER_BUFFER_COUNT;
+    pNext = &pReader->units[nextIndex];
+    pNext->buffer = pNextBuffer;
+    pNext->capacity = nextCapacity;
+    pNextBuffer = NULL;
+    pNext->size = spillSize;
+    pNext->keyFrame = FALSE;
+    pNext->captureTime = pacerGetTime();
+    pNext->segment = pReader->segment;
+
+    if (pReader->pWatcher != NULL) {
+        if (pUnit->segment == pReader->lastSegment) {
+            pUnit->captureTime = pReader->lastSegmentCaptureTime + pReader->segmentFrameDuration;
+        } else {
+            pUnit->captureTime = MAX(pUnit->captureTime, pReader->lastSegmentCaptureTime + pReader->segmentFrameDuration);
+            pReader->lastSegment = pUnit->segment;
+        }
+
+        pReader->lastSegmentCaptureTime = pUnit->captureTime;
+    }
+
+    pReader->stats.accessUnits++;
+    if (pUnit->keyFrame) {
+        pReader->stats.keyFrames++;
+    }
+
+    pReader->readyCount++;
+    pReader->fillIndex = nextIndex;
+    pReader->hasVcl = FALSE;
+    CVAR_SIGNAL(pReader->readyCvar);
+    if (pReader->readyFn != NULL) {
+        pReader->readyFn(pReader->customData);
+    }
+
+CleanUp:
+
+    if (locked) {
+        MUTEX_UNLOCK(pReader->lock);
+    }
+
+    if (pNextBuffer != NULL) {
+        framePoolPut(pReader->pPool, pNextBuffer);
+    }
+
+    return retStatus;
+}
+
+/**
+ * Finds access unit boundaries in the bytes appended since the last call.
+ */
+STATIC STATUS scanAccessUnits(PAnnexBReader pReader)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    PAnnexBAccessUnit pUnit = &pReader->units[pReader->fillIndex];
+    PBYTE pStartCode, pEnd;
+    UINT32 offset, nalStart;
+    UINT8 nalType;
+
+    while (TRUE) {
+        pEnd = pUnit->buffer + pUnit->size;
+        pStartCode = annexBFindStartCode(pUnit->buffer + pReader->scanOffset, pEnd);
+
+        if (pEnd - pStartCode < ANNEXB_NAL_PREFIX_LOOKAHEAD) {
+            if (pStartCode != pEnd) {
+                // Need the NAL header to decide, look at this start code again after the next read
+                pReader->scanOffset = (UINT32) (pStartCode - pUnit->buffer);
+            } else {
+                // A start code could straddle the read boundary
+                pReader->scanOffset = pUnit->size > 2 ? pUnit->size - 2 : 0;
+                if (!pReader->synced) {
+                    MEMMOVE(pUnit->buffer, pUnit->buffer + pReader->scanOffset, pUnit->size - pReader->scanOffset);
+                    pUnit->size -= pReader->scanOffset;
+                    pReader->scanOffset = 0;
+                }
+            }
+
+            break;
+        }
+
+        offset = (UINT32) (pStartCode - pUnit->buffer);
+        nalType = pStartCode[3] & H264_NAL_TYPE_MASK;
+        // Keep the leading zero of a four byte start code with the NAL it introduces
+        nalStart = offset > 0 && pUnit->buffer[offset - 1] == 0x00 ? offset - 1 : offset;
+
+        if (!pReader->synced) {
+            // Joined the stream mid NAL, drop everything before the first start code
+            MEMMOVE(pUnit->buffer, pUnit->buffer + nalStart, pUnit->size - nalStart);
+            pUnit->size -= nalStart;
+            offset -= nalStart;
+            pReader->synced = TRUE;
+        } else if (pReader->hasVcl &&
+                   (isAccessUnitPrefixNal(nalType) ||
+                    // first_mb_in_slice is ue(v), a leading 1 bit encodes 0, the first slice of a new picture
+                    (isVclNal(nalType) && (pStartCode[4] & 0x80) != 0))) {
+            CHK_STATUS(completeAccessUnit(pReader, nalStart));
+            pUnit = &pReader->units[pReader->fillIndex];
+            offset -= nalStart;
+        }
+
+        if (isVclNal(nalType)) {
+            pReader->hasVcl = TRUE;
+            if (nalType == H264_NAL_TYPE_IDR_SLICE) {
+                pUnit->keyFrame = TRUE;
+            }
+        }
+
+        pReader->scanOffset = offset + 3;
+    }
+
+CleanUp:
+
+    return retStatus;
+}
+
+/**
+ * Publishes the last picture of the segment being read, it has no following start code, and closes the segment.
+ * The next one starts with a start code of its own.
+ */
+STATIC STATUS finishSegment(PAnnexBReader pReader)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    PAnnexBAccessUnit pUnit = &pReader->units[pReader->fillIndex];
+
+    if (pReader->oversized) {
+        pReader->stats.droppedOversizedFrames++;
+        pReader->awaitingKeyFrame = TRUE;
+    } else if (pReader->synced && pReader->hasVcl) {
+        CHK_STATUS(completeAccessUnit(pReader, pUnit->size));
+        pUnit = &pReader->units[pReader->fillIndex];
+    }
+
+    pUnit->size = 0;
+    pUnit->keyFrame = FALSE;
+    pReader->scanOffset = 0;
+    pReader->synced = FALSE;
+    pReader->hasVcl = FALSE;
+    pReader->oversized = FALSE;
+    close(pReader->fd);
+    pReader->fd = -1;
+
+CleanUp:
+
+    return retStatus;
+}
+
+STATIC STATUS openNextSegment(PAnnexBReader pReader)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    PAnnexBAccessUnit pUnit = &pReader->units[pReader->fillIndex];
+
+    CHK_STATUS(segmentWatcherOpenNext(pReader->pWatcher, &pReader->fd, &pReader->segment));
+    pUnit->segment = pReader->segment;
+    pUnit->captureTime = pacerGetTime();
+    pReader->tailing = FALSE;
+
+CleanUp:
+
+    return retStatus;
+}
+
+STATIC PVOID annexBIngestRoutine(PVOID args)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    PAnnexBReader pReader = (PAnnexBReader) args;
+    PAnnexBAccessUnit pUnit;
+    struct pollfd pollFds[3];
+    UINT64 startWallTime = getClockNs(CLOCK_MONOTONIC), scanStartTime;
+    UINT32 readSize, keepFrom;
+    ssize_t bytesRead;
+
+    pollFds[0].fd = pReader->fd;
+    pollFds[0].events = POLLIN;
+    pollFds[1].fd = pReader->stopFd;
+    pollFds[1].events = POLLIN;
+    // -1 without a watched directory, poll skips it
+    pollFds[2].fd = segmentWatcherGetFd(pReader->pWatcher);
+    pollFds[2].events = POLLIN;
+
+    pUnit = &pReader->units[pReader->fillIndex];
+    retStatus = getFillBuffer(pReader, 0, &pUnit->buffer, &pUnit->capacity);
+    CHK(retStatus != STATUS_ANNEXB_END_OF_STREAM, STATUS_SUCCESS);
+    CHK_STATUS(retStatus);
+    pUnit->captureTime = pacerGetTime();
+
+    if (pReader->pWatcher != NULL) {
+        CHK_STATUS(openNextSegment(pReader));
+    }
+
+    while (!ATOMIC_LOAD_BOOL(&pReader->shutdown)) {
+        pUnit = &pReader->units[pReader->fillIndex];
+
+        if (pUnit->size == pUnit->capacity && pUnit->capacity < pReader->maxFrameSize) {
+            // a frame larger than its class moves up, key frames mostly
+            retStatus = getFillBuffer(pReader, pUnit->size, &pUnit->buffer, &pUnit->capacity);
+            CHK(retStatus != STATUS_ANNEXB_END_OF_STREAM, STATUS_SUCCESS);
+            CHK_STATUS(retStatus);
+        }
+
+        if (pUnit->size == pReader->maxFrameSize) {
+            // Everything before the scan offset is scanned already. Keep the unscanned tail and the byte in front of
+            // it so a start code spanning the cut is still found.
+            keepFrom = pReader->scanOffset > 0 ? pReader->scanOffset - 1 : 0;
+            MEMMOVE(pUnit->buffer, pUnit->buffer + keepFrom, pUnit->size - keepFrom);
+            pReader->scanOffset -= keepFrom;
+            pUnit->size -= keepFrom;
+            pReader->oversized = TRUE;
+        }
+
+        // a segment is always readable, one that was read up to what the recorder wrote so far waits for its events
+        pollFds[0].fd = pReader->tailing ? -1 : pReader->fd;
+        if (poll(pollFds, 3, -1) < 0) {
+            CHK(errno == EINTR, STATUS_READ_FILE_FAILED);
+            continue;
+        }
+
+        if (pollFds[1].revents != 0) {
+            break;
+        }
+
+        if (pollFds[2].revents != 0) {
+            // drained before the segment is read again so whatever the events report is visible to the read
+            CHK_STATUS(segmentWatcherProcessEvents(pReader->pWatcher));
+            pReader->tailing = FALSE;
+        }
+
+        if (pReader->fd < 0) {
+            CHK_STATUS(openNextSegment(pReader));
+            continue;
+        }
+
+        readSize = MIN(ANNEXB_READER_READ_SIZE, pUnit->capacity - pUnit->size);
+        bytesRead = read(pReader->fd, pUnit->buffer + pUnit->size, readSize);
+        if (bytesRead < 0) {
+            CHK(errno == EINTR || errno == EAGAIN, STATUS_READ_FILE_FAILED);
+            continue;
+        }
+
+        if (bytesRead == 0 && pReader->pWatcher != NULL) {
+            if (!segmentWatcherIsReadDone(pReader->pWatcher)) {
+                pReader->tailing = TRUE;
+                continue;
+            }
+
+            retStatus = finishSegment(pReader);
+            CHK(retStatus != STATUS_ANNEXB_END_OF_STREAM, STATUS_SUCCESS);
+            CHK_STATUS(retStatus);
+            CHK_STATUS(openNextSegment(pReader));
+            continue;
+        }
+
+        if (bytesRead == 0) {
+            // End of a pipe or file. Flush the last picture, it has no following start code.
+            if (pReader->oversized) {
+                pReader->stats.droppedOversizedFrames++;
+            } else if (pReader->synced && pReader->hasVcl) {
+                retStatus = completeAccessUnit(pReader, pUnit->size);
+                CHK(retStatus != STATUS_ANNEXB_END_OF_STREAM, STATUS_SUCCESS);
+                CHK_STATUS(retStatus);
+            }
+
+            break;
+        }
+
+        pUnit->size += (UINT32) bytesRead;
+        pReader->stats.bytesRead += (UINT64) bytesRead;
+
+        scanStartTime = getClockNs(CLOCK_THREAD_CPUTIME_ID);
+        retStatus = scanAccessUnits(pReader);
+        pReader->stats.scanCpuTimeNs += getClockNs(CLOCK_THREAD_CPUTIME_ID) - scanStartTime;
+        CHK(retStatus != STATUS_ANNEXB_END_OF_STREAM, STATUS_SUCCESS);
+        CHK_STATUS(retStatus);
+    }
+
+CleanUp:
+
+    if (STATUS_FAILED(retStatus)) {
+        ALOGE("Annex-B ingest from %s failed with 0x%08x", pReader->path, retStatus);
+    }
+
+    pReader->stats.threadCpuTimeNs = getClockNs(CLOCK_THREAD_CPUTIME_ID);
+    pReader->stats.threadWallTimeNs = getClockNs(CLOCK_MONOTONIC) - startWallTime;
+
+    MUTEX_LOCK(pReader->lock);
+    pReader->endOfStream = TRUE;
+    CVAR_BROADCAST(pReader->readyCvar);
+    if (pReader->readyFn != NULL) {
+        pReader->readyFn(pReader->customData);
+    }
+    MUTEX_UNLOCK(pReader->lock);
+
+    return (PVOID) (ULONG_PTR) retStatus;
+}
+
+STATUS createAnnexBReader(PCHAR path, UINT64 segmentFrameDuration, PFramePool pPool, AnnexBReadyFunc readyFn, UINT64 customData, PAnnexBReader* ppReader)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    PAnnexBReader pReader = NULL;
+    struct stat fileStat;
+
+    CHK(path != NULL && pPool != NULL && ppReader != NULL, STATUS_NULL_ARG);
+
+    CHK(NULL != (pReader = (PAnnexBReader) MEMCALLOC(1, SIZEOF(AnnexBReader))), STATUS_NOT_ENOUGH_MEMORY);
+    STRNCPY(pReader->path, path, MAX_PATH_LEN);
+    pReader->fd = -1;
+    pReader->stopFd = -1;
+    pReader->segmentFrameDuration = segmentFrameDuration;
+    pReader->pPool = pPool;
+    pReader->maxFrameSize = framePoolGetMaxSize(pPool);
+    pReader->readyFn = readyFn;
+    pReader->customData = customData;
+    pReader->lock = MUTEX_CREATE(FALSE);
+    pReader->readyCvar = CVAR_CREATE();
+    pReader->freeCvar = CVAR_CREATE();
+    CHK(IS_VALID_MUTEX_VALUE(pReader->lock) && IS_VALID_CVAR_VALUE(pReader->readyCvar) && IS_VALID_CVAR_VALUE(pReader->freeCvar),
+        STATUS_NOT_ENOUGH_MEMORY);
+
+    if (STRCMP(path, "-") == 0) {
+        pReader->fd = STDIN_FILENO;
+    } else {
+        CHK(stat(path, &fileStat) == 0, STATUS_OPEN_FILE_FAILED);
+        pReader->isFifo = S_ISFIFO(fileStat.st_mode);
+        if (S_ISDIR(fileStat.st_mode)) {
+            // the segments are opened by the ingest thread as they show up
+            CHK_STATUS(createSegmentWatcher(path, &pReader->pWatcher));
+        } else {
+            // Holding the write side of a FIFO as well means an encoder restart never shows up as end of file
+            CHK((pReader->fd = open(path, pReader->isFifo ? O_RDWR : O_RDONLY)) >= 0, STATUS_OPEN_FILE_FAILED);
+        }
+    }
+
+    CHK((pReader->stopFd = eventfd(0, EFD_CLOEXEC)) >= 0, STATUS_INVALID_OPERATION);
+    CHK_STATUS(THREAD_CREATE(&pReader->ingestTid, annexBIngestRoutine, (PVOID) pReader));
+
+CleanUp:
+
+    if (STATUS_FAILED(retStatus)) {
+        DLOGE("Failed to open Annex-B input %s with 0x%08x", path == NULL ? "" : path, retStatus);
+        freeAnnexBReader(&pReader);
+    }
+
+    if (ppReader != NULL) {
+        *ppReader = pReader;
+    }
+
+    return retStatus;
+}
+
+STATUS annexBReaderStop(PAnnexBReader pReader)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    UINT64 value = 1;
+
+    CHK(pReader != NULL, STATUS_NULL_ARG);
+    CHK(IS_VALID_TID_VALUE(pReader->ingestTid), retStatus);
+
+    ATOMIC_STORE_BOOL(&pReader->shutdown, TRUE);
+    if (write(pReader->stopFd, &value, SIZEOF(value)) != SIZEOF(value)) {
+        ALOGW("Failed to signal the Annex-B ingest thread");
+    }
+
+    MUTEX_LOCK(pReader->lock);
+    CVAR_BROADCAST(pReader->freeCvar);
+    MUTEX_UNLOCK(pReader->lock);
+
+    THREAD_JOIN(pReader->ingestTid, NULL);
+    pReader->ingestTid = INVALID_TID_VALUE;
+
+CleanUp:
+
+    return retStatus;
+}
+
+STATUS freeAnnexBReader(PAnnexBReader* ppReader)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    PAnnexBReader pReader;
+    UINT32 i;
+
+    CHK(ppReader != NULL, STATUS_NULL_ARG);
+
+    pReader = *ppReader;
+    CHK(pReader != NULL, retStatus);
+
+    annexBReaderStop(pReader);
+
+    if (pReader->fd > STDIN_FILENO) {
+        close(pReader->fd);
+    }
+
+    if (pReader->stopFd >= 0) {
+        close(pReader->stopFd);
+    }
+
+    freeSegmentWatcher(&pReader->pWatcher);
+
+    // the unit being filled and the queued ones still hold pool buffers
+    for (i = 0; i < ANNEXB_READER_BUFFER_COUNT; i++) {
+        if (pReader->units[i].buffer != NULL) {
+            framePoolPut(pReader->pPool, pReader->units[i].buffer);
+        }
+    }
+
+    if (IS_VALID_CVAR_VALUE(pReader->readyCvar)) {
+        CVAR_FREE(pReader->readyCvar);
+    }
+
+    if (IS_VALID_CVAR_VALUE(pReader->freeCvar)) {
+        CVAR_FREE(pReader->freeCvar);
+    }
+
+    if (IS_VALID_MUTEX_VALUE(pReader->lock)) {
+        MUTEX_FREE(pReader->lock);
+    }
+
+    MEMFREE(pReader);
+    *ppReader = NULL;
+
+CleanUp:
+
+    return retStatus;
+}
+
+STATUS annexBReaderAcquire(PAnnexBReader pReader, UINT64 timeout, PAnnexBAccessUnit* ppUnit)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    BOOL locked = FALSE;
+
+    CHK(pReader != NULL && ppUnit != NULL, STATUS_NULL_ARG);
+
+    MUTEX_LOCK(pReader->lock);
+    locked = TRUE;
+
+    if (pReader->readyCount == 0 && !pReader->endOfStream && timeout != 0) {
+        CVAR_WAIT(pReader->readyCvar, pReader->lock, timeout);
+    }
+
+    if (pReader->readyCount != 0) {
+        *ppUnit = &pReader->units[pReader->readyHead];
+    } else {
+        CHK(!pReader->endOfStream, STATUS_ANNEXB_END_OF_STREAM);
+        CHK(FALSE, STATUS_OPERATION_TIMED_OUT);
+    }
+
+CleanUp:
+
+    if (locked) {
+        MUTEX_UNLOCK(pReader->lock);
+    }
+
+    return retStatus;
+}
+
+STATUS annexBReaderRelease(PAnnexBReader pReader)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    BOOL locked = FALSE;
+
+    CHK(pReader != NULL, STATUS_NULL_ARG);
+
+    MUTEX_LOCK(pReader->lock);
+    locked = TRUE;
+
+    CHK(pReader->readyCount != 0, STATUS_INVALID_OPERATION);
+    framePoolPut(pReader->pPool, pReader->units[pReader->readyHead].buffer);
+    pReader->units[pReader->readyHead].buffer = NULL;
+    pReader->readyHead = (pReader->readyHead + 1) % ANNEXB_READER_BUFFER_COUNT;
+    pReader->readyCount--;
+    CVAR_SIGNAL(pReader->freeCvar);
+
+CleanUp:
+
+    if (locked) {
+        MUTEX_UNLOCK(pReader->lock);
+    }
+
+    return retStatus;
+}
+
+STATUS annexBReaderGetStats(PAnnexBReader pReader, PAnnexBReaderStats pStats)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+
+    CHK(pReader != NULL && pStats != NULL, STATUS_NULL_ARG);
+
+    *pStats = pReader->stats;
+
+CleanUp:
+
+    return retStatus;
+}
@@ -0,0 +1,181 @@
+/*
+ * Copyright (C) 2020 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __KVS_ANNEXB_H__
+#define __KVS_ANNEXB_H__
+
+#include "KvsApp.h"
+#include "FramePool.h"
+#include "SegmentWatcher.h"
+
+#define H264_NAL_TYPE_MASK                  0x1f
+#define H264_NAL_TYPE_NON_IDR_SLICE         1
+#define H264_NAL_TYPE_IDR_SLICE             5
+#define H264_NAL_TYPE_SEI                   6
+#define H264_NAL_TYPE_SPS                   7
+#define H264_NAL_TYPE_PPS                   8
+#define H264_NAL_TYPE_AUD                   9
+
+/**
+ * Number of access units cycled between the ingest thread and the put routine.
+ * One is being filled, the rest are queued or being put.
+ */
+#define ANNEXB_READER_BUFFER_COUNT          4
+#define ANNEXB_READER_READ_SIZE             (64 * 1024)
+// how often an ingest thread waiting for the frame pool checks for shutdown
+#define ANNEXB_READER_POOL_WAIT             (100 * HUNDREDS_OF_NANOS_IN_A_MILLISECOND)
+#define DEFAULT_ANNEXB_MAX_FRAME_SIZE       (512 * 1024)
+#define DEFAULT_ANNEXB_SEGMENT_FRAME_RATE   30
+// NAL units are converted to 4 byte big endian length prefixes, the avcC says so with lengthSizeMinusOne
+#define ANNEXB_AVCC_LENGTH_SIZE             4
+#define ANNEXB_MAX_AVCC_CPD_SIZE            1024
+
+/**
+ * Returns a pointer to the first 00 00 01 start code prefix in [pStart, pEnd) or pEnd when there is none.
+ * Uses SSE2 or NEON when the compiler targets them, scalar code otherwise.
+ */
+PBYTE annexBFindStartCode(PBYTE, PBYTE);
+
+/**
+ * Rewrites an Annex-B access unit as length prefixed NAL units in place and returns the new size. Trailing zeros are
+ * dropped and a three byte start code grows the unit by a byte, it has to fit the capacity or STATUS_BUFFER_TOO_SMALL
+ * is returned with the unit untouched. Only moves what follows a three byte start code, a unit with four byte start
+ * codes is rewritten without moving its payload.
+ */
+STATUS annexBConvertToAvcc(PBYTE, UINT32, UINT32, PUINT32);
+
+/**
+ * Builds the avcC decoder configuration record of the first SPS and PPS of a length prefixed access unit. Returns
+ * STATUS_ANNEXB_MISSING_PARAMETER_SETS when the unit does not carry both.
+ */
+STATUS annexBGetAvccCpd(PBYTE, UINT32, PBYTE, PUINT32);
+
+typedef struct {
+    // frame pool buffer, held while the unit is filled, queued or being put
+    PBYTE buffer;
+    UINT32 capacity;
+    UINT32 size;
+    BOOL keyFrame;
+    // pacerGetTime() when the first byte of the access unit was read, monotonic so a wall clock step moves no frame
+    UINT64 captureTime;
+    // segment of a watched directory the unit was read from, 0 for other inputs
+    UINT32 segment;
+} AnnexBAccessUnit, *PAnnexBAccessUnit;
+
+typedef struct {
+    UINT64 bytesRead;
+    UINT64 accessUnits;
+    UINT64 keyFrames;
+    UINT64 droppedOversizedFrames;
+    // frames after a dropped one up to the next key frame, they reference it
+    UINT64 droppedDependentFrames;
+    // CPU time spent splitting and converting, excluding read() and waiting for free buffers
+    UINT64 scanCpuTimeNs;
+    // CPU time of the whole ingest thread and its wall clock lifetime
+    UINT64 threadCpuTimeNs;
+    UINT64 threadWallTimeNs;
+} AnnexBReaderStats, *PAnnexBReaderStats;
+
+/**
+ * Called from the ingest thread when an access unit is ready and once at the end of the input. Has to return quickly.
+ */
+typedef VOID (*AnnexBReadyFunc)(UINT64);
+
+/**
+ * Splits an Annex-B H.264 elementary stream read from a pipe, FIFO, file or the segments a recorder writes to a
+ * directory into access units.
+ *
+ * Reads land directly in frame pool buffers, starting in the smallest class and moving up when a frame outgrows
+ * its buffer. Only the bytes that belong to the next access unit are moved when a boundary is found, then the unit
+ * is converted to length prefixed NAL units in place so the SDK does not adapt every frame again. The put side
+ * acquires units in order and releases them once putKinesisVideoFrame returns, which hands the buffer back to the
+ * pool.
+ */
+typedef struct {
+    CHAR path[MAX_PATH_LEN + 1];
+    INT32 fd;
+    INT32 stopFd;
+    BOOL isFifo;
+    // frames of segments are spaced by this, in 100ns
+    UINT64 segmentFrameDuration;
+    // NULL unless the input is a directory of segments, fd is then the segment being read or -1
+    PSegmentWatcher pWatcher;
+    // shared with the other readers, the largest class bounds the frame size
+    PFramePool pPool;
+    UINT32 maxFrameSize;
+    AnnexBReadyFunc readyFn;
+    UINT64 customData;
+    TID ingestTid;
+    MUTEX lock;
+    CVAR readyCvar;
+    CVAR freeCvar;
+    // guarded by lock
+    UINT32 readyHead;
+    UINT32 readyCount;
+    BOOL endOfStream;
+    volatile ATOMIC_BOOL shutdown;
+    AnnexBAccessUnit units[ANNEXB_READER_BUFFER_COUNT];
+    // owned by the ingest thread
+    UINT32 fillIndex;
+    UINT32 scanOffset;
+    BOOL synced;
+    BOOL hasVcl;
+    BOOL oversized;
+    // a unit was dropped, the ones up to the next key frame cannot be decoded without it
+    BOOL awaitingKeyFrame;
+    UINT32 segment;
+    // captureTime of the last unit of a segment published
+    UINT64 lastSegmentCaptureTime;
+    UINT32 lastSegment;
+    // read everything written to the segment so far, waiting for the recorder
+    BOOL tailing;
+    AnnexBReaderStats stats;
+} AnnexBReader, *PAnnexBReader;
+
+/**
+ * Opens the input ("-" for stdin, a directory to follow the segments written to it) and starts the ingest thread
+ * filling buffers of the pool. The ready callback is optional. A recorder writes segments in bursts, their frames
+ * are timestamped the frame duration (100ns) apart from the time the first one of a segment was read instead of when
+ * each one was.
+ */
+STATUS createAnnexBReader(PCHAR, UINT64, PFramePool, AnnexBReadyFunc, UINT64, PAnnexBReader*);
+STATUS freeAnnexBReader(PAnnexBReader*);
+
+/**
+ * Stops the ingest thread and closes the queue, stats are final afterwards.
+ */
+STATUS annexBReaderStop(PAnnexBReader);
+
+/**
+ * Waits up to the timeout (100ns) for the next access unit, a zero timeout only polls. Returns STATUS_OPERATION_TIMED_OUT when none arrived
+ * and STATUS_ANNEXB_END_OF_STREAM once the input is exhausted and all units were consumed.
+ */
+STATUS annexBReaderAcquire(PAnnexBReader, UINT64, PAnnexBAccessUnit*);
+
+/**
+ * Hands the oldest acquired access unit back to the ingest thread and its buffer back to the pool.
+ */
+STATUS annexBReaderRelease(PAnnexBReader);
+
+STATUS annexBReaderGetStats(PAnnexBReader, PAnnexBReaderStats);
+
+#endif /* __KVS_ANNEXB_H__ */
@@ -0,0 +1,770 @@
+/*
+ * Copyright (C) 2020 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "AsyncLog.h"
+#include "MemoryArena.h"
+
+#define ASYNC_LOG_NOT_TRUNCATED             MAX_UINT32
+
+typedef enum {
+    ASYNC_LOG_LENGTH_NONE,
+    ASYNC_LOG_LENGTH_HH,
+    ASYNC_LOG_LENGTH_H,
+    ASYNC_LOG_LENGTH_L,
+    ASYNC_LOG_LENGTH_LL,
+    ASYNC_LOG_LENGTH_J,
+    ASYNC_LOG_LENGTH_Z,
+    ASYNC_LOG_LENGTH_T,
+    ASYNC_LOG_LENGTH_LONG_DOUBLE,
+} ASYNC_LOG_LENGTH;
+
+/**
+ * One printf conversion, parsed the same way when capturing and when formatting
+ */
+typedef struct {
+    PCHAR pStart;
+    PCHAR pFlags;
+    UINT32 flagsLength;
+    BOOL widthStar;
+    PCHAR pWidth;
+    UINT32 widthLength;
+    BOOL precisionStar;
+    PCHAR pPrecision;
+    UINT32 precisionLength;
+    ASYNC_LOG_LENGTH length;
+    CHAR conversion;
+} AsyncLogSpec, *PAsyncLogSpec;
+
+static AsyncLogger gAsyncLogger;
+
+/**
+ * Parses the conversion starting at the '%', returns the character following it
+ */
+STATIC PCHAR asyncLogParseSpec(PCHAR pCur, PAsyncLogSpec pSpec)
+{
+    MEMSET(pSpec, 0x00, SIZEOF(AsyncLogSpec));
+    pSpec->pStart = pCur++;
+
+    pSpec->pFlags = pCur;
+    while (*pCur != '\0' && STRCHR("-+ #0'", *pCur) != NULL) {
+        pCur++;
+    }
+    pSpec->flagsLength = (UINT32) (pCur - pSpec->pFlags);
+
+    if (*pCur == '*') {
+        pSpec->widthStar = TRUE;
+        pCur++;
+    } else {
+        pSpec->pWidth = pCur;
+        while (*pCur >= '0' && *pCur <= '9') {
+            pCur++;
+        }
+        pSpec->widthLength = (UINT32) (pCur - pSpec->pWidth);
+    }
+
+    if (*pCur == '.') {
+        pCur++;
+        if (*pCur == '*') {
+            pSpec->precisionStar = TRUE;
+            pCur++;
+        } else {
+            // an empty precision is zero
+            pSpec->pPrecision = pCur - 1;
+            while (*pCur >= '0' && *pCur <= '9') {
+                pCur++;
+            }
+            pSpec->precisionLength = (UINT32) (pCur - pSpec->pPrecision);
+        }
+    }
+
+    switch (*pCur) {
+        case 'h':
+            pSpec->length = *++pCur == 'h' ? ASYNC_LOG_LENGTH_HH : ASYNC_LOG_LENGTH_H;
+            pCur += pSpec->length == ASYNC_LOG_LENGTH_HH ? 1 : 0;
+            break;
+        case 'l':
+            pSpec->length = *++pCur == 'l' ? ASYNC_LOG_LENGTH_LL : ASYNC_LOG_LENGTH_L;
+            pCur += pSpec->length == ASYNC_LOG_LENGTH_LL ? 1 : 0;
+            break;
+        case 'q':
+            pSpec->length = ASYNC_LOG_LENGTH_LL;
+            pCur++;
+            break;
+        case 'j':
+            pSpec->length = ASYNC_LOG_LENGTH_J;
+            pCur++;
+            break;
+        case 'z':
+            pSpec->length = ASYNC_LOG_LENGTH_Z;
+            pCur++;
+            break;
+        case 't':
+            pSpec->length = ASYNC_LOG_LENGTH_T;
+            pCur++;
+            break;
+        case 'L':
+            pSpec->length = ASYNC_LOG_LENGTH_LONG_DOUBLE;
+            pCur++;
+            break;
+        default:
+            break;
+    }
+
+    pSpec->conversion = *pCur;
+
+    return *pCur == '\0' ? pCur : pCur + 1;
+}
+
+STATIC BOOL asyncLogIsWide(PAsyncLogSpec pSpec)
+{
+    return pSpec->length == ASYNC_LOG_LENGTH_L || pSpec->length == ASYNC_LOG_LENGTH_LL || pSpec->length == ASYNC_LOG_LENGTH_J ||
+        pSpec->length == ASYNC_LOG_LENGTH_Z || pSpec->length == ASYNC_LOG_LENGTH_T;
+}
+
+/**
+ * Pulls one argument of the conversion off the list, FALSE for conversions which can not be deferred
+ */
+STATIC BOOL asyncLogCaptureArg(PAsyncLogSpec pSpec, va_list* pArgs, PAsyncLogRecord pRecord, PUINT32 pTextSize)
+{
+    PCHAR string;
+    DOUBLE value;
+    UINT32 length;
+
+    switch (pSpec->conversion) {
+        case 'd':
+        case 'i':
+            switch (pSpec->length) {
+                case ASYNC_LOG_LENGTH_L:
+                    pRecord->args[pRecord->argCount] = (UINT64) (INT64) va_arg(*pArgs, long);
+                    break;
+                case ASYNC_LOG_LENGTH_LL:
+                    pRecord->args[pRecord->argCount] = (UINT64) (INT64) va_arg(*pArgs, long long);
+                    break;
+                case ASYNC_LOG_LENGTH_J:
+                    pRecord->args[pRecord->argCount] = (UINT64) (INT64) va_arg(*pArgs, intmax_t);
+                    break;
+                case ASYNC_LOG_LENGTH_Z:
+                    pRecord->args[pRecord->argCount] = (UINT64) (INT64) va_arg(*pArgs, ssize_t);
+                    break;
+                case ASYNC_LOG_LENGTH_T:
+                    pRecord->args[pRecord->argCount] = (UINT64) (INT64) va_arg(*pArgs, ptrdiff_t);
+                    break;
+                default:
+                    pRecord->args[pRecord->argCount] = (UINT64) (INT64) va_arg(*pArgs, int);
+                    break;
+            }
+            break;
+        case 'u':
+        case 'o':
+        case 'x':
+        case 'X':
+            switch (pSpec->length) {
+                case ASYNC_LOG_LENGTH_L:
+                    pRecord->args[pRecord->argCount] = (UINT64) va_arg(*pArgs, unsigned long);
+                    break;
+                case ASYNC_LOG_LENGTH_LL:
+                    pRecord->args[pRecord->argCount] = (UINT64) va_arg(*pArgs, unsigned long long);
+                    break;
+                case ASYNC_LOG_LENGTH_J:
+                    pRecord->args[pRecord->argCount] = (UINT64) va_arg(*pArgs, uintmax_t);
+                    break;
+                case ASYNC_LOG_LENGTH_Z:
+                    pRecord->args[pRecord->argCount] = (UINT64) va_arg(*pArgs, size_t);
+                    break;
+                case ASYNC_LOG_LENGTH_T:
+                    pRecord->args[pRecord->argCount] = (UINT64) va_arg(*pArgs, ptrdiff_t);
+                    break;
+                default:
+                    pRecord->args[pRecord->argCount] = (UINT64) va_arg(*pArgs, unsigned int);
+                    break;
+            }
+            break;
+        case 'c':
+            if (pSpec->length != ASYNC_LOG_LENGTH_NONE) {
+                return FALSE;
+            }
+            pRecord->args[pRecord->argCount] = (UINT64) va_arg(*pArgs, int);
+            break;
+        case 'e':
+        case 'E':
+        case 'f':
+        case 'F':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A':
+            value = pSpec->length == ASYNC_LOG_LENGTH_LONG_DOUBLE ? (DOUBLE) va_arg(*pArgs, long double) : va_arg(*pArgs, double);
+            MEMCPY(&pRecord->args[pRecord->argCount], &value, SIZEOF(value));
+            break;
+        case 'p':
+            pRecord->args[pRecord->argCount] = (UINT64) (ULONG_PTR) va_arg(*pArgs, PVOID);
+            break;
+        case 's':
+            // the string is gone by the time the record is formatted, copy what fits
+            if (pSpec->length != ASYNC_LOG_LENGTH_NONE || *pTextSize == ASYNC_LOG_TEXT_SIZE) {
+                return FALSE;
+            }
+            if ((string = va_arg(*pArgs, PCHAR)) == NULL) {
+                string = (PCHAR) "(null)";
+            }
+            length = (UINT32) STRNLEN(string, ASYNC_LOG_TEXT_SIZE - 1 - *pTextSize);
+            MEMCPY(pRecord->text + *pTextSize, string, length);
+            pRecord->text[*pTextSize + length] = '\0';
+            pRecord->args[pRecord->argCount] = *pTextSize;
+            *pTextSize += length + 1;
+            break;
+        default:
+            // %n, wide characters and anything unknown
+            return FALSE;
+    }
+
+    pRecord->argCount++;
+
+    return TRUE;
+}
+
+/**
+ * Copies the arguments the format refers to into the record, the format itself stays a pointer
+ */
+STATIC VOID asyncLogCapture(PAsyncLogRecord pRecord, PCHAR format, va_list args)
+{
+    AsyncLogSpec spec;
+    PCHAR pCur = format;
+    UINT32 textSize = 0, needed;
+    va_list argsCopy;
+
+    va_copy(argsCopy, args);
+    pRecord->format = format;
+    pRecord->argCount = 0;
+    pRecord->truncatedAt = ASYNC_LOG_NOT_TRUNCATED;
+
+    while ((pCur = STRCHR(pCur, '%')) != NULL) {
+        if (pCur[1] == '%') {
+            pCur += 2;
+            continue;
+        }
+
+        pCur = asyncLogParseSpec(pCur, &spec);
+        needed = 1 + (spec.widthStar ? 1 : 0) + (spec.precisionStar ? 1 : 0);
+        if (pRecord->argCount + needed > ASYNC_LOG_MAX_ARGS) {
+            pRecord->truncatedAt = (UINT32) (spec.pStart - format);
+            break;
+        }
+
+        if (spec.widthStar) {
+            pRecord->args[pRecord->argCount++] = (UINT64) (INT64) va_arg(argsCopy, int);
+        }
+
+        if (spec.precisionStar) {
+            pRecord->args[pRecord->argCount++] = (UINT64) (INT64) va_arg(argsCopy, int);
+        }
+
+        if (!asyncLogCaptureArg(&spec, &argsCopy, pRecord, &textSize)) {
+            pRecord->truncatedAt = (UINT32) (spec.pStart - format);
+            break;
+        }
+    }
+
+    va_end(argsCopy);
+}
+
+/**
+ * Rebuilds one conversion with the star arguments filled in and the length matching the 64 bit argument
+ */
+STATIC VOID asyncLogBuildSpec(PAsyncLogSpec pSpec, PAsyncLogRecord pRecord, PUINT32 pArg, PCHAR spec, UINT32 specSize)
+{
+    UINT32 size = 0;
+
+    spec[size++] = '%';
+    MEMCPY(spec + size, pSpec->pFlags, pSpec->flagsLength);
+    size += pSpec->flagsLength;
+
+    if (pSpec->widthStar) {
+        size += SNPRINTF(spec + size, specSize - size, "%d", (INT32) pRecord->args[(*pArg)++]);
+    } else {
+        MEMCPY(spec + size, pSpec->pWidth, pSpec->widthLength);
+        size += pSpec->widthLength;
+    }
+
+    if (pSpec->precisionStar) {
+        size += SNPRINTF(spec + size, specSize - size, ".%d", (INT32) pRecord->args[(*pArg)++]);
+    } else {
+        MEMCPY(spec + size, pSpec->pPrecision, pSpec->precisionLength);
+        size += pSpec->precisionLength;
+    }
+
+    switch (pSpec->conversion) {
+        case 'd':
+        case 'i':
+        case 'u':
+        case 'o':
+        case 'x':
+        case 'X':
+            if (asyncLogIsWide(pSpec)) {
+                spec[size++] = 'l';
+                spec[size++] = 'l';
+            } else if (pSpec->length == ASYNC_LOG_LENGTH_H || pSpec->length == ASYNC_LOG_LENGTH_HH) {
+                spec[size++] = 'h';
+                if (pSpec->length == ASYNC_LOG_LENGTH_HH) {
+                    spec[size++] = 'h';
+                }
+            }
+            break;
+        default:
+            break;
+    }
+
+    spec[size++] = pSpec->conversion;
+    spec[size] = '\0';
+}
+
+/**
+ * Formats a captured record into the line, returns the line length
+ */
+STATIC UINT32 asyncLogFormat(PAsyncLogRecord pRecord, PCHAR line, UINT32 lineSize)
+{
+    AsyncLogSpec spec;
+    CHAR specText[64];
+    PCHAR pCur = pRecord->format, pNext, pEnd = NULL;
+    UINT32 size = 0, arg = 0, length;
+    UINT64 value;
+    DOUBLE doubleValue;
+    INT32 result;
+
+    if (pRecord->truncatedAt != ASYNC_LOG_NOT_TRUNCATED) {
+        pEnd = pRecord->format + pRecord->truncatedAt;
+    }
+
+    while (size < lineSize - 1 && *pCur != '\0' && pCur != pEnd) {
+        pNext = STRCHR(pCur, '%');
+        if (pNext == NULL || (pEnd != NULL && pNext >= pEnd)) {
+            break;
+        }
+
+        length = MIN((UINT32) (pNext - pCur), lineSize - 1 - size);
+        MEMCPY(line + size, pCur, length);
+        size += length;
+
+        if (pNext[1] == '%') {
+            line[size++] = '%';
+            pCur = pNext + 2;
+            continue;
+        }
+
+        pCur = asyncLogParseSpec(pNext, &spec);
+        asyncLogBuildSpec(&spec, pRecord, &arg, specText, SIZEOF(specText));
+        value = pRecord->args[arg++];
+        switch (spec.conversion) {
+            case 'd':
+            case 'i':
+                result = asyncLogIsWide(&spec) ? SNPRINTF(line + size, lineSize - size, specText, (long long) (INT64) value)
+                                               : SNPRINTF(line + size, lineSize - size, specText, (int) (INT64) value);
+                break;
+            case 'u':
+            case 'o':
+            case 'x':
+            case 'X':
+                result = asyncLogIsWide(&spec) ? SNPRINTF(line + size, lineSize - size, specText, (unsigned long long) value)
+                                               : SNPRINTF(line + size, lineSize - size, specText, (unsigned int) value);
+                break;
+            case 'c':
+                result = SNPRINTF(line + size, lineSize - size, specText, (int) value);
+                break;
+            case 'p':
+                result = SNPRINTF(line + size, lineSize - size, specText, (PVOID) (ULONG_PTR) value);
+                break;
+            case 's':
+                result = SNPRINTF(line + size, lineSize - size, specText, pRecord->text + value);
+                break;
+            default:
+                MEMCPY(&doubleValue, &value, SIZEOF(doubleValue));
+                result = SNPRINTF(line + size, lineSize - size, specText, doubleValue);
+                break;
+        }
+
+        size = result < 0 ? size : MIN(size + (UINT32) result, lineSize - 1);
+    }
+
+    // the literal tail, or everything from the conversion which could not be captured
+    length = MIN((UINT32) STRLEN(pCur), lineSize - 1 - size);
+    MEMCPY(line + size, pCur, length);
+    size += length;
+    line[size] = '\0';
+
+    // the SDK terminates its lines itself, the app lines follow the SDK
+    while (size > 0 && line[size - 1] == '\n') {
+        line[--size] = '\0';
+    }
+
+    if (pRecord->suppressed != 0) {
+        result = SNPRINTF(line + size, lineSize - size, " (%u similar suppressed)", pRecord->suppressed);
+        size = result < 0 ? size : MIN(size + (UINT32) result, lineSize - 1);
+    }
+
+    return size;
+}
+
+/**
+ * Lets ASYNC_LOG_SITE_RATE records of the site through per second, returns how many were held back since the last one
+ */
+STATIC BOOL asyncLogSiteAdmit(PAsyncLogSite pSite, UINT64 now, PUINT32 pSuppressed)
+{
+    // milliseconds wrap after weeks instead of minutes on 32 bit
+    SIZE_T nowMs = (SIZE_T) (now / HUNDREDS_OF_NANOS_IN_A_MILLISECOND), windowStart = ATOMIC_LOAD(&pSite->windowStart);
+
+    if (nowMs - windowStart >= 1000 && ATOMIC_COMPARE_EXCHANGE(&pSite->windowStart, &windowStart, nowMs)) {
+        ATOMIC_STORE(&pSite->windowCount, 0);
+    }
+
+    if (ATOMIC_INCREMENT(&pSite->windowCount) >= ASYNC_LOG_SITE_RATE) {
+        ATOMIC_INCREMENT(&pSite->suppressed);
+        ATOMIC_INCREMENT(&gAsyncLogger.suppressed);
+        return FALSE;
+    }
+
+    *pSuppressed = (UINT32) ATOMIC_EXCHANGE(&pSite->suppressed, 0);
+
+    return TRUE;
+}
+
+STATIC VOID asyncLogReleaseRing(PVOID pRing)
+{
+    // the records stay for the flusher, the next new thread appends behind them
+    ATOMIC_STORE_BOOL(&((PAsyncLogRing) pRing)->owned, FALSE);
+}
+
+/**
+ * The ring of the calling thread. Threads get one on their first log, reusing the ring of an exited thread when
+ * there is one. NULL once all ASYNC_LOG_MAX_RINGS are taken.
+ */
+STATIC PAsyncLogRing asyncLogGetRing()
+{
+    PAsyncLogRing pRing = (PAsyncLogRing) pthread_getspecific(gAsyncLogger.ringKey);
+    SIZE_T count, owned, i;
+    MEMORY_TAG tag;
+
+    if (pRing != NULL) {
+        return pRing;
+    }
+
+    count = MIN(ATOMIC_LOAD(&gAsyncLogger.ringCount), ASYNC_LOG_MAX_RINGS);
+    for (i = 0; i < count && pRing == NULL; i++) {
+        pRing = (PAsyncLogRing) ATOMIC_LOAD(&gAsyncLogger.rings[i]);
+        owned = FALSE;
+        if (pRing == NULL || !ATOMIC_COMPARE_EXCHANGE(&pRing->owned, &owned, TRUE)) {
+            pRing = NULL;
+        }
+    }
+
+    if (pRing == NULL) {
+        // one allocation per thread, never per record
+        tag = memoryArenaSetTag(MEMORY_TAG_LOGGING);
+        if ((i = ATOMIC_INCREMENT(&gAsyncLogger.ringCount)) < ASYNC_LOG_MAX_RINGS) {
+            pRing = (PAsyncLogRing) MEMCALLOC(1, SIZEOF(AsyncLogRing));
+        }
+        memoryArenaSetTag(tag);
+
+        if (pRing == NULL) {
+            return NULL;
+        }
+
+        pRing->owned = TRUE;
+        ATOMIC_STORE(&gAsyncLogger.rings[i], (SIZE_T) pRing);
+    }
+
+    pthread_setspecific(gAsyncLogger.ringKey, pRing);
+
+    return pRing;
+}
+
+/**
+ * Formats on the calling thread and writes through the given logger
+ */
+STATIC VOID asyncLogWriteNow(logPrintFunc printFn, UINT32 level, PCHAR tag, PCHAR format, va_list args, UINT32 suppressed)
+{
+    CHAR line[ASYNC_LOG_LINE_SIZE];
+    INT32 size;
+
+    size = vsnprintf(line, SIZEOF(line), format, args);
+    size = size < 0 ? 0 : MIN(size, (INT32) SIZEOF(line) - 1);
+    while (size > 0 && line[size - 1] == '\n') {
+        line[--size] = '\0';
+    }
+
+    if (suppressed != 0) {
+        SNPRINTF(line + size, SIZEOF(line) - size, " (%u similar suppressed)", suppressed);
+    }
+
+    printFn(level, tag, (PCHAR) "%s", line);
+}
+
+STATIC VOID asyncLogAppend(PAsyncLogSite pSite, UINT32 level, PCHAR tag, PCHAR format, va_list args)
+{
+    PAsyncLogRing pRing;
+    PAsyncLogRecord pRecord;
+    UINT64 now = GETTIME();
+    UINT32 suppressed = 0;
+    SIZE_T head, tail;
+
+    if (level < loggerGetLogLevel() || !asyncLogSiteAdmit(pSite, now, &suppressed)) {
+        return;
+    }
+
+    if (!ATOMIC_LOAD_BOOL(&gAsyncLogger.started)) {
+        asyncLogWriteNow(globalCustomLogPrintFn, level, tag, format, args, suppressed);
+        return;
+    }
+
+    ATOMIC_INCREMENT(&gAsyncLogger.records);
+    if ((pRing = asyncLogGetRing()) == NULL) {
+        ATOMIC_INCREMENT(&gAsyncLogger.unbuffered);
+        asyncLogWriteNow(gAsyncLogger.sinkFn, level, tag, format, args, suppressed);
+        return;
+    }
+
+    head = pRing->head;
+    tail = ATOMIC_LOAD(&pRing->tail);
+    if (head - tail >= ASYNC_LOG_RING_RECORD_COUNT) {
+        // never wait for the flusher, the flusher reports the loss
+        ATOMIC_INCREMENT(&pRing->dropped);
+        return;
+    }
+
+    pRecord = &pRing->records[head % ASYNC_LOG_RING_RECORD_COUNT];
+    pRecord->time = now;
+    pRecord->tag = tag;
+    pRecord->level = level;
+    pRecord->suppressed = suppressed;
+    asyncLogCapture(pRecord, format, args);
+    ATOMIC_STORE(&pRing->head, head + 1);
+
+    // wake the flusher early rather than dropping, only once per fill
+    if (head + 1 - tail == ASYNC_LOG_RING_RECORD_COUNT / 2) {
+        CVAR_SIGNAL(gAsyncLogger.wakeCvar);
+    }
+}
+
+VOID asyncLogPrint(PAsyncLogSite pSite, UINT32 level, PCHAR format, ...)
+{
+    va_list args;
+
+    va_start(args, format);
+    asyncLogAppend(pSite, level, (PCHAR) ASYNC_LOG_TAG, format, args);
+    va_end(args);
+}
+
+/**
+ * Installed as the SDK logger. The SDK formats are literals, every one is rate limited on its own.
+ */
+STATIC VOID asyncLogSdkPrint(UINT32 level, PCHAR tag, PCHAR format, ...)
+{
+    va_list args;
+
+    va_start(args, format);
+    asyncLogAppend(&gAsyncLogger.sdkSites[((ULONG_PTR) format >> 3) % ASYNC_LOG_SDK_SITE_COUNT], level, tag, format, args);
+    va_end(args);
+}
+
+/**
+ * Writes out every record logged so far in time order across the rings, under the flush lock
+ */
+STATIC VOID asyncLogDrain()
+{
+    CHAR line[ASYNC_LOG_LINE_SIZE];
+    PAsyncLogRing pRing, pOldest;
+    PAsyncLogRecord pRecord;
+    SIZE_T count, tail, i;
+    UINT64 dropped;
+
+    MUTEX_LOCK(gAsyncLogger.flushLock);
+
+    count = MIN(ATOMIC_LOAD(&gAsyncLogger.ringCount), ASYNC_LOG_MAX_RINGS);
+    while (TRUE) {
+        pOldest = NULL;
+        for (i = 0; i < count; i++) {
+            pRing = (PAsyncLogRing) ATOMIC_LOAD(&gAsyncLogger.rings[i]);
+            if (pRing != NULL && pRing->tail != ATOMIC_LOAD(&pRing->head) &&
+                (pOldest == NULL ||
+                 pRing->records[pRing->tail % ASYNC_LOG_RING_RECORD_COUNT].time <
+                     pOldest->records[pOldest->tail % ASYNC_LOG_RING_RECORD_COUNT].time)) {
+                pOldest = pRing;
+            }
+        }
+
+        if (pOldest == NULL) {
+            break;
+        }
+
+        tail = pOldest->tail;
+        pRecord = &pOldest->records[tail % ASYNC_LOG_RING_RECORD_COUNT];
+        asyncLogFormat(pRecord, line, SIZEOF(line));
+        gAsyncLogger.sinkFn(pRecord->level, pRecord->tag, (PCHAR) "%s", line);
+        gAsyncLogger.written++;
+        ATOMIC_STORE(&pOldest->tail, tail + 1);
+    }
+
+    for (i = 0; i < count; i++) {
+        pRing = (PAsyncLogRing) ATOMIC_LOAD(&gAsyncLogger.rings[i]);
+        if (pRing != NULL && (dropped = (UINT64) ATOMIC_LOAD(&pRing->dropped)) != pRing->droppedReported) {
+            gAsyncLogger.sinkFn(LOG_LEVEL_WARN, (PCHAR) ASYNC_LOG_TAG, (PCHAR) "%" PRIu64 " log records dropped, the log output fell behind\n",
+                                dropped - pRing->droppedReported);
+            pRing->droppedReported = dropped;
+        }
+    }
+
+    MUTEX_UNLOCK(gAsyncLogger.flushLock);
+}
+
+STATIC PVOID asyncLogFlusherRoutine(PVOID args)
+{
+    UNUSED_PARAM(args);
+
+    while (!ATOMIC_LOAD_BOOL(&gAsyncLogger.shutdown)) {
+        MUTEX_LOCK(gAsyncLogger.wakeLock);
+        CVAR_WAIT(gAsyncLogger.wakeCvar, gAsyncLogger.wakeLock, ASYNC_LOG_FLUSH_INTERVAL);
+        MUTEX_UNLOCK(gAsyncLogger.wakeLock);
+
+        asyncLogDrain();
+    }
+
+    asyncLogDrain();
+
+    return NULL;
+}
+
+STATUS asyncLogStart()
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    PAsyncLogger pLogger = &gAsyncLogger;
+    BOOL keyCreated = FALSE;
+
+    CHK(!ATOMIC_LOAD_BOOL(&pLogger->started), STATUS_INVALID_OPERATION);
+
+    MEMSET(pLogger, 0x00, SIZEOF(AsyncLogger));
+    CHK(pthread_key_create(&pLogger->ringKey, asyncLogReleaseRing) == 0, STATUS_NOT_ENOUGH_MEMORY);
+    keyCreated = TRUE;
+    pLogger->flushLock = MUTEX_CREATE(FALSE);
+    pLogger->wakeLock = MUTEX_CREATE(FALSE);
+    pLogger->wakeCvar = CVAR_CREATE();
+    CHK(IS_VALID_MUTEX_VALUE(pLogger->flushLock) && IS_VALID_MUTEX_VALUE(pLogger->wakeLock) && IS_VALID_CVAR_VALUE(pLogger->wakeCvar),
+        STATUS_NOT_ENOUGH_MEMORY);
+
+    // the logger in place, the console or the SDK file logger, writes the formatted lines
+    pLogger->sinkFn = globalCustomLogPrintFn;
+    CHK_STATUS(THREAD_CREATE(&pLogger->flusherTid, asyncLogFlusherRoutine, NULL));
+    ATOMIC_STORE_BOOL(&pLogger->started, TRUE);
+    globalCustomLogPrintFn = asyncLogSdkPrint;
+
+CleanUp:
+
+    if (STATUS_FAILED(retStatus) && retStatus != STATUS_INVALID_OPERATION) {
+        if (IS_VALID_MUTEX_VALUE(pLogger->flushLock)) {
+            MUTEX_FREE(pLogger->flushLock);
+        }
+        if (IS_VALID_MUTEX_VALUE(pLogger->wakeLock)) {
+            MUTEX_FREE(pLogger->wakeLock);
+        }
+        if (IS_VALID_CVAR_VALUE(pLogger->wakeCvar)) {
+            CVAR_FREE(pLogger->wakeCvar);
+        }
+        if (keyCreated) {
+            pthread_key_delete(pLogger->ringKey);
+        }
+        MEMSET(pLogger, 0x00, SIZEOF(AsyncLogger));
+    }
+
+    return retStatus;
+}
+
+STATUS asyncLogStop()
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    PAsyncLogger pLogger = &gAsyncLogger;
+    UINT32 i;
+
+    CHK(ATOMIC_LOAD_BOOL(&pLogger->started), retStatus);
+
+    globalCustomLogPrintFn = pLogger->sinkFn;
+    ATOMIC_STORE_BOOL(&pLogger->shutdown, TRUE);
+    CVAR_SIGNAL(pLogger->wakeCvar);
+    THREAD_JOIN(pLogger->flusherTid, NULL);
+    ATOMIC_STORE_BOOL(&pLogger->started, FALSE);
+
+    pthread_key_delete(pLogger->ringKey);
+    for (i = 0; i < MIN(pLogger->ringCount, ASYNC_LOG_MAX_RINGS); i++) {
+        MEMFREE((PVOID) pLogger->rings[i]);
+        pLogger->rings[i] = 0;
+    }
+
+    MUTEX_FREE(pLogger->flushLock);
+    MUTEX_FREE(pLogger->wakeLock);
+    CVAR_FREE(pLogger->wakeCvar);
+
+CleanUp:
+
+    return retStatus;
+}
+
+VOID asyncLogFlush()
+{
+    if (ATOMIC_LOAD_BOOL(&gAsyncLogger.started)) {
+        asyncLogDrain();
+    }
+}
+
+VOID asyncLogGetStats(PAsyncLogStats pStats)
+{
+    PAsyncLogRing pRing;
+    UINT32 i;
+
+    MEMSET(pStats, 0x00, SIZEOF(AsyncLogStats));
+    pStats->records = (UINT64) ATOMIC_LOAD(&gAsyncLogger.records);
+    pStats->suppressed = (UINT64) ATOMIC_LOAD(&gAsyncLogger.suppressed);
+    pStats->unbuffered = (UINT64) ATOMIC_LOAD(&gAsyncLogger.unbuffered);
+    if (!ATOMIC_LOAD_BOOL(&gAsyncLogger.started)) {
+        return;
+    }
+
+    MUTEX_LOCK(gAsyncLogger.flushLock);
+    pStats->written = gAsyncLogger.written;
+    pStats->rings = (UINT32) MIN(ATOMIC_LOAD(&gAsyncLogger.ringCount), ASYNC_LOG_MAX_RINGS);
+    for (i = 0; i < pStats->rings; i++) {
+        if ((pRing = (PAsyncLogRing) ATOMIC_LOAD(&gAsyncLogger.rings[i])) != NULL) {
+            pStats->dropped += (UINT64) ATOMIC_LOAD(&pRing->dropped);
+        }
+    }
+    MUTEX_UNLOCK(gAsyncLogger.flushLock);
+}
+
+VOID asyncLogPrintStats()
+{
+    AsyncLogStats stats;
+
+    asyncLogGetStats(&stats);
+    printf("Async log: %" PRIu64 " records, %" PRIu64 " written, %" PRIu64 " dropped, %" PRIu64 " suppressed by rate, %" PRIu64
+           " written unbuffered, %u thread rings\n",
+           stats.records, stats.written, stats.dropped, stats.suppressed, stats.unbuffered, stats.rings);
+}
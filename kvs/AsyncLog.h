@@ -0,0 +1,163 @@
+/*
+ * Copyright (C) 2020 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __KVS_ASYNC_LOG_H__
+#define __KVS_ASYNC_LOG_H__
+
+#include <pthread.h>
+
+#include "KvsApp.h"
+
+#define ASYNC_LOG_MAX_RINGS                 64
+#define ASYNC_LOG_RING_RECORD_COUNT         64
+#define ASYNC_LOG_MAX_ARGS                  12
+#define ASYNC_LOG_TEXT_SIZE                 224
+#define ASYNC_LOG_LINE_SIZE                 1024
+#define ASYNC_LOG_FLUSH_INTERVAL            (50 * HUNDREDS_OF_NANOS_IN_A_MILLISECOND)
+// records a single call site may log per second, the rest are counted and reported with the next one let through
+#define ASYNC_LOG_SITE_RATE                 20
+#define ASYNC_LOG_SDK_SITE_COUNT            128
+#define ASYNC_LOG_TAG                       "kvs"
+
+/**
+ * Rate limit state of one call site, lives in a static of the call site or in the table of SDK formats
+ */
+typedef struct {
+    volatile SIZE_T windowStart;
+    volatile SIZE_T windowCount;
+    // suppressed since the last record let through
+    volatile SIZE_T suppressed;
+} AsyncLogSite, *PAsyncLogSite;
+
+/**
+ * One log call captured for later formatting. Arguments are kept as 64 bit values, string arguments are copied into
+ * the text area because their memory is gone by the time the record is formatted.
+ */
+typedef struct {
+    UINT64 time;
+    // string literals of the caller
+    PCHAR format;
+    PCHAR tag;
+    UINT32 level;
+    UINT32 suppressed;
+    UINT32 argCount;
+    // the format could not be captured past this offset, it is printed verbatim from there
+    UINT32 truncatedAt;
+    UINT64 args[ASYNC_LOG_MAX_ARGS];
+    CHAR text[ASYNC_LOG_TEXT_SIZE];
+} AsyncLogRecord, *PAsyncLogRecord;
+
+/**
+ * Single producer single consumer ring owned by one logging thread, drained by the flusher
+ */
+typedef struct {
+    // written by the owner only
+    volatile SIZE_T head;
+    // written by the flusher only
+    volatile SIZE_T tail;
+    // cleared when the owner exits, the next new thread takes the ring over
+    volatile ATOMIC_BOOL owned;
+    volatile SIZE_T dropped;
+    UINT64 droppedReported;
+    AsyncLogRecord records[ASYNC_LOG_RING_RECORD_COUNT];
+} AsyncLogRing, *PAsyncLogRing;
+
+typedef struct {
+    UINT64 records;
+    UINT64 written;
+    // ring full, the flusher fell behind
+    UINT64 dropped;
+    // over the rate of their call site
+    UINT64 suppressed;
+    // logged synchronously because every ring was taken
+    UINT64 unbuffered;
+    UINT32 rings;
+} AsyncLogStats, *PAsyncLogStats;
+
+/**
+ * Takes formatting and output off the calling threads.
+ *
+ * Every logging thread appends binary records to a ring of its own without locks or system calls. A flusher thread
+ * wakes up every ASYNC_LOG_FLUSH_INTERVAL, or early when a ring fills up, formats the records in time order and
+ * hands the lines to the logger which was installed before, the console or the SDK file logger. A full ring drops
+ * the record and counts it instead of blocking the caller. Once started the logger also replaces the SDK logger so
+ * the SDK logs from the put path are deferred as well.
+ */
+typedef struct {
+    // the SDK logger function which was installed before, writes the formatted lines
+    logPrintFunc sinkFn;
+    volatile ATOMIC_BOOL started;
+    volatile ATOMIC_BOOL shutdown;
+    // rings of all threads so far, published as addresses
+    volatile SIZE_T ringCount;
+    volatile SIZE_T rings[ASYNC_LOG_MAX_RINGS];
+    // one rate limit per SDK format, hashed by its address
+    AsyncLogSite sdkSites[ASYNC_LOG_SDK_SITE_COUNT];
+    volatile SIZE_T records;
+    volatile SIZE_T suppressed;
+    volatile SIZE_T unbuffered;
+    pthread_key_t ringKey;
+    // the flusher and asyncLogFlush drain under this lock, the producers never take it
+    MUTEX flushLock;
+    MUTEX wakeLock;
+    CVAR wakeCvar;
+    UINT64 written;
+    TID flusherTid;
+} AsyncLogger, *PAsyncLogger;
+
+/**
+ * Starts the flusher and installs the async logger as the SDK logger. The logger is process wide like the SDK one.
+ */
+STATUS asyncLogStart();
+
+/**
+ * Drains what is left, stops the flusher and puts the previous SDK logger back. Only call it once every thread which
+ * logs has stopped.
+ */
+STATUS asyncLogStop();
+
+/**
+ * Formats and writes every record logged so far on the calling thread, e.g. before printing a summary
+ */
+VOID asyncLogFlush();
+
+/**
+ * Logs through the ring of the calling thread, subject to the rate of the site. Writes synchronously through the SDK
+ * logger when the async logger is not started.
+ */
+VOID asyncLogPrint(PAsyncLogSite, UINT32, PCHAR, ...);
+
+VOID asyncLogGetStats(PAsyncLogStats);
+VOID asyncLogPrintStats();
+
+#define __ALOG(level, fmt, ...)                                                                                                            \
+    do {                                                                                                                                   \
+        static AsyncLogSite __asyncLogSite;                                                                                                \
+        asyncLogPrint(&__asyncLogSite, (level), (PCHAR) (fmt), ##__VA_ARGS__);                                                             \
+    } while (0)
+
+#define ALOGE(fmt, ...)                     __ALOG(LOG_LEVEL_ERROR, fmt, ##__VA_ARGS__)
+#define ALOGW(fmt, ...)                     __ALOG(LOG_LEVEL_WARN, fmt, ##__VA_ARGS__)
+#define ALOGI(fmt, ...)                     __ALOG(LOG_LEVEL_INFO, fmt, ##__VA_ARGS__)
+#define ALOGD(fmt, ...)                     __ALOG(LOG_LEVEL_DEBUG, fmt, ##__VA_ARGS__)
+
+#endif /* __KVS_ASYNC_LOG_H__ */
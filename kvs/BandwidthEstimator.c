@@ -0,0 +1,187 @@
+/*
+ * Copyright (C) 2020 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "BandwidthEstimator.h"
+
+VOID bandwidthEstimatorInit(PBandwidthEstimator pEstimator, UINT64 minBitrate, UINT64 maxBitrate)
+{
+    MEMSET(pEstimator, 0x00, SIZEOF(BandwidthEstimator));
+    pEstimator->minBitrate = minBitrate;
+    pEstimator->maxBitrate = MAX(minBitrate, maxBitrate);
+    pEstimator->stats.bitrate = (SIZE_T) pEstimator->maxBitrate;
+}
+
+VOID bandwidthEstimatorObservePut(PBandwidthEstimator pEstimator, PFrame pFrame, UINT64 now)
+{
+    PBandwidthEstimatorFragment pFragment;
+    SIZE_T head;
+
+    if ((pFrame->flags & FRAME_FLAG_KEY_FRAME) != 0) {
+        head = pEstimator->head;
+        if (head - ATOMIC_LOAD(&pEstimator->tail) < BANDWIDTH_ESTIMATOR_RING_SIZE) {
+            pFragment = &pEstimator->fragments[head % BANDWIDTH_ESTIMATOR_RING_SIZE];
+            pFragment->putTime = now;
+            pFragment->previousBytes = pEstimator->started ? pEstimator->fragmentBytes : 0;
+            // published once written
+            ATOMIC_STORE(&pEstimator->head, head + 1);
+        } else {
+            // acks stopped coming, which fragment the next one is for is lost
+            ATOMIC_STORE_BOOL(&pEstimator->overrun, TRUE);
+        }
+
+        pEstimator->fragmentBytes = 0;
+        pEstimator->started = TRUE;
+    }
+
+    if (pEstimator->started) {
+        pEstimator->fragmentBytes += pFrame->size;
+    }
+}
+
+/**
+ * Takes the delay into the window of now and recomputes the minimum over the windows kept
+ */
+STATIC VOID bandwidthEstimatorUpdateBaseDelay(PBandwidthEstimator pEstimator, UINT64 delay, UINT64 now)
+{
+    UINT64 elapsed;
+    UINT32 i;
+
+    if (!pEstimator->baseDelayKnown) {
+        for (i = 0; i < BANDWIDTH_ESTIMATOR_BASE_DELAY_HISTORY; i++) {
+            pEstimator->baseDelays[i] = MAX_UINT64;
+        }
+        pEstimator->baseDelayWindowStart = now;
+        pEstimator->baseDelayKnown = TRUE;
+    }
+
+    // windows passed without acks are emptied on the way
+    elapsed = (now - pEstimator->baseDelayWindowStart) / BANDWIDTH_ESTIMATOR_BASE_DELAY_WINDOW;
+    for (i = 0; i < MIN(elapsed, BANDWIDTH_ESTIMATOR_BASE_DELAY_HISTORY); i++) {
+        pEstimator->baseDelayIndex = (pEstimator->baseDelayIndex + 1) % BANDWIDTH_ESTIMATOR_BASE_DELAY_HISTORY;
+        pEstimator->baseDelays[pEstimator->baseDelayIndex] = MAX_UINT64;
+    }
+    pEstimator->baseDelayWindowStart += elapsed * BANDWIDTH_ESTIMATOR_BASE_DELAY_WINDOW;
+    pEstimator->baseDelays[pEstimator->baseDelayIndex] = MIN(pEstimator->baseDelays[pEstimator->baseDelayIndex], delay);
+
+    pEstimator->baseDelay = MAX_UINT64;
+    for (i = 0; i < BANDWIDTH_ESTIMATOR_BASE_DELAY_HISTORY; i++) {
+        pEstimator->baseDelay = MIN(pEstimator->baseDelay, pEstimator->baseDelays[i]);
+    }
+}
+
+VOID bandwidthEstimatorReset(PBandwidthEstimator pEstimator)
+{
+    // the base delay and the rate are of the link, they are kept
+    ATOMIC_STORE_BOOL(&pEstimator->overrun, FALSE);
+    ATOMIC_STORE(&pEstimator->tail, ATOMIC_LOAD(&pEstimator->head));
+    pEstimator->lastAckTime = 0;
+    ATOMIC_INCREMENT(&pEstimator->stats.resyncs);
+}
+
+BOOL bandwidthEstimatorObserveAck(PBandwidthEstimator pEstimator, UINT64 now)
+{
+    BandwidthEstimatorFragment fragment;
+    UINT64 delay, queueDelay, sample, bitrate, target;
+    SIZE_T tail = pEstimator->tail;
+
+    if (ATOMIC_LOAD_BOOL(&pEstimator->overrun)) {
+        bandwidthEstimatorReset(pEstimator);
+        return FALSE;
+    }
+
+    if (tail == ATOMIC_LOAD(&pEstimator->head)) {
+        // a fragment put before a reset, the rate sample would span more than one fragment
+        pEstimator->lastAckTime = 0;
+        return FALSE;
+    }
+
+    fragment = pEstimator->fragments[tail % BANDWIDTH_ESTIMATOR_RING_SIZE];
+    ATOMIC_STORE(&pEstimator->tail, tail + 1);
+
+    delay = now > fragment.putTime ? now - fragment.putTime : 0;
+    bandwidthEstimatorUpdateBaseDelay(pEstimator, delay, now);
+    queueDelay = delay - pEstimator->baseDelay;
+    ATOMIC_STORE(&pEstimator->stats.queueDelay, (SIZE_T) queueDelay);
+
+    if (pEstimator->lastAckTime != 0 && now > pEstimator->lastAckTime && fragment.previousBytes != 0) {
+        sample = fragment.previousBytes * 8 * HUNDREDS_OF_NANOS_IN_A_SECOND / (now - pEstimator->lastAckTime);
+        if (pEstimator->rate == 0) {
+            pEstimator->rate = sample;
+        } else {
+            pEstimator->rate = (pEstimator->rate * (BANDWIDTH_ESTIMATOR_RATE_WEIGHT - 1) + sample) / BANDWIDTH_ESTIMATOR_RATE_WEIGHT;
+        }
+        pEstimator->lastRate = sample;
+        ATOMIC_STORE(&pEstimator->stats.estimate, (SIZE_T) pEstimator->rate);
+    }
+    pEstimator->lastAckTime = now;
+
+    bitrate = (UINT64) ATOMIC_LOAD(&pEstimator->stats.bitrate);
+    if (queueDelay >= BANDWIDTH_ESTIMATOR_OVERUSE_DELAY) {
+        // the queue still drains from the last decrease unless the delay grew past where it was
+        if (pEstimator->rate == 0 ||
+            (pEstimator->lastDecreaseTime != 0 &&
+             (now - pEstimator->lastDecreaseTime < BANDWIDTH_ESTIMATOR_DECREASE_HOLD || delay <= pEstimator->lastDecreaseDelay))) {
+            return FALSE;
+        }
+
+        // the smoothed rate still remembers the link before it was overused
+        target = MIN(pEstimator->rate, pEstimator->lastRate) * BANDWIDTH_ESTIMATOR_BACKOFF_PERCENT / 100;
+        target = MAX(target, pEstimator->minBitrate);
+        if (target * 100 > bitrate * (100 - BANDWIDTH_ESTIMATOR_HYSTERESIS)) {
+            return FALSE;
+        }
+
+        pEstimator->lastDecreaseTime = now;
+        pEstimator->lastDecreaseDelay = delay;
+        ATOMIC_INCREMENT(&pEstimator->stats.decreases);
+    } else if (queueDelay <= BANDWIDTH_ESTIMATOR_DRAINED_DELAY) {
+        pEstimator->lastDecreaseTime = 0;
+        if (bitrate >= pEstimator->maxBitrate || now - pEstimator->lastChangeTime < BANDWIDTH_ESTIMATOR_INCREASE_INTERVAL) {
+            return FALSE;
+        }
+
+        target = MIN(bitrate * (100 + BANDWIDTH_ESTIMATOR_INCREASE_PERCENT) / 100, pEstimator->maxBitrate);
+        ATOMIC_INCREMENT(&pEstimator->stats.increases);
+    } else {
+        // between the two the bitrate is held
+        return FALSE;
+    }
+
+    pEstimator->lastChangeTime = now;
+    ATOMIC_STORE(&pEstimator->stats.bitrate, (SIZE_T) target);
+
+    return TRUE;
+}
+
+UINT64 bandwidthEstimatorGetBitrate(PBandwidthEstimator pEstimator)
+{
+    return (UINT64) ATOMIC_LOAD(&pEstimator->stats.bitrate);
+}
+
+VOID bandwidthEstimatorPrintStats(PBandwidthEstimator pEstimator, PCHAR name)
+{
+    printf("Channel %s bitrate: %" PRIu64 " kbps asked after %" PRIu64 " decreases and %" PRIu64 " increases, %" PRIu64
+           " kbps delivered, %" PRIu64 " ms queue delay, %" PRIu64 " resyncs\n",
+           name, (UINT64) pEstimator->stats.bitrate / 1000, (UINT64) pEstimator->stats.decreases, (UINT64) pEstimator->stats.increases,
+           (UINT64) pEstimator->stats.estimate / 1000, (UINT64) (pEstimator->stats.queueDelay / HUNDREDS_OF_NANOS_IN_A_MILLISECOND),
+           (UINT64) pEstimator->stats.resyncs);
+}
@@ -0,0 +1,142 @@
+/*
+ * Copyright (C) 2020 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __KVS_BANDWIDTH_ESTIMATOR_H__
+#define __KVS_BANDWIDTH_ESTIMATOR_H__
+
+#include "KvsApp.h"
+
+// fragments put and not acked yet which are tracked, more and the estimator starts over
+#define BANDWIDTH_ESTIMATOR_RING_SIZE           256
+// the base delay is the smallest delay of the last windows, the oldest window is dropped as a new one starts. A route
+// change is picked up once it filled all of them, an overuse never lasts that long with the bitrate lowered on it.
+#define BANDWIDTH_ESTIMATOR_BASE_DELAY_WINDOW   (30 * HUNDREDS_OF_NANOS_IN_A_SECOND)
+#define BANDWIDTH_ESTIMATOR_BASE_DELAY_HISTORY  10
+// weight of the newest delivery rate sample, 1/N
+#define BANDWIDTH_ESTIMATOR_RATE_WEIGHT         4
+// queue delay over the base one from which the link counts as overused and down to which it counts as drained, 100ns
+#define BANDWIDTH_ESTIMATOR_OVERUSE_DELAY       (1 * HUNDREDS_OF_NANOS_IN_A_SECOND)
+#define BANDWIDTH_ESTIMATOR_DRAINED_DELAY       (300 * HUNDREDS_OF_NANOS_IN_A_MILLISECOND)
+// a decrease takes a while to drain the queue, the next one waits for the delay to grow again
+#define BANDWIDTH_ESTIMATOR_DECREASE_HOLD       (3 * HUNDREDS_OF_NANOS_IN_A_SECOND)
+// time since the last change before the bitrate goes up again
+#define BANDWIDTH_ESTIMATOR_INCREASE_INTERVAL   (5 * HUNDREDS_OF_NANOS_IN_A_SECOND)
+// share of the delivery rate asked for on overuse and step up once drained, percent
+#define BANDWIDTH_ESTIMATOR_BACKOFF_PERCENT     85
+#define BANDWIDTH_ESTIMATOR_INCREASE_PERCENT    8
+// a decrease smaller than this is not worth a change, percent
+#define BANDWIDTH_ESTIMATOR_HYSTERESIS          10
+
+/**
+ * Read by the metrics server, bitrates in bits per second
+ */
+typedef struct {
+    // asked of the encoder
+    volatile SIZE_T bitrate;
+    // smoothed rate the fragments were delivered at
+    volatile SIZE_T estimate;
+    // of the last fragment acked over the base one, 100ns
+    volatile SIZE_T queueDelay;
+    volatile SIZE_T decreases;
+    volatile SIZE_T increases;
+    // the acks could no longer be told apart from the fragments put
+    volatile SIZE_T resyncs;
+} BandwidthEstimatorStats, *PBandwidthEstimatorStats;
+
+typedef struct {
+    UINT64 putTime;
+    // of the fragment before, sent by the time this one started arriving
+    UINT64 previousBytes;
+} BandwidthEstimatorFragment, *PBandwidthEstimatorFragment;
+
+/**
+ * Estimates the upload bandwidth of a live stream and picks the bitrate its encoder is asked for.
+ *
+ * Fragments start at key frames and the buffering ack of a fragment comes as it starts arriving, so the acks match the
+ * key frames put in order. The time from the put of a key frame to its ack is the queue delay of the link, the bytes
+ * of the fragment before over the time between two acks the rate it delivered at. A queue delay growing past the
+ * smallest seen means the encoder produces more than the link takes: the bitrate drops under the delivery rate and
+ * stays there until the queue drained, then creeps back up. Decreases wait for the delay to grow again and increases
+ * for the link to have settled, so the bitrate does not swing with every ack.
+ *
+ * The key frames are recorded from the put thread and the acks taken on the ack callback, through a single producer
+ * single consumer ring neither side waits on.
+ */
+typedef struct {
+    UINT64 minBitrate;
+    UINT64 maxBitrate;
+
+    // owned by the put thread
+    UINT64 fragmentBytes;
+    BOOL started;
+
+    BandwidthEstimatorFragment fragments[BANDWIDTH_ESTIMATOR_RING_SIZE];
+    volatile SIZE_T head;
+    volatile SIZE_T tail;
+    // set by the put thread when the ring was full, the ack callback starts over
+    volatile ATOMIC_BOOL overrun;
+
+    // owned by the ack callback
+    UINT64 lastAckTime;
+    // smallest delay from put to ack, what the link takes with nothing queued
+    UINT64 baseDelay;
+    BOOL baseDelayKnown;
+    // smallest delay of each window, MAX_UINT64 for a window without acks
+    UINT64 baseDelays[BANDWIDTH_ESTIMATOR_BASE_DELAY_HISTORY];
+    UINT32 baseDelayIndex;
+    UINT64 baseDelayWindowStart;
+    UINT64 rate;
+    UINT64 lastRate;
+    UINT64 lastChangeTime;
+    UINT64 lastDecreaseTime;
+    UINT64 lastDecreaseDelay;
+    BandwidthEstimatorStats stats;
+} BandwidthEstimator, *PBandwidthEstimator;
+
+/**
+ * Bitrates in bits per second, the encoder starts at the largest
+ */
+VOID bandwidthEstimatorInit(PBandwidthEstimator, UINT64, UINT64);
+
+/**
+ * Takes a video frame put with the time it was put at, from the put thread
+ */
+VOID bandwidthEstimatorObservePut(PBandwidthEstimator, PFrame, UINT64);
+
+/**
+ * Takes the time of a buffering ack. Returns TRUE when a new bitrate was decided.
+ */
+BOOL bandwidthEstimatorObserveAck(PBandwidthEstimator, UINT64);
+
+/**
+ * An error ack, the fragments in flight are resent and the acks no longer match
+ */
+VOID bandwidthEstimatorReset(PBandwidthEstimator);
+
+/**
+ * Bitrate decided last in bits per second
+ */
+UINT64 bandwidthEstimatorGetBitrate(PBandwidthEstimator);
+
+VOID bandwidthEstimatorPrintStats(PBandwidthEstimator, PCHAR);
+
+#endif /* __KVS_BANDWIDTH_ESTIMATOR_H__ */
@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2020 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "CaptureClock.h"
+
+VOID captureClockInit(PCaptureClock pClock)
+{
+    pClock->monotonicTime = pacerGetTime();
+    pClock->wallTime = defaultGetTime();
+}
+
+UINT64 captureClockGetWallTime(PCaptureClock pClock, UINT64 monotonicTime)
+{
+    return pClock->wallTime + monotonicTime - pClock->monotonicTime;
+}
+
+VOID captureTrackClockInit(PCaptureTrackClock pTrackClock, PCaptureClock pClock, UINT64 maxSlewPpm, UINT64 discontinuityThreshold)
+{
+    MEMSET(pTrackClock, 0x00, SIZEOF(CaptureTrackClock));
+    pTrackClock->pClock = pClock;
+    pTrackClock->maxSlewPpm = maxSlewPpm;
+    pTrackClock->discontinuityThreshold = discontinuityThreshold;
+}
+
+UINT64 captureTrackClockStamp(PCaptureTrackClock pTrackClock, UINT64 captureTime, UINT64 duration, BOOL canStep, PBOOL pDiscontinuity)
+{
+    UINT64 capture = captureClockGetWallTime(pTrackClock->pClock, captureTime), timestamp, interval;
+    INT64 error, maxSlew;
+    BOOL discontinuity = FALSE;
+
+    if (duration == 0) {
+        // the source has no frame durations, go by the average interval between captures leaving gaps out
+        interval = captureTime - pTrackClock->lastCaptureTime;
+        if (pTrackClock->started && captureTime > pTrackClock->lastCaptureTime && interval < pTrackClock->discontinuityThreshold) {
+            pTrackClock->averageInterval = pTrackClock->averageInterval == 0
+                ? interval
+                : (UINT64) ((INT64) pTrackClock->averageInterval + ((INT64) interval - (INT64) pTrackClock->averageInterval) / CAPTURE_CLOCK_INTERVAL_WEIGHT);
+        }
+
+        duration = pTrackClock->averageInterval;
+    }
+
+    pTrackClock->lastCaptureTime = captureTime;
+    if (!pTrackClock->started) {
+        pTrackClock->started = TRUE;
+        pTrackClock->nextTimestamp = capture;
+    }
+
+    error = (INT64) (capture - pTrackClock->nextTimestamp);
+    if (error > (INT64) pTrackClock->discontinuityThreshold && canStep) {
+        pTrackClock->nextTimestamp = capture;
+        discontinuity = TRUE;
+        ATOMIC_INCREMENT(&pTrackClock->stats.discontinuities);
+    } else {
+        maxSlew = (INT64) (duration * pTrackClock->maxSlewPpm / 1000000);
+        pTrackClock->nextTimestamp += (UINT64) MAX(-maxSlew, MIN(error, maxSlew));
+        if (ABS(error) <= (INT64) pTrackClock->discontinuityThreshold && (SIZE_T) ABS(error) > pTrackClock->stats.maxError) {
+            ATOMIC_STORE(&pTrackClock->stats.maxError, (SIZE_T) ABS(error));
+        }
+    }
+
+    timestamp = pTrackClock->nextTimestamp;
+    if (pTrackClock->lastTimestamp != 0 && timestamp <= pTrackClock->lastTimestamp) {
+        timestamp = pTrackClock->lastTimestamp + 1;
+    }
+
+    pTrackClock->lastTimestamp = timestamp;
+    pTrackClock->nextTimestamp = timestamp + duration;
+    ATOMIC_INCREMENT(&pTrackClock->stats.frames);
+    ATOMIC_STORE(&pTrackClock->stats.error, (SIZE_T) (INT64) (capture - timestamp));
+
+    if (pDiscontinuity != NULL) {
+        *pDiscontinuity = discontinuity;
+    }
+
+    return timestamp;
+}
+
+VOID captureTrackClockPrintStats(PCaptureTrackClock pTrackClock, PCHAR channelName, PCHAR trackName)
+{
+    printf("Channel %s %s timestamps: %" PRIu64 " frames, %" PRIu64 " discontinuities, capture clock %.3f ms ahead, at most %.3f ms apart\n",
+           channelName, trackName, (UINT64) pTrackClock->stats.frames, (UINT64) pTrackClock->stats.discontinuities,
+           (DOUBLE) (INT64) pTrackClock->stats.error / HUNDREDS_OF_NANOS_IN_A_MILLISECOND,
+           (DOUBLE) pTrackClock->stats.maxError / HUNDREDS_OF_NANOS_IN_A_MILLISECOND);
+}
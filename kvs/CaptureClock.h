@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2020 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __KVS_CAPTURE_CLOCK_H__
+#define __KVS_CAPTURE_CLOCK_H__
+
+#include "Pacer.h"
+
+/**
+ * Largest correction per frame, in parts per million of the frame duration. 1000 lets a track make up 3.6 s an hour
+ * without the step between two frames ever being noticeable.
+ */
+#define DEFAULT_CAPTURE_CLOCK_MAX_SLEW_PPM  1000
+// a capture time further ahead of the track than this is a gap in the source, not drift
+#define DEFAULT_CAPTURE_CLOCK_DISCONTINUITY (500 * HUNDREDS_OF_NANOS_IN_A_MILLISECOND)
+// weight of the newest frame interval when the source gives no frame duration, 1/N
+#define CAPTURE_CLOCK_INTERVAL_WEIGHT       16
+
+/**
+ * The monotonic clock mapped onto wall time once at startup. Stepping the wall clock later, NTP coming up on a device
+ * without RTC for one, moves nothing: every capture time is converted through the same anchor.
+ */
+typedef struct {
+    UINT64 wallTime;
+    UINT64 monotonicTime;
+} CaptureClock, *PCaptureClock;
+
+/**
+ * Read by the metrics server
+ */
+typedef struct {
+    volatile SIZE_T frames;
+    volatile SIZE_T discontinuities;
+    // capture time minus timestamp of the last frame, an INT64 in 100ns
+    volatile SIZE_T error;
+    // largest absolute error outside of discontinuities, 100ns
+    volatile SIZE_T maxError;
+} CaptureTrackClockStats, *PCaptureTrackClockStats;
+
+/**
+ * Timestamps of one track. They advance by the frame durations of the source, which is smooth but drifts from the
+ * capture clock, and are slewed towards the capture times by at most maxSlewPpm of every frame duration. Tracks slewed
+ * towards the same capture clock stay aligned with each other.
+ *
+ * A capture time more than the discontinuity threshold ahead is a gap in the source: the track steps forward to it,
+ * video at the next key frame so the gap falls between fragments. The track never steps back, timestamps only ever
+ * increase.
+ */
+typedef struct {
+    PCaptureClock pClock;
+    UINT64 maxSlewPpm;
+    UINT64 discontinuityThreshold;
+    BOOL started;
+    // wall time of the next frame going by the frame durations alone
+    UINT64 nextTimestamp;
+    UINT64 lastTimestamp;
+    // for sources without frame durations
+    UINT64 lastCaptureTime;
+    UINT64 averageInterval;
+    CaptureTrackClockStats stats;
+} CaptureTrackClock, *PCaptureTrackClock;
+
+/**
+ * Anchors the clock at the current time
+ */
+VOID captureClockInit(PCaptureClock);
+
+/**
+ * Wall time of a pacerGetTime() value
+ */
+UINT64 captureClockGetWallTime(PCaptureClock, UINT64);
+
+VOID captureTrackClockInit(PCaptureTrackClock, PCaptureClock, UINT64, UINT64);
+
+/**
+ * Returns the timestamp of the frame captured at the pacerGetTime() given, with the frame duration of the source or 0
+ * when it has none. Whether the track may step forward now, a key frame for video, is passed in; the last parameter
+ * is set when it did.
+ */
+UINT64 captureTrackClockStamp(PCaptureTrackClock, UINT64, UINT64, BOOL, PBOOL);
+
+VOID captureTrackClockPrintStats(PCaptureTrackClock, PCHAR, PCHAR);
+
+#endif /* __KVS_CAPTURE_CLOCK_H__ */
@@ -0,0 +1,159 @@
+/*
+ * Copyright (C) 2020 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <ctype.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+
+#include "Channel.h"
+#include "FrameArchive.h"
+
+#define CHANNEL_LIST_LINE_LEN               (MAX_STREAM_NAME_LEN + MAX_PATH_LEN + 16)
+
+STATIC PCHAR channelNextToken(PCHAR* ppCur)
+{
+    PCHAR pStart = *ppCur, pEnd;
+
+    while (*pStart != '\0' && isspace((BYTE) *pStart)) {
+        pStart++;
+    }
+
+    if (*pStart == '\0') {
+        *ppCur = pStart;
+        return NULL;
+    }
+
+    for (pEnd = pStart; *pEnd != '\0' && !isspace((BYTE) *pEnd); pEnd++);
+    if (*pEnd != '\0') {
+        *pEnd++ = '\0';
+    }
+
+    *ppCur = pEnd;
+
+    return pStart;
+}
+
+STATIC BOOL channelHasExtension(PCHAR pSource, UINT32 length, PCHAR extension)
+{
+    return length > STRLEN(extension) && STRCMP(pSource + length - STRLEN(extension), extension) == 0;
+}
+
+STATUS channelListParseFile(PCHAR path, PChannelConfig pConfigs, UINT32 maxCount, PUINT32 pCount)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    FILE* pFile = NULL;
+    CHAR line[CHANNEL_LIST_LINE_LEN];
+    PCHAR pCur, pName, pSource;
+    PChannelConfig pConfig;
+    struct stat sourceStat;
+    UINT32 lineNumber = 0, length;
+
+    CHK(path != NULL && pConfigs != NULL && pCount != NULL, STATUS_NULL_ARG);
+    CHK(NULL != (pFile = FOPEN(path, "r")), STATUS_OPEN_FILE_FAILED);
+
+    while (fgets(line, SIZEOF(line), pFile) != NULL) {
+        lineNumber++;
+        pCur = line;
+        pName = channelNextToken(&pCur);
+        if (pName == NULL || *pName == CHANNEL_LIST_COMMENT) {
+            continue;
+        }
+
+        pSource = channelNextToken(&pCur);
+        if (pSource == NULL || channelNextToken(&pCur) != NULL) {
+            DLOGE("%s:%u: expected '<channel-name> <source>'", path, lineNumber);
+            CHK(FALSE, STATUS_INVALID_ARG);
+        }
+
+        CHK(*pCount < maxCount, STATUS_INVALID_ARG);
+        CHK(STRLEN(pName) <= MAX_STREAM_NAME_LEN && STRLEN(pSource) <= MAX_PATH_LEN, STATUS_INVALID_ARG);
+
+        pConfig = &pConfigs[(*pCount)++];
+        MEMSET(pConfig, 0x00, SIZEOF(ChannelConfig));
+        STRCPY(pConfig->name, pName);
+
+        length = (UINT32) STRLEN(pSource);
+        if (STRNCMP(pSource, CHANNEL_SEGMENTS_PREFIX, STRLEN(CHANNEL_SEGMENTS_PREFIX)) == 0) {
+            CHK(pSource[STRLEN(CHANNEL_SEGMENTS_PREFIX)] != '\0', STATUS_INVALID_ARG);
+            STRCPY(pConfig->videoInputPath, pSource + STRLEN(CHANNEL_SEGMENTS_PREFIX));
+        } else if (pSource[length - 1] == '/' || (stat(pSource, &sourceStat) == 0 && S_ISDIR(sourceStat.st_mode))) {
+            STRCPY(pConfig->directory, pSource);
+        } else if (channelHasExtension(pSource, length, (PCHAR) CHANNEL_ARCHIVE_EXTENSION) ||
+                   channelHasExtension(pSource, length, (PCHAR) CHANNEL_MP4_EXTENSION) ||
+                   channelHasExtension(pSource, length, (PCHAR) CHANNEL_MATROSKA_EXTENSION)) {
+            STRCPY(pConfig->archivePath, pSource);
+        } else {
+            STRCPY(pConfig->videoInputPath, pSource);
+        }
+    }
+
+CleanUp:
+
+    if (pFile != NULL) {
+        FCLOSE(pFile);
+    }
+
+    return retStatus;
+}
+
+STATUS channelConfigResolve(PChannelConfig pConfig, PCHAR defaultDirectory)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    PCHAR directory;
+
+    CHK(pConfig != NULL && defaultDirectory != NULL, STATUS_NULL_ARG);
+    CHK(pConfig->archivePath[0] == '\0' && pConfig->videoInputPath[0] == '\0', retStatus);
+
+    directory = pConfig->directory[0] != '\0' ? pConfig->directory : defaultDirectory;
+    CHK(directory[0] != '\0', STATUS_INVALID_ARG);
+    SNPRINTF(pConfig->archivePath, MAX_PATH_LEN, "%s%s%s", directory, directory[STRLEN(directory) - 1] == '/' ? "" : "/",
+             DEFAULT_FRAME_ARCHIVE_NAME);
+
+CleanUp:
+
+    return retStatus;
+}
+
+UINT64 channelGetThreadCpuTime()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+
+    return (UINT64) now.tv_sec * 1000000000ULL + (UINT64) now.tv_nsec;
+}
+
+VOID channelPrintProcessUsage(UINT32 channelCount, UINT64 duration)
+{
+    struct rusage usage;
+    DOUBLE seconds = (DOUBLE) duration / HUNDREDS_OF_NANOS_IN_A_SECOND, cpuSeconds;
+
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return;
+    }
+
+    cpuSeconds = usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000000.0;
+    // ru_maxrss is in KB on Linux
+    printf("Process: %u channels, peak RSS %ld KB (%ld KB per channel), CPU %.3f%% of a core (%.3f%% per channel)\n", channelCount,
+           usage.ru_maxrss, channelCount == 0 ? 0 : usage.ru_maxrss / channelCount, seconds <= 0 ? 0.0 : 100.0 * cpuSeconds / seconds,
+           seconds <= 0 || channelCount == 0 ? 0.0 : 100.0 * cpuSeconds / seconds / channelCount);
+}
@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2020 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __KVS_CHANNEL_H__
+#define __KVS_CHANNEL_H__
+
+#include "KvsApp.h"
+
+#define MAX_CHANNEL_COUNT                   64
+#define DEFAULT_CHANNEL_WORKER_COUNT        4
+#define CHANNEL_LIST_COMMENT                '#'
+#define CHANNEL_ARCHIVE_EXTENSION           ".kva"
+// containers demuxed into an archive when they are opened
+#define CHANNEL_MP4_EXTENSION               ".mp4"
+#define CHANNEL_MATROSKA_EXTENSION          ".mkv"
+// a directory a recorder writes segments to, a plain directory is a media directory
+#define CHANNEL_SEGMENTS_PREFIX             "segments:"
+
+/**
+ * What one channel streams. Empty strings are unset.
+ */
+typedef struct {
+    CHAR name[MAX_STREAM_NAME_LEN + 1];
+    CHAR directory[MAX_PATH_LEN + 1];
+    CHAR archivePath[MAX_PATH_LEN + 1];
+    CHAR videoInputPath[MAX_PATH_LEN + 1];
+} ChannelConfig, *PChannelConfig;
+
+/**
+ * Appends the channels of a channel list file.
+ *
+ * One channel per line, '<channel-name> <source>'. The source is a media directory holding a frame archive, an
+ * archive ending in .kva, a fragmented MP4 or Matroska file ending in .mp4 or .mkv, 'segments:<directory>' for the
+ * segments a recorder writes or anything else for a live Annex-B input such as a FIFO. Blank lines and lines starting with # are skipped.
+ */
+STATUS channelListParseFile(PCHAR, PChannelConfig, UINT32, PUINT32);
+
+/**
+ * Fills the archive path from the directory when the channel streams neither an archive nor a live input.
+ */
+STATUS channelConfigResolve(PChannelConfig, PCHAR);
+
+/**
+ * Returns the thread CPU time in nanoseconds, used to charge put costs to channels
+ */
+UINT64 channelGetThreadCpuTime();
+
+/**
+ * Prints the peak RSS and the CPU time of the whole process, to compare with one process per channel
+ */
+VOID channelPrintProcessUsage(UINT32, UINT64);
+
+#endif /* __KVS_CHANNEL_H__ */
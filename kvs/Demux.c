@@ -0,0 +1,922 @@
+/*
+ * Copyright (C) 2020 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "Demux.h"
+
+#define MP4_BOX_TYPE(a, b, c, d)            (((UINT32) (a) << 24) | ((UINT32) (b) << 16) | ((UINT32) (c) << 8) | (UINT32) (d))
+#define MP4_BOX_HEADER_SIZE                 8
+// version and flags of a full box
+#define MP4_FULL_BOX_HEADER_SIZE            4
+#define MP4_SAMPLE_FLAG_NON_SYNC            0x00010000
+#define MP4_TFHD_BASE_DATA_OFFSET           0x000001
+#define MP4_TFHD_SAMPLE_DESCRIPTION_INDEX   0x000002
+#define MP4_TFHD_DEFAULT_DURATION           0x000008
+#define MP4_TFHD_DEFAULT_SIZE               0x000010
+#define MP4_TFHD_DEFAULT_FLAGS              0x000020
+#define MP4_TRUN_DATA_OFFSET                0x000001
+#define MP4_TRUN_FIRST_SAMPLE_FLAGS         0x000004
+#define MP4_TRUN_DURATION                   0x000100
+#define MP4_TRUN_SIZE                       0x000200
+#define MP4_TRUN_FLAGS                      0x000400
+#define MP4_TRUN_COMPOSITION_OFFSET         0x000800
+// fields of a VisualSampleEntry and an AudioSampleEntry in front of their child boxes
+#define MP4_VISUAL_SAMPLE_ENTRY_SIZE        78
+#define MP4_AUDIO_SAMPLE_ENTRY_SIZE         28
+#define MP4_ES_DESCRIPTOR_TAG               0x03
+#define MP4_DECODER_CONFIG_TAG              0x04
+#define MP4_DECODER_SPECIFIC_INFO_TAG       0x05
+// object type, stream type, buffer size and bitrates
+#define MP4_DECODER_CONFIG_SIZE             13
+
+#define MKV_ID_EBML                         0x1A45DFA3
+#define MKV_ID_SEGMENT                      0x18538067
+#define MKV_ID_SEEK_HEAD                    0x114D9B74
+#define MKV_ID_INFO                         0x1549A966
+#define MKV_ID_TIMECODE_SCALE               0x2AD7B1
+#define MKV_ID_TRACKS                       0x1654AE6B
+#define MKV_ID_TRACK_ENTRY                  0xAE
+#define MKV_ID_TRACK_NUMBER                 0xD7
+#define MKV_ID_CODEC_ID                     0x86
+#define MKV_ID_CODEC_PRIVATE                0x63A2
+#define MKV_ID_DEFAULT_DURATION             0x23E383
+#define MKV_ID_CLUSTER                      0x1F43B675
+#define MKV_ID_TIMECODE                     0xE7
+#define MKV_ID_SIMPLE_BLOCK                 0xA3
+#define MKV_ID_BLOCK_GROUP                  0xA0
+#define MKV_ID_BLOCK                        0xA1
+#define MKV_ID_BLOCK_DURATION               0x9B
+#define MKV_ID_REFERENCE_BLOCK              0xFB
+#define MKV_ID_CUES                         0x1C53BB6B
+#define MKV_ID_CHAPTERS                     0x1043A770
+#define MKV_ID_TAGS                         0x1254C367
+#define MKV_ID_ATTACHMENTS                  0x1941A469
+#define MKV_BLOCK_FLAG_KEY_FRAME            0x80
+#define MKV_BLOCK_FLAG_LACING               0x06
+// relative timecode and flags after the track number
+#define MKV_BLOCK_HEADER_SIZE               3
+#define MKV_CODEC_H264                      "V_MPEG4/ISO/AVC"
+#define MKV_CODEC_AAC                       "A_AAC"
+
+typedef struct {
+    // track_ID of an MP4 track, TrackNumber of a Matroska one
+    UINT64 containerId;
+    // DEFAULT_VIDEO_TRACK_ID or DEFAULT_AUDIO_TRACK_ID, 0 for a track that is not streamed
+    UINT64 trackId;
+    PBYTE codecPrivateData;
+    UINT32 codecPrivateDataSize;
+    UINT32 frameCount;
+    // MP4: units per second, the trex defaults and the decoding time of the next sample in those units
+    UINT64 timescale;
+    UINT32 defaultDuration;
+    UINT32 defaultSize;
+    UINT32 defaultFlags;
+    UINT64 decodeTime;
+    // Matroska: DefaultDuration in ns, the last entry whose duration waits for the timecode of the next block
+    UINT64 frameDuration;
+    BOOL pending;
+    UINT32 pendingEntry;
+    UINT64 pendingTimestamp;
+    UINT64 pendingDuration;
+    UINT64 lastDuration;
+} DemuxTrack, *PDemuxTrack;
+
+typedef struct {
+    PFrameArchive pArchive;
+    UINT32 indexCapacity;
+    DemuxTrack tracks[DEMUX_MAX_TRACK_COUNT];
+    UINT32 trackCount;
+    // ns per Matroska timecode unit
+    UINT64 timecodeScale;
+    // laced Matroska blocks are not split
+    UINT32 skippedBlocks;
+    // the file ends in the middle of a sample
+    BOOL truncated;
+} DemuxContext, *PDemuxContext;
+
+typedef struct {
+    UINT32 type;
+    UINT64 content;
+    UINT64 end;
+} Mp4Box, *PMp4Box;
+
+typedef struct {
+    UINT32 id;
+    UINT64 start;
+    UINT64 content;
+    UINT64 end;
+    // a live Segment or Cluster, it ends where the next element of its level starts
+    BOOL unknownSize;
+    // the file ends before the element does
+    BOOL truncated;
+} MkvElement, *PMkvElement;
+
+STATIC UINT32 readBe16(PBYTE p)
+{
+    return ((UINT32) p[0] << 8) | (UINT32) p[1];
+}
+
+STATIC UINT32 readBe32(PBYTE p)
+{
+    return ((UINT32) p[0] << 24) | ((UINT32) p[1] << 16) | ((UINT32) p[2] << 8) | (UINT32) p[3];
+}
+
+STATIC UINT64 readBe64(PBYTE p)
+{
+    return ((UINT64) readBe32(p) << 32) | (UINT64) readBe32(p + 4);
+}
+
+STATIC PDemuxTrack demuxFindTrack(PDemuxContext pContext, UINT64 containerId)
+{
+    UINT32 i;
+
+    for (i = 0; i < pContext->trackCount; i++) {
+        if (pContext->tracks[i].containerId == containerId) {
+            return &pContext->tracks[i];
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Streams the first H.264 track as video and the first AAC track as audio
+ */
+STATIC VOID demuxAddTrack(PDemuxContext pContext, PDemuxTrack pTrack, BOOL isH264, BOOL isAac)
+{
+    UINT64 trackId = isH264 ? DEFAULT_VIDEO_TRACK_ID : isAac ? DEFAULT_AUDIO_TRACK_ID : 0;
+    UINT32 i;
+
+    if (pContext->trackCount == DEMUX_MAX_TRACK_COUNT || demuxFindTrack(pContext, pTrack->containerId) != NULL) {
+        return;
+    }
+
+    for (i = 0; i < pContext->trackCount && trackId != 0; i++) {
+        if (pContext->tracks[i].trackId == trackId) {
+            trackId = 0;
+        }
+    }
+
+    pTrack->trackId = trackId;
+    pContext->tracks[pContext->trackCount++] = *pTrack;
+}
+
+STATIC STATUS demuxAppend(PDemuxContext pContext, PDemuxTrack pTrack, UINT64 offset, UINT64 size, UINT64 duration, BOOL keyFrame)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    PFrameArchive pArchive = pContext->pArchive;
+    PFrameArchiveIndexEntry pIndex, pEntry;
+    UINT32 capacity;
+
+    if (pArchive->frameCount == pContext->indexCapacity) {
+        CHK(pContext->indexCapacity <= MAX_UINT32 / 2 / SIZEOF(FrameArchiveIndexEntry), STATUS_NOT_ENOUGH_MEMORY);
+        capacity = pContext->indexCapacity == 0 ? DEMUX_INITIAL_INDEX_CAPACITY : 2 * pContext->indexCapacity;
+        CHK(NULL != (pIndex = (PFrameArchiveIndexEntry) MEMREALLOC(pArchive->pIndex, capacity * SIZEOF(FrameArchiveIndexEntry))),
+            STATUS_NOT_ENOUGH_MEMORY);
+        pArchive->pIndex = pIndex;
+        pArchive->ownsIndex = TRUE;
+        pContext->indexCapacity = capacity;
+    }
+
+    pEntry = &pArchive->pIndex[pArchive->frameCount++];
+    pEntry->offset = offset;
+    pEntry->size = (UINT32) size;
+    // as kvspack packs them, only video frames are key frames
+    pEntry->flags = keyFrame && pTrack->trackId == DEFAULT_VIDEO_TRACK_ID ? FRAME_ARCHIVE_ENTRY_FLAG_KEY_FRAME : FRAME_ARCHIVE_ENTRY_FLAG_NONE;
+    pEntry->trackId = pTrack->trackId;
+    pEntry->duration = duration;
+    pTrack->frameCount++;
+
+CleanUp:
+
+    return retStatus;
+}
+
+/**
+ * Hands the streamed tracks to the archive, the video one has to have frames
+ */
+STATIC STATUS demuxFinish(PDemuxContext pContext, PCHAR format)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    PFrameArchive pArchive = pContext->pArchive;
+    PDemuxTrack pTrack;
+    UINT32 i;
+    BOOL hasVideo = FALSE;
+
+    for (i = 0; i < pContext->trackCount; i++) {
+        pTrack = &pContext->tracks[i];
+        if (pTrack->trackId == 0 || pTrack->frameCount == 0) {
+            continue;
+        }
+
+        hasVideo = hasVideo || pTrack->trackId == DEFAULT_VIDEO_TRACK_ID;
+        pArchive->tracks[pArchive->trackCount].trackId = pTrack->trackId;
+        pArchive->tracks[pArchive->trackCount].codecPrivateData = pTrack->codecPrivateData;
+        pArchive->tracks[pArchive->trackCount].codecPrivateDataSize = pTrack->codecPrivateDataSize;
+        pArchive->trackCount++;
+    }
+
+    CHK(hasVideo, STATUS_FRAME_ARCHIVE_UNSUPPORTED_CODEC);
+
+    if (pContext->truncated) {
+        DLOGW("The %s file ends in the middle of a sample, it is streamed up to the sample before", format);
+    }
+
+    if (pContext->skippedBlocks != 0) {
+        DLOGW("Skipped %u laced blocks of the %s file", pContext->skippedBlocks, format);
+    }
+
+    DLOGI("Demuxed %u frames of %u tracks from %" PRIu64 " KB of %s", pArchive->frameCount, pArchive->trackCount, pArchive->size >> 10,
+          format);
+
+CleanUp:
+
+    return retStatus;
+}
+
+/**
+ * Reads the box header at the offset. A box cut short is where a file still being written ends.
+ */
+STATIC BOOL mp4ReadBox(PBYTE pBase, UINT64 offset, UINT64 end, PMp4Box pBox)
+{
+    UINT64 size, headerSize = MP4_BOX_HEADER_SIZE;
+
+    if (offset > end || end - offset < MP4_BOX_HEADER_SIZE) {
+        return FALSE;
+    }
+
+    size = readBe32(pBase + offset);
+    pBox->type = readBe32(pBase + offset + 4);
+    if (size == 1) {
+        if (end - offset < MP4_BOX_HEADER_SIZE + SIZEOF(UINT64)) {
+            return FALSE;
+        }
+        size = readBe64(pBase + offset + MP4_BOX_HEADER_SIZE);
+        headerSize += SIZEOF(UINT64);
+    } else if (size == 0) {
+        size = end - offset;
+    }
+
+    if (size < headerSize || size > end - offset) {
+        return FALSE;
+    }
+
+    pBox->content = offset + headerSize;
+    pBox->end = offset + size;
+
+    return TRUE;
+}
+
+STATIC BOOL mp4FindBox(PBYTE pBase, UINT64 offset, UINT64 end, UINT32 type, PMp4Box pBox)
+{
+    while (mp4ReadBox(pBase, offset, end, pBox)) {
+        if (pBox->type == type) {
+            return TRUE;
+        }
+        offset = pBox->end;
+    }
+
+    return FALSE;
+}
+
+/**
+ * Reads the tag and the length of an MPEG-4 descriptor, the length takes up to four 7 bit groups
+ */
+STATIC BOOL mp4ReadDescriptor(PBYTE pBase, PUINT64 pOffset, UINT64 end, PUINT32 pTag, PUINT64 pLength)
+{
+    UINT64 offset = *pOffset, length = 0;
+    UINT32 i;
+    BYTE b = 0x80;
+
+    if (offset >= end) {
+        return FALSE;
+    }
+
+    *pTag = pBase[offset++];
+    for (i = 0; i < 4 && (b & 0x80) != 0; i++) {
+        if (offset >= end) {
+            return FALSE;
+        }
+        b = pBase[offset++];
+        length = (length << 7) | (b & 0x7f);
+    }
+
+    if (length > end - offset) {
+        return FALSE;
+    }
+
+    *pOffset = offset;
+    *pLength = length;
+
+    return TRUE;
+}
+
+/**
+ * Finds the AudioSpecificConfig in the DecoderSpecificInfo of an esds box
+ */
+STATIC VOID mp4ParseEsds(PBYTE pBase, PMp4Box pEsds, PDemuxTrack pTrack)
+{
+    UINT64 offset = pEsds->content + MP4_FULL_BOX_HEADER_SIZE, length;
+    UINT32 tag;
+    BYTE flags;
+
+    if (!mp4ReadDescriptor(pBase, &offset, pEsds->end, &tag, &length) || tag != MP4_ES_DESCRIPTOR_TAG || length < 3) {
+        return;
+    }
+
+    // ES_ID, then the flags announce the optional fields
+    flags = pBase[offset + 2];
+    offset += 3;
+    offset += (flags & 0x80) != 0 ? 2 : 0;
+    if ((flags & 0x40) != 0) {
+        offset += offset < pEsds->end ? 1 + (UINT64) pBase[offset] : 0;
+    }
+    offset += (flags & 0x20) != 0 ? 2 : 0;
+
+    if (!mp4ReadDescriptor(pBase, &offset, pEsds->end, &tag, &length) || tag != MP4_DECODER_CONFIG_TAG ||
+        length < MP4_DECODER_CONFIG_SIZE) {
+        return;
+    }
+
+    offset += MP4_DECODER_CONFIG_SIZE;
+    if (mp4ReadDescriptor(pBase, &offset, pEsds->end, &tag, &length) && tag == MP4_DECODER_SPECIFIC_INFO_TAG) {
+        pTrack->codecPrivateData = pBase + offset;
+        pTrack->codecPrivateDataSize = (UINT32) length;
+    }
+}
+
+STATIC VOID mp4ParseTrak(PDemuxContext pContext, PMp4Box pTrak)
+{
+    PBYTE pBase = pContext->pArchive->pBase;
+    Mp4Box tkhd, mdia, mdhd, minf, stbl, stsd, entry, config;
+    DemuxTrack track;
+    BOOL isH264 = FALSE, isAac = FALSE;
+    UINT32 offset;
+
+    MEMSET(&track, 0x00, SIZEOF(DemuxTrack));
+
+    if (!mp4FindBox(pBase, pTrak->content, pTrak->end, MP4_BOX_TYPE('t', 'k', 'h', 'd'), &tkhd) ||
+        !mp4FindBox(pBase, pTrak->content, pTrak->end, MP4_BOX_TYPE('m', 'd', 'i', 'a'), &mdia) ||
+        !mp4FindBox(pBase, mdia.content, mdia.end, MP4_BOX_TYPE('m', 'd', 'h', 'd'), &mdhd) ||
+        !mp4FindBox(pBase, mdia.content, mdia.end, MP4_BOX_TYPE('m', 'i', 'n', 'f'), &minf) ||
+        !mp4FindBox(pBase, minf.content, minf.end, MP4_BOX_TYPE('s', 't', 'b', 'l'), &stbl) ||
+        !mp4FindBox(pBase, stbl.content, stbl.end, MP4_BOX_TYPE('s', 't', 's', 'd'), &stsd)) {
+        return;
+    }
+
+    // version 1 has 64 bit creation and modification times in front
+    offset = pBase[tkhd.content] == 1 ? 20 : 12;
+    if (tkhd.end - tkhd.content < offset + 4) {
+        return;
+    }
+    track.containerId = readBe32(pBase + tkhd.content + offset);
+
+    offset = pBase[mdhd.content] == 1 ? 20 : 12;
+    if (mdhd.end - mdhd.content < offset + 4 || (track.timescale = readBe32(pBase + mdhd.content + offset)) == 0) {
+        return;
+    }
+
+    // the first sample entry describes the samples of every fragment
+    if (mp4ReadBox(pBase, stsd.content + MP4_FULL_BOX_HEADER_SIZE + 4, stsd.end, &entry)) {
+        if ((entry.type == MP4_BOX_TYPE('a', 'v', 'c', '1') || entry.type == MP4_BOX_TYPE('a', 'v', 'c', '3')) &&
+            mp4FindBox(pBase, entry.content + MP4_VISUAL_SAMPLE_ENTRY_SIZE, entry.end, MP4_BOX_TYPE('a', 'v', 'c', 'C'), &config)) {
+            isH264 = TRUE;
+            track.codecPrivateData = pBase + config.content;
+            track.codecPrivateDataSize = (UINT32) (config.end - config.content);
+        } else if (entry.type == MP4_BOX_TYPE('m', 'p', '4', 'a') &&
+                   mp4FindBox(pBase, entry.content + MP4_AUDIO_SAMPLE_ENTRY_SIZE, entry.end, MP4_BOX_TYPE('e', 's', 'd', 's'), &config)) {
+            mp4ParseEsds(pBase, &config, &track);
+            isAac = track.codecPrivateData != NULL;
+        }
+    }
+
+    demuxAddTrack(pContext, &track, isH264, isAac);
+}
+
+STATIC VOID mp4ParseMoov(PDemuxContext pContext, PMp4Box pMoov)
+{
+    PBYTE pBase = pContext->pArchive->pBase;
+    PDemuxTrack pTrack;
+    Mp4Box box, trex;
+    UINT64 offset;
+
+    for (offset = pMoov->content; mp4ReadBox(pBase, offset, pMoov->end, &box); offset = box.end) {
+        if (box.type == MP4_BOX_TYPE('t', 'r', 'a', 'k')) {
+            mp4ParseTrak(pContext, &box);
+        }
+    }
+
+    // the defaults of the fragments may come before or after the tracks
+    if (!mp4FindBox(pBase, pMoov->content, pMoov->end, MP4_BOX_TYPE('m', 'v', 'e', 'x'), &box)) {
+        return;
+    }
+
+    for (offset = box.content; mp4ReadBox(pBase, offset, box.end, &trex); offset = trex.end) {
+        // track_ID, default_sample_description_index, duration, size and flags
+        if (trex.type == MP4_BOX_TYPE('t', 'r', 'e', 'x') && trex.end - trex.content >= MP4_FULL_BOX_HEADER_SIZE + 20 &&
+            (pTrack = demuxFindTrack(pContext, readBe32(pBase + trex.content + MP4_FULL_BOX_HEADER_SIZE))) != NULL) {
+            pTrack->defaultDuration = readBe32(pBase + trex.content + MP4_FULL_BOX_HEADER_SIZE + 8);
+            pTrack->defaultSize = readBe32(pBase + trex.content + MP4_FULL_BOX_HEADER_SIZE + 12);
+            pTrack->defaultFlags = readBe32(pBase + trex.content + MP4_FULL_BOX_HEADER_SIZE + 16);
+        }
+    }
+}
+
+/**
+ * Indexes the samples of one track run, data follows the previous run of the fragment unless it has an offset
+ */
+STATIC STATUS mp4ParseTrun(PDemuxContext pContext, PMp4Box pTrun, PDemuxTrack pTrack, UINT64 baseOffset, UINT32 defaultDuration,
+                           UINT32 defaultSize, UINT32 defaultFlags, PUINT64 pDataOffset)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    PBYTE pBase = pContext->pArchive->pBase, p;
+    UINT32 flags, count, recordSize, i, duration, size, sampleFlags, firstFlags = 0;
+    UINT64 dataOffset = *pDataOffset, start;
+
+    CHK(pTrun->end - pTrun->content >= MP4_FULL_BOX_HEADER_SIZE + 4, STATUS_FRAME_ARCHIVE_INVALID_FORMAT);
+    flags = readBe32(pBase + pTrun->content) & 0xffffff;
+    count = readBe32(pBase + pTrun->content + MP4_FULL_BOX_HEADER_SIZE);
+    p = pBase + pTrun->content + MP4_FULL_BOX_HEADER_SIZE + 4;
+
+    recordSize = 4 * (((flags & MP4_TRUN_DURATION) != 0) + ((flags & MP4_TRUN_SIZE) != 0) + ((flags & MP4_TRUN_FLAGS) != 0) +
+                      ((flags & MP4_TRUN_COMPOSITION_OFFSET) != 0));
+    CHK((UINT64) (pBase + pTrun->end - p) >=
+            4 * (UINT64) (((flags & MP4_TRUN_DATA_OFFSET) != 0) + ((flags & MP4_TRUN_FIRST_SAMPLE_FLAGS) != 0)) + (UINT64) count * recordSize,
+        STATUS_FRAME_ARCHIVE_INVALID_FORMAT);
+
+    if ((flags & MP4_TRUN_DATA_OFFSET) != 0) {
+        dataOffset = baseOffset + (INT64) (INT32) readBe32(p);
+        p += 4;
+    }
+
+    if ((flags & MP4_TRUN_FIRST_SAMPLE_FLAGS) != 0) {
+        firstFlags = readBe32(p);
+        p += 4;
+    }
+
+    for (i = 0; i < count; i++) {
+        duration = defaultDuration;
+        size = defaultSize;
+        sampleFlags = i == 0 && (flags & MP4_TRUN_FIRST_SAMPLE_FLAGS) != 0 ? firstFlags : defaultFlags;
+        if ((flags & MP4_TRUN_DURATION) != 0) {
+            duration = readBe32(p);
+            p += 4;
+        }
+        if ((flags & MP4_TRUN_SIZE) != 0) {
+            size = readBe32(p);
+            p += 4;
+        }
+        if ((flags & MP4_TRUN_FLAGS) != 0) {
+            sampleFlags = readBe32(p);
+            p += 4;
+        }
+        if ((flags & MP4_TRUN_COMPOSITION_OFFSET) != 0) {
+            p += 4;
+        }
+
+        if (dataOffset > pContext->pArchive->size || size > pContext->pArchive->size - dataOffset) {
+            pContext->truncated = TRUE;
+            break;
+        }
+
+        if (pTrack->trackId != 0) {
+            // from the decoding times so the rounding does not add up
+            start = pTrack->decodeTime * HUNDREDS_OF_NANOS_IN_A_SECOND / pTrack->timescale;
+            pTrack->decodeTime += duration;
+            CHK_STATUS(demuxAppend(pContext, pTrack, dataOffset, size,
+                                   pTrack->decodeTime * HUNDREDS_OF_NANOS_IN_A_SECOND / pTrack->timescale - start,
+                                   (sampleFlags & MP4_SAMPLE_FLAG_NON_SYNC) == 0));
+        }
+
+        dataOffset += size;
+    }
+
+    *pDataOffset = dataOffset;
+
+CleanUp:
+
+    return retStatus;
+}
+
+STATIC STATUS mp4ParseMoof(PDemuxContext pContext, UINT64 moofStart, PMp4Box pMoof)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    PBYTE pBase = pContext->pArchive->pBase, p;
+    PDemuxTrack pTrack;
+    Mp4Box traf, tfhd, trun;
+    UINT64 offset, trunOffset, baseOffset, dataOffset;
+    UINT32 flags, defaultDuration, defaultSize, defaultFlags;
+
+    for (offset = pMoof->content; mp4ReadBox(pBase, offset, pMoof->end, &traf) && !pContext->truncated; offset = traf.end) {
+        if (traf.type != MP4_BOX_TYPE('t', 'r', 'a', 'f') ||
+            !mp4FindBox(pBase, traf.content, traf.end, MP4_BOX_TYPE('t', 'f', 'h', 'd'), &tfhd) ||
+            tfhd.end - tfhd.content < MP4_FULL_BOX_HEADER_SIZE + 4 ||
+            (pTrack = demuxFindTrack(pContext, readBe32(pBase + tfhd.content + MP4_FULL_BOX_HEADER_SIZE))) == NULL) {
+            continue;
+        }
+
+        flags = readBe32(pBase + tfhd.content) & 0xffffff;
+        p = pBase + tfhd.content + MP4_FULL_BOX_HEADER_SIZE + 4;
+        CHK((UINT64) (pBase + tfhd.end - p) >= 8 * ((flags & MP4_TFHD_BASE_DATA_OFFSET) != 0) +
+                    4 * (UINT64) (((flags & MP4_TFHD_SAMPLE_DESCRIPTION_INDEX) != 0) + ((flags & MP4_TFHD_DEFAULT_DURATION) != 0) +
+                                  ((flags & MP4_TFHD_DEFAULT_SIZE) != 0) + ((flags & MP4_TFHD_DEFAULT_FLAGS) != 0)),
+            STATUS_FRAME_ARCHIVE_INVALID_FORMAT);
+
+        // without an explicit base the data is addressed from the moof, as default-base-is-moof has it
+        baseOffset = moofStart;
+        if ((flags & MP4_TFHD_BASE_DATA_OFFSET) != 0) {
+            baseOffset = readBe64(p);
+            p += 8;
+        }
+        p += (flags & MP4_TFHD_SAMPLE_DESCRIPTION_INDEX) != 0 ? 4 : 0;
+        defaultDuration = pTrack->defaultDuration;
+        defaultSize = pTrack->defaultSize;
+        defaultFlags = pTrack->defaultFlags;
+        if ((flags & MP4_TFHD_DEFAULT_DURATION) != 0) {
+            defaultDuration = readBe32(p);
+            p += 4;
+        }
+        if ((flags & MP4_TFHD_DEFAULT_SIZE) != 0) {
+            defaultSize = readBe32(p);
+            p += 4;
+        }
+        if ((flags & MP4_TFHD_DEFAULT_FLAGS) != 0) {
+            defaultFlags = readBe32(p);
+        }
+
+        dataOffset = baseOffset;
+        for (trunOffset = traf.content; mp4ReadBox(pBase, trunOffset, traf.end, &trun) && !pContext->truncated; trunOffset = trun.end) {
+            if (trun.type == MP4_BOX_TYPE('t', 'r', 'u', 'n')) {
+                CHK_STATUS(mp4ParseTrun(pContext, &trun, pTrack, baseOffset, defaultDuration, defaultSize, defaultFlags, &dataOffset));
+            }
+        }
+    }
+
+CleanUp:
+
+    return retStatus;
+}
+
+BOOL demuxIsMp4(PBYTE pBase, UINT64 size)
+{
+    UINT32 type;
+
+    if (size < MP4_BOX_HEADER_SIZE) {
+        return FALSE;
+    }
+
+    type = readBe32(pBase + 4);
+
+    return type == MP4_BOX_TYPE('f', 't', 'y', 'p') || type == MP4_BOX_TYPE('s', 't', 'y', 'p') || type == MP4_BOX_TYPE('m', 'o', 'o', 'v');
+}
+
+STATUS demuxMp4(PFrameArchive pArchive)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    DemuxContext context;
+    Mp4Box box;
+    UINT64 offset;
+    BOOL hasMoov = FALSE;
+
+    CHK(pArchive != NULL, STATUS_NULL_ARG);
+
+    MEMSET(&context, 0x00, SIZEOF(DemuxContext));
+    context.pArchive = pArchive;
+
+    for (offset = 0; mp4ReadBox(pArchive->pBase, offset, pArchive->size, &box) && !context.truncated; offset = box.end) {
+        if (box.type == MP4_BOX_TYPE('m', 'o', 'o', 'v')) {
+            mp4ParseMoov(&context, &box);
+            hasMoov = TRUE;
+        } else if (box.type == MP4_BOX_TYPE('m', 'o', 'o', 'f')) {
+            // the tracks are described before the first fragment
+            CHK(hasMoov, STATUS_FRAME_ARCHIVE_INVALID_FORMAT);
+            CHK_STATUS(mp4ParseMoof(&context, offset, &box));
+        }
+    }
+
+    CHK_STATUS(demuxFinish(&context, (PCHAR) "fragmented MP4"));
+
+CleanUp:
+
+    return retStatus;
+}
+
+/**
+ * Reads an EBML variable length integer. IDs keep their length marker, sizes with all value bits set are unknown.
+ */
+STATIC BOOL mkvReadVint(PBYTE pBase, PUINT64 pOffset, UINT64 end, BOOL isId, PUINT64 pValue, PBOOL pUnknown)
+{
+    UINT64 offset = *pOffset, value;
+    UINT32 length, i;
+    BYTE first, mask;
+    BOOL allOnes;
+
+    if (offset >= end || (first = pBase[offset]) == 0) {
+        return FALSE;
+    }
+
+    for (length = 1, mask = 0x80; (first & mask) == 0; length++, mask >>= 1);
+    if (end - offset < length || (isId && length > 4)) {
+        return FALSE;
+    }
+
+    value = isId ? first : (first & (mask - 1));
+    allOnes = (first & (mask - 1)) == mask - 1;
+    for (i = 1; i < length; i++) {
+        value = (value << 8) | pBase[offset + i];
+        allOnes = allOnes && pBase[offset + i] == 0xff;
+    }
+
+    *pOffset = offset + length;
+    *pValue = value;
+    if (pUnknown != NULL) {
+        *pUnknown = !isId && allOnes;
+    }
+
+    return TRUE;
+}
+
+/**
+ * Reads the element header at the offset. An element of unknown size, or one cut short, runs to the end of its parent.
+ */
+STATIC BOOL mkvReadElement(PBYTE pBase, UINT64 offset, UINT64 end, PMkvElement pElement)
+{
+    UINT64 id, size;
+
+    pElement->start = offset;
+    if (!mkvReadVint(pBase, &offset, end, TRUE, &id, NULL) || !mkvReadVint(pBase, &offset, end, FALSE, &size, &pElement->unknownSize)) {
+        return FALSE;
+    }
+
+    pElement->id = (UINT32) id;
+    pElement->content = offset;
+    pElement->truncated = !pElement->unknownSize && size > end - offset;
+    pElement->end = pElement->unknownSize || pElement->truncated ? end : offset + size;
+
+    return TRUE;
+}
+
+STATIC UINT64 mkvReadUint(PBYTE pBase, PMkvElement pElement)
+{
+    UINT64 value = 0, offset;
+
+    for (offset = pElement->content; offset < pElement->end && offset < pElement->content + SIZEOF(UINT64); offset++) {
+        value = (value << 8) | pBase[offset];
+    }
+
+    return value;
+}
+
+STATIC BOOL mkvIsString(PBYTE pBase, PMkvElement pElement, PCHAR value, BOOL prefix)
+{
+    UINT64 length = pElement->end - pElement->content, valueLength = STRLEN(value);
+
+    // strings may be padded with zeros
+    while (length > 0 && pBase[pElement->content + length - 1] == '\0') {
+        length--;
+    }
+
+    return (prefix ? length >= valueLength : length == valueLength) && MEMCMP(pBase + pElement->content, value, valueLength) == 0;
+}
+
+/**
+ * Elements of the Segment, one of them ends a Cluster of unknown size
+ */
+STATIC BOOL mkvIsTopLevel(UINT32 id)
+{
+    return id == MKV_ID_CLUSTER || id == MKV_ID_INFO || id == MKV_ID_TRACKS || id == MKV_ID_SEEK_HEAD || id == MKV_ID_CUES ||
+        id == MKV_ID_CHAPTERS || id == MKV_ID_TAGS || id == MKV_ID_ATTACHMENTS || id == MKV_ID_EBML || id == MKV_ID_SEGMENT;
+}
+
+STATIC VOID mkvParseTracks(PDemuxContext pContext, PMkvElement pTracks)
+{
+    PBYTE pBase = pContext->pArchive->pBase;
+    MkvElement entry, element;
+    DemuxTrack track;
+    UINT64 offset, entryOffset;
+    BOOL isH264, isAac;
+
+    for (offset = pTracks->content; mkvReadElement(pBase, offset, pTracks->end, &entry); offset = entry.end) {
+        if (entry.id != MKV_ID_TRACK_ENTRY) {
+            continue;
+        }
+
+        MEMSET(&track, 0x00, SIZEOF(DemuxTrack));
+        isH264 = FALSE;
+        isAac = FALSE;
+        for (entryOffset = entry.content; mkvReadElement(pBase, entryOffset, entry.end, &element); entryOffset = element.end) {
+            switch (element.id) {
+                case MKV_ID_TRACK_NUMBER:
+                    track.containerId = mkvReadUint(pBase, &element);
+                    break;
+                case MKV_ID_CODEC_ID:
+                    isH264 = mkvIsString(pBase, &element, (PCHAR) MKV_CODEC_H264, FALSE);
+                    isAac = mkvIsString(pBase, &element, (PCHAR) MKV_CODEC_AAC, TRUE);
+                    break;
+                case MKV_ID_CODEC_PRIVATE:
+                    track.codecPrivateData = pBase + element.content;
+                    track.codecPrivateDataSize = (UINT32) (element.end - element.content);
+                    break;
+                case MKV_ID_DEFAULT_DURATION:
+                    track.frameDuration = mkvReadUint(pBase, &element);
+                    break;
+                default:
+                    break;
+            }
+        }
+
+        if (track.containerId != 0) {
+            demuxAddTrack(pContext, &track, isH264, isAac);
+        }
+    }
+}
+
+/**
+ * Gives the previous frame of the track its duration, a block only tells when it starts
+ */
+STATIC VOID mkvSettleDuration(PDemuxContext pContext, PDemuxTrack pTrack, UINT64 duration)
+{
+    pContext->pArchive->pIndex[pTrack->pendingEntry].duration = duration / 100;
+    pTrack->lastDuration = duration;
+    pTrack->pending = FALSE;
+}
+
+STATIC STATUS mkvParseBlock(PDemuxContext pContext, PMkvElement pBlock, INT64 clusterTimecode, BOOL simpleBlock, BOOL referenced,
+                            UINT64 blockDuration)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    PBYTE pBase = pContext->pArchive->pBase;
+    PDemuxTrack pTrack;
+    UINT64 offset = pBlock->content, number;
+    INT64 timecode;
+    BYTE flags;
+    UINT64 timestamp;
+
+    CHK(mkvReadVint(pBase, &offset, pBlock->end, FALSE, &number, NULL) && pBlock->end - offset >= MKV_BLOCK_HEADER_SIZE,
+        STATUS_FRAME_ARCHIVE_INVALID_FORMAT);
+    CHK((pTrack = demuxFindTrack(pContext, number)) != NULL && pTrack->trackId != 0, retStatus);
+
+    timecode = clusterTimecode + (INT16) readBe16(pBase + offset);
+    flags = pBase[offset + 2];
+    offset += MKV_BLOCK_HEADER_SIZE;
+    if ((flags & MKV_BLOCK_FLAG_LACING) != 0) {
+        pContext->skippedBlocks++;
+        CHK(FALSE, retStatus);
+    }
+
+    timestamp = timecode > 0 ? (UINT64) timecode * pContext->timecodeScale : 0;
+    if (pTrack->pending) {
+        mkvSettleDuration(pContext, pTrack,
+                          timestamp > pTrack->pendingTimestamp ? timestamp - pTrack->pendingTimestamp
+                                                               : pTrack->frameDuration != 0 ? pTrack->frameDuration : pTrack->lastDuration);
+    }
+
+    CHK_STATUS(demuxAppend(pContext, pTrack, offset, pBlock->end - offset, 0,
+                           simpleBlock ? (flags & MKV_BLOCK_FLAG_KEY_FRAME) != 0 : !referenced));
+    pTrack->pending = TRUE;
+    pTrack->pendingEntry = pContext->pArchive->frameCount - 1;
+    pTrack->pendingTimestamp = timestamp;
+    pTrack->pendingDuration = blockDuration * pContext->timecodeScale;
+
+CleanUp:
+
+    return retStatus;
+}
+
+/**
+ * Indexes the blocks of a Cluster and returns where the next element of the Segment starts
+ */
+STATIC STATUS mkvParseCluster(PDemuxContext pContext, PMkvElement pCluster, PUINT64 pNextOffset)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    PBYTE pBase = pContext->pArchive->pBase;
+    MkvElement element, child, block;
+    UINT64 offset, groupOffset, blockDuration;
+    INT64 clusterTimecode = 0;
+    BOOL referenced, hasBlock;
+
+    for (offset = pCluster->content; mkvReadElement(pBase, offset, pCluster->end, &element); offset = element.end) {
+        if (pCluster->unknownSize && mkvIsTopLevel(element.id)) {
+            break;
+        }
+
+        if (element.id == MKV_ID_TIMECODE) {
+            clusterTimecode = (INT64) mkvReadUint(pBase, &element);
+        } else if (element.id == MKV_ID_SIMPLE_BLOCK || element.id == MKV_ID_BLOCK_GROUP) {
+            if (element.truncated) {
+                pContext->truncated = TRUE;
+                break;
+            }
+
+            if (element.id == MKV_ID_SIMPLE_BLOCK) {
+                CHK_STATUS(mkvParseBlock(pContext, &element, clusterTimecode, TRUE, FALSE, 0));
+                continue;
+            }
+
+            referenced = FALSE;
+            hasBlock = FALSE;
+            blockDuration = 0;
+            for (groupOffset = element.content; mkvReadElement(pBase, groupOffset, element.end, &child); groupOffset = child.end) {
+                if (child.id == MKV_ID_BLOCK) {
+                    block = child;
+                    hasBlock = TRUE;
+                } else if (child.id == MKV_ID_REFERENCE_BLOCK) {
+                    referenced = TRUE;
+                } else if (child.id == MKV_ID_BLOCK_DURATION) {
+                    blockDuration = mkvReadUint(pBase, &child);
+                }
+            }
+
+            if (hasBlock) {
+                CHK_STATUS(mkvParseBlock(pContext, &block, clusterTimecode, FALSE, referenced, blockDuration));
+            }
+        }
+    }
+
+    *pNextOffset = offset;
+
+CleanUp:
+
+    return retStatus;
+}
+
+BOOL demuxIsMatroska(PBYTE pBase, UINT64 size)
+{
+    return size >= 4 && readBe32(pBase) == MKV_ID_EBML;
+}
+
+STATUS demuxMatroska(PFrameArchive pArchive)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    PBYTE pBase;
+    DemuxContext context;
+    MkvElement segment, element, child;
+    PDemuxTrack pTrack;
+    UINT64 offset, childOffset;
+    UINT32 i;
+
+    CHK(pArchive != NULL, STATUS_NULL_ARG);
+
+    MEMSET(&context, 0x00, SIZEOF(DemuxContext));
+    context.pArchive = pArchive;
+    context.timecodeScale = MKV_DEFAULT_TIMECODE_SCALE;
+    pBase = pArchive->pBase;
+
+    // the EBML header, then the Segment
+    CHK(mkvReadElement(pBase, 0, pArchive->size, &element) &&
+            mkvReadElement(pBase, element.end, pArchive->size, &segment) && segment.id == MKV_ID_SEGMENT,
+        STATUS_FRAME_ARCHIVE_INVALID_FORMAT);
+
+    offset = segment.content;
+    while (!context.truncated && mkvReadElement(pBase, offset, segment.end, &element)) {
+        offset = element.end;
+        if (element.id == MKV_ID_INFO) {
+            for (childOffset = element.content; mkvReadElement(pBase, childOffset, element.end, &child); childOffset = child.end) {
+                if (child.id == MKV_ID_TIMECODE_SCALE && mkvReadUint(pBase, &child) != 0) {
+                    context.timecodeScale = mkvReadUint(pBase, &child);
+                }
+            }
+        } else if (element.id == MKV_ID_TRACKS) {
+            mkvParseTracks(&context, &element);
+        } else if (element.id == MKV_ID_CLUSTER) {
+            CHK_STATUS(mkvParseCluster(&context, &element, &offset));
+        } else if (element.unknownSize) {
+            // nothing tells where it ends
+            break;
+        }
+    }
+
+    // the last frame of a track has no next block, it lasts as long as the block says or the track's frames do
+    for (i = 0; i < context.trackCount; i++) {
+        pTrack = &context.tracks[i];
+        if (pTrack->pending) {
+            mkvSettleDuration(&context, pTrack,
+                              pTrack->pendingDuration != 0 ? pTrack->pendingDuration
+                                                           : pTrack->frameDuration != 0 ? pTrack->frameDuration : pTrack->lastDuration);
+        }
+    }
+
+    CHK_STATUS(demuxFinish(&context, (PCHAR) "Matroska"));
+
+CleanUp:
+
+    return retStatus;
+}
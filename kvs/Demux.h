@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2020 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __KVS_DEMUX_H__
+#define __KVS_DEMUX_H__
+
+#include "KvsApp.h"
+#include "FrameArchive.h"
+
+// tracks of a container looked at, only the first H.264 and AAC ones are streamed
+#define DEMUX_MAX_TRACK_COUNT               8
+#define DEMUX_INITIAL_INDEX_CAPACITY        1024
+#define MKV_DEFAULT_TIMECODE_SCALE          1000000
+
+/**
+ * Demuxers of fragmented MP4 and Matroska files already mapped by openFrameArchive.
+ *
+ * They only walk the structure: moov/moof/traf/trun boxes or the Tracks and the SimpleBlocks and Blocks of the
+ * Clusters. Every sample becomes an index entry pointing into the mapping, so frames are put straight from the
+ * container like from a .kva archive and the media data is never touched. The first H.264 track becomes the video
+ * track and the first AAC track the audio track, with their codec private data. Durations come from the sample
+ * durations of a fragment or from the block timecodes, composition offsets are ignored.
+ *
+ * A file cut short by a recorder still writing it ends at the last sample that is complete.
+ */
+BOOL demuxIsMp4(PBYTE, UINT64);
+BOOL demuxIsMatroska(PBYTE, UINT64);
+
+/**
+ * Fill the index and the tracks of the archive, which owns the index afterwards
+ */
+STATUS demuxMp4(PFrameArchive);
+STATUS demuxMatroska(PFrameArchive);
+
+#endif /* __KVS_DEMUX_H__ */
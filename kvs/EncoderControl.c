@@ -0,0 +1,167 @@
+/*
+ * Copyright (C) 2020 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "EncoderControl.h"
+
+/**
+ * Sends one message, pPending is set when it did not get through
+ */
+STATIC STATUS encoderControlSend(PEncoderControl pControl, PCHAR message, INT32 length, PBOOL pPending)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+
+    CHK(length > 0 && length < ENCODER_CONTROL_MAX_MESSAGE_LEN, STATUS_INVALID_ARG_LEN);
+
+    ATOMIC_INCREMENT(&pControl->stats.requests);
+    if (sendto(pControl->fd, message, (SIZE_T) length, MSG_NOSIGNAL, (struct sockaddr*) &pControl->address, SIZEOF(pControl->address)) !=
+        length) {
+        // no encoder behind the path yet or its queue is full
+        ATOMIC_INCREMENT(&pControl->stats.failures);
+        DLOGD("Encoder control %s not delivered: %s", pControl->address.sun_path, strerror(errno));
+        if (pPending != NULL) {
+            *pPending = TRUE;
+        }
+        CHK(FALSE, retStatus);
+    }
+
+    if (pPending != NULL) {
+        *pPending = FALSE;
+    }
+
+CleanUp:
+
+    return retStatus;
+}
+
+STATUS createEncoderControl(PCHAR path, PEncoderControl* ppControl)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    PEncoderControl pControl = NULL;
+
+    CHK(path != NULL && ppControl != NULL, STATUS_NULL_ARG);
+    CHK(STRLEN(path) < SIZEOF(pControl->address.sun_path), STATUS_INVALID_ARG_LEN);
+
+    CHK(NULL != (pControl = (PEncoderControl) MEMCALLOC(1, SIZEOF(EncoderControl))), STATUS_NOT_ENOUGH_MEMORY);
+    pControl->address.sun_family = AF_UNIX;
+    STRCPY(pControl->address.sun_path, path);
+    // never blocks the ack callback on a stalled encoder
+    CHK((pControl->fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0)) >= 0, STATUS_INVALID_OPERATION);
+
+    DLOGI("Encoder control on %s", path);
+
+CleanUp:
+
+    if (STATUS_FAILED(retStatus) && pControl != NULL) {
+        MEMFREE(pControl);
+        pControl = NULL;
+    }
+
+    if (ppControl != NULL) {
+        *ppControl = pControl;
+    }
+
+    return retStatus;
+}
+
+STATUS freeEncoderControl(PEncoderControl* ppControl)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+
+    CHK(ppControl != NULL, STATUS_NULL_ARG);
+    CHK(*ppControl != NULL, retStatus);
+
+    close((*ppControl)->fd);
+    MEMFREE(*ppControl);
+    *ppControl = NULL;
+
+CleanUp:
+
+    return retStatus;
+}
+
+STATUS encoderControlSetKeyFrameInterval(PEncoderControl pControl, UINT64 interval)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    CHAR message[ENCODER_CONTROL_MAX_MESSAGE_LEN];
+
+    CHK(pControl != NULL, STATUS_NULL_ARG);
+    CHK(interval != 0 && (interval != pControl->keyFrameInterval || pControl->pending), retStatus);
+
+    pControl->keyFrameInterval = interval;
+    CHK_STATUS(encoderControlSend(pControl, message,
+                                  SNPRINTF(message, SIZEOF(message), "key-frame-interval %" PRIu64 "\n",
+                                           (UINT64) (interval / HUNDREDS_OF_NANOS_IN_A_MILLISECOND)),
+                                  &pControl->pending));
+
+CleanUp:
+
+    return retStatus;
+}
+
+STATUS encoderControlSetBitrate(PEncoderControl pControl, UINT64 bitrate)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    CHAR message[ENCODER_CONTROL_MAX_MESSAGE_LEN];
+
+    CHK(pControl != NULL, STATUS_NULL_ARG);
+    CHK(bitrate != 0 && (bitrate != pControl->bitrate || pControl->bitratePending), retStatus);
+
+    pControl->bitrate = bitrate;
+    CHK_STATUS(encoderControlSend(pControl, message, SNPRINTF(message, SIZEOF(message), "bitrate %" PRIu64 "\n", bitrate / 1000),
+                                  &pControl->bitratePending));
+
+CleanUp:
+
+    return retStatus;
+}
+
+STATUS encoderControlRequestKeyFrame(PEncoderControl pControl)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    CHAR message[] = "key-frame\n";
+
+    CHK(pControl != NULL, STATUS_NULL_ARG);
+
+    ATOMIC_INCREMENT(&pControl->stats.keyFrameRequests);
+    CHK_STATUS(encoderControlSend(pControl, message, (INT32) STRLEN(message), NULL));
+
+CleanUp:
+
+    return retStatus;
+}
+
+VOID encoderControlPrintStats(PEncoderControl pControl, PCHAR name)
+{
+    if (pControl == NULL) {
+        return;
+    }
+
+    printf("Channel %s encoder control: %" PRIu64 " requests, %" PRIu64 " not delivered, key frame every %" PRIu64 " ms asked, %" PRIu64
+           " kbps asked, %" PRIu64 " key frames asked\n",
+           name, (UINT64) pControl->stats.requests, (UINT64) pControl->stats.failures,
+           (UINT64) (pControl->keyFrameInterval / HUNDREDS_OF_NANOS_IN_A_MILLISECOND),
+           pControl->bitrate / 1000, (UINT64) pControl->stats.keyFrameRequests);
+}
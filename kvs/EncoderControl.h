@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2020 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __KVS_ENCODER_CONTROL_H__
+#define __KVS_ENCODER_CONTROL_H__
+
+#include <sys/un.h>
+
+#include "KvsApp.h"
+
+#define ENCODER_CONTROL_FILE_EXTENSION      ".ctl"
+#define ENCODER_CONTROL_MAX_MESSAGE_LEN     64
+
+/**
+ * Read by the metrics server
+ */
+typedef struct {
+    volatile SIZE_T requests;
+    // the encoder was not listening, the request goes out again with the next one
+    volatile SIZE_T failures;
+    volatile SIZE_T keyFrameRequests;
+} EncoderControlStats, *PEncoderControlStats;
+
+/**
+ * Asks the encoder feeding a live input for changes. The encoder listens on a Unix datagram socket and gets one text
+ * line per datagram:
+ *
+ *     key-frame-interval <ms>
+ *     bitrate <kbps>
+ *     key-frame
+ *
+ * Nothing is ever read back, an encoder may ignore what it does not understand. It may also come and go: a key frame
+ * interval or bitrate it missed is sent again on the next call, a key frame request is only good for the moment.
+ */
+typedef struct {
+    struct sockaddr_un address;
+    INT32 fd;
+    // last asked for, 0 for nothing yet
+    UINT64 keyFrameInterval;
+    BOOL pending;
+    // bits per second, 0 for nothing yet
+    UINT64 bitrate;
+    BOOL bitratePending;
+    EncoderControlStats stats;
+} EncoderControl, *PEncoderControl;
+
+STATUS createEncoderControl(PCHAR, PEncoderControl*);
+STATUS freeEncoderControl(PEncoderControl*);
+
+/**
+ * Asks for a key frame every interval in 100ns. Sends only when the interval changed or the last request did not get
+ * through, so it can be called on every ack.
+ */
+STATUS encoderControlSetKeyFrameInterval(PEncoderControl, UINT64);
+
+/**
+ * Asks for a bitrate in bits per second, sent like the key frame interval
+ */
+STATUS encoderControlSetBitrate(PEncoderControl, UINT64);
+
+/**
+ * Asks for a key frame right away. Safe to call from another thread than the other requests.
+ */
+STATUS encoderControlRequestKeyFrame(PEncoderControl);
+
+VOID encoderControlPrintStats(PEncoderControl, PCHAR);
+
+#endif /* __KVS_ENCODER_CONTROL_H__ */
@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2020 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "FragmentController.h"
+
+VOID fragmentControllerInit(PFragmentController pController, UINT64 minDuration, UINT64 maxDuration, UINT32 overheadPercent)
+{
+    MEMSET(pController, 0x00, SIZEOF(FragmentController));
+    pController->minDuration = minDuration;
+    pController->maxDuration = MAX(minDuration, maxDuration);
+    pController->overheadPercent = MAX(overheadPercent, 1);
+    if (pController->minDuration == pController->maxDuration) {
+        pController->stats.duration = (SIZE_T) minDuration;
+    }
+}
+
+VOID fragmentControllerObserveFragment(PFragmentController pController, UINT64 timecode)
+{
+    // a gap in the timecodes longer than any fragment is an outage or a restart, not a fragment
+    if (pController->lastTimecode != 0 && timecode > pController->lastTimecode &&
+        timecode - pController->lastTimecode <= 2 * pController->maxDuration) {
+        pController->fragmentDuration = timecode - pController->lastTimecode;
+        ATOMIC_STORE(&pController->stats.observedDuration, (SIZE_T) pController->fragmentDuration);
+    }
+
+    pController->lastTimecode = timecode;
+}
+
+BOOL fragmentControllerObserveLatency(PFragmentController pController, UINT64 latency)
+{
+    UINT64 overhead, duration, target;
+
+    if (pController->fragmentDuration == 0) {
+        return FALSE;
+    }
+
+    overhead = latency > pController->fragmentDuration ? latency - pController->fragmentDuration : 0;
+    if (pController->samples == 0 && pController->overhead == 0) {
+        pController->overhead = overhead;
+    } else {
+        pController->overhead = (pController->overhead * (FRAGMENT_CONTROLLER_OVERHEAD_WEIGHT - 1) + overhead) / FRAGMENT_CONTROLLER_OVERHEAD_WEIGHT;
+    }
+    ATOMIC_STORE(&pController->stats.overhead, (SIZE_T) pController->overhead);
+
+    // the fragments acked right after a decision were cut at the old duration
+    if (++pController->samples < FRAGMENT_CONTROLLER_SETTLE_FRAGMENTS) {
+        return FALSE;
+    }
+
+    target = pController->overhead * 100 / pController->overheadPercent;
+    target = (target + FRAGMENT_CONTROLLER_STEP - 1) / FRAGMENT_CONTROLLER_STEP * FRAGMENT_CONTROLLER_STEP;
+    target = MIN(MAX(target, pController->minDuration), pController->maxDuration);
+
+    duration = (UINT64) ATOMIC_LOAD(&pController->stats.duration);
+    if (duration != 0 && (target > duration ? target - duration : duration - target) * 100 <= duration * FRAGMENT_CONTROLLER_HYSTERESIS) {
+        return FALSE;
+    }
+
+    pController->samples = 0;
+    ATOMIC_STORE(&pController->stats.duration, (SIZE_T) target);
+    ATOMIC_INCREMENT(&pController->stats.decisions);
+
+    return TRUE;
+}
+
+UINT64 fragmentControllerGetDuration(PFragmentController pController)
+{
+    return (UINT64) ATOMIC_LOAD(&pController->stats.duration);
+}
+
+VOID fragmentControllerPrintStats(PFragmentController pController, PCHAR name)
+{
+    printf("Channel %s fragments: %" PRIu64 " ms asked after %" PRIu64 " decisions, last one %" PRIu64 " ms with %" PRIu64
+           " ms overhead\n",
+           name, (UINT64) (pController->stats.duration / HUNDREDS_OF_NANOS_IN_A_MILLISECOND), (UINT64) pController->stats.decisions,
+           (UINT64) (pController->stats.observedDuration / HUNDREDS_OF_NANOS_IN_A_MILLISECOND),
+           (UINT64) (pController->stats.overhead / HUNDREDS_OF_NANOS_IN_A_MILLISECOND));
+}
@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2020 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __KVS_FRAGMENT_CONTROLLER_H__
+#define __KVS_FRAGMENT_CONTROLLER_H__
+
+#include "KvsApp.h"
+
+#define DEFAULT_FRAGMENT_MIN_DURATION           (1 * HUNDREDS_OF_NANOS_IN_A_SECOND)
+#define DEFAULT_FRAGMENT_MAX_DURATION           (10 * HUNDREDS_OF_NANOS_IN_A_SECOND)
+// share of every fragment the overhead of its own may take, percent
+#define DEFAULT_FRAGMENT_OVERHEAD_PERCENT       10
+// durations asked for are multiples of this
+#define FRAGMENT_CONTROLLER_STEP                (250 * HUNDREDS_OF_NANOS_IN_A_MILLISECOND)
+// weight of the newest overhead sample, 1/N
+#define FRAGMENT_CONTROLLER_OVERHEAD_WEIGHT     4
+// fragments acked since the last decision before the next one
+#define FRAGMENT_CONTROLLER_SETTLE_FRAGMENTS    3
+// a duration closer than this to the current one is not worth a change, percent
+#define FRAGMENT_CONTROLLER_HYSTERESIS          20
+
+/**
+ * Read by the metrics server, durations in 100ns
+ */
+typedef struct {
+    volatile SIZE_T decisions;
+    // asked for, 0 until the first decision
+    volatile SIZE_T duration;
+    // of the last fragment acked
+    volatile SIZE_T observedDuration;
+    // smoothed per fragment overhead
+    volatile SIZE_T overhead;
+} FragmentControllerStats, *PFragmentControllerStats;
+
+/**
+ * Picks the fragment duration of a stream from its acks.
+ *
+ * The buffering ack of a fragment comes as it starts arriving and the persisted ack once it is complete and stored,
+ * so the time between them is the fragment duration plus what every fragment costs on top: the round trip, the
+ * request and the service storing it. Longer fragments spread that overhead, shorter ones are seen earlier. The
+ * controller asks for the shortest duration keeping the overhead under its share of the fragment, within bounds. A
+ * slower link gets longer fragments, a fast one short fragments and low latency.
+ *
+ * Only touched from the ack callback of the stream.
+ */
+typedef struct {
+    UINT64 minDuration;
+    UINT64 maxDuration;
+    UINT32 overheadPercent;
+    // timecode of the last buffering ack, the next one ends its fragment
+    UINT64 lastTimecode;
+    UINT64 fragmentDuration;
+    UINT64 overhead;
+    UINT32 samples;
+    FragmentControllerStats stats;
+} FragmentController, *PFragmentController;
+
+/**
+ * Equal bounds fix the duration, it is then decided from the start
+ */
+VOID fragmentControllerInit(PFragmentController, UINT64, UINT64, UINT32);
+
+/**
+ * Takes the timecode of a buffering ack
+ */
+VOID fragmentControllerObserveFragment(PFragmentController, UINT64);
+
+/**
+ * Takes the time from the buffering to the persisted ack of a fragment. Returns TRUE when a new duration was decided.
+ */
+BOOL fragmentControllerObserveLatency(PFragmentController, UINT64);
+
+/**
+ * Duration decided last, 0 before the first decision
+ */
+UINT64 fragmentControllerGetDuration(PFragmentController);
+
+VOID fragmentControllerPrintStats(PFragmentController, PCHAR);
+
+#endif /* __KVS_FRAGMENT_CONTROLLER_H__ */
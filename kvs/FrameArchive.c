@@ -0,0 +1,236 @@
+/*
+ * Copyright (C) 2020 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "FrameArchive.h"
+#include "Demux.h"
+
+STATUS openFrameArchive(PCHAR filePath, PFrameArchive* ppArchive)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    PFrameArchive pArchive = NULL;
+    PFrameArchiveHeader pHeader;
+    PFrameArchiveIndexEntry pEntry;
+    struct stat fileStat;
+    PVOID pMapping = MAP_FAILED;
+    INT32 fd = -1;
+    UINT32 i, j;
+
+    CHK(filePath != NULL && ppArchive != NULL, STATUS_NULL_ARG);
+
+    CHK((fd = open(filePath, O_RDONLY)) >= 0, STATUS_OPEN_FILE_FAILED);
+    CHK(fstat(fd, &fileStat) == 0, STATUS_READ_FILE_FAILED);
+    CHK((UINT64) fileStat.st_size >= SIZEOF(FrameArchiveHeader), STATUS_FRAME_ARCHIVE_INVALID_FORMAT);
+
+    pMapping = mmap(NULL, (SIZE_T) fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    CHK(pMapping != MAP_FAILED, STATUS_FRAME_ARCHIVE_MAP_FAILED);
+
+    // Frames are consumed in a loop for the whole run so keep the pages resident
+    madvise(pMapping, (SIZE_T) fileStat.st_size, MADV_WILLNEED);
+
+    pArchive = (PFrameArchive) MEMCALLOC(1, SIZEOF(FrameArchive));
+    CHK(pArchive != NULL, STATUS_NOT_ENOUGH_MEMORY);
+
+    pArchive->pBase = (PBYTE) pMapping;
+    pArchive->size = (UINT64) fileStat.st_size;
+
+    if (demuxIsMp4(pArchive->pBase, pArchive->size)) {
+        CHK_STATUS(demuxMp4(pArchive));
+        CHK(FALSE, retStatus);
+    } else if (demuxIsMatroska(pArchive->pBase, pArchive->size)) {
+        CHK_STATUS(demuxMatroska(pArchive));
+        CHK(FALSE, retStatus);
+    }
+
+    pHeader = (PFrameArchiveHeader) pMapping;
+    CHK(MEMCMP(pHeader->magic, FRAME_ARCHIVE_MAGIC, FRAME_ARCHIVE_MAGIC_LEN) == 0, STATUS_FRAME_ARCHIVE_INVALID_FORMAT);
+    CHK(pHeader->version == FRAME_ARCHIVE_CURRENT_VERSION, STATUS_FRAME_ARCHIVE_UNSUPPORTED_VERSION);
+    CHK(pHeader->frameCount != 0 && pHeader->indexOffset % SIZEOF(UINT64) == 0 &&
+            pHeader->indexOffset <= (UINT64) fileStat.st_size &&
+            (UINT64) pHeader->frameCount * SIZEOF(FrameArchiveIndexEntry) <= (UINT64) fileStat.st_size - pHeader->indexOffset,
+        STATUS_FRAME_ARCHIVE_INVALID_FORMAT);
+
+    // Validate all the entries once so the hot path never has to
+    pEntry = (PFrameArchiveIndexEntry) ((PBYTE) pMapping + pHeader->indexOffset);
+    for (i = 0; i < pHeader->frameCount; i++, pEntry++) {
+        CHK(pEntry->offset >= SIZEOF(FrameArchiveHeader) && pEntry->offset <= pHeader->indexOffset &&
+                pEntry->size <= pHeader->indexOffset - pEntry->offset,
+            STATUS_FRAME_ARCHIVE_INVALID_FORMAT);
+
+        for (j = 0; j < pArchive->trackCount && pArchive->tracks[j].trackId != pEntry->trackId; j++);
+        if (j == pArchive->trackCount && j < FRAME_ARCHIVE_MAX_TRACK_COUNT) {
+            pArchive->tracks[pArchive->trackCount++].trackId = pEntry->trackId;
+        }
+    }
+
+    pArchive->frameCount = pHeader->frameCount;
+    pArchive->pIndex = (PFrameArchiveIndexEntry) ((PBYTE) pMapping + pHeader->indexOffset);
+
+CleanUp:
+
+    // The mapping stays valid after the descriptor is closed
+    if (fd >= 0) {
+        close(fd);
+    }
+
+    if (STATUS_FAILED(retStatus)) {
+        DLOGE("Failed to open frame archive %s with 0x%08x", filePath == NULL ? "" : filePath, retStatus);
+        if (pArchive != NULL) {
+            if (pArchive->ownsIndex) {
+                MEMFREE(pArchive->pIndex);
+            }
+            MEMFREE(pArchive);
+        }
+        if (pMapping != MAP_FAILED) {
+            munmap(pMapping, (SIZE_T) fileStat.st_size);
+        }
+        pArchive = NULL;
+    }
+
+    if (ppArchive != NULL) {
+        *ppArchive = pArchive;
+    }
+
+    return retStatus;
+}
+
+STATUS closeFrameArchive(PFrameArchive* ppArchive)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    PFrameArchive pArchive;
+
+    CHK(ppArchive != NULL, STATUS_NULL_ARG);
+
+    pArchive = *ppArchive;
+    CHK(pArchive != NULL, retStatus);
+
+    munmap(pArchive->pBase, (SIZE_T) pArchive->size);
+    if (pArchive->ownsIndex) {
+        MEMFREE(pArchive->pIndex);
+    }
+    MEMFREE(pArchive);
+    *ppArchive = NULL;
+
+CleanUp:
+
+    return retStatus;
+}
+
+PFrameArchiveTrack frameArchiveGetTrack(PFrameArchive pArchive, UINT64 trackId)
+{
+    UINT32 i;
+
+    for (i = 0; pArchive != NULL && i < pArchive->trackCount; i++) {
+        if (pArchive->tracks[i].trackId == trackId) {
+            return &pArchive->tracks[i];
+        }
+    }
+
+    return NULL;
+}
+
+VOID frameArchivePrefetch(PFrameArchive pArchive, UINT64 offset, UINT64 window)
+{
+    UINT64 pageSize = (UINT64) getpagesize(), start, end;
+
+    if (pArchive == NULL || offset + window / 2 < pArchive->prefetchedOffset) {
+        return;
+    }
+
+    start = MAX(offset, pArchive->prefetchedOffset) / pageSize * pageSize;
+    end = MIN(offset + window, pArchive->size);
+    if (start < end && madvise(pArchive->pBase + start, (SIZE_T) (end - start), MADV_WILLNEED) != 0) {
+        DLOGW("Failed to read ahead the frame archive with errno %d", errno);
+    }
+
+    pArchive->prefetchedOffset = end;
+}
+
+STATUS frameArchiveCursorInit(PFrameArchive pArchive, UINT64 trackId, PFrameArchiveCursor pCursor)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    UINT32 i;
+
+    CHK(pArchive != NULL && pCursor != NULL, STATUS_NULL_ARG);
+
+    for (i = 0; i < pArchive->frameCount && pArchive->pIndex[i].trackId != trackId; i++);
+    CHK(i < pArchive->frameCount, STATUS_FRAME_ARCHIVE_TRACK_NOT_FOUND);
+
+    pCursor->pArchive = pArchive;
+    pCursor->trackId = trackId;
+    pCursor->position = i;
+    pCursor->laps = 0;
+
+CleanUp:
+
+    return retStatus;
+}
+
+STATUS frameArchiveCursorGetFrame(PFrameArchiveCursor pCursor, PFrame pFrame)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    PFrameArchiveIndexEntry pEntry;
+
+    CHK(pCursor != NULL && pCursor->pArchive != NULL && pFrame != NULL, STATUS_NULL_ARG);
+
+    pEntry = &pCursor->pArchive->pIndex[pCursor->position];
+    pFrame->frameData = pCursor->pArchive->pBase + pEntry->offset;
+    pFrame->size = pEntry->size;
+    pFrame->duration = pEntry->duration;
+    pFrame->flags = (pEntry->flags & FRAME_ARCHIVE_ENTRY_FLAG_KEY_FRAME) ? FRAME_FLAG_KEY_FRAME : FRAME_FLAG_NONE;
+
+CleanUp:
+
+    return retStatus;
+}
+
+STATUS frameArchiveCursorAdvance(PFrameArchiveCursor pCursor)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    PFrameArchive pArchive;
+    UINT32 position;
+
+    CHK(pCursor != NULL && pCursor->pArchive != NULL, STATUS_NULL_ARG);
+
+    pArchive = pCursor->pArchive;
+    position = pCursor->position;
+
+    // The cursor always sits on a frame of its own track, so this terminates after at most one full lap
+    do {
+        position = (position + 1) % pArchive->frameCount;
+    } while (pArchive->pIndex[position].trackId != pCursor->trackId);
+
+    if (position <= pCursor->position) {
+        pCursor->laps++;
+    }
+
+    pCursor->position = position;
+
+CleanUp:
+
+    return retStatus;
+}
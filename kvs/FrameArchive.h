@@ -0,0 +1,138 @@
+/*
+ * Copyright (C) 2020 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __KVS_FRAME_ARCHIVE_H__
+#define __KVS_FRAME_ARCHIVE_H__
+
+#include "KvsApp.h"
+
+/**
+ * Packed frame archive.
+ *
+ * All frames of all tracks live in a single file which is mmap'd once, so a
+ * frame put is a pointer into the mapping instead of an open/read/malloc.
+ * A fragmented MP4 or Matroska file is mapped the same way, the demuxer
+ * builds the index from its boxes or elements instead (see Demux.h).
+ *
+ * On-disk layout, host byte order:
+ *
+ *  +--------------------+---------------------+------------------------------+
+ *  | FrameArchiveHeader | frame payloads ...  | FrameArchiveIndexEntry * N   |
+ *  +--------------------+---------------------+------------------------------+
+ *
+ * Index entries are stored in decoding order with the tracks interleaved.
+ */
+#define FRAME_ARCHIVE_MAGIC                 "KVSFRARC"
+#define FRAME_ARCHIVE_MAGIC_LEN             8
+#define FRAME_ARCHIVE_CURRENT_VERSION       1
+#define DEFAULT_FRAME_ARCHIVE_NAME          "frames.kva"
+
+#define FRAME_ARCHIVE_MAX_TRACK_COUNT       2
+
+#define FRAME_ARCHIVE_ENTRY_FLAG_NONE       0x0
+#define FRAME_ARCHIVE_ENTRY_FLAG_KEY_FRAME  0x1
+
+typedef struct {
+    CHAR magic[FRAME_ARCHIVE_MAGIC_LEN];
+    UINT32 version;
+    UINT32 frameCount;
+    UINT64 indexOffset;
+} FrameArchiveHeader, *PFrameArchiveHeader;
+
+typedef struct {
+    // Payload offset from the start of the file
+    UINT64 offset;
+    UINT32 size;
+    UINT32 flags;
+    UINT64 trackId;
+    // Frame duration in 100ns
+    UINT64 duration;
+} FrameArchiveIndexEntry, *PFrameArchiveIndexEntry;
+
+/**
+ * A container also tells how the samples of a track are coded: the avcC of an H.264 track, whose samples are then
+ * length prefixed instead of Annex-B, or the AudioSpecificConfig of an AAC track. Both point into the mapping, a .kva
+ * archive has none.
+ */
+typedef struct {
+    UINT64 trackId;
+    PBYTE codecPrivateData;
+    UINT32 codecPrivateDataSize;
+} FrameArchiveTrack, *PFrameArchiveTrack;
+
+typedef struct {
+    PBYTE pBase;
+    UINT64 size;
+    UINT32 frameCount;
+    PFrameArchiveIndexEntry pIndex;
+    // the demuxer built the index on the heap, a .kva index lives in the mapping
+    BOOL ownsIndex;
+    FrameArchiveTrack tracks[FRAME_ARCHIVE_MAX_TRACK_COUNT];
+    UINT32 trackCount;
+    // end of the payloads asked to be read ahead, see frameArchivePrefetch
+    UINT64 prefetchedOffset;
+} FrameArchive, *PFrameArchive;
+
+/**
+ * Per-track read position. Wraps around to the first frame of the track at the end of the archive.
+ */
+typedef struct {
+    PFrameArchive pArchive;
+    UINT64 trackId;
+    UINT32 position;
+    // times the cursor wrapped around
+    UINT32 laps;
+} FrameArchiveCursor, *PFrameArchiveCursor;
+
+/**
+ * Maps the archive read-only and validates the header and the index, or demuxes a fragmented MP4 or Matroska file.
+ */
+STATUS openFrameArchive(PCHAR, PFrameArchive*);
+STATUS closeFrameArchive(PFrameArchive*);
+
+/**
+ * Returns the track or NULL when the archive has no frame of it
+ */
+PFrameArchiveTrack frameArchiveGetTrack(PFrameArchive, UINT64);
+
+/**
+ * Has the kernel read the payloads from the offset up to the window ahead while the frames before are being put.
+ * The read-ahead is issued once half the window is used up, so it costs a syscall every window / 2 bytes.
+ */
+VOID frameArchivePrefetch(PFrameArchive, UINT64, UINT64);
+
+/**
+ * Positions the cursor on the first frame of the track.
+ */
+STATUS frameArchiveCursorInit(PFrameArchive, UINT64, PFrameArchiveCursor);
+
+/**
+ * Points the frame at the payload under the cursor. Sets frameData, size, flags and duration only.
+ */
+STATUS frameArchiveCursorGetFrame(PFrameArchiveCursor, PFrame);
+
+/**
+ * Moves the cursor to the next frame of the track.
+ */
+STATUS frameArchiveCursorAdvance(PFrameArchiveCursor);
+
+#endif /* __KVS_FRAME_ARCHIVE_H__ */
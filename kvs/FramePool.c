@@ -0,0 +1,351 @@
+/*
+ * Copyright (C) 2020 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "FramePool.h"
+
+STATUS framePoolParseConfig(PCHAR spec, PFramePoolClassConfig pClasses, PUINT32 pCount)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    PCHAR pCur = spec, pEnd;
+    UINT64 size, count;
+
+    CHK(spec != NULL && pClasses != NULL && pCount != NULL, STATUS_NULL_ARG);
+
+    *pCount = 0;
+    while (pCur != NULL) {
+        CHK(*pCount < FRAME_POOL_MAX_CLASS_COUNT, STATUS_INVALID_ARG);
+        CHK(NULL != (pEnd = STRCHR(pCur, 'x')), STATUS_INVALID_ARG);
+        CHK_STATUS(STRTOUI64(pCur, pEnd, 10, &size));
+        pCur = pEnd + 1;
+        pEnd = STRCHR(pCur, ',');
+        CHK_STATUS(STRTOUI64(pCur, pEnd, 10, &count));
+        CHK(size != 0 && size <= MAX_UINT32 / 1024 && count != 0 && count <= MAX_UINT32, STATUS_INVALID_ARG);
+        CHK(*pCount == 0 || size * 1024 > pClasses[*pCount - 1].size, STATUS_INVALID_ARG);
+
+        pClasses[*pCount].size = (UINT32) size * 1024;
+        pClasses[*pCount].count = (UINT32) count;
+        (*pCount)++;
+        pCur = pEnd == NULL ? NULL : pEnd + 1;
+    }
+
+CleanUp:
+
+    return retStatus;
+}
+
+VOID framePoolDefaultConfig(UINT32 maxFrameSize, UINT32 inputCount, PFramePoolClassConfig pClasses, PUINT32 pCount)
+{
+    UINT32 sizes[4], counts[4], i;
+
+    sizes[0] = maxFrameSize / 32;
+    counts[0] = inputCount * 4;
+    sizes[1] = maxFrameSize / 8;
+    counts[1] = inputCount * 2;
+    sizes[2] = maxFrameSize / 2;
+    counts[2] = inputCount;
+    sizes[3] = maxFrameSize;
+    counts[3] = (inputCount + 1) / 2;
+
+    *pCount = 0;
+    for (i = 0; i < ARRAY_SIZE(sizes); i++) {
+        sizes[i] = MAX(sizes[i], MIN(FRAME_POOL_MIN_BUFFER_SIZE, maxFrameSize));
+        if (*pCount != 0 && sizes[i] <= pClasses[*pCount - 1].size) {
+            // tiny frame limits collapse the small classes
+            pClasses[*pCount - 1].count += counts[i];
+            continue;
+        }
+
+        pClasses[*pCount].size = sizes[i];
+        pClasses[*pCount].count = counts[i];
+        (*pCount)++;
+    }
+}
+
+STATUS createFramePool(PFramePoolClassConfig pConfigs, UINT32 classCount, PFramePool* ppPool)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    PFramePool pPool = NULL;
+    PFramePoolClass pClass;
+    UINT64 slabSize = 0;
+    UINT32 bufferCount = 0, i, j;
+
+    CHK(pConfigs != NULL && ppPool != NULL, STATUS_NULL_ARG);
+    CHK(classCount != 0 && classCount <= FRAME_POOL_MAX_CLASS_COUNT, STATUS_INVALID_ARG);
+
+    for (i = 0; i < classCount; i++) {
+        CHK(pConfigs[i].size != 0 && pConfigs[i].count != 0, STATUS_INVALID_ARG);
+        CHK(i == 0 || pConfigs[i].size > pConfigs[i - 1].size, STATUS_INVALID_ARG);
+        slabSize += (UINT64) ROUND_UP(pConfigs[i].size, FRAME_POOL_BUFFER_ALIGNMENT) * pConfigs[i].count;
+        bufferCount += pConfigs[i].count;
+    }
+
+    CHK(NULL != (pPool = (PFramePool) MEMCALLOC(1, SIZEOF(FramePool))), STATUS_NOT_ENOUGH_MEMORY);
+    pPool->lock = MUTEX_CREATE(FALSE);
+    pPool->freeCvar = CVAR_CREATE();
+    CHK(IS_VALID_MUTEX_VALUE(pPool->lock) && IS_VALID_CVAR_VALUE(pPool->freeCvar), STATUS_NOT_ENOUGH_MEMORY);
+
+    // the only two allocations the pool ever makes
+    CHK(NULL != (pPool->pSlab = (PBYTE) MEMALLOC((SIZE_T) slabSize)), STATUS_NOT_ENOUGH_MEMORY);
+    CHK(NULL != (pPool->ppFreeStacks = (PBYTE*) MEMALLOC(bufferCount * SIZEOF(PBYTE))), STATUS_NOT_ENOUGH_MEMORY);
+    pPool->stats.heapAllocations = 2;
+    pPool->stats.slabSize = slabSize;
+
+    pPool->classCount = classCount;
+    slabSize = 0;
+    bufferCount = 0;
+    for (i = 0; i < classCount; i++) {
+        pClass = &pPool->classes[i];
+        pClass->size = pConfigs[i].size;
+        pClass->count = pConfigs[i].count;
+        pClass->pBase = pPool->pSlab + slabSize;
+        pClass->ppFree = pPool->ppFreeStacks + bufferCount;
+        for (j = 0; j < pClass->count; j++) {
+            pClass->ppFree[j] = pClass->pBase + (UINT64) j * ROUND_UP(pClass->size, FRAME_POOL_BUFFER_ALIGNMENT);
+        }
+        pClass->freeCount = pClass->count;
+
+        slabSize += (UINT64) ROUND_UP(pClass->size, FRAME_POOL_BUFFER_ALIGNMENT) * pClass->count;
+        bufferCount += pClass->count;
+    }
+
+CleanUp:
+
+    if (STATUS_FAILED(retStatus)) {
+        freeFramePool(&pPool);
+    }
+
+    if (ppPool != NULL) {
+        *ppPool = pPool;
+    }
+
+    return retStatus;
+}
+
+STATUS freeFramePool(PFramePool* ppPool)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    PFramePool pPool;
+
+    CHK(ppPool != NULL, STATUS_NULL_ARG);
+
+    pPool = *ppPool;
+    CHK(pPool != NULL, retStatus);
+
+    if (pPool->stats.inUse != 0) {
+        DLOGW("Freeing the frame pool with %u buffers in use", pPool->stats.inUse);
+    }
+
+    if (IS_VALID_CVAR_VALUE(pPool->freeCvar)) {
+        CVAR_FREE(pPool->freeCvar);
+    }
+
+    if (IS_VALID_MUTEX_VALUE(pPool->lock)) {
+        MUTEX_FREE(pPool->lock);
+    }
+
+    SAFE_MEMFREE(pPool->pSlab);
+    SAFE_MEMFREE(pPool->ppFreeStacks);
+    MEMFREE(pPool);
+    *ppPool = NULL;
+
+CleanUp:
+
+    return retStatus;
+}
+
+UINT32 framePoolGetMaxSize(PFramePool pPool)
+{
+    return pPool->classes[pPool->classCount - 1].size;
+}
+
+/**
+ * Pops a buffer of the smallest class fitting the size which has one free, the lock is held
+ */
+STATIC PBYTE framePoolTake(PFramePool pPool, UINT32 size, PUINT32 pCapacity)
+{
+    PFramePoolClass pClass;
+    BOOL fits = FALSE;
+    PBYTE pBuffer;
+    UINT32 i;
+
+    for (i = 0; i < pPool->classCount; i++) {
+        pClass = &pPool->classes[i];
+        if (pClass->size < size) {
+            continue;
+        } else if (pClass->freeCount == 0) {
+            fits = TRUE;
+            continue;
+        }
+
+        if (fits) {
+            pPool->stats.fallbacks++;
+        }
+
+        pBuffer = pClass->ppFree[--pClass->freeCount];
+        pClass->gets++;
+        pClass->highWater = MAX(pClass->highWater, pClass->count - pClass->freeCount);
+        pPool->stats.gets++;
+        pPool->stats.inUse++;
+        pPool->stats.inUseBytes += pClass->size;
+        pPool->stats.inUseHighWater = MAX(pPool->stats.inUseHighWater, pPool->stats.inUse);
+        pPool->stats.inUseBytesHighWater = MAX(pPool->stats.inUseBytesHighWater, pPool->stats.inUseBytes);
+        *pCapacity = pClass->size;
+
+        return pBuffer;
+    }
+
+    return NULL;
+}
+
+STATIC PFramePoolClass framePoolFindClass(PFramePool pPool, PBYTE pBuffer)
+{
+    PFramePoolClass pClass;
+    UINT32 i;
+
+    for (i = 0; i < pPool->classCount; i++) {
+        pClass = &pPool->classes[i];
+        if (pBuffer >= pClass->pBase && pBuffer < pClass->pBase + (UINT64) pClass->count * ROUND_UP(pClass->size, FRAME_POOL_BUFFER_ALIGNMENT)) {
+            return pClass;
+        }
+    }
+
+    return NULL;
+}
+
+STATUS framePoolGet(PFramePool pPool, UINT32 size, UINT64 timeout, PBYTE* ppBuffer, PUINT32 pCapacity)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    BOOL locked = FALSE, waited = FALSE;
+    UINT64 deadline = GETTIME() + timeout, now;
+
+    CHK(pPool != NULL && ppBuffer != NULL && pCapacity != NULL, STATUS_NULL_ARG);
+    CHK(size <= framePoolGetMaxSize(pPool), STATUS_INVALID_ARG);
+
+    MUTEX_LOCK(pPool->lock);
+    locked = TRUE;
+
+    while (NULL == (*ppBuffer = framePoolTake(pPool, size, pCapacity))) {
+        now = GETTIME();
+        CHK(now < deadline, STATUS_OPERATION_TIMED_OUT);
+        if (!waited) {
+            pPool->stats.waits++;
+            waited = TRUE;
+        }
+
+        CVAR_WAIT(pPool->freeCvar, pPool->lock, deadline - now);
+    }
+
+CleanUp:
+
+    if (locked) {
+        MUTEX_UNLOCK(pPool->lock);
+    }
+
+    return retStatus;
+}
+
+STATUS framePoolGrow(PFramePool pPool, UINT32 usedSize, UINT64 timeout, PBYTE* ppBuffer, PUINT32 pCapacity)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    PBYTE pBuffer;
+    UINT32 capacity;
+
+    CHK(pPool != NULL && ppBuffer != NULL && *ppBuffer != NULL && pCapacity != NULL, STATUS_NULL_ARG);
+
+    CHK_STATUS(framePoolGet(pPool, *pCapacity + 1, timeout, &pBuffer, &capacity));
+    MEMCPY(pBuffer, *ppBuffer, usedSize);
+    CHK_STATUS(framePoolPut(pPool, *ppBuffer));
+
+    MUTEX_LOCK(pPool->lock);
+    pPool->stats.grows++;
+    pPool->stats.grownBytes += usedSize;
+    MUTEX_UNLOCK(pPool->lock);
+
+    *ppBuffer = pBuffer;
+    *pCapacity = capacity;
+
+CleanUp:
+
+    return retStatus;
+}
+
+STATUS framePoolPut(PFramePool pPool, PBYTE pBuffer)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    PFramePoolClass pClass;
+    BOOL locked = FALSE;
+
+    CHK(pPool != NULL && pBuffer != NULL, STATUS_NULL_ARG);
+    CHK(NULL != (pClass = framePoolFindClass(pPool, pBuffer)), STATUS_INVALID_ARG);
+
+    MUTEX_LOCK(pPool->lock);
+    locked = TRUE;
+
+    CHK(pClass->freeCount < pClass->count, STATUS_INVALID_OPERATION);
+    pClass->ppFree[pClass->freeCount++] = pBuffer;
+    pPool->stats.puts++;
+    pPool->stats.inUse--;
+    pPool->stats.inUseBytes -= pClass->size;
+    CVAR_BROADCAST(pPool->freeCvar);
+
+CleanUp:
+
+    if (locked) {
+        MUTEX_UNLOCK(pPool->lock);
+    }
+
+    return retStatus;
+}
+
+VOID framePoolGetStats(PFramePool pPool, PFramePoolStats pStats)
+{
+    MUTEX_LOCK(pPool->lock);
+    *pStats = pPool->stats;
+    MUTEX_UNLOCK(pPool->lock);
+}
+
+VOID framePoolGetClasses(PFramePool pPool, PFramePoolClass pClasses, PUINT32 pCount)
+{
+    MUTEX_LOCK(pPool->lock);
+    MEMCPY(pClasses, pPool->classes, pPool->classCount * SIZEOF(FramePoolClass));
+    *pCount = pPool->classCount;
+    MUTEX_UNLOCK(pPool->lock);
+}
+
+VOID framePoolPrintStats(PFramePool pPool)
+{
+    FramePoolClass classes[FRAME_POOL_MAX_CLASS_COUNT];
+    FramePoolStats stats;
+    UINT32 count, i;
+
+    framePoolGetStats(pPool, &stats);
+    framePoolGetClasses(pPool, classes, &count);
+
+    printf("Frame pool: %" PRIu64 " KB slab, %" PRIu64 " heap allocations, %" PRIu64 " gets, %" PRIu64 " fallbacks, %" PRIu64
+           " grows copying %" PRIu64 " KB, %" PRIu64 " waits\n",
+           stats.slabSize / 1024, stats.heapAllocations, stats.gets, stats.fallbacks, stats.grows, stats.grownBytes / 1024, stats.waits);
+    printf("Frame pool: at most %u buffers and %" PRIu64 " KB in use\n", stats.inUseHighWater, stats.inUseBytesHighWater / 1024);
+    for (i = 0; i < count; i++) {
+        printf("Frame pool: %6u KB x %-4u high-water %-4u gets %" PRIu64 "\n", classes[i].size / 1024, classes[i].count, classes[i].highWater,
+               classes[i].gets);
+    }
+}
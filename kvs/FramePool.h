@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) 2020 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __KVS_FRAME_POOL_H__
+#define __KVS_FRAME_POOL_H__
+
+#include "KvsApp.h"
+
+#define FRAME_POOL_MAX_CLASS_COUNT          8
+#define FRAME_POOL_MIN_BUFFER_SIZE          (4 * 1024)
+#define FRAME_POOL_BUFFER_ALIGNMENT         64
+
+typedef struct {
+    UINT32 size;
+    UINT32 count;
+} FramePoolClassConfig, *PFramePoolClassConfig;
+
+typedef struct {
+    UINT32 size;
+    UINT32 count;
+    PBYTE pBase;
+    // stack of free buffers, guarded by the pool lock
+    PBYTE* ppFree;
+    UINT32 freeCount;
+    UINT32 highWater;
+    UINT64 gets;
+} FramePoolClass, *PFramePoolClass;
+
+typedef struct {
+    // heap allocations made by the pool, all of them at creation
+    UINT64 heapAllocations;
+    UINT64 slabSize;
+    UINT64 gets;
+    UINT64 puts;
+    // requests served from a larger class because the fitting ones were all in use
+    UINT64 fallbacks;
+    // buffers outgrown by the frame they held and the bytes copied moving to a larger one
+    UINT64 grows;
+    UINT64 grownBytes;
+    // requests which had to wait for a buffer to come back
+    UINT64 waits;
+    // buffers of all classes in use at the worst moment, and their bytes
+    UINT32 inUse;
+    UINT32 inUseHighWater;
+    UINT64 inUseBytes;
+    UINT64 inUseBytesHighWater;
+} FramePoolStats, *PFramePoolStats;
+
+/**
+ * Fixed frame buffers in a few size classes carved out of one slab at startup.
+ *
+ * Inputs fill buffers taken from the pool in place and hand them to putKinesisVideoFrame, they go back to the pool
+ * right after the put returns. A frame outgrowing its buffer moves to the next class up. Nothing is allocated once
+ * the pool is created, an exhausted pool makes the input wait instead.
+ */
+typedef struct {
+    MUTEX lock;
+    CVAR freeCvar;
+    UINT32 classCount;
+    FramePoolClass classes[FRAME_POOL_MAX_CLASS_COUNT];
+    PBYTE pSlab;
+    PBYTE* ppFreeStacks;
+    FramePoolStats stats;
+} FramePool, *PFramePool;
+
+/**
+ * Parses '<KB>x<count>[,<KB>x<count>...]', sizes ascending
+ */
+STATUS framePoolParseConfig(PCHAR, PFramePoolClassConfig, PUINT32);
+
+/**
+ * Classes for the given number of live inputs: every input can hold its ring of small units, a couple of mid-sized
+ * ones and one key frame up to half the largest frame, while the largest frames share one buffer per two inputs
+ */
+VOID framePoolDefaultConfig(UINT32, UINT32, PFramePoolClassConfig, PUINT32);
+
+STATUS createFramePool(PFramePoolClassConfig, UINT32, PFramePool*);
+STATUS freeFramePool(PFramePool*);
+
+UINT32 framePoolGetMaxSize(PFramePool);
+
+/**
+ * Takes the smallest free buffer holding at least size bytes. Waits up to the timeout (100ns) for one to be put back
+ * and returns STATUS_OPERATION_TIMED_OUT when none was.
+ */
+STATUS framePoolGet(PFramePool, UINT32, UINT64, PBYTE*, PUINT32);
+
+/**
+ * Moves the first used bytes of the buffer into a free buffer of a larger class and puts the old one back
+ */
+STATUS framePoolGrow(PFramePool, UINT32, UINT64, PBYTE*, PUINT32);
+
+STATUS framePoolPut(PFramePool, PBYTE);
+
+VOID framePoolGetStats(PFramePool, PFramePoolStats);
+
+/**
+ * Copies the classes with their high-water marks under the lock
+ */
+VOID framePoolGetClasses(PFramePool, PFramePoolClass, PUINT32);
+
+VOID framePoolPrintStats(PFramePool);
+
+#endif /* __KVS_FRAME_POOL_H__ */
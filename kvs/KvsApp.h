@@ -0,0 +1,49 @@
+/*
+ * Copyright (C) 2020 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __KVS_APP_INCLUDE__
+#define __KVS_APP_INCLUDE__
+
+#include <com/amazonaws/kinesis/video/cproducer/Include.h>
+
+/**
+ * Status codes returned by the application modules. Kept well away from the
+ * ranges used by the SDK so they are easy to tell apart in the logs.
+ */
+#define STATUS_KVS_APP_BASE                         0x70000000
+#define STATUS_FRAME_ARCHIVE_INVALID_FORMAT         STATUS_KVS_APP_BASE + 0x00000001
+#define STATUS_FRAME_ARCHIVE_UNSUPPORTED_VERSION    STATUS_KVS_APP_BASE + 0x00000002
+#define STATUS_FRAME_ARCHIVE_TRACK_NOT_FOUND        STATUS_KVS_APP_BASE + 0x00000003
+#define STATUS_FRAME_ARCHIVE_MAP_FAILED             STATUS_KVS_APP_BASE + 0x00000004
+#define STATUS_ANNEXB_END_OF_STREAM                 STATUS_KVS_APP_BASE + 0x00000005
+#define STATUS_SCHEDULER_FRAME_PENDING              STATUS_KVS_APP_BASE + 0x00000006
+#define STATUS_SCHEDULER_TRACK_FINISHED             STATUS_KVS_APP_BASE + 0x00000008
+#define STATUS_SIZING_RAM_CEILING_TOO_LOW           STATUS_KVS_APP_BASE + 0x00000009
+#define STATUS_SPOOL_FULL                           STATUS_KVS_APP_BASE + 0x0000000a
+#define STATUS_SPOOL_EMPTY                          STATUS_KVS_APP_BASE + 0x0000000b
+#define STATUS_FRAME_ARCHIVE_UNSUPPORTED_CODEC      STATUS_KVS_APP_BASE + 0x0000000c
+#define STATUS_PLACEMENT_FAILED                     STATUS_KVS_APP_BASE + 0x0000000d
+#define STATUS_CONNECTION_STALE                     STATUS_KVS_APP_BASE + 0x0000000e
+#define STATUS_SIM_INVARIANT_VIOLATED               STATUS_KVS_APP_BASE + 0x0000000f
+#define STATUS_ANNEXB_MISSING_PARAMETER_SETS        STATUS_KVS_APP_BASE + 0x00000010
+
+#endif /* __KVS_APP_INCLUDE__ */
@@ -0,0 +1,1331 @@
+/*
+ * Copyright (C) 2020 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// pipe2 and F_SETPIPE_SZ
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "Channel.h"
+#include "EncoderControl.h"
+#include "FrameArchive.h"
+#include "Metrics.h"
+#include "MockEndpoint.h"
+#include "Pacer.h"
+
+#define DEFAULT_BENCH_KVS_PATH              "./kvs"
+#define DEFAULT_BENCH_DURATION              30
+#define DEFAULT_BENCH_FPS                   25
+#define DEFAULT_BENCH_BITRATES              "2000"
+#define DEFAULT_BENCH_CHANNELS              "1"
+#define DEFAULT_BENCH_SIZES                 "2048"
+#define DEFAULT_BENCH_ACK_LATENCIES         "100"
+#define DEFAULT_BENCH_LOG_MODES             "async"
+#define DEFAULT_BENCH_PLACEMENTS            "default"
+#define DEFAULT_BENCH_BITRATE_CONTROLS      "off"
+// lowest bitrate kvs may ask of the generated streams, percent of the run bitrate
+#define BENCH_MIN_BITRATE_PERCENT           10
+#define BENCH_MAX_RUN_VALUES                16
+#define BENCH_WARMUP_DURATION               (2 * HUNDREDS_OF_NANOS_IN_A_SECOND)
+#define BENCH_SCRAPE_INTERVAL               HUNDREDS_OF_NANOS_IN_A_SECOND
+// how soon the exit of kvs is noticed, a backfill is timed by it
+#define BENCH_EXIT_POLL_INTERVAL            (10 * HUNDREDS_OF_NANOS_IN_A_MILLISECOND)
+#define BENCH_SCRAPE_BUFFER_SIZE            (512 * 1024)
+#define BENCH_FRAME_OVERHEAD                64
+#define BENCH_FRAME_FILLER                  0xAA
+#define BENCH_VIDEO_WIDTH_MBS               40
+#define BENCH_VIDEO_HEIGHT_MBS              30
+// AAC frames of the recordings backfilled, never decoded
+#define BENCH_AUDIO_FRAME_DURATION          (20 * HUNDREDS_OF_NANOS_IN_A_MILLISECOND)
+#define BENCH_AUDIO_FRAME_SIZE              32
+#define BENCH_MAX_KVS_ARGS                  48
+// a tty buffers a few KB before the writer blocks, a pipe 64 KB
+#define BENCH_CONSOLE_PIPE_SIZE             4096
+#define BENCH_CONSOLE_CHUNK_SIZE            256
+
+typedef struct {
+    PCHAR kvsPath;
+    UINT64 duration;
+    UINT64 fps;
+    MockEndpointConfig mockConfig;
+    BOOL mockOnly;
+    FILE* pOutput;
+    PCHAR logLevel;
+    // bytes per second kvs can write to its console, 0 for no limit
+    UINT64 consoleRate;
+    // link to the mock cut this long after kvs started, for this long, 100ns
+    UINT64 outageStart;
+    UINT64 outageDuration;
+    // MB of spool per channel, 0 for none
+    UINT64 spoolSize;
+    // handed to kvs, the sources then take key frame requests like an encoder. NULL for a key frame every second.
+    PCHAR fragmentDuration;
+    // kvs uploads a recording of the duration as fast as it can instead of streaming live
+    BOOL backfill;
+} BenchConfig, *PBenchConfig;
+
+typedef struct {
+    UINT32 channelCount;
+    // kbps per channel
+    UINT64 bitrate;
+    // KB per channel
+    UINT64 bufferSize;
+    PCHAR logMode;
+    // ms the mock delays the received and persisted acks by
+    UINT64 ackLatency;
+    // which of the kvs thread placement and memory locking settings are on
+    PCHAR placement;
+    // put latency p99 in ms of the first placement of the same configuration, 0 when this run is the first
+    DOUBLE baselinePutLatencyP99;
+    // set by the run
+    DOUBLE putLatencyP99;
+    // 'on' when kvs asks the generated streams for the bitrate the link takes
+    PCHAR bitrateControl;
+} BenchRun, *PBenchRun;
+
+/**
+ * Writes a synthetic Annex-B stream into the live input FIFO of one channel, or a recording into its archive with --backfill
+ */
+typedef struct {
+    PBenchConfig pConfig;
+    PBenchRun pRun;
+    CHAR path[MAX_PATH_LEN + 1];
+    // encoder control socket kvs sends key frame requests to, -1 without
+    CHAR controlPath[MAX_PATH_LEN + 1];
+    INT32 controlFd;
+    volatile ATOMIC_BOOL* pStop;
+    volatile SIZE_T framesWritten;
+    TID tid;
+} BenchSource, *PBenchSource;
+
+typedef struct {
+    UINT64 time;
+    UINT64 videoFrames;
+    UINT64 droppedFrames;
+    UINT64 errors;
+    // put latency histogram of all channels and tracks, bounds in seconds with their cumulative counts
+    DOUBLE putLatencyBounds[METRICS_HISTOGRAM_MAX_BOUNDS + 1];
+    UINT64 putLatencyCounts[METRICS_HISTOGRAM_MAX_BOUNDS + 1];
+    UINT32 putLatencyBoundCount;
+    DOUBLE putLatencyMax;
+    // seconds from the kvs start to the first put and the first ack of the slowest channel
+    DOUBLE firstPutTime;
+    DOUBLE firstAckTime;
+    UINT64 spooledFrames;
+    UINT64 replayedFrames;
+    // summed over the channels
+    DOUBLE fragmentDuration;
+    DOUBLE fragmentOverhead;
+    // summed over the channels, kbps
+    UINT64 encoderBitrate;
+    UINT64 keyFrameRequests;
+    // resident size of kvs when scraped and the most bytes it had allocated through the SDK hooks
+    UINT64 rssKB;
+    UINT64 memoryHighWater;
+    // summed over the channels, recovery times in seconds
+    UINT64 recoveries;
+    DOUBLE recoveryTime;
+    DOUBLE recoveryMax;
+    UINT64 recoveryFramesLost;
+} BenchScrape, *PBenchScrape;
+
+/**
+ * Drains the console output of kvs no faster than a serial line would, kvs blocks on its writes once the pipe is full
+ */
+typedef struct {
+    INT32 fd;
+    UINT64 rate;
+    volatile SIZE_T bytes;
+    TID tid;
+} BenchConsole, *PBenchConsole;
+
+typedef struct {
+    PBYTE pData;
+    UINT32 capacity;
+    UINT32 bitOffset;
+} BenchBitWriter, *PBenchBitWriter;
+
+static struct option long_options[] = {
+    /*   NAME           ARGUMENT            FLAG    SHORTNAME */
+    {"kvs",             required_argument,  NULL,   'k'},
+    {"duration",        required_argument,  NULL,   'D'},
+    {"fps",             required_argument,  NULL,   'f'},
+    {"bitrates",        required_argument,  NULL,   'b'},
+    {"channels",        required_argument,  NULL,   'c'},
+    {"sizes",           required_argument,  NULL,   's'},
+    {"ack-latency",     required_argument,  NULL,   'L'},
+    {"bandwidth",       required_argument,  NULL,   'B'},
+    {"loss",            required_argument,  NULL,   'x'},
+    {"faults",          required_argument,  NULL,   'e'},
+    {"port",            required_argument,  NULL,   'p'},
+    {"mock-only",       no_argument,        NULL,   'm'},
+    {"output",          required_argument,  NULL,   'o'},
+    {"log-modes",       required_argument,  NULL,   'l'},
+    {"log-level",       required_argument,  NULL,   'v'},
+    {"console-rate",    required_argument,  NULL,   'C'},
+    {"outage",          required_argument,  NULL,   'O'},
+    {"spool-size",      required_argument,  NULL,   'S'},
+    {"fragment-duration", required_argument, NULL,  'F'},
+    {"backfill",        no_argument,        NULL,   'R'},
+    {"placements",      required_argument,  NULL,   'P'},
+    {"bitrate-controls", required_argument, NULL,   'A'},
+    {"help",            no_argument,        NULL,   'h'},
+    {NULL,              0,                  NULL,   0}
+};
+
+void displayUsage( int err )
+{
+    printf ("Benchmark kvs end to end against a local mock Kinesis Video Streams endpoint.\n");
+    printf ("Every combination of bitrate, channel count, buffer size and ack latency is one run, printed as one JSON line.\n");
+    printf ("Usage: \n");
+    printf ("kvsbench [options...]\n");
+    printf ("\n");
+    printf ("-k, --kvs              kvs binary\n");
+    printf ("                       default to '%s'\n", DEFAULT_BENCH_KVS_PATH);
+    printf ("-D, --duration         duration of each run in second\n");
+    printf ("                       default to %d\n", DEFAULT_BENCH_DURATION);
+    printf ("-f, --fps              video frame rate of the generated streams\n");
+    printf ("                       default to %d\n", DEFAULT_BENCH_FPS);
+    printf ("-b, --bitrates         comma separated video bitrates per channel in kbps\n");
+    printf ("                       default to %s\n", DEFAULT_BENCH_BITRATES);
+    printf ("-c, --channels         comma separated channel counts\n");
+    printf ("                       default to %s\n", DEFAULT_BENCH_CHANNELS);
+    printf ("-s, --sizes            comma separated stream buffer sizes in KB per channel\n");
+    printf ("                       default to %s\n", DEFAULT_BENCH_SIZES);
+    printf ("-L, --ack-latency      comma separated delays of the received and persisted acks in milliseconds\n");
+    printf ("                       default to %s\n", DEFAULT_BENCH_ACK_LATENCIES);
+    printf ("-B, --bandwidth        mock upload cap per stream in kbps\n");
+    printf ("                       default to 0, no cap\n");
+    printf ("-x, --loss             percent of fragments never acked as received and persisted\n");
+    printf ("                       default to 0\n");
+    printf ("-e, --faults           percent of fragments failing their upload session with an error ack or a connection\n");
+    printf ("                       reset, reports how long kvs takes to recover, default to 0\n");
+    printf ("-p, --port             mock endpoint port\n");
+    printf ("                       default to 0, any free port\n");
+    printf ("-m, --mock-only        only serve the mock endpoint for the duration, for a kvs started by hand\n");
+    printf ("-o, --output           append the results to a file instead of stdout\n");
+    printf ("-l, --log-modes        comma separated kvs log modes, 'async' and 'sync'\n");
+    printf ("                       default to %s\n", DEFAULT_BENCH_LOG_MODES);
+    printf ("-v, --log-level        kvs log level\n");
+    printf ("                       default to the kvs default\n");
+    printf ("-C, --console-rate     bytes per second the kvs console output drains at, e.g. 11520 for a 115200 baud serial console\n");
+    printf ("                       default to 0, no limit. The output goes to stderr\n");
+    printf ("-O, --outage           '<start>,<duration>' in seconds, cuts the link to the mock during every run\n");
+    printf ("-S, --spool-size       spool size in MB per channel, kvs spools to the run directory\n");
+    printf ("                       default to 0, no spool\n");
+    printf ("-F, --fragment-duration\n");
+    printf ("                       kvs fragment duration in ms or 'auto', the generated streams follow its key frame requests\n");
+    printf ("                       default to a key frame every second\n");
+    printf ("-R, --backfill         record --duration seconds per channel into an archive and have kvs backfill it as fast\n");
+    printf ("                       as the mock takes it, reports the speed relative to real time\n");
+    printf ("-P, --placements       comma separated kvs placements run back to back, each compared to the first: 'default',\n");
+    printf ("                       'affinity' for the put threads on the last CPU and the others on the rest, 'realtime' for\n");
+    printf ("                       SCHED_FIFO put threads, 'locked' for locked memory and 'all' for the three\n");
+    printf ("                       default to %s\n", DEFAULT_BENCH_PLACEMENTS);
+    printf ("-A, --bitrate-controls comma separated 'off' and 'on' run back to back, 'on' has kvs ask the generated streams\n");
+    printf ("                       for the bitrate the link takes, down to %d%% of the run bitrate\n", BENCH_MIN_BITRATE_PERCENT);
+    printf ("                       default to %s\n", DEFAULT_BENCH_BITRATE_CONTROLS);
+    exit (err);
+}
+
+STATUS parseValueList(PCHAR list, PUINT64 pValues, PUINT32 pCount, BOOL allowZero)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    PCHAR pCur = list, pEnd;
+
+    *pCount = 0;
+    while (pCur != NULL) {
+        CHK(*pCount < BENCH_MAX_RUN_VALUES, STATUS_INVALID_ARG);
+        pEnd = STRCHR(pCur, ',');
+        CHK_STATUS(STRTOUI64(pCur, pEnd, 10, &pValues[*pCount]));
+        CHK(allowZero || pValues[*pCount] != 0, STATUS_INVALID_ARG);
+        (*pCount)++;
+        pCur = pEnd == NULL ? NULL : pEnd + 1;
+    }
+
+    CHK(*pCount != 0, STATUS_INVALID_ARG);
+
+CleanUp:
+
+    return retStatus;
+}
+
+/**
+ * Splits a comma separated list in place, every name has to be one of the NULL terminated valid names
+ */
+STATUS parseNameList(PCHAR list, PCHAR* pValidNames, PCHAR* pNames, PUINT32 pCount)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    PCHAR pCur = list, pEnd;
+    UINT32 i;
+
+    *pCount = 0;
+    while (pCur != NULL) {
+        CHK(*pCount < BENCH_MAX_RUN_VALUES, STATUS_INVALID_ARG);
+        if ((pEnd = STRCHR(pCur, ',')) != NULL) {
+            *pEnd++ = '\0';
+        }
+        for (i = 0; pValidNames[i] != NULL && STRCMP(pCur, pValidNames[i]) != 0; i++);
+        CHK(pValidNames[i] != NULL, STATUS_INVALID_ARG);
+        pNames[(*pCount)++] = pCur;
+        pCur = pEnd;
+    }
+
+CleanUp:
+
+    return retStatus;
+}
+
+VOID benchPutBits(PBenchBitWriter pWriter, UINT32 value, UINT32 bits)
+{
+    while (bits-- > 0) {
+        if ((value >> bits) & 1) {
+            pWriter->pData[pWriter->bitOffset / 8] |= (BYTE) (0x80 >> (pWriter->bitOffset % 8));
+        }
+        pWriter->bitOffset++;
+    }
+}
+
+VOID benchPutUe(PBenchBitWriter pWriter, UINT32 value)
+{
+    UINT32 bits = 32 - __builtin_clz(value + 1);
+
+    // exp-Golomb, bits - 1 leading zeros then value + 1
+    benchPutBits(pWriter, 0, bits - 1);
+    benchPutBits(pWriter, value + 1, bits);
+}
+
+/**
+ * Wraps an RBSP into a NAL unit with a four byte start code and emulation prevention, returns its size
+ */
+UINT32 benchWriteNal(PBYTE pOut, BYTE nalHeader, PBenchBitWriter pWriter)
+{
+    UINT32 size = 0, zeros = 0, i, rbspSize;
+
+    // rbsp_trailing_bits
+    benchPutBits(pWriter, 1, 1);
+    rbspSize = (pWriter->bitOffset + 7) / 8;
+
+    pOut[size++] = 0x00;
+    pOut[size++] = 0x00;
+    pOut[size++] = 0x00;
+    pOut[size++] = 0x01;
+    pOut[size++] = nalHeader;
+    for (i = 0; i < rbspSize; i++) {
+        if (zeros == 2 && pWriter->pData[i] <= 0x03) {
+            pOut[size++] = 0x03;
+            zeros = 0;
+        }
+
+        zeros = pWriter->pData[i] == 0x00 ? zeros + 1 : 0;
+        pOut[size++] = pWriter->pData[i];
+    }
+
+    return size;
+}
+
+/**
+ * Baseline 640x480 SPS and PPS, enough for the SDK to extract the codec private data
+ */
+UINT32 benchWriteParameterSets(PBYTE pOut)
+{
+    BYTE rbsp[32];
+    BenchBitWriter writer;
+    UINT32 size;
+
+    MEMSET(rbsp, 0x00, SIZEOF(rbsp));
+    writer.pData = rbsp;
+    writer.capacity = SIZEOF(rbsp);
+    writer.bitOffset = 0;
+    // profile_idc baseline, constraint_set0/1, level 3.0
+    benchPutBits(&writer, 66, 8);
+    benchPutBits(&writer, 0xC0, 8);
+    benchPutBits(&writer, 30, 8);
+    // seq_parameter_set_id, log2_max_frame_num_minus4, pic_order_cnt_type, max_num_ref_frames
+    benchPutUe(&writer, 0);
+    benchPutUe(&writer, 0);
+    benchPutUe(&writer, 2);
+    benchPutUe(&writer, 1);
+    // gaps_in_frame_num_value_allowed_flag
+    benchPutBits(&writer, 0, 1);
+    benchPutUe(&writer, BENCH_VIDEO_WIDTH_MBS - 1);
+    benchPutUe(&writer, BENCH_VIDEO_HEIGHT_MBS - 1);
+    // frame_mbs_only_flag, direct_8x8_inference_flag, frame_cropping_flag, vui_parameters_present_flag
+    benchPutBits(&writer, 0x0C, 4);
+    size = benchWriteNal(pOut, 0x67, &writer);
+
+    MEMSET(rbsp, 0x00, SIZEOF(rbsp));
+    writer.bitOffset = 0;
+    // pic_parameter_set_id, seq_parameter_set_id
+    benchPutUe(&writer, 0);
+    benchPutUe(&writer, 0);
+    // entropy_coding_mode_flag, bottom_field_pic_order_in_frame_present_flag
+    benchPutBits(&writer, 0, 2);
+    // num_slice_groups_minus1, num_ref_idx_l0/l1_default_active_minus1
+    benchPutUe(&writer, 0);
+    benchPutUe(&writer, 0);
+    benchPutUe(&writer, 0);
+    // weighted_pred_flag, weighted_bipred_idc
+    benchPutBits(&writer, 0, 3);
+    // pic_init_qp_minus26, pic_init_qs_minus26, chroma_qp_index_offset as se(0)
+    benchPutUe(&writer, 0);
+    benchPutUe(&writer, 0);
+    benchPutUe(&writer, 0);
+    // deblocking_filter_control_present_flag, constrained_intra_pred_flag, redundant_pic_cnt_present_flag
+    benchPutBits(&writer, 0x04, 3);
+    size += benchWriteNal(pOut + size, 0x68, &writer);
+
+    return size;
+}
+
+/**
+ * AUD, parameter sets on key frames, then one slice padded with filler to the frame size. A stamped slice carries the
+ * time it was built at for the mock to measure the latency. Returns the size.
+ */
+UINT32 benchBuildFrame(PBYTE pFrame, UINT32 frameSize, PBYTE pParameterSets, UINT32 parameterSetSize, BOOL keyFrame, BOOL stamped)
+{
+    UINT32 size = 0;
+
+    pFrame[size++] = 0x00;
+    pFrame[size++] = 0x00;
+    pFrame[size++] = 0x00;
+    pFrame[size++] = 0x01;
+    pFrame[size++] = 0x09;
+    pFrame[size++] = 0xF0;
+    if (keyFrame) {
+        MEMCPY(pFrame + size, pParameterSets, parameterSetSize);
+        size += parameterSetSize;
+    }
+
+    pFrame[size++] = 0x00;
+    pFrame[size++] = 0x00;
+    pFrame[size++] = 0x00;
+    pFrame[size++] = 0x01;
+    pFrame[size++] = keyFrame ? 0x65 : 0x41;
+    // first_mb_in_slice 0, starts a new picture
+    pFrame[size++] = 0x88;
+    if (stamped) {
+        size += SNPRINTF((PCHAR) pFrame + size, MOCK_ENDPOINT_TIMESTAMP_LEN + 1, "%s%016" PRIx64, MOCK_ENDPOINT_TIMESTAMP_MARKER, pacerGetTime());
+    }
+    if (size < frameSize) {
+        MEMSET(pFrame + size, BENCH_FRAME_FILLER, frameSize - size);
+        size = frameSize;
+    }
+
+    return size;
+}
+
+/**
+ * Records the duration of the run into the archive of a channel, a key frame every second and the audio interleaved
+ * by timestamp the way kvspack does. The count gets the video frames written.
+ */
+STATUS benchWriteArchive(PBenchSource pSource, PUINT64 pFrameCount)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    UINT64 fps = pSource->pConfig->fps, frameDuration = HUNDREDS_OF_NANOS_IN_A_SECOND / fps, padding = 0;
+    UINT64 end = pSource->pConfig->duration * HUNDREDS_OF_NANOS_IN_A_SECOND, videoTs = 0, audioTs = 0, videoFrames = 0;
+    UINT32 frameSize = (UINT32) MAX(pSource->pRun->bitrate * 1000 / 8 / fps, BENCH_FRAME_OVERHEAD), parameterSetSize, frameCount, i;
+    BYTE parameterSets[128], audioFrame[BENCH_AUDIO_FRAME_SIZE];
+    PFrameArchiveIndexEntry pIndex = NULL, pEntry;
+    FrameArchiveHeader header;
+    PBYTE pFrame = NULL;
+    FILE* pFile = NULL;
+    BOOL video;
+
+    frameCount = (UINT32) ((end + frameDuration - 1) / frameDuration + (end + BENCH_AUDIO_FRAME_DURATION - 1) / BENCH_AUDIO_FRAME_DURATION);
+    CHK(NULL != (pIndex = (PFrameArchiveIndexEntry) MEMCALLOC(frameCount, SIZEOF(FrameArchiveIndexEntry))), STATUS_NOT_ENOUGH_MEMORY);
+    CHK(NULL != (pFrame = (PBYTE) MEMALLOC(frameSize + SIZEOF(parameterSets) + BENCH_FRAME_OVERHEAD)), STATUS_NOT_ENOUGH_MEMORY);
+    CHK(NULL != (pFile = FOPEN(pSource->path, "wb")), STATUS_OPEN_FILE_FAILED);
+
+    MEMSET(&header, 0x00, SIZEOF(header));
+    CHK(FWRITE(&header, SIZEOF(header), 1, pFile) == 1, STATUS_WRITE_TO_FILE_FAILED);
+
+    parameterSetSize = benchWriteParameterSets(parameterSets);
+    MEMSET(audioFrame, BENCH_FRAME_FILLER, SIZEOF(audioFrame));
+    for (i = 0; i < frameCount; i++) {
+        video = audioTs >= end || (videoTs < end && videoTs <= audioTs);
+        pEntry = &pIndex[i];
+        pEntry->offset = (UINT64) FTELL(pFile);
+        if (video) {
+            pEntry->trackId = DEFAULT_VIDEO_TRACK_ID;
+            pEntry->duration = frameDuration;
+            pEntry->flags = videoFrames % fps == 0 ? FRAME_ARCHIVE_ENTRY_FLAG_KEY_FRAME : FRAME_ARCHIVE_ENTRY_FLAG_NONE;
+            pEntry->size = benchBuildFrame(pFrame, frameSize, parameterSets, parameterSetSize, videoFrames % fps == 0, FALSE);
+            CHK(FWRITE(pFrame, pEntry->size, 1, pFile) == 1, STATUS_WRITE_TO_FILE_FAILED);
+            videoTs += frameDuration;
+            videoFrames++;
+        } else {
+            pEntry->trackId = DEFAULT_AUDIO_TRACK_ID;
+            pEntry->duration = BENCH_AUDIO_FRAME_DURATION;
+            pEntry->size = SIZEOF(audioFrame);
+            CHK(FWRITE(audioFrame, SIZEOF(audioFrame), 1, pFile) == 1, STATUS_WRITE_TO_FILE_FAILED);
+            audioTs += BENCH_AUDIO_FRAME_DURATION;
+        }
+    }
+
+    header.indexOffset = (UINT64) FTELL(pFile);
+    if (header.indexOffset % SIZEOF(UINT64) != 0) {
+        CHK(FWRITE(&padding, SIZEOF(UINT64) - header.indexOffset % SIZEOF(UINT64), 1, pFile) == 1, STATUS_WRITE_TO_FILE_FAILED);
+        header.indexOffset = (UINT64) FTELL(pFile);
+    }
+
+    CHK(FWRITE(pIndex, SIZEOF(FrameArchiveIndexEntry), frameCount, pFile) == frameCount, STATUS_WRITE_TO_FILE_FAILED);
+
+    MEMCPY(header.magic, FRAME_ARCHIVE_MAGIC, FRAME_ARCHIVE_MAGIC_LEN);
+    header.version = FRAME_ARCHIVE_CURRENT_VERSION;
+    header.frameCount = frameCount;
+    CHK(FSEEK(pFile, 0, SEEK_SET) == 0, STATUS_WRITE_TO_FILE_FAILED);
+    CHK(FWRITE(&header, SIZEOF(header), 1, pFile) == 1, STATUS_WRITE_TO_FILE_FAILED);
+
+    *pFrameCount = videoFrames;
+
+CleanUp:
+
+    if (pFile != NULL && FCLOSE(pFile) != 0 && STATUS_SUCCEEDED(retStatus)) {
+        retStatus = STATUS_WRITE_TO_FILE_FAILED;
+    }
+
+    SAFE_MEMFREE(pIndex);
+    SAFE_MEMFREE(pFrame);
+
+    return retStatus;
+}
+
+/**
+ * Opens the FIFO once kvs has opened its end, gives up when the run is stopped first
+ */
+INT32 benchOpenSource(PBenchSource pSource)
+{
+    INT32 fd;
+
+    while (!ATOMIC_LOAD_BOOL(pSource->pStop)) {
+        if ((fd = open(pSource->path, O_WRONLY | O_NONBLOCK | O_CLOEXEC)) >= 0) {
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+            return fd;
+        } else if (errno != ENXIO) {
+            break;
+        }
+
+        THREAD_SLEEP(10 * HUNDREDS_OF_NANOS_IN_A_MILLISECOND);
+    }
+
+    return -1;
+}
+
+/**
+ * Takes the requests kvs sent since the last frame like an encoder would: the GOP length in frames, the frame size up
+ * to the one of the run bitrate and whether the next frame is a key frame
+ */
+VOID benchReadEncoderRequests(PBenchSource pSource, PUINT64 pGopLength, PUINT32 pFrameSize, UINT32 maxFrameSize, PBOOL pKeyFrame)
+{
+    CHAR message[ENCODER_CONTROL_MAX_MESSAGE_LEN + 1];
+    UINT64 value;
+    ssize_t result;
+
+    while (pSource->controlFd >= 0 && (result = recv(pSource->controlFd, message, SIZEOF(message) - 1, MSG_DONTWAIT)) > 0) {
+        message[result] = '\0';
+        if (STRNCMP(message, "key-frame-interval ", 19) == 0 && STATUS_SUCCEEDED(STRTOUI64(message + 19, STRCHR(message, '\n'), 10, &value))) {
+            *pGopLength = MAX(value * pSource->pConfig->fps / 1000, 1);
+        } else if (STRNCMP(message, "bitrate ", 8) == 0 && STATUS_SUCCEEDED(STRTOUI64(message + 8, STRCHR(message, '\n'), 10, &value))) {
+            *pFrameSize = (UINT32) MIN(MAX(value * 1000 / 8 / pSource->pConfig->fps, BENCH_FRAME_OVERHEAD), maxFrameSize);
+        } else if (STRCMP(message, "key-frame\n") == 0) {
+            *pKeyFrame = TRUE;
+        }
+    }
+}
+
+PVOID benchSourceRoutine(PVOID args)
+{
+    PBenchSource pSource = (PBenchSource) args;
+    UINT64 fps = pSource->pConfig->fps, frameDuration = HUNDREDS_OF_NANOS_IN_A_SECOND / fps, startTime, deadline, now;
+    UINT32 maxFrameSize = (UINT32) MAX(pSource->pRun->bitrate * 1000 / 8 / fps, BENCH_FRAME_OVERHEAD), frameSize = maxFrameSize;
+    UINT32 parameterSetSize, size, offset;
+    BYTE parameterSets[128];
+    PBYTE pFrame = NULL;
+    UINT64 index, gopLength = fps, gopIndex = 0;
+    BOOL keyFrame, keyFrameAsked = FALSE;
+    INT32 fd;
+    ssize_t result;
+
+    if ((fd = benchOpenSource(pSource)) < 0 || NULL == (pFrame = (PBYTE) MEMALLOC(maxFrameSize + SIZEOF(parameterSets) + BENCH_FRAME_OVERHEAD))) {
+        goto CleanUp;
+    }
+
+    parameterSetSize = benchWriteParameterSets(parameterSets);
+    startTime = pacerGetTime();
+    for (index = 0; !ATOMIC_LOAD_BOOL(pSource->pStop); index++) {
+        deadline = startTime + index * frameDuration;
+        now = pacerGetTime();
+        if (deadline > now) {
+            THREAD_SLEEP(deadline - now);
+        }
+
+        // a new GOP length applies from the next key frame on, a new bitrate right away
+        benchReadEncoderRequests(pSource, &gopLength, &frameSize, maxFrameSize, &keyFrameAsked);
+        keyFrame = gopIndex == 0 || gopIndex >= gopLength || keyFrameAsked;
+        keyFrameAsked = FALSE;
+        gopIndex = keyFrame ? 1 : gopIndex + 1;
+
+        size = benchBuildFrame(pFrame, frameSize, parameterSets, parameterSetSize, keyFrame, TRUE);
+
+        for (offset = 0; offset < size; offset += (UINT32) result) {
+            result = write(fd, pFrame + offset, size - offset);
+            if (result < 0 && errno == EINTR) {
+                result = 0;
+            } else if (result <= 0) {
+                // kvs is gone
+                goto CleanUp;
+            }
+        }
+
+        ATOMIC_INCREMENT(&pSource->framesWritten);
+    }
+
+CleanUp:
+
+    if (fd >= 0) {
+        close(fd);
+    }
+
+    SAFE_MEMFREE(pFrame);
+
+    return NULL;
+}
+
+PVOID benchConsoleRoutine(PVOID args)
+{
+    PBenchConsole pConsole = (PBenchConsole) args;
+    CHAR buffer[BENCH_CONSOLE_CHUNK_SIZE];
+    UINT64 startTime = pacerGetTime(), deadline, now, bytes = 0;
+    ssize_t result;
+
+    while ((result = read(pConsole->fd, buffer, SIZEOF(buffer))) != 0) {
+        if (result < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+
+        fwrite(buffer, 1, (SIZE_T) result, stderr);
+        bytes += (UINT64) result;
+        ATOMIC_ADD(&pConsole->bytes, (SIZE_T) result);
+
+        if (pConsole->rate != 0) {
+            deadline = startTime + bytes * HUNDREDS_OF_NANOS_IN_A_SECOND / pConsole->rate;
+            now = pacerGetTime();
+            if (deadline > now) {
+                THREAD_SLEEP(deadline - now);
+            }
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Upper bound of the bucket holding the given percentile of the put latencies, in milliseconds
+ */
+DOUBLE benchGetPutLatencyPercentile(PBenchScrape pScrape, UINT64 percentile)
+{
+    UINT64 total;
+    UINT32 i;
+
+    if (pScrape->putLatencyBoundCount == 0 || (total = pScrape->putLatencyCounts[pScrape->putLatencyBoundCount - 1]) == 0) {
+        return 0.0;
+    }
+
+    for (i = 0; i < pScrape->putLatencyBoundCount - 1 && pScrape->putLatencyCounts[i] * 100 < total * percentile; i++);
+
+    // no put took longer than the largest one, which is also the only estimate for the overflow bucket
+    return i == pScrape->putLatencyBoundCount - 1 ? pScrape->putLatencyMax * 1000
+                                                  : MIN(pScrape->putLatencyBounds[i], pScrape->putLatencyMax) * 1000;
+}
+
+/**
+ * Adds one cumulative bucket of a put latency series to the sum of all series
+ */
+VOID benchAddPutLatencyBucket(PBenchScrape pScrape, PCHAR pLine)
+{
+    PCHAR pBound = STRSTR(pLine, "le=\"");
+    DOUBLE bound;
+    UINT32 i;
+
+    if (pBound == NULL) {
+        return;
+    }
+
+    // +Inf sorts last
+    bound = pBound[4] == '+' ? 1e300 : strtod(pBound + 4, NULL);
+    for (i = 0; i < pScrape->putLatencyBoundCount && pScrape->putLatencyBounds[i] != bound; i++);
+    if (i == pScrape->putLatencyBoundCount) {
+        if (i == ARRAY_SIZE(pScrape->putLatencyBounds)) {
+            return;
+        }
+        pScrape->putLatencyBounds[pScrape->putLatencyBoundCount++] = bound;
+    }
+
+    pScrape->putLatencyCounts[i] += strtoull(STRRCHR(pLine, ' ') + 1, NULL, 10);
+}
+
+/**
+ * Sums the counters of all channels from the kvs metrics endpoint
+ */
+STATUS benchScrapeMetrics(PCHAR socketPath, PCHAR pBuffer, PBenchScrape pScrape)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    static const CHAR request[] = "GET /metrics HTTP/1.0\r\nHost: localhost\r\n\r\n";
+    struct sockaddr_un address;
+    PCHAR pLine, pNext;
+    UINT32 size = 0;
+    ssize_t result;
+    INT32 fd = -1;
+
+    MEMSET(&address, 0x00, SIZEOF(address));
+    address.sun_family = AF_UNIX;
+    STRNCPY(address.sun_path, socketPath, SIZEOF(address.sun_path) - 1);
+    CHK((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) >= 0, STATUS_INVALID_OPERATION);
+    CHK(connect(fd, (struct sockaddr*) &address, SIZEOF(address)) == 0, STATUS_INVALID_OPERATION);
+    CHK(send(fd, request, SIZEOF(request) - 1, MSG_NOSIGNAL) == SIZEOF(request) - 1, STATUS_INVALID_OPERATION);
+
+    while (size < BENCH_SCRAPE_BUFFER_SIZE - 1 && (result = read(fd, pBuffer + size, BENCH_SCRAPE_BUFFER_SIZE - 1 - size)) > 0) {
+        size += (UINT32) result;
+    }
+    pBuffer[size] = '\0';
+
+    MEMSET(pScrape, 0x00, SIZEOF(BenchScrape));
+    pScrape->time = pacerGetTime();
+    for (pLine = pBuffer; pLine != NULL; pLine = pNext) {
+        if ((pNext = STRCHR(pLine, '\n')) != NULL) {
+            *pNext++ = '\0';
+        }
+
+        if (STRNCMP(pLine, "kvs_put_frames_total{", 21) == 0 && STRSTR(pLine, "track=\"video\"") != NULL) {
+            pScrape->videoFrames += strtoull(STRRCHR(pLine, ' ') + 1, NULL, 10);
+        } else if (STRNCMP(pLine, "kvs_dropped_frames_total{", 25) == 0) {
+            pScrape->droppedFrames += strtoull(STRRCHR(pLine, ' ') + 1, NULL, 10);
+        } else if (STRNCMP(pLine, "kvs_errors_total{", 17) == 0) {
+            pScrape->errors += strtoull(STRRCHR(pLine, ' ') + 1, NULL, 10);
+        } else if (STRNCMP(pLine, "kvs_put_latency_seconds_bucket{", 31) == 0) {
+            benchAddPutLatencyBucket(pScrape, pLine);
+        } else if (STRNCMP(pLine, "kvs_put_latency_max_seconds{", 28) == 0) {
+            pScrape->putLatencyMax = MAX(pScrape->putLatencyMax, strtod(STRRCHR(pLine, ' ') + 1, NULL));
+        } else if (STRNCMP(pLine, "kvs_startup_seconds{", 20) == 0 && STRSTR(pLine, "milestone=\"first_put\"") != NULL) {
+            pScrape->firstPutTime = MAX(pScrape->firstPutTime, strtod(STRRCHR(pLine, ' ') + 1, NULL));
+        } else if (STRNCMP(pLine, "kvs_startup_seconds{", 20) == 0 && STRSTR(pLine, "milestone=\"first_ack\"") != NULL) {
+            pScrape->firstAckTime = MAX(pScrape->firstAckTime, strtod(STRRCHR(pLine, ' ') + 1, NULL));
+        } else if (STRNCMP(pLine, "kvs_spool_frames_total{", 23) == 0 && STRSTR(pLine, "op=\"spooled\"") != NULL) {
+            pScrape->spooledFrames += strtoull(STRRCHR(pLine, ' ') + 1, NULL, 10);
+        } else if (STRNCMP(pLine, "kvs_spool_frames_total{", 23) == 0 && STRSTR(pLine, "op=\"replayed\"") != NULL) {
+            pScrape->replayedFrames += strtoull(STRRCHR(pLine, ' ') + 1, NULL, 10);
+        } else if (STRNCMP(pLine, "kvs_fragment_duration_seconds{", 30) == 0) {
+            pScrape->fragmentDuration += strtod(STRRCHR(pLine, ' ') + 1, NULL);
+        } else if (STRNCMP(pLine, "kvs_fragment_overhead_seconds{", 30) == 0) {
+            pScrape->fragmentOverhead += strtod(STRRCHR(pLine, ' ') + 1, NULL);
+        } else if (STRNCMP(pLine, "kvs_encoder_bitrate_bps{", 24) == 0) {
+            pScrape->encoderBitrate += strtoull(STRRCHR(pLine, ' ') + 1, NULL, 10) / 1000;
+        } else if (STRNCMP(pLine, "kvs_encoder_key_frame_requests_total{", 37) == 0) {
+            pScrape->keyFrameRequests += strtoull(STRRCHR(pLine, ' ') + 1, NULL, 10);
+        } else if (STRNCMP(pLine, "kvs_memory_high_water_bytes{tag=\"all\"}", 38) == 0) {
+            pScrape->memoryHighWater = strtoull(STRRCHR(pLine, ' ') + 1, NULL, 10);
+        } else if (STRNCMP(pLine, "kvs_recoveries_total{", 21) == 0) {
+            pScrape->recoveries += strtoull(STRRCHR(pLine, ' ') + 1, NULL, 10);
+        } else if (STRNCMP(pLine, "kvs_recovery_seconds_total{", 27) == 0) {
+            pScrape->recoveryTime += strtod(STRRCHR(pLine, ' ') + 1, NULL);
+        } else if (STRNCMP(pLine, "kvs_recovery_seconds_max{", 25) == 0) {
+            pScrape->recoveryMax = MAX(pScrape->recoveryMax, strtod(STRRCHR(pLine, ' ') + 1, NULL));
+        } else if (STRNCMP(pLine, "kvs_recovery_frames_lost_total{", 31) == 0) {
+            pScrape->recoveryFramesLost += strtoull(STRRCHR(pLine, ' ') + 1, NULL, 10);
+        }
+    }
+
+CleanUp:
+
+    if (fd >= 0) {
+        close(fd);
+    }
+
+    return retStatus;
+}
+
+/**
+ * The sources then take requests from kvs like an encoder
+ */
+BOOL benchUsesEncoderControl(PBenchConfig pConfig, PBenchRun pRun)
+{
+    return pConfig->fragmentDuration != NULL || STRCMP(pRun->bitrateControl, "on") == 0;
+}
+
+UINT64 benchGetRss(pid_t pid)
+{
+    CHAR path[64];
+    UINT64 pages = 0;
+    FILE* pFile;
+
+    SNPRINTF(path, SIZEOF(path), "/proc/%d/statm", (INT32) pid);
+    if (NULL != (pFile = FOPEN(path, "r"))) {
+        if (fscanf(pFile, "%*u %" SCNu64, &pages) != 1) {
+            pages = 0;
+        }
+        FCLOSE(pFile);
+    }
+
+    return pages * (UINT64) sysconf(_SC_PAGESIZE) / 1024;
+}
+
+pid_t benchStartKvs(PBenchConfig pConfig, PBenchRun pRun, PCHAR directory, PCHAR channelListPath, PCHAR metricsPath, UINT16 port,
+                    INT32 consoleFd)
+{
+    CHAR duration[32], size[32], frameSize[32], endpoint[64], spoolSize[32], backfillStart[32], putCpus[16], networkCpus[16];
+    CHAR bitrateRange[48];
+    PCHAR args[BENCH_MAX_KVS_ARGS];
+    UINT32 argCount = 0;
+    BOOL all = STRCMP(pRun->placement, "all") == 0;
+    INT64 cpuCount = sysconf(_SC_NPROCESSORS_ONLN);
+    pid_t pid;
+
+    SNPRINTF(duration, SIZEOF(duration), "%" PRIu64, pConfig->duration);
+    SNPRINTF(size, SIZEOF(size), "%" PRIu64, pRun->bufferSize);
+    // twice the generated frame, in KB
+    SNPRINTF(frameSize, SIZEOF(frameSize), "%" PRIu64, MAX(pRun->bitrate / 4 / pConfig->fps, 1) + 64);
+    SNPRINTF(endpoint, SIZEOF(endpoint), "http://127.0.0.1:%u", port);
+
+    args[argCount++] = pConfig->kvsPath;
+    args[argCount++] = (PCHAR) "--channel-list";
+    args[argCount++] = channelListPath;
+    args[argCount++] = (PCHAR) "--endpoint";
+    args[argCount++] = endpoint;
+    args[argCount++] = (PCHAR) "--duration";
+    args[argCount++] = duration;
+    args[argCount++] = (PCHAR) "--size";
+    args[argCount++] = size;
+    args[argCount++] = (PCHAR) "--max-frame-size";
+    args[argCount++] = frameSize;
+    args[argCount++] = (PCHAR) "--metrics";
+    args[argCount++] = metricsPath;
+    args[argCount++] = (PCHAR) "--log-mode";
+    args[argCount++] = pRun->logMode;
+    if (pConfig->logLevel != NULL) {
+        args[argCount++] = (PCHAR) "--log-level";
+        args[argCount++] = pConfig->logLevel;
+    }
+    if (pConfig->spoolSize != 0) {
+        SNPRINTF(spoolSize, SIZEOF(spoolSize), "%" PRIu64, pConfig->spoolSize);
+        args[argCount++] = (PCHAR) "--spool";
+        args[argCount++] = directory;
+        args[argCount++] = (PCHAR) "--spool-size";
+        args[argCount++] = spoolSize;
+        args[argCount++] = (PCHAR) "--spool-stream";
+        args[argCount++] = (PCHAR) "-spool";
+    }
+    if (pConfig->fragmentDuration != NULL) {
+        args[argCount++] = (PCHAR) "--fragment-duration";
+        args[argCount++] = pConfig->fragmentDuration;
+    }
+    if (benchUsesEncoderControl(pConfig, pRun)) {
+        args[argCount++] = (PCHAR) "--encoder-control";
+        args[argCount++] = directory;
+    }
+    if (STRCMP(pRun->bitrateControl, "on") == 0) {
+        SNPRINTF(bitrateRange, SIZEOF(bitrateRange), "%" PRIu64 "-%" PRIu64, MAX(pRun->bitrate * BENCH_MIN_BITRATE_PERCENT / 100, 1),
+                 pRun->bitrate);
+        args[argCount++] = (PCHAR) "--bitrate-range";
+        args[argCount++] = bitrateRange;
+    }
+    if (pConfig->backfill) {
+        // as if the recording ended just now
+        SNPRINTF(backfillStart, SIZEOF(backfillStart), "%" PRIu64, (UINT64) time(NULL) - pConfig->duration);
+        args[argCount++] = (PCHAR) "--backfill";
+        args[argCount++] = backfillStart;
+    }
+    if ((all || STRCMP(pRun->placement, "affinity") == 0) && cpuCount > 1) {
+        // the mock and the sources of the bench share the network CPUs
+        SNPRINTF(putCpus, SIZEOF(putCpus), "%" PRId64, cpuCount - 1);
+        SNPRINTF(networkCpus, SIZEOF(networkCpus), "0-%" PRId64, cpuCount - 2);
+        args[argCount++] = (PCHAR) "--put-cpus";
+        args[argCount++] = putCpus;
+        args[argCount++] = (PCHAR) "--network-cpus";
+        args[argCount++] = networkCpus;
+    }
+    if (all || STRCMP(pRun->placement, "realtime") == 0) {
+        args[argCount++] = (PCHAR) "--put-policy";
+        args[argCount++] = (PCHAR) "fifo";
+    }
+    if (all || STRCMP(pRun->placement, "locked") == 0) {
+        args[argCount++] = (PCHAR) "--lock-memory";
+    }
+    args[argCount] = NULL;
+
+    if ((pid = fork()) != 0) {
+        return pid;
+    }
+
+    // both go to the console like on the device
+    dup2(consoleFd, STDOUT_FILENO);
+    dup2(consoleFd, STDERR_FILENO);
+
+    // the mock does not check the signature
+    setenv("AWS_ACCESS_KEY_ID", "KVSBENCHACCESSKEY", 0);
+    setenv("AWS_SECRET_ACCESS_KEY", "KVSBENCHSECRETKEY", 0);
+    execv(pConfig->kvsPath, args);
+    fprintf(stderr, "Failed to run %s: %s\n", pConfig->kvsPath, strerror(errno));
+    _exit(127);
+}
+
+STATUS benchRun(PBenchConfig pConfig, PBenchRun pRun)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    CHAR directory[] = "/tmp/kvsbench-XXXXXX", channelListPath[MAX_PATH_LEN + 1], metricsPath[MAX_PATH_LEN + 1];
+    PBenchSource pSources = NULL;
+    PMockEndpoint pEndpoint = NULL;
+    MockEndpointConfig mockConfig;
+    struct sockaddr_un address;
+    PCHAR pScrapeBuffer = NULL;
+    BenchScrape first, last, current;
+    BenchConsole console;
+    INT32 consoleFds[2] = {-1, -1};
+    volatile ATOMIC_BOOL stop = FALSE;
+    UINT64 startTime, wallTime, now, nextScrape, framesWritten = 0, archiveFrames, p50, p90, p99;
+    CHAR spoolPath[MAX_PATH_LEN + 1];
+    struct rusage usage;
+    FILE* pListFile = NULL;
+    BOOL directoryCreated = FALSE;
+    INT32 exitStatus = -1;
+    pid_t pid = -1;
+    UINT32 i;
+
+    MEMSET(&first, 0x00, SIZEOF(first));
+    MEMSET(&last, 0x00, SIZEOF(last));
+    MEMSET(&usage, 0x00, SIZEOF(usage));
+    MEMSET(&console, 0x00, SIZEOF(console));
+    console.tid = INVALID_TID_VALUE;
+    CHK(NULL != (pSources = (PBenchSource) MEMCALLOC(pRun->channelCount, SIZEOF(BenchSource))), STATUS_NOT_ENOUGH_MEMORY);
+    CHK(NULL != (pScrapeBuffer = (PCHAR) MEMALLOC(BENCH_SCRAPE_BUFFER_SIZE)), STATUS_NOT_ENOUGH_MEMORY);
+    for (i = 0; i < pRun->channelCount; i++) {
+        pSources[i].tid = INVALID_TID_VALUE;
+        pSources[i].controlFd = -1;
+    }
+
+    CHK(mkdtemp(directory) != NULL, STATUS_INVALID_OPERATION);
+    directoryCreated = TRUE;
+    SNPRINTF(channelListPath, MAX_PATH_LEN, "%s/channels.txt", directory);
+    SNPRINTF(metricsPath, MAX_PATH_LEN, "%s/metrics.sock", directory);
+    CHK(NULL != (pListFile = FOPEN(channelListPath, "w")), STATUS_OPEN_FILE_FAILED);
+    for (i = 0; i < pRun->channelCount; i++) {
+        pSources[i].pConfig = pConfig;
+        pSources[i].pRun = pRun;
+        pSources[i].pStop = &stop;
+        if (pConfig->backfill) {
+            // recorded before kvs starts, the generation is not part of the upload time
+            SNPRINTF(pSources[i].path, MAX_PATH_LEN, "%s/bench-%u.kva", directory, i);
+            CHK_STATUS(benchWriteArchive(&pSources[i], &archiveFrames));
+            pSources[i].framesWritten = (SIZE_T) archiveFrames;
+        } else {
+            SNPRINTF(pSources[i].path, MAX_PATH_LEN, "%s/bench-%u.h264", directory, i);
+            CHK(mkfifo(pSources[i].path, 0600) == 0, STATUS_INVALID_OPERATION);
+        }
+        fprintf(pListFile, "bench-%u %s\n", i, pSources[i].path);
+        if (benchUsesEncoderControl(pConfig, pRun)) {
+            // bound before kvs starts, its first request is not lost
+            MEMSET(&address, 0x00, SIZEOF(address));
+            address.sun_family = AF_UNIX;
+            SNPRINTF(address.sun_path, SIZEOF(address.sun_path), "%s/bench-%u%s", directory, i, ENCODER_CONTROL_FILE_EXTENSION);
+            STRCPY(pSources[i].controlPath, address.sun_path);
+            CHK((pSources[i].controlFd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0)) >= 0, STATUS_INVALID_OPERATION);
+            CHK(bind(pSources[i].controlFd, (struct sockaddr*) &address, SIZEOF(address)) == 0, STATUS_INVALID_OPERATION);
+        }
+    }
+    CHK(FCLOSE(pListFile) == 0, STATUS_WRITE_TO_FILE_FAILED);
+    pListFile = NULL;
+
+    // a fresh mock per run so its counters only cover this run
+    mockConfig = pConfig->mockConfig;
+    mockConfig.ackLatency = pRun->ackLatency * HUNDREDS_OF_NANOS_IN_A_MILLISECOND;
+    CHK_STATUS(createMockEndpoint(&mockConfig, &pEndpoint));
+    CHK(pipe2(consoleFds, O_CLOEXEC) == 0, STATUS_INVALID_OPERATION);
+#ifdef F_SETPIPE_SZ
+    fcntl(consoleFds[1], F_SETPIPE_SZ, BENCH_CONSOLE_PIPE_SIZE);
+#endif
+    console.fd = consoleFds[0];
+    console.rate = pConfig->consoleRate;
+    CHK_STATUS(THREAD_CREATE(&console.tid, benchConsoleRoutine, (PVOID) &console));
+
+    startTime = pacerGetTime();
+    pid = benchStartKvs(pConfig, pRun, directory, channelListPath, metricsPath, pEndpoint->port, consoleFds[1]);
+    // the console thread sees the end of the output once kvs is gone
+    close(consoleFds[1]);
+    consoleFds[1] = -1;
+    CHK(pid > 0, STATUS_INVALID_OPERATION);
+
+    for (i = 0; i < pRun->channelCount && !pConfig->backfill; i++) {
+        CHK_STATUS(THREAD_CREATE(&pSources[i].tid, benchSourceRoutine, (PVOID) &pSources[i]));
+    }
+
+    // sustained rate is measured between the first scrape after the warmup and the last one
+    nextScrape = startTime + BENCH_SCRAPE_INTERVAL;
+    while (wait4(pid, &exitStatus, WNOHANG, &usage) == 0) {
+        THREAD_SLEEP(BENCH_EXIT_POLL_INTERVAL);
+        if (pacerGetTime() < nextScrape) {
+            continue;
+        }
+
+        nextScrape += BENCH_SCRAPE_INTERVAL;
+        if (pConfig->outageDuration != 0) {
+            // to the scrape interval, good enough for outages of seconds
+            now = pacerGetTime() - startTime;
+            mockEndpointSetLinkDown(pEndpoint, now >= pConfig->outageStart && now < pConfig->outageStart + pConfig->outageDuration);
+        }
+
+        if (STATUS_SUCCEEDED(benchScrapeMetrics(metricsPath, pScrapeBuffer, &current))) {
+            current.rssKB = benchGetRss(pid);
+            if (first.time == 0 && current.time - startTime >= BENCH_WARMUP_DURATION && current.videoFrames != 0) {
+                first = current;
+            }
+            last = current;
+        }
+    }
+
+    pid = -1;
+    wallTime = pacerGetTime() - startTime;
+    ATOMIC_STORE_BOOL(&stop, TRUE);
+    for (i = 0; i < pRun->channelCount; i++) {
+        if (IS_VALID_TID_VALUE(pSources[i].tid)) {
+            THREAD_JOIN(pSources[i].tid, NULL);
+            pSources[i].tid = INVALID_TID_VALUE;
+        }
+        framesWritten += pSources[i].framesWritten;
+    }
+
+    THREAD_JOIN(console.tid, NULL);
+    console.tid = INVALID_TID_VALUE;
+
+    mockEndpointGetLatencyPercentiles(pEndpoint, &p50, &p90, &p99);
+    pRun->putLatencyP99 = benchGetPutLatencyPercentile(&last, 99);
+    fprintf(pConfig->pOutput,
+            "{\"logMode\":\"%s\",\"placement\":\"%s\",\"bitrateControl\":\"%s\",\"channels\":%u,\"bitrateKbps\":%" PRIu64 ",\"bufferKB\":%" PRIu64 ",\"ackLatencyMs\":%" PRIu64
+            ",\"targetFps\":%" PRIu64 ",\"fps\":%.2f,"
+            "\"latencyMsP50\":%" PRIu64 ",\"latencyMsP90\":%" PRIu64 ",\"latencyMsP99\":%" PRIu64 ",\"cpuPercent\":%.2f,\"maxRssKB\":%ld,"
+            "\"framesWritten\":%" PRIu64 ",\"framesPut\":%" PRIu64 ",\"droppedFrames\":%" PRIu64 ",\"errors\":%" PRIu64 ",\"mockBytes\":%" PRIu64
+            ",\"fragments\":%" PRIu64 ",\"acks\":%" PRIu64 ",\"lostFragments\":%" PRIu64 ",\"putLatencyMsP50\":%.3f,\"putLatencyMsP90\":%.3f,\"putLatencyMsP99\":%.3f"
+            ",\"putLatencyMsMax\":%.3f,\"putLatencyP99Change\":%.1f"
+            ",\"firstPutMs\":%.1f,\"firstAckMs\":%.1f,\"spooledFrames\":%" PRIu64 ",\"replayedFrames\":%" PRIu64 ",\"consoleBytes\":%" PRIu64
+            ",\"fragmentMs\":%.0f,\"fragmentOverheadMs\":%.0f,\"backfillSpeed\":%.2f,\"encoderBitrateKbps\":%" PRIu64 ",\"keyFrameRequests\":%" PRIu64 ",\"rssGrowthKB\":%" PRId64 ",\"memoryHighWaterKB\":%" PRIu64
+            ",\"faults\":%" PRIu64 ",\"recoveries\":%" PRIu64 ",\"recoveryMsAvg\":%.1f,\"recoveryMsMax\":%.1f,\"recoveryFramesLost\":%" PRIu64 ",\"exitStatus\":%d}\n",
+            pRun->logMode, pRun->placement, pRun->bitrateControl, pRun->channelCount, pRun->bitrate, pRun->bufferSize, pRun->ackLatency, pConfig->fps,
+            last.time > first.time ? (DOUBLE) (last.videoFrames - first.videoFrames) * HUNDREDS_OF_NANOS_IN_A_SECOND / (last.time - first.time) / pRun->channelCount
+                                   : 0.0,
+            p50, p90, p99,
+            100.0 * ((DOUBLE) usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6) /
+                ((DOUBLE) wallTime / HUNDREDS_OF_NANOS_IN_A_SECOND),
+            usage.ru_maxrss, framesWritten, last.videoFrames, last.droppedFrames, last.errors, (UINT64) pEndpoint->stats.bytesReceived,
+            (UINT64) pEndpoint->stats.fragments, (UINT64) pEndpoint->stats.acksSent, (UINT64) pEndpoint->stats.lostFragments,
+            benchGetPutLatencyPercentile(&last, 50), benchGetPutLatencyPercentile(&last, 90), pRun->putLatencyP99,
+            last.putLatencyMax * 1000,
+            pRun->baselinePutLatencyP99 == 0.0 ? 0.0 : 100.0 * (pRun->putLatencyP99 - pRun->baselinePutLatencyP99) / pRun->baselinePutLatencyP99, last.firstPutTime * 1000, last.firstAckTime * 1000,
+            last.spooledFrames, last.replayedFrames, (UINT64) console.bytes, last.fragmentDuration * 1000 / pRun->channelCount,
+            last.fragmentOverhead * 1000 / pRun->channelCount,
+            pConfig->backfill ? (DOUBLE) pConfig->duration * HUNDREDS_OF_NANOS_IN_A_SECOND / wallTime : 0.0,
+            last.encoderBitrate / pRun->channelCount, last.keyFrameRequests,
+            // flat over a soak once the warmup has allocated what kvs keeps
+            first.time == 0 ? (INT64) 0 : (INT64) last.rssKB - (INT64) first.rssKB, last.memoryHighWater / 1024,
+            (UINT64) pEndpoint->stats.faults, last.recoveries, last.recoveries == 0 ? 0.0 : last.recoveryTime * 1000 / last.recoveries,
+            last.recoveryMax * 1000, last.recoveryFramesLost,
+            WIFEXITED(exitStatus) ? WEXITSTATUS(exitStatus) : -1);
+    fflush(pConfig->pOutput);
+
+CleanUp:
+
+    CHK_LOG_ERR(retStatus);
+
+    if (pid > 0) {
+        kill(pid, SIGTERM);
+        waitpid(pid, NULL, 0);
+    }
+
+    if (consoleFds[1] >= 0) {
+        close(consoleFds[1]);
+    }
+
+    if (IS_VALID_TID_VALUE(console.tid)) {
+        THREAD_JOIN(console.tid, NULL);
+    }
+
+    if (consoleFds[0] >= 0) {
+        close(consoleFds[0]);
+    }
+
+    if (pSources != NULL) {
+        ATOMIC_STORE_BOOL(&stop, TRUE);
+        for (i = 0; i < pRun->channelCount; i++) {
+            if (IS_VALID_TID_VALUE(pSources[i].tid)) {
+                THREAD_JOIN(pSources[i].tid, NULL);
+            }
+            if (pSources[i].path[0] != '\0') {
+                unlink(pSources[i].path);
+            }
+            if (directoryCreated) {
+                SNPRINTF(spoolPath, MAX_PATH_LEN, "%s/bench-%u.spool", directory, i);
+                unlink(spoolPath);
+            }
+            if (pSources[i].controlFd >= 0) {
+                close(pSources[i].controlFd);
+                unlink(pSources[i].controlPath);
+            }
+        }
+    }
+
+    if (pListFile != NULL) {
+        FCLOSE(pListFile);
+    }
+
+    if (directoryCreated) {
+        unlink(channelListPath);
+        unlink(metricsPath);
+        rmdir(directory);
+    }
+
+    freeMockEndpoint(&pEndpoint);
+    SAFE_MEMFREE(pSources);
+    SAFE_MEMFREE(pScrapeBuffer);
+
+    return retStatus;
+}
+
+STATUS benchServeMock(PBenchConfig pConfig)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    PMockEndpoint pEndpoint = NULL;
+    UINT64 p50, p90, p99;
+
+    CHK_STATUS(createMockEndpoint(&pConfig->mockConfig, &pEndpoint));
+    printf("Mock endpoint listening on http://127.0.0.1:%u for %" PRIu64 " seconds\n", pEndpoint->port, pConfig->duration);
+    THREAD_SLEEP(pConfig->duration * HUNDREDS_OF_NANOS_IN_A_SECOND);
+
+    mockEndpointGetLatencyPercentiles(pEndpoint, &p50, &p90, &p99);
+    fprintf(pConfig->pOutput,
+            "{\"requests\":%" PRIu64 ",\"putMediaSessions\":%" PRIu64 ",\"mockBytes\":%" PRIu64 ",\"fragments\":%" PRIu64 ",\"acks\":%" PRIu64
+            ",\"lostFragments\":%" PRIu64 ",\"faults\":%" PRIu64 ",\"latencyMsP50\":%" PRIu64 ",\"latencyMsP90\":%" PRIu64 ",\"latencyMsP99\":%" PRIu64 "}\n",
+            (UINT64) pEndpoint->stats.requests, (UINT64) pEndpoint->stats.putMediaSessions, (UINT64) pEndpoint->stats.bytesReceived,
+            (UINT64) pEndpoint->stats.fragments, (UINT64) pEndpoint->stats.acksSent, (UINT64) pEndpoint->stats.lostFragments,
+            (UINT64) pEndpoint->stats.faults, p50, p90, p99);
+
+CleanUp:
+
+    freeMockEndpoint(&pEndpoint);
+
+    return retStatus;
+}
+
+INT32 main(INT32 argc, CHAR *argv[])
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    PCHAR bitrates = DEFAULT_BENCH_BITRATES, channels = DEFAULT_BENCH_CHANNELS, sizes = DEFAULT_BENCH_SIZES, outputPath = NULL;
+    PCHAR ackLatencies = DEFAULT_BENCH_ACK_LATENCIES;
+    CHAR logModeList[] = DEFAULT_BENCH_LOG_MODES, placementList[] = DEFAULT_BENCH_PLACEMENTS;
+    CHAR bitrateControlList[] = DEFAULT_BENCH_BITRATE_CONTROLS;
+    PCHAR logModes = logModeList, logModeValues[BENCH_MAX_RUN_VALUES];
+    PCHAR placements = placementList, placementValues[BENCH_MAX_RUN_VALUES];
+    PCHAR bitrateControls = bitrateControlList, bitrateControlValues[BENCH_MAX_RUN_VALUES];
+    PCHAR validBitrateControls[] = {(PCHAR) "off", (PCHAR) "on", NULL};
+    PCHAR validLogModes[] = {(PCHAR) "async", (PCHAR) "sync", NULL};
+    PCHAR validPlacements[] = {(PCHAR) "default", (PCHAR) "affinity", (PCHAR) "realtime", (PCHAR) "locked", (PCHAR) "all", NULL};
+    UINT64 bitrateValues[BENCH_MAX_RUN_VALUES], channelValues[BENCH_MAX_RUN_VALUES], sizeValues[BENCH_MAX_RUN_VALUES];
+    UINT64 ackLatencyValues[BENCH_MAX_RUN_VALUES];
+    UINT64 value;
+    INT32 choice, option_index = 0;
+    UINT32 bitrateCount, channelCount, sizeCount, logModeCount, ackLatencyCount, placementCount, bitrateControlCount, b, c, s, a, l, p, r;
+    BenchConfig config;
+    BenchRun run;
+
+    MEMSET(&config, 0x00, SIZEOF(config));
+    config.kvsPath = DEFAULT_BENCH_KVS_PATH;
+    config.duration = DEFAULT_BENCH_DURATION;
+    config.fps = DEFAULT_BENCH_FPS;
+    config.pOutput = stdout;
+
+    while ((choice = getopt_long(argc, argv, ":k:D:f:b:c:s:L:B:x:e:p:mo:l:v:C:O:S:F:RP:A:h",
+                 long_options, &option_index)) != -1) {
+        switch (choice) {
+        case 'k':
+            config.kvsPath = optarg;
+            break;
+        case 'D':
+            CHK_STATUS(STRTOUI64(optarg, NULL, 10, &config.duration));
+            CHK(config.duration != 0, STATUS_INVALID_ARG);
+            break;
+        case 'f':
+            CHK_STATUS(STRTOUI64(optarg, NULL, 10, &config.fps));
+            CHK(config.fps != 0, STATUS_INVALID_ARG);
+            break;
+        case 'b':
+            bitrates = optarg;
+            break;
+        case 'c':
+            channels = optarg;
+            break;
+        case 's':
+            sizes = optarg;
+            break;
+        case 'L':
+            ackLatencies = optarg;
+            break;
+        case 'B':
+            CHK_STATUS(STRTOUI64(optarg, NULL, 10, &value));
+            config.mockConfig.bandwidth = value * 1000 / 8;
+            break;
+        case 'x':
+            CHK_STATUS(STRTOUI64(optarg, NULL, 10, &value));
+            CHK(value <= 100, STATUS_INVALID_ARG);
+            config.mockConfig.lossPercent = (UINT32) value;
+            break;
+        case 'e':
+            CHK_STATUS(STRTOUI64(optarg, NULL, 10, &value));
+            CHK(value <= 100, STATUS_INVALID_ARG);
+            config.mockConfig.faultPercent = (UINT32) value;
+            break;
+        case 'p':
+            CHK_STATUS(STRTOUI64(optarg, NULL, 10, &value));
+            CHK(value <= 0xFFFF, STATUS_INVALID_ARG);
+            config.mockConfig.port = (UINT16) value;
+            break;
+        case 'm':
+            config.mockOnly = TRUE;
+            break;
+        case 'o':
+            outputPath = optarg;
+            break;
+        case 'l':
+            logModes = optarg;
+            break;
+        case 'v':
+            config.logLevel = optarg;
+            break;
+        case 'C':
+            CHK_STATUS(STRTOUI64(optarg, NULL, 10, &config.consoleRate));
+            break;
+        case 'O':
+            if (STRCHR(optarg, ',') == NULL || STATUS_FAILED(STRTOUI64(optarg, STRCHR(optarg, ','), 10, &config.outageStart)) ||
+                STATUS_FAILED(STRTOUI64(STRCHR(optarg, ',') + 1, NULL, 10, &config.outageDuration)) || config.outageDuration == 0) {
+                fprintf(stderr, "%s: invalid outage '%s'\n", argv[0], optarg);
+                displayUsage(1);
+            }
+            config.outageStart *= HUNDREDS_OF_NANOS_IN_A_SECOND;
+            config.outageDuration *= HUNDREDS_OF_NANOS_IN_A_SECOND;
+            break;
+        case 'S':
+            CHK_STATUS(STRTOUI64(optarg, NULL, 10, &config.spoolSize));
+            break;
+        case 'F':
+            config.fragmentDuration = optarg;
+            break;
+        case 'R':
+            config.backfill = TRUE;
+            break;
+        case 'P':
+            placements = optarg;
+            break;
+        case 'A':
+            bitrateControls = optarg;
+            break;
+        case 'h':
+            displayUsage(0);
+            break;
+        case ':':
+            fprintf(stderr, "%s: option '-%c' requires an argument\n", argv[0], optopt);
+            displayUsage(1);
+            break;
+        default:
+            displayUsage(1);
+        }
+    }
+
+    CHK_STATUS(parseValueList(bitrates, bitrateValues, &bitrateCount, FALSE));
+    CHK_STATUS(parseValueList(channels, channelValues, &channelCount, FALSE));
+    CHK_STATUS(parseValueList(sizes, sizeValues, &sizeCount, FALSE));
+    CHK_STATUS(parseValueList(ackLatencies, ackLatencyValues, &ackLatencyCount, TRUE));
+    CHK_STATUS(parseNameList(logModes, validLogModes, logModeValues, &logModeCount));
+    CHK_STATUS(parseNameList(placements, validPlacements, placementValues, &placementCount));
+    CHK_STATUS(parseNameList(bitrateControls, validBitrateControls, bitrateControlValues, &bitrateControlCount));
+    if (outputPath != NULL) {
+        CHK(NULL != (config.pOutput = FOPEN(outputPath, "a")), STATUS_OPEN_FILE_FAILED);
+    }
+
+    // a kvs exiting mid write must not take the bench down
+    signal(SIGPIPE, SIG_IGN);
+
+    for (c = 0; c < channelCount && !config.mockOnly; c++) {
+        for (b = 0; b < bitrateCount; b++) {
+            for (s = 0; s < sizeCount; s++) {
+                for (a = 0; a < ackLatencyCount; a++) {
+                    // the log modes, bitrate controls and placements of one configuration run back to back so they are easy to compare
+                    for (l = 0; l < logModeCount; l++) {
+                        for (r = 0; r < bitrateControlCount; r++) {
+                            for (p = 0; p < placementCount; p++) {
+                                CHK(channelValues[c] <= MAX_CHANNEL_COUNT, STATUS_INVALID_ARG);
+                                run.channelCount = (UINT32) channelValues[c];
+                                run.bitrate = bitrateValues[b];
+                                run.bufferSize = sizeValues[s];
+                                run.ackLatency = ackLatencyValues[a];
+                                run.logMode = logModeValues[l];
+                                run.bitrateControl = bitrateControlValues[r];
+                                run.placement = placementValues[p];
+                                run.baselinePutLatencyP99 = p == 0 ? 0.0 : run.baselinePutLatencyP99;
+                                CHK_STATUS(benchRun(&config, &run));
+                                if (p == 0) {
+                                    run.baselinePutLatencyP99 = run.putLatencyP99;
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    if (config.mockOnly) {
+        config.mockConfig.ackLatency = ackLatencyValues[0] * HUNDREDS_OF_NANOS_IN_A_MILLISECOND;
+        CHK_STATUS(benchServeMock(&config));
+    }
+
+CleanUp:
+
+    if (config.pOutput != NULL && config.pOutput != stdout) {
+        FCLOSE(config.pOutput);
+    }
+
+    if (STATUS_FAILED(retStatus)) {
+        printf("Failed with status 0x%08x\n", retStatus);
+    }
+
+    return (INT32) retStatus;
+}
@@ -0,0 +1,538 @@
+/*
+ * Copyright (C) 2020 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <unistd.h>
+#include <getopt.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "AnnexB.h"
+#include "FrameArchive.h"
+#include "Demux.h"
+
+#define DEFAULT_FPS_VALUE                   25
+#define DEFAULT_AUDIO_FRAME_DURATION_MS     20
+#define DEFAULT_MEDIA_DIRECTORY             "../"
+#define H264_NAL_TYPE_IDR                   5
+#define DEFAULT_BENCH_DURATION              (1 * HUNDREDS_OF_NANOS_IN_A_SECOND)
+#define MAX_BENCH_ACCESS_UNITS              (64 * 1024)
+
+typedef struct {
+    PCHAR pathFormat;
+    UINT64 trackId;
+    UINT64 frameDuration;
+    // Force a key frame every N frames, 0 to detect IDR NALs. Ignored for audio.
+    UINT32 keyFrameInterval;
+    BOOL isVideo;
+    UINT32 fileCount;
+    UINT32 nextFile;
+    UINT64 nextTimestamp;
+} PackTrack, *PPackTrack;
+
+static struct option long_options[] = {
+    /*   NAME           ARGUMENT            FLAG    SHORTNAME */
+    {"directory",       required_argument,  NULL,   'd'},
+    {"output",          required_argument,  NULL,   'o'},
+    {"fps",             required_argument,  NULL,   'f'},
+    {"audio-duration",  required_argument,  NULL,   'a'},
+    {"key-interval",    required_argument,  NULL,   'k'},
+    {"bench",           required_argument,  NULL,   'b'},
+    {"help",            no_argument,        NULL,   'h'},
+    {NULL,              0,                  NULL,   0}
+};
+
+void displayUsage( int err )
+{
+    printf ("Pack numbered sample frame files into a single frame archive for kvs.\n");
+    printf ("Usage: \n");
+    printf ("kvspack [options...]\n");
+    printf ("\n");
+    printf ("-d, --directory        media directory containing h264SampleFrames/ and aacSampleFrames/\n");
+    printf ("                       default to '../'\n");
+    printf ("-o, --output           archive file\n");
+    printf ("                       default to '<directory>/%s'\n", DEFAULT_FRAME_ARCHIVE_NAME);
+    printf ("-f, --fps              video frame rate\n");
+    printf ("                       default to %d\n", DEFAULT_FPS_VALUE);
+    printf ("-a, --audio-duration   audio frame duration in milliseconds\n");
+    printf ("                       default to %d\n", DEFAULT_AUDIO_FRAME_DURATION_MS);
+    printf ("-k, --key-interval     mark every N-th video frame as key frame\n");
+    printf ("                       default to 0, detect IDR NAL units\n");
+    printf ("-b, --bench            demux this fragmented MP4 or Matroska file over and over and print the parse rate\n");
+    printf ("                       instead of packing, or convert the access units of this H.264 Annex-B stream to\n");
+    printf ("                       length prefixed NAL units and print the rate of the copy the SDK makes and of kvs\n");
+    exit (err);
+}
+
+BOOL isIdrFrame(PBYTE pData, UINT32 size)
+{
+    UINT32 i;
+
+    // Annex-B: look for a 00 00 01 start code followed by an IDR slice header
+    for (i = 0; i + 3 < size; i++) {
+        if (pData[i] == 0x00 && pData[i + 1] == 0x00 && pData[i + 2] == 0x01 &&
+            (pData[i + 3] & 0x1f) == H264_NAL_TYPE_IDR) {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+STATUS countTrackFiles(PCHAR directory, PPackTrack pTrack)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    CHAR filePath[MAX_PATH_LEN + 1];
+    BOOL exists = TRUE;
+
+    for (pTrack->fileCount = 0; exists; pTrack->fileCount++) {
+        SNPRINTF(filePath, MAX_PATH_LEN, pTrack->pathFormat, directory, pTrack->fileCount + 1);
+        CHK_STATUS(fileExists(filePath, &exists));
+        if (!exists) {
+            break;
+        }
+    }
+
+CleanUp:
+
+    return retStatus;
+}
+
+STATUS packFrame(FILE* pOutFile, PCHAR directory, PPackTrack pTrack, PBYTE* ppBuffer, PUINT64 pBufferSize,
+                 PFrameArchiveIndexEntry pEntry)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    CHAR filePath[MAX_PATH_LEN + 1];
+    UINT64 fileSize;
+    PBYTE pNewBuffer;
+
+    SNPRINTF(filePath, MAX_PATH_LEN, pTrack->pathFormat, directory, pTrack->nextFile + 1);
+    CHK_STATUS(readFile(filePath, TRUE, NULL, &fileSize));
+    CHK(fileSize <= MAX_UINT32, STATUS_INVALID_ARG_LEN);
+
+    // Grow-only scratch buffer, the packer is not on any hot path
+    if (fileSize > *pBufferSize) {
+        pNewBuffer = (PBYTE) MEMREALLOC(*ppBuffer, fileSize);
+        CHK(pNewBuffer != NULL, STATUS_NOT_ENOUGH_MEMORY);
+        *ppBuffer = pNewBuffer;
+        *pBufferSize = fileSize;
+    }
+
+    CHK_STATUS(readFile(filePath, TRUE, *ppBuffer, &fileSize));
+
+    pEntry->offset = (UINT64) FTELL(pOutFile);
+    pEntry->size = (UINT32) fileSize;
+    pEntry->trackId = pTrack->trackId;
+    pEntry->duration = pTrack->frameDuration;
+    pEntry->flags = FRAME_ARCHIVE_ENTRY_FLAG_NONE;
+    if (pTrack->isVideo) {
+        if (pTrack->keyFrameInterval != 0 ? pTrack->nextFile % pTrack->keyFrameInterval == 0 :
+                                            isIdrFrame(*ppBuffer, (UINT32) fileSize)) {
+            pEntry->flags |= FRAME_ARCHIVE_ENTRY_FLAG_KEY_FRAME;
+        }
+    }
+
+    CHK(FWRITE(*ppBuffer, 1, (SIZE_T) fileSize, pOutFile) == fileSize, STATUS_WRITE_TO_FILE_FAILED);
+
+    pTrack->nextFile++;
+    pTrack->nextTimestamp += pTrack->frameDuration;
+
+CleanUp:
+
+    return retStatus;
+}
+
+/**
+ * Indexes a mapped container repeatedly, only the structure is walked so the rate is the one of the box parsing
+ */
+STATUS benchDemux(PCHAR path)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    PFrameArchive pArchive = NULL;
+    FrameArchive copy;
+    UINT64 startTime, elapsed = 0, runs = 0;
+
+    CHK_STATUS(openFrameArchive(path, &pArchive));
+    CHK_ERR(pArchive->ownsIndex, STATUS_INVALID_ARG, "%s is a frame archive, not a container", path);
+    // the first demux logged what it found, the runs would repeat it
+    loggerSetLogLevel(LOG_LEVEL_ERROR);
+
+    startTime = GETTIME();
+    while (elapsed < DEFAULT_BENCH_DURATION) {
+        MEMSET(&copy, 0x00, SIZEOF(copy));
+        copy.pBase = pArchive->pBase;
+        copy.size = pArchive->size;
+        if (demuxIsMp4(copy.pBase, copy.size)) {
+            CHK_STATUS(demuxMp4(&copy));
+        } else {
+            CHK_STATUS(demuxMatroska(&copy));
+        }
+        SAFE_MEMFREE(copy.pIndex);
+        runs++;
+        elapsed = GETTIME() - startTime;
+    }
+
+    printf("Demuxed %u frames of %u tracks %" PRIu64 " times, %" PRIu64 " ns per frame, %.2f GB/s of container\n",
+           pArchive->frameCount, pArchive->trackCount, runs, elapsed * 100 / runs / MAX(pArchive->frameCount, 1),
+           (DOUBLE) pArchive->size * runs * HUNDREDS_OF_NANOS_IN_A_SECOND / elapsed / 1e9);
+
+CleanUp:
+
+    closeFrameArchive(&pArchive);
+
+    return retStatus;
+}
+
+/**
+ * Time stamp counter where there is one, bench rates are then per cycle as well
+ */
+UINT64 benchGetCycles()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+BOOL isAnnexBStream(PBYTE pData, UINT64 size)
+{
+    return size >= 4 && pData[0] == 0x00 && pData[1] == 0x00 && (pData[2] == 0x01 || (pData[2] == 0x00 && pData[3] == 0x01));
+}
+
+/**
+ * What the SDK does to every frame with NAL_ADAPTATION_ANNEXB_NALS: a byte by byte scan copying each NAL unit behind
+ * its length into a second buffer. Returns the size written.
+ */
+UINT32 benchAdaptByCopy(PBYTE pIn, UINT32 size, PBYTE pOut)
+{
+    UINT32 i, start = 0, end, written = 0, length;
+    BOOL inNal = FALSE;
+
+    for (i = 0; i <= size; i++) {
+        if (i + 3 <= size && pIn[i] == 0x00 && pIn[i + 1] == 0x00 && pIn[i + 2] == 0x01) {
+            end = i;
+        } else if (i == size) {
+            end = size;
+        } else {
+            continue;
+        }
+
+        if (inNal) {
+            for (; end > start && pIn[end - 1] == 0x00; end--);
+            length = end - start;
+            if (length != 0) {
+                pOut[written++] = (BYTE) (length >> 24);
+                pOut[written++] = (BYTE) (length >> 16);
+                pOut[written++] = (BYTE) (length >> 8);
+                pOut[written++] = (BYTE) length;
+                MEMCPY(pOut + written, pIn + start, length);
+                written += length;
+            }
+        }
+
+        inNal = TRUE;
+        start = i + 3;
+        i += 2;
+    }
+
+    return written;
+}
+
+/**
+ * Splits an Annex-B stream before every access unit delimiter, SPS or first slice following a slice
+ */
+UINT32 benchSplitAccessUnits(PBYTE pData, UINT32 size, PUINT32 pOffsets, UINT32 maxCount)
+{
+    PBYTE pEnd = pData + size, pStartCode = annexBFindStartCode(pData, pEnd);
+    UINT32 count = 0;
+    UINT8 nalType;
+    BOOL hasVcl = FALSE;
+
+    for (; pEnd - pStartCode > 4 && count < maxCount; pStartCode = annexBFindStartCode(pStartCode + 3, pEnd)) {
+        nalType = pStartCode[3] & H264_NAL_TYPE_MASK;
+        if (count == 0 || (hasVcl && (nalType == H264_NAL_TYPE_AUD || nalType == H264_NAL_TYPE_SPS ||
+                                      ((nalType == H264_NAL_TYPE_NON_IDR_SLICE || nalType == H264_NAL_TYPE_IDR_SLICE) && (pStartCode[4] & 0x80) != 0)))) {
+            pOffsets[count++] = (UINT32) (pStartCode - pData) - (pStartCode > pData && pStartCode[-1] == 0x00 ? 1 : 0);
+            hasVcl = FALSE;
+        }
+        hasVcl = hasVcl || nalType == H264_NAL_TYPE_NON_IDR_SLICE || nalType == H264_NAL_TYPE_IDR_SLICE;
+    }
+
+    pOffsets[count] = size;
+
+    return count;
+}
+
+/**
+ * Converts the access units of an Annex-B stream over and over, once the way the SDK adapts them into a copy and once
+ * in place the way the reader of kvs does. In place conversion destroys its input, restoring it is timed on its own
+ * and taken off.
+ */
+STATUS benchAnnexB(PCHAR path, PBYTE pData, UINT32 size)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    PBYTE pOut = NULL, pWork = NULL;
+    PUINT32 pOffsets = NULL;
+    UINT64 startTime, startCycles, elapsed[3], cycles[3], bytes[3], runs;
+    UINT32 unitCount, i, unitSize, maxUnitSize = 0, copySize, convertedSize = 0;
+    DOUBLE rate;
+    INT32 mode;
+    PCHAR modeNames[] = {(PCHAR) "copy adaptation", (PCHAR) "in place"};
+
+    CHK(NULL != (pOffsets = (PUINT32) MEMALLOC((MAX_BENCH_ACCESS_UNITS + 1) * SIZEOF(UINT32))), STATUS_NOT_ENOUGH_MEMORY);
+    unitCount = benchSplitAccessUnits(pData, size, pOffsets, MAX_BENCH_ACCESS_UNITS);
+    CHK_ERR(unitCount != 0, STATUS_INVALID_ARG, "No access unit found in %s", path);
+    for (i = 0; i < unitCount; i++) {
+        maxUnitSize = MAX(maxUnitSize, pOffsets[i + 1] - pOffsets[i]);
+    }
+
+    // three byte start codes grow a unit by a byte each, a third more covers any of them
+    CHK(NULL != (pOut = (PBYTE) MEMALLOC(maxUnitSize + maxUnitSize / 3 + 4)), STATUS_NOT_ENOUGH_MEMORY);
+    CHK(NULL != (pWork = (PBYTE) MEMALLOC(maxUnitSize + maxUnitSize / 3 + 4)), STATUS_NOT_ENOUGH_MEMORY);
+
+    // both give the same bytes
+    for (i = 0; i < unitCount; i++) {
+        unitSize = pOffsets[i + 1] - pOffsets[i];
+        copySize = benchAdaptByCopy(pData + pOffsets[i], unitSize, pOut);
+        MEMCPY(pWork, pData + pOffsets[i], unitSize);
+        CHK_STATUS(annexBConvertToAvcc(pWork, unitSize, maxUnitSize + maxUnitSize / 3 + 4, &convertedSize));
+        CHK_ERR(copySize == convertedSize && MEMCMP(pOut, pWork, copySize) == 0, STATUS_INVALID_OPERATION,
+                "Access unit %u converts differently in place", i);
+    }
+
+    // 0 adapts into a copy, 1 restores and converts in place, 2 only restores
+    for (mode = 0; mode < 3; mode++) {
+        startTime = GETTIME();
+        startCycles = benchGetCycles();
+        for (runs = 0, bytes[mode] = 0; GETTIME() - startTime < DEFAULT_BENCH_DURATION; runs++) {
+            for (i = 0; i < unitCount; i++) {
+                unitSize = pOffsets[i + 1] - pOffsets[i];
+                if (mode == 0) {
+                    benchAdaptByCopy(pData + pOffsets[i], unitSize, pOut);
+                } else {
+                    MEMCPY(pWork, pData + pOffsets[i], unitSize);
+                    if (mode == 1) {
+                        annexBConvertToAvcc(pWork, unitSize, maxUnitSize + maxUnitSize / 3 + 4, &convertedSize);
+                    }
+                }
+                bytes[mode] += unitSize;
+            }
+        }
+        cycles[mode] = benchGetCycles() - startCycles;
+        elapsed[mode] = GETTIME() - startTime;
+    }
+
+    printf("Converted %u access units of %u bytes in %s, %s start code search\n", unitCount, size, path,
+#if defined(__SSE2__)
+           "SSE2"
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+           "NEON"
+#else
+           "scalar"
+#endif
+    );
+
+    for (mode = 0; mode < 2; mode++) {
+        // per byte costs, the in place run less the restoring one
+        rate = (DOUBLE) elapsed[mode] / bytes[mode] - (mode == 1 ? (DOUBLE) elapsed[2] / bytes[2] : 0.0);
+        printf("%-16s %.2f GB/s", modeNames[mode], rate <= 0 ? 0.0 : (DOUBLE) HUNDREDS_OF_NANOS_IN_A_SECOND / rate / 1e9);
+        if (cycles[mode] != 0) {
+            rate = (DOUBLE) cycles[mode] / bytes[mode] - (mode == 1 ? (DOUBLE) cycles[2] / bytes[2] : 0.0);
+            printf(", %.2f bytes/cycle", rate <= 0 ? 0.0 : 1 / rate);
+        }
+        printf("\n");
+    }
+
+CleanUp:
+
+    SAFE_MEMFREE(pOffsets);
+    SAFE_MEMFREE(pOut);
+    SAFE_MEMFREE(pWork);
+
+    return retStatus;
+}
+
+/**
+ * Benches the demuxer on a container or the conversion on an Annex-B stream, by its first bytes
+ */
+STATUS bench(PCHAR path)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    PBYTE pData = NULL;
+    UINT64 size;
+
+    CHK_STATUS(readFile(path, TRUE, NULL, &size));
+    CHK(size <= MAX_UINT32, STATUS_INVALID_ARG_LEN);
+    CHK(NULL != (pData = (PBYTE) MEMALLOC(MAX(size, 1))), STATUS_NOT_ENOUGH_MEMORY);
+    CHK_STATUS(readFile(path, TRUE, pData, &size));
+
+    if (isAnnexBStream(pData, size)) {
+        CHK_STATUS(benchAnnexB(path, pData, (UINT32) size));
+    } else {
+        CHK_STATUS(benchDemux(path));
+    }
+
+CleanUp:
+
+    SAFE_MEMFREE(pData);
+
+    return retStatus;
+}
+
+INT32 main(INT32 argc, CHAR *argv[])
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    PCHAR mediaDirectory = DEFAULT_MEDIA_DIRECTORY, outputPath = NULL, benchPath = NULL;
+    CHAR directory[MAX_PATH_LEN + 1], defaultOutputPath[MAX_PATH_LEN + 1];
+    UINT64 fps = DEFAULT_FPS_VALUE, audioDurationMs = DEFAULT_AUDIO_FRAME_DURATION_MS, keyFrameInterval = 0;
+    UINT64 bufferSize = 0, padding = 0;
+    INT32 choice, option_index = 0;
+    PackTrack tracks[2];
+    PPackTrack pTrack;
+    PFrameArchiveIndexEntry pIndex = NULL;
+    FrameArchiveHeader header;
+    PBYTE pBuffer = NULL;
+    FILE* pOutFile = NULL;
+    UINT32 frameCount, i;
+
+    while ((choice = getopt_long(argc, argv, ":d:o:f:a:k:b:h",
+                 long_options, &option_index)) != -1) {
+        switch (choice) {
+        case 'd':
+            mediaDirectory = optarg;
+            break;
+        case 'o':
+            outputPath = optarg;
+            break;
+        case 'f':
+            CHK_STATUS(STRTOUI64(optarg, NULL, 10, &fps));
+            CHK(fps != 0, STATUS_INVALID_ARG);
+            break;
+        case 'a':
+            CHK_STATUS(STRTOUI64(optarg, NULL, 10, &audioDurationMs));
+            CHK(audioDurationMs != 0, STATUS_INVALID_ARG);
+            break;
+        case 'k':
+            CHK_STATUS(STRTOUI64(optarg, NULL, 10, &keyFrameInterval));
+            break;
+        case 'b':
+            benchPath = optarg;
+            break;
+        case 'h':
+            displayUsage(0);
+            break;
+        case ':':
+            fprintf(stderr, "%s: option '-%c' requires an argument\n", argv[0], optopt);
+            displayUsage(1);
+            break;
+        default:
+            displayUsage(1);
+        }
+    }
+
+    if (benchPath != NULL) {
+        CHK_STATUS(bench(benchPath));
+        CHK(FALSE, retStatus);
+    }
+
+    STRNCPY(directory, mediaDirectory, MAX_PATH_LEN);
+    directory[MAX_PATH_LEN] = '\0';
+    if (directory[STRLEN(directory) - 1] == '/') {
+        directory[STRLEN(directory) - 1] = '\0';
+    }
+
+    if (outputPath == NULL) {
+        SNPRINTF(defaultOutputPath, MAX_PATH_LEN, "%s/%s", directory, DEFAULT_FRAME_ARCHIVE_NAME);
+        outputPath = defaultOutputPath;
+    }
+
+    MEMSET(tracks, 0x00, SIZEOF(tracks));
+    tracks[0].pathFormat = "%s/h264SampleFrames/frame-%03d.h264";
+    tracks[0].trackId = DEFAULT_VIDEO_TRACK_ID;
+    tracks[0].frameDuration = HUNDREDS_OF_NANOS_IN_A_SECOND / fps;
+    tracks[0].keyFrameInterval = (UINT32) keyFrameInterval;
+    tracks[0].isVideo = TRUE;
+    tracks[1].pathFormat = "%s/aacSampleFrames/sample-%03d.aac";
+    tracks[1].trackId = DEFAULT_AUDIO_TRACK_ID;
+    tracks[1].frameDuration = audioDurationMs * HUNDREDS_OF_NANOS_IN_A_MILLISECOND;
+
+    CHK_STATUS(countTrackFiles(directory, &tracks[0]));
+    CHK_STATUS(countTrackFiles(directory, &tracks[1]));
+    CHK_ERR(tracks[0].fileCount != 0, STATUS_INVALID_ARG, "No video frames found under %s", directory);
+    printf("Packing %u video and %u audio frames from '%s'\n", tracks[0].fileCount, tracks[1].fileCount, directory);
+
+    frameCount = tracks[0].fileCount + tracks[1].fileCount;
+    CHK(NULL != (pIndex = (PFrameArchiveIndexEntry) MEMCALLOC(frameCount, SIZEOF(FrameArchiveIndexEntry))), STATUS_NOT_ENOUGH_MEMORY);
+    CHK(NULL != (pOutFile = FOPEN(outputPath, "wb")), STATUS_OPEN_FILE_FAILED);
+
+    // Header is rewritten once the index location is known
+    MEMSET(&header, 0x00, SIZEOF(header));
+    CHK(FWRITE(&header, SIZEOF(header), 1, pOutFile) == 1, STATUS_WRITE_TO_FILE_FAILED);
+
+    // Interleave the tracks in timestamp order, the way a muxer would, so the playback cursors walk the index linearly
+    for (i = 0; i < frameCount; i++) {
+        if (tracks[1].nextFile == tracks[1].fileCount ||
+            (tracks[0].nextFile < tracks[0].fileCount && tracks[0].nextTimestamp <= tracks[1].nextTimestamp)) {
+            pTrack = &tracks[0];
+        } else {
+            pTrack = &tracks[1];
+        }
+
+        CHK_STATUS(packFrame(pOutFile, directory, pTrack, &pBuffer, &bufferSize, &pIndex[i]));
+    }
+
+    // Keep the index 8-byte aligned so it can be used in place from the mapping
+    header.indexOffset = (UINT64) FTELL(pOutFile);
+    if (header.indexOffset % SIZEOF(UINT64) != 0) {
+        CHK(FWRITE(&padding, SIZEOF(UINT64) - header.indexOffset % SIZEOF(UINT64), 1, pOutFile) == 1, STATUS_WRITE_TO_FILE_FAILED);
+        header.indexOffset = (UINT64) FTELL(pOutFile);
+    }
+
+    CHK(FWRITE(pIndex, SIZEOF(FrameArchiveIndexEntry), frameCount, pOutFile) == frameCount, STATUS_WRITE_TO_FILE_FAILED);
+
+    MEMCPY(header.magic, FRAME_ARCHIVE_MAGIC, FRAME_ARCHIVE_MAGIC_LEN);
+    header.version = FRAME_ARCHIVE_CURRENT_VERSION;
+    header.frameCount = frameCount;
+    CHK(FSEEK(pOutFile, 0, SEEK_SET) == 0, STATUS_WRITE_TO_FILE_FAILED);
+    CHK(FWRITE(&header, SIZEOF(header), 1, pOutFile) == 1, STATUS_WRITE_TO_FILE_FAILED);
+
+    printf("Wrote %u frames to '%s'\n", frameCount, outputPath);
+
+CleanUp:
+
+    if (pOutFile != NULL) {
+        if (FCLOSE(pOutFile) != 0 && STATUS_SUCCEEDED(retStatus)) {
+            retStatus = STATUS_WRITE_TO_FILE_FAILED;
+        }
+    }
+
+    if (STATUS_FAILED(retStatus)) {
+        printf("Failed with status 0x%08x\n", retStatus);
+    }
+
+    SAFE_MEMFREE(pIndex);
+    SAFE_MEMFREE(pBuffer);
+
+    return (INT32) retStatus;
+}
@@ -0,0 +1,1184 @@
+/*
+ * Copyright (C) 2020 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <unistd.h>
+#include <getopt.h>
+
+#include "Channel.h"
+#include "FrameArchive.h"
+#include "Metrics.h"
+#include "Pacer.h"
+
+#define DEFAULT_SIM_DURATION                600
+#define DEFAULT_SIM_CHANNELS                1
+#define DEFAULT_SIM_FPS                     25
+#define DEFAULT_SIM_BITRATE                 2000
+#define DEFAULT_SIM_KEY_FRAME_INTERVAL      1000
+#define DEFAULT_SIM_BUFFER_SIZE             2048
+#define DEFAULT_SIM_ACK_LATENCY             100
+#define DEFAULT_SIM_BANDWIDTH               10000
+#define DEFAULT_SIM_PUT_COST                50
+#define DEFAULT_SIM_LATE_POLICY             "catch-up"
+#define DEFAULT_SIM_SEED                    1
+// the virtual clock starts where a monotonic clock of a host up for a while would be, nothing reads 0 as unset
+#define SIM_CLOCK_EPOCH                     HUNDREDS_OF_NANOS_IN_AN_HOUR
+// the service is stepped this often, sending and acking
+#define SIM_NETWORK_TICK                    HUNDREDS_OF_NANOS_IN_A_MILLISECOND
+// the SDK signals storage pressure once this share of the content store is left, and buffer duration pressure once
+// this share of the buffer duration is
+#define SIM_STORAGE_PRESSURE_PERCENT        5
+#define SIM_BUFFER_DURATION_PRESSURE_PERCENT 5
+// a key frame is this many times the average frame, every frame varies by up to this percent
+#define SIM_KEY_FRAME_SIZE_FACTOR           4
+#define SIM_FRAME_SIZE_JITTER_PERCENT       20
+#define SIM_AUDIO_FRAME_DURATION            (20 * HUNDREDS_OF_NANOS_IN_A_MILLISECOND)
+#define SIM_AUDIO_FRAME_SIZE                320
+// GOPs in the archive of a channel, kvs loops over it
+#define SIM_ARCHIVE_GOP_COUNT               10
+#define SIM_MAX_EVENTS                      32
+#define SIM_MAX_FRAGMENTS                   4096
+// violations printed in full, the rest are only counted
+#define SIM_MAX_REPORTED_VIOLATIONS         10
+#define SIM_MAX_ARGUMENTS                   32
+
+typedef enum {
+    // nothing is sent or acked, the connections stay open
+    SIM_EVENT_OUTAGE,
+    // the bandwidth of every stream drops to the value in kbps
+    SIM_EVENT_THROTTLE,
+    // the sessions fail, what was not persisted is sent again once they are back after the duration
+    SIM_EVENT_ERROR,
+    // one put takes the value in ms
+    SIM_EVENT_STALL,
+    // the received and persisted acks take the value in ms
+    SIM_EVENT_SLOW_ACKS,
+} SIM_EVENT_KIND;
+
+typedef struct {
+    SIM_EVENT_KIND kind;
+    UINT64 start;
+    UINT64 duration;
+    UINT64 value;
+    BOOL applied;
+} SimEvent, *PSimEvent;
+
+typedef struct {
+    UINT64 duration;
+    UINT32 channelCount;
+    UINT64 fps;
+    // bits per second per channel
+    UINT64 bitrate;
+    UINT64 keyFrameInterval;
+    BOOL audio;
+    // bytes per channel, the content store holds all of them
+    UINT64 bufferSize;
+    UINT64 ackLatency;
+    // bits per second per stream
+    UINT64 bandwidth;
+    UINT64 putCost;
+    PCHAR latePolicy;
+    UINT64 lateThreshold;
+    UINT32 seed;
+    SimEvent events[SIM_MAX_EVENTS];
+    UINT32 eventCount;
+    FILE* pOutput;
+} SimConfig, *PSimConfig;
+
+/**
+ * Frames of one key frame, buffered until the service persists them
+ */
+typedef struct {
+    UINT64 timestamp;
+    UINT64 putTime;
+    UINT64 size;
+    UINT64 sent;
+    // persisted ack due, 0 until the fragment is received
+    UINT64 ackTime;
+} SimFragment, *PSimFragment;
+
+/**
+ * What a track put so far, the frames of an archive follow each other by their durations
+ */
+typedef struct {
+    BOOL put;
+    // decoding time the next frame has unless frames were dropped in between
+    UINT64 nextTimestamp;
+} SimTrack, *PSimTrack;
+
+typedef struct {
+    CHAR name[32];
+    CHAR archivePath[MAX_PATH_LEN + 1];
+    UINT32 randomSeed;
+    // set once kvs created the stream, ready from the next service step on
+    STREAM_HANDLE streamHandle;
+    BOOL ready;
+    UINT64 bufferDuration;
+    SimTrack videoTrack;
+    SimTrack audioTrack;
+    // content store view of the stream, oldest first, the last one is the one being put
+    SimFragment fragments[SIM_MAX_FRAGMENTS];
+    UINT32 fragmentHead;
+    UINT32 fragmentCount;
+    UINT64 bufferedBytes;
+    UINT64 newestTimestamp;
+    BOOL bufferDurationPressure;
+    // bits the link may send and not sent yet, times 100ns
+    UINT64 sendCredit;
+    UINT64 framesPut;
+    UINT64 framesDropped;
+    UINT64 bytesPersisted;
+    UINT64 bytesResent;
+    UINT64 evictedFragments;
+    UINT64 gopBreaks;
+    MetricsHistogram ackLatency;
+} SimChannel, *PSimChannel;
+
+/**
+ * Runs kvs itself on a virtual clock against a model of the SDK and of the service.
+ *
+ * kvs streams a synthetic archive per channel from one scheduler thread and sleeps through pacerWait, which moves the
+ * clock instead. The SDK calls of kvs are linked with --wrap onto the model: the content store holds the frames put
+ * until the service persists them and calls the callbacks kvs registered the way the SDK does, pressure from inside
+ * the puts, readiness and acks from the service steps. The service takes the oldest bytes not sent yet at the
+ * bandwidth of the stream and acks every fragment once the next one started, after the ack latency. Nothing sleeps,
+ * so hours of streaming take seconds and the same options always give the same run.
+ */
+typedef struct {
+    PSimConfig pConfig;
+    PSimChannel pChannels;
+    PClientCallbacks pCallbacks;
+    UINT64 storageSize;
+    UINT64 bufferedBytes;
+    UINT64 maxBufferedBytes;
+    UINT64 maxBufferedDuration;
+    BOOL storagePressure;
+    UINT64 pressureEvents;
+    UINT64 nextStepTime;
+    // the put thread is stalled until then
+    UINT64 stallTime;
+    UINT64 linkUpTime;
+    UINT64 violations;
+} Sim, *PSim;
+
+// the SDK entry points kvs calls, linked with --wrap onto the model
+STATUS __wrap_createKinesisVideoClient(PDeviceInfo, PClientCallbacks, PCLIENT_HANDLE);
+STATUS __wrap_freeKinesisVideoClient(PCLIENT_HANDLE);
+STATUS __wrap_createKinesisVideoStream(CLIENT_HANDLE, PStreamInfo, PSTREAM_HANDLE);
+STATUS __wrap_stopKinesisVideoStreamSync(STREAM_HANDLE);
+STATUS __wrap_freeKinesisVideoStream(PSTREAM_HANDLE);
+STATUS __wrap_putKinesisVideoFrame(STREAM_HANDLE, PFrame);
+STATUS __wrap_kinesisVideoStreamFormatChanged(STREAM_HANDLE, UINT32, PBYTE, UINT64);
+STATUS __wrap_getKinesisVideoMetrics(CLIENT_HANDLE, PClientMetrics);
+STATUS __wrap_getKinesisVideoStreamMetrics(STREAM_HANDLE, PStreamMetrics);
+STATUS __wrap_kinesisVideoStreamResetConnection(STREAM_HANDLE);
+STATUS __wrap_kinesisVideoStreamResetStream(STREAM_HANDLE);
+
+// kvs.c linked in with KVS_MAIN=kvsMain
+INT32 kvsMain(INT32, CHAR*[]);
+
+static volatile UINT64 gSimTime = SIM_CLOCK_EPOCH;
+// the SDK calls carry no custom data of ours
+static PSim gpSim = NULL;
+static const UINT64 gSimAckLatencyBounds[] = {50, 100, 250, 500, 750, 1000, 1250, 1500, 2000, 2500, 5000, 10000, 30000, 60000, 120000};
+
+static struct option long_options[] = {
+    /*   NAME           ARGUMENT            FLAG    SHORTNAME */
+    {"duration",        required_argument,  NULL,   'D'},
+    {"channels",        required_argument,  NULL,   'c'},
+    {"fps",             required_argument,  NULL,   'f'},
+    {"bitrate",         required_argument,  NULL,   'b'},
+    {"key-frame-interval", required_argument, NULL, 'k'},
+    {"audio",           no_argument,        NULL,   'a'},
+    {"size",            required_argument,  NULL,   's'},
+    {"ack-latency",     required_argument,  NULL,   'L'},
+    {"bandwidth",       required_argument,  NULL,   'B'},
+    {"put-cost",        required_argument,  NULL,   'p'},
+    {"late-policy",     required_argument,  NULL,   'l'},
+    {"late-threshold",  required_argument,  NULL,   't'},
+    {"events",          required_argument,  NULL,   'e'},
+    {"seed",            required_argument,  NULL,   'r'},
+    {"output",          required_argument,  NULL,   'o'},
+    {"help",            no_argument,        NULL,   'h'},
+    {NULL,              0,                  NULL,   0}
+};
+
+void displaySimUsage( int err )
+{
+    printf ("Run kvs on a virtual clock against a model of the SDK and of a scripted service, hours of streaming in seconds.\n");
+    printf ("Checks that timestamps stay monotonic, every GOP is put whole from its key frame and the content store never\n");
+    printf ("overflows, prints the drops and ack latencies as one JSON line and exits with an error on any violation.\n");
+    printf ("What kvs prints goes to stderr.\n");
+    printf ("Usage: \n");
+    printf ("kvssim [options...]\n");
+    printf ("\n");
+    printf ("-D, --duration         simulated streaming duration in second\n");
+    printf ("                       default to %d\n", DEFAULT_SIM_DURATION);
+    printf ("-c, --channels         channel count, at most %d\n", MAX_CHANNEL_COUNT);
+    printf ("                       default to %d\n", DEFAULT_SIM_CHANNELS);
+    printf ("-f, --fps              video frame rate\n");
+    printf ("                       default to %d\n", DEFAULT_SIM_FPS);
+    printf ("-b, --bitrate          video bitrate per channel in kbps\n");
+    printf ("                       default to %d\n", DEFAULT_SIM_BITRATE);
+    printf ("-k, --key-frame-interval\n");
+    printf ("                       milliseconds between key frames\n");
+    printf ("                       default to %d\n", DEFAULT_SIM_KEY_FRAME_INTERVAL);
+    printf ("-a, --audio            add an AAC track to every channel\n");
+    printf ("-s, --size             stream buffer size in KB per channel, as kvs --size\n");
+    printf ("                       default to %d\n", DEFAULT_SIM_BUFFER_SIZE);
+    printf ("-L, --ack-latency      delay of the acks after a fragment is received in milliseconds\n");
+    printf ("                       default to %d\n", DEFAULT_SIM_ACK_LATENCY);
+    printf ("-B, --bandwidth        upload bandwidth per stream in kbps\n");
+    printf ("                       default to %d\n", DEFAULT_SIM_BANDWIDTH);
+    printf ("-p, --put-cost         microseconds one put takes the put thread\n");
+    printf ("                       default to %d\n", DEFAULT_SIM_PUT_COST);
+    printf ("-l, --late-policy      'catch-up', 'skip' or 'key-frame', as kvs --late-policy. 'skip' drops single frames\n");
+    printf ("                       and so breaks GOPs, each one is a violation\n");
+    printf ("                       default to '%s'\n", DEFAULT_SIM_LATE_POLICY);
+    printf ("-t, --late-threshold   late threshold in milliseconds\n");
+    printf ("                       default to %d\n", (INT32) (DEFAULT_PACER_LATE_THRESHOLD / HUNDREDS_OF_NANOS_IN_A_MILLISECOND));
+    printf ("-e, --events           comma separated '<kind>@<second>[+<seconds>][=<value>]' the service goes through:\n");
+    printf ("                       'outage@<s>+<s>' sends and acks nothing, 'throttle@<s>+<s>=<kbps>' caps the bandwidth,\n");
+    printf ("                       'error@<s>+<s>' fails the sessions and resends what was not persisted once they are back,\n");
+    printf ("                       'stall@<s>=<ms>' blocks the put thread, 'slow-acks@<s>+<s>=<ms>' delays the acks\n");
+    printf ("-r, --seed             seed of the frame sizes\n");
+    printf ("                       default to %d\n", DEFAULT_SIM_SEED);
+    printf ("-o, --output           append the result to a file instead of stdout\n");
+    exit (err);
+}
+
+STATIC UINT64 simGetTime()
+{
+    return gSimTime;
+}
+
+/**
+ * Time that really passed, for the speedup, the SDK time functions read the virtual clock
+ */
+STATIC UINT64 simGetWallTime()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (UINT64) now.tv_sec * HUNDREDS_OF_NANOS_IN_A_SECOND + (UINT64) now.tv_nsec / DEFAULT_TIME_UNIT_IN_NANOS;
+}
+
+/**
+ * Parses one '<kind>@<second>[+<seconds>][=<value>]' event in place
+ */
+STATUS simParseEvent(PCHAR text, PSimEvent pEvent)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    PCHAR pAt, pPlus, pEquals;
+
+    MEMSET(pEvent, 0x00, SIZEOF(SimEvent));
+    CHK((pAt = STRCHR(text, '@')) != NULL, STATUS_INVALID_ARG);
+    *pAt++ = '\0';
+    if ((pEquals = STRCHR(pAt, '=')) != NULL) {
+        *pEquals++ = '\0';
+        CHK_STATUS(STRTOUI64(pEquals, NULL, 10, &pEvent->value));
+    }
+    if ((pPlus = STRCHR(pAt, '+')) != NULL) {
+        *pPlus++ = '\0';
+        CHK_STATUS(STRTOUI64(pPlus, NULL, 10, &pEvent->duration));
+    }
+    CHK_STATUS(STRTOUI64(pAt, NULL, 10, &pEvent->start));
+    pEvent->start = pEvent->start * HUNDREDS_OF_NANOS_IN_A_SECOND;
+    pEvent->duration *= HUNDREDS_OF_NANOS_IN_A_SECOND;
+
+    if (STRCMP(text, "outage") == 0) {
+        pEvent->kind = SIM_EVENT_OUTAGE;
+        CHK(pEvent->duration != 0, STATUS_INVALID_ARG);
+    } else if (STRCMP(text, "throttle") == 0) {
+        pEvent->kind = SIM_EVENT_THROTTLE;
+        CHK(pEvent->duration != 0 && pEquals != NULL, STATUS_INVALID_ARG);
+        pEvent->value *= 1000;
+    } else if (STRCMP(text, "error") == 0) {
+        pEvent->kind = SIM_EVENT_ERROR;
+    } else if (STRCMP(text, "stall") == 0) {
+        pEvent->kind = SIM_EVENT_STALL;
+        CHK(pEquals != NULL, STATUS_INVALID_ARG);
+        pEvent->value *= HUNDREDS_OF_NANOS_IN_A_MILLISECOND;
+    } else if (STRCMP(text, "slow-acks") == 0) {
+        pEvent->kind = SIM_EVENT_SLOW_ACKS;
+        CHK(pEvent->duration != 0 && pEquals != NULL, STATUS_INVALID_ARG);
+        pEvent->value *= HUNDREDS_OF_NANOS_IN_A_MILLISECOND;
+    } else {
+        CHK(FALSE, STATUS_INVALID_ARG);
+    }
+
+CleanUp:
+
+    return retStatus;
+}
+
+STATUS simParseEvents(PCHAR list, PSimConfig pConfig)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    PCHAR pCur = list, pEnd;
+
+    while (pCur != NULL) {
+        CHK(pConfig->eventCount < SIM_MAX_EVENTS, STATUS_INVALID_ARG);
+        if ((pEnd = STRCHR(pCur, ',')) != NULL) {
+            *pEnd++ = '\0';
+        }
+        CHK_STATUS(simParseEvent(pCur, &pConfig->events[pConfig->eventCount++]));
+        pCur = pEnd;
+    }
+
+CleanUp:
+
+    return retStatus;
+}
+
+/**
+ * Whether an event of the kind covers the time since the start of the run, its value if so
+ */
+BOOL simEventActive(PSimConfig pConfig, SIM_EVENT_KIND kind, UINT64 time, PUINT64 pValue)
+{
+    UINT32 i;
+
+    for (i = 0; i < pConfig->eventCount; i++) {
+        if (pConfig->events[i].kind == kind && time >= pConfig->events[i].start &&
+            time < pConfig->events[i].start + pConfig->events[i].duration) {
+            if (pValue != NULL) {
+                *pValue = pConfig->events[i].value;
+            }
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+VOID simViolation(PSim pSim, PSimChannel pChannel, PCHAR format, UINT64 value)
+{
+    if (pSim->violations++ < SIM_MAX_REPORTED_VIOLATIONS) {
+        fprintf(stderr, "%.3f s %s: ", (DOUBLE) (gSimTime - SIM_CLOCK_EPOCH) / HUNDREDS_OF_NANOS_IN_A_SECOND, pChannel->name);
+        fprintf(stderr, format, value);
+        fprintf(stderr, "\n");
+    }
+}
+
+/**
+ * Returns the percentile in the unit of the histogram, the upper bound of its bucket or the largest observation
+ */
+UINT64 simGetPercentile(PMetricsHistogram pHistogram, UINT32 percent)
+{
+    UINT64 cumulative = 0;
+    UINT32 i;
+
+    for (i = 0; i < pHistogram->boundCount && pHistogram->count != 0; i++) {
+        cumulative += pHistogram->buckets[i];
+        if (cumulative * 100 >= (UINT64) pHistogram->count * percent) {
+            return MIN(pHistogram->pBounds[i], (UINT64) pHistogram->max);
+        }
+    }
+
+    return (UINT64) pHistogram->max;
+}
+
+/**
+ * Sizes a video frame, key frames SIM_KEY_FRAME_SIZE_FACTOR times the rest with the average kept
+ */
+UINT32 simVideoFrameSize(PSimChannel pChannel, UINT64 averageSize, UINT32 gopLength, BOOL keyFrame)
+{
+    UINT64 size = averageSize, keyFactor = MIN(SIM_KEY_FRAME_SIZE_FACTOR, gopLength);
+
+    if (gopLength > 1) {
+        size = keyFrame ? size * keyFactor : size * (gopLength - keyFactor) / (gopLength - 1);
+        size = size * (100 - SIM_FRAME_SIZE_JITTER_PERCENT + rand_r(&pChannel->randomSeed) % (2 * SIM_FRAME_SIZE_JITTER_PERCENT + 1)) / 100;
+    }
+
+    return (UINT32) MAX(size, 1);
+}
+
+/**
+ * Writes the archive kvs streams the channel from, SIM_ARCHIVE_GOP_COUNT GOPs with the audio interleaved by timestamp
+ * the way kvspack does. Every frame points at the same zeroed payload, the model only looks at the sizes, so the file
+ * stays small whatever the bitrate.
+ */
+STATUS simWriteArchive(PSimChannel pChannel, PSimConfig pConfig)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    UINT64 frameDuration = HUNDREDS_OF_NANOS_IN_A_SECOND / pConfig->fps, averageSize = MAX(pConfig->bitrate / 8 / pConfig->fps, 1);
+    UINT64 videoTs = 0, audioTs = 0, end, maxSize = SIM_AUDIO_FRAME_SIZE;
+    UINT32 gopLength = (UINT32) MAX(pConfig->keyFrameInterval / frameDuration, 1), videoFrames, audioFrames, frameCount, i, v = 0, a = 0;
+    PFrameArchiveIndexEntry pIndex = NULL, pEntry;
+    FrameArchiveHeader header;
+    FILE* pFile = NULL;
+
+    videoFrames = gopLength * SIM_ARCHIVE_GOP_COUNT;
+    end = videoFrames * frameDuration;
+    audioFrames = pConfig->audio ? (UINT32) (end / SIM_AUDIO_FRAME_DURATION) : 0;
+    frameCount = videoFrames + audioFrames;
+    CHK(NULL != (pIndex = (PFrameArchiveIndexEntry) MEMCALLOC(frameCount, SIZEOF(FrameArchiveIndexEntry))), STATUS_NOT_ENOUGH_MEMORY);
+
+    for (i = 0; i < frameCount; i++) {
+        pEntry = &pIndex[i];
+        pEntry->offset = SIZEOF(FrameArchiveHeader);
+        if (a == audioFrames || (v < videoFrames && videoTs <= audioTs)) {
+            pEntry->trackId = DEFAULT_VIDEO_TRACK_ID;
+            pEntry->duration = frameDuration;
+            pEntry->flags = v % gopLength == 0 ? FRAME_ARCHIVE_ENTRY_FLAG_KEY_FRAME : FRAME_ARCHIVE_ENTRY_FLAG_NONE;
+            pEntry->size = simVideoFrameSize(pChannel, averageSize, gopLength, v % gopLength == 0);
+            videoTs += frameDuration;
+            v++;
+        } else {
+            pEntry->trackId = DEFAULT_AUDIO_TRACK_ID;
+            pEntry->duration = SIM_AUDIO_FRAME_DURATION;
+            pEntry->flags = FRAME_ARCHIVE_ENTRY_FLAG_KEY_FRAME;
+            pEntry->size = SIM_AUDIO_FRAME_SIZE;
+            audioTs += SIM_AUDIO_FRAME_DURATION;
+            a++;
+        }
+        maxSize = MAX(maxSize, pEntry->size);
+    }
+
+    MEMSET(&header, 0x00, SIZEOF(header));
+    MEMCPY(header.magic, FRAME_ARCHIVE_MAGIC, FRAME_ARCHIVE_MAGIC_LEN);
+    header.version = FRAME_ARCHIVE_CURRENT_VERSION;
+    header.frameCount = frameCount;
+    header.indexOffset = ROUND_UP(SIZEOF(FrameArchiveHeader) + maxSize, SIZEOF(UINT64));
+
+    // the payload is a hole in the file
+    CHK(NULL != (pFile = FOPEN(pChannel->archivePath, "wb")), STATUS_OPEN_FILE_FAILED);
+    CHK(FWRITE(&header, SIZEOF(header), 1, pFile) == 1, STATUS_WRITE_TO_FILE_FAILED);
+    CHK(FSEEK(pFile, (INT64) header.indexOffset, SEEK_SET) == 0, STATUS_WRITE_TO_FILE_FAILED);
+    CHK(FWRITE(pIndex, SIZEOF(FrameArchiveIndexEntry), frameCount, pFile) == frameCount, STATUS_WRITE_TO_FILE_FAILED);
+
+CleanUp:
+
+    if (pFile != NULL && FCLOSE(pFile) != 0 && STATUS_SUCCEEDED(retStatus)) {
+        retStatus = STATUS_WRITE_TO_FILE_FAILED;
+    }
+
+    SAFE_MEMFREE(pIndex);
+
+    return retStatus;
+}
+
+PSimChannel simFindChannel(PSim pSim, STREAM_HANDLE streamHandle)
+{
+    if (pSim == NULL || !IS_VALID_STREAM_HANDLE(streamHandle) || streamHandle > pSim->pConfig->channelCount) {
+        return NULL;
+    }
+
+    return &pSim->pChannels[streamHandle - 1];
+}
+
+UINT64 simGetBufferedDuration(PSimChannel pChannel)
+{
+    return pChannel->fragmentCount == 0 ? 0 : pChannel->newestTimestamp - pChannel->fragments[pChannel->fragmentHead].timestamp;
+}
+
+/**
+ * Calls the ack callback kvs registered with the SDK, timestamped in ms like the acks of the service
+ */
+VOID simAckFragment(PSim pSim, PSimChannel pChannel, PSimFragment pFragment, FRAGMENT_ACK_TYPE ackType)
+{
+    FragmentAck fragmentAck;
+
+    MEMSET(&fragmentAck, 0x00, SIZEOF(fragmentAck));
+    fragmentAck.version = FRAGMENT_ACK_CURRENT_VERSION;
+    fragmentAck.ackType = ackType;
+    fragmentAck.timestamp = pFragment->timestamp / HUNDREDS_OF_NANOS_IN_A_MILLISECOND;
+    fragmentAck.result = SERVICE_CALL_RESULT_OK;
+    pSim->pCallbacks->fragmentAckReceivedFn(pSim->pCallbacks->customData, pChannel->streamHandle, 0, &fragmentAck);
+}
+
+/**
+ * Drops the oldest fragment, the frames are lost
+ */
+VOID simEvictFragment(PSim pSim, PSimChannel pChannel)
+{
+    PSimFragment pFragment = &pChannel->fragments[pChannel->fragmentHead];
+
+    pChannel->bufferedBytes -= pFragment->size;
+    pSim->bufferedBytes -= pFragment->size;
+    pChannel->fragmentHead = (pChannel->fragmentHead + 1) % SIM_MAX_FRAGMENTS;
+    pChannel->fragmentCount--;
+}
+
+/**
+ * The next session of the stream starts from the last persisted fragment
+ */
+VOID simResendFragments(PSimChannel pChannel)
+{
+    PSimFragment pFragment;
+    UINT32 i;
+
+    for (i = 0; i < pChannel->fragmentCount; i++) {
+        pFragment = &pChannel->fragments[(pChannel->fragmentHead + i) % SIM_MAX_FRAGMENTS];
+        pChannel->bytesResent += pFragment->sent;
+        pFragment->sent = 0;
+        pFragment->ackTime = 0;
+    }
+}
+
+/**
+ * Checks a frame kvs put the way the stream would decode it. A video frame other than a key frame only decodes when
+ * every frame since its key frame was put, whatever the late policy.
+ */
+VOID simCheckFrame(PSim pSim, PSimChannel pChannel, PFrame pFrame)
+{
+    PSimTrack pTrack = pFrame->trackId == DEFAULT_VIDEO_TRACK_ID ? &pChannel->videoTrack : &pChannel->audioTrack;
+
+    if (pTrack->put && pFrame->decodingTs < pTrack->nextTimestamp) {
+        simViolation(pSim, pChannel, (PCHAR) "timestamp %" PRIu64 " put out of order", pFrame->decodingTs);
+    }
+
+    if (pFrame->trackId == DEFAULT_VIDEO_TRACK_ID && (pFrame->flags & FRAME_FLAG_KEY_FRAME) == 0 &&
+        (!pTrack->put || pFrame->decodingTs != pTrack->nextTimestamp)) {
+        pChannel->gopBreaks++;
+        simViolation(pSim, pChannel, (PCHAR) "frame at %" PRIu64 " ms put without the frames before it in its GOP",
+                     pFrame->decodingTs / HUNDREDS_OF_NANOS_IN_A_MILLISECOND);
+    }
+
+    // the archive frames follow each other by their durations, a gap is what kvs dropped
+    if (pFrame->decodingTs > pTrack->nextTimestamp && pFrame->duration != 0) {
+        pChannel->framesDropped += (pFrame->decodingTs - pTrack->nextTimestamp) / pFrame->duration;
+    }
+
+    pTrack->put = TRUE;
+    pTrack->nextTimestamp = MAX(pTrack->nextTimestamp, pFrame->decodingTs + pFrame->duration);
+}
+
+/**
+ * Adds a frame kvs put to the content store and signals pressure to kvs from inside the put like the SDK
+ */
+VOID simStoreFrame(PSim pSim, PSimChannel pChannel, PFrame pFrame)
+{
+    PClientCallbacks pCallbacks = pSim->pCallbacks;
+    PSimFragment pFragment;
+    UINT64 bufferedDuration, remaining;
+    BOOL pressure;
+
+    pChannel->framesPut++;
+    if (pFrame->trackId == DEFAULT_VIDEO_TRACK_ID) {
+        pChannel->newestTimestamp = pFrame->presentationTs;
+    }
+
+    if (pFrame->trackId == DEFAULT_VIDEO_TRACK_ID && (pFrame->flags & FRAME_FLAG_KEY_FRAME) != 0) {
+        if (pChannel->fragmentCount == SIM_MAX_FRAGMENTS) {
+            simEvictFragment(pSim, pChannel);
+            pChannel->evictedFragments++;
+        }
+        pFragment = &pChannel->fragments[(pChannel->fragmentHead + pChannel->fragmentCount++) % SIM_MAX_FRAGMENTS];
+        MEMSET(pFragment, 0x00, SIZEOF(SimFragment));
+        pFragment->timestamp = pFrame->presentationTs;
+        pFragment->putTime = gSimTime;
+    } else if (pChannel->fragmentCount == 0) {
+        // audio ahead of the first key frame, the stream starts with the key frame
+        return;
+    }
+
+    pFragment = &pChannel->fragments[(pChannel->fragmentHead + pChannel->fragmentCount - 1) % SIM_MAX_FRAGMENTS];
+    pFragment->size += pFrame->size;
+    pChannel->bufferedBytes += pFrame->size;
+    pSim->bufferedBytes += pFrame->size;
+
+    // what the SDK drops to make room breaks the stream, admission is there so it never has to
+    while (pSim->bufferedBytes > pSim->storageSize && pChannel->fragmentCount > 1) {
+        simViolation(pSim, pChannel, (PCHAR) "content store overflowed by %" PRIu64 " bytes", pSim->bufferedBytes - pSim->storageSize);
+        pCallbacks->droppedFrameReportFn(pCallbacks->customData, pChannel->streamHandle,
+                                         pChannel->fragments[pChannel->fragmentHead].timestamp / HUNDREDS_OF_NANOS_IN_A_MILLISECOND);
+        simEvictFragment(pSim, pChannel);
+        pChannel->evictedFragments++;
+    }
+    while ((bufferedDuration = simGetBufferedDuration(pChannel)) > pChannel->bufferDuration && pChannel->fragmentCount > 1) {
+        simViolation(pSim, pChannel, (PCHAR) "buffer duration exceeded by %" PRIu64 " ms",
+                     (bufferedDuration - pChannel->bufferDuration) / HUNDREDS_OF_NANOS_IN_A_MILLISECOND);
+        pCallbacks->droppedFrameReportFn(pCallbacks->customData, pChannel->streamHandle,
+                                         pChannel->fragments[pChannel->fragmentHead].timestamp / HUNDREDS_OF_NANOS_IN_A_MILLISECOND);
+        simEvictFragment(pSim, pChannel);
+        pChannel->evictedFragments++;
+    }
+
+    pSim->maxBufferedBytes = MAX(pSim->maxBufferedBytes, pSim->bufferedBytes);
+    pSim->maxBufferedDuration = MAX(pSim->maxBufferedDuration, bufferedDuration);
+
+    remaining = pSim->storageSize - MIN(pSim->bufferedBytes, pSim->storageSize);
+    pressure = remaining * 100 < pSim->storageSize * SIM_STORAGE_PRESSURE_PERCENT;
+    if (pressure) {
+        pSim->pressureEvents += pSim->storagePressure ? 0 : 1;
+        pCallbacks->storageOverflowPressureFn(pCallbacks->customData, remaining);
+    }
+    pSim->storagePressure = pressure;
+
+    remaining = pChannel->bufferDuration - MIN(bufferedDuration, pChannel->bufferDuration);
+    pressure = remaining * 100 < pChannel->bufferDuration * SIM_BUFFER_DURATION_PRESSURE_PERCENT;
+    if (pressure) {
+        pSim->pressureEvents += pChannel->bufferDurationPressure ? 0 : 1;
+        pCallbacks->bufferDurationOverflowPressureFn(pCallbacks->customData, pChannel->streamHandle, remaining);
+    }
+    pChannel->bufferDurationPressure = pressure;
+}
+
+/**
+ * One step of the service for every stream: readies the streams kvs created since the last one, sends what the
+ * bandwidth allows and acks what is due. Returns whether a stream got ready, kvs has tracks to open then.
+ */
+BOOL simStepService(PSim pSim, UINT64 now)
+{
+    PSimConfig pConfig = pSim->pConfig;
+    PClientCallbacks pCallbacks = pSim->pCallbacks;
+    PSimChannel pChannel;
+    PSimFragment pFragment;
+    UINT64 time = now - SIM_CLOCK_EPOCH, bandwidth = pConfig->bandwidth, ackLatency = pConfig->ackLatency, budget, size;
+    UINT32 i, j;
+    BOOL ready = FALSE;
+
+    for (i = 0; i < pConfig->channelCount; i++) {
+        pChannel = &pSim->pChannels[i];
+        if (IS_VALID_STREAM_HANDLE(pChannel->streamHandle) && !pChannel->ready) {
+            pChannel->ready = TRUE;
+            ready = TRUE;
+            pCallbacks->streamReadyFn(pCallbacks->customData, pChannel->streamHandle);
+        }
+    }
+
+    for (i = 0; i < pConfig->eventCount; i++) {
+        if (!pConfig->events[i].applied && time >= pConfig->events[i].start) {
+            pConfig->events[i].applied = TRUE;
+            if (pConfig->events[i].kind == SIM_EVENT_STALL) {
+                pSim->stallTime = MAX(pSim->stallTime, now + pConfig->events[i].value);
+            } else if (pConfig->events[i].kind == SIM_EVENT_ERROR) {
+                // the SDK reports the failed session and starts the next one from the last persisted fragment
+                for (j = 0; j < pConfig->channelCount; j++) {
+                    pChannel = &pSim->pChannels[j];
+                    if (pChannel->ready) {
+                        simResendFragments(pChannel);
+                        pCallbacks->streamErrorReportFn(pCallbacks->customData, pChannel->streamHandle, 0,
+                                                        pChannel->fragmentCount == 0 ? 0
+                                                            : pChannel->fragments[pChannel->fragmentHead].timestamp / HUNDREDS_OF_NANOS_IN_A_MILLISECOND,
+                                                        STATUS_SERVICE_CALL_UNKNOWN_ERROR);
+                    }
+                }
+                pSim->linkUpTime = MAX(pSim->linkUpTime, now + pConfig->events[i].duration);
+            }
+        }
+    }
+
+    if (simEventActive(pConfig, SIM_EVENT_OUTAGE, time, NULL) || now < pSim->linkUpTime) {
+        return ready;
+    }
+
+    simEventActive(pConfig, SIM_EVENT_THROTTLE, time, &bandwidth);
+    simEventActive(pConfig, SIM_EVENT_SLOW_ACKS, time, &ackLatency);
+
+    for (i = 0; i < pConfig->channelCount; i++) {
+        pChannel = &pSim->pChannels[i];
+        // unused credit is not saved up past one step, a link does not send faster after an idle while
+        pChannel->sendCredit = MIN(pChannel->sendCredit + bandwidth * SIM_NETWORK_TICK, 2 * bandwidth * SIM_NETWORK_TICK);
+        budget = pChannel->sendCredit / (8 * HUNDREDS_OF_NANOS_IN_A_SECOND);
+
+        for (j = 0; j < pChannel->fragmentCount && budget != 0; j++) {
+            pFragment = &pChannel->fragments[(pChannel->fragmentHead + j) % SIM_MAX_FRAGMENTS];
+            size = MIN(budget, pFragment->size - pFragment->sent);
+            if (size != 0 && pFragment->sent == 0) {
+                simAckFragment(pSim, pChannel, pFragment, FRAGMENT_ACK_TYPE_BUFFERING);
+            }
+            pFragment->sent += size;
+            budget -= size;
+            pChannel->sendCredit -= size * 8 * HUNDREDS_OF_NANOS_IN_A_SECOND;
+        }
+
+        // a fragment is received once the next one starts
+        for (j = 0; j + 1 < pChannel->fragmentCount; j++) {
+            pFragment = &pChannel->fragments[(pChannel->fragmentHead + j) % SIM_MAX_FRAGMENTS];
+            if (pFragment->sent == pFragment->size && pFragment->ackTime == 0) {
+                pFragment->ackTime = now + ackLatency;
+                simAckFragment(pSim, pChannel, pFragment, FRAGMENT_ACK_TYPE_RECEIVED);
+            }
+        }
+
+        while (pChannel->fragmentCount > 1 && (pFragment = &pChannel->fragments[pChannel->fragmentHead])->ackTime != 0 &&
+               pFragment->ackTime <= now) {
+            metricsHistogramObserve(&pChannel->ackLatency, (now - pFragment->putTime) / HUNDREDS_OF_NANOS_IN_A_MILLISECOND);
+            pChannel->bytesPersisted += pFragment->size;
+            simAckFragment(pSim, pChannel, pFragment, FRAGMENT_ACK_TYPE_PERSISTED);
+            simEvictFragment(pSim, pChannel);
+        }
+    }
+
+    return ready;
+}
+
+/**
+ * Moves the clock to the time, stepping the service on the way. Waiting kvs is woken up at the step a stream got
+ * ready in, a put is not.
+ */
+VOID simAdvance(PSim pSim, UINT64 time, BOOL wake)
+{
+    // kvs runs one put thread, the only thread moving the clock once the streams are created
+    while (gSimTime < time || pSim->nextStepTime == gSimTime) {
+        if (pSim->nextStepTime > time) {
+            gSimTime = time;
+            break;
+        }
+
+        gSimTime = pSim->nextStepTime;
+        pSim->nextStepTime += SIM_NETWORK_TICK;
+        if (simStepService(pSim, gSimTime) && wake) {
+            break;
+        }
+    }
+}
+
+/**
+ * The wait kvs sleeps in between its frames
+ */
+STATIC VOID simWait(UINT64 deadline)
+{
+    simAdvance(gpSim, deadline, TRUE);
+}
+
+STATIC VOID simSleep(UINT64 duration)
+{
+    simAdvance(gpSim, gSimTime + duration, FALSE);
+}
+
+STATUS __wrap_createKinesisVideoClient(PDeviceInfo pDeviceInfo, PClientCallbacks pClientCallbacks, PCLIENT_HANDLE pClientHandle)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+
+    CHK(gpSim != NULL && pDeviceInfo != NULL && pClientCallbacks != NULL && pClientHandle != NULL, STATUS_NULL_ARG);
+
+    SET_LOGGER_LOG_LEVEL(pDeviceInfo->clientInfo.loggerLogLevel);
+    gpSim->pCallbacks = pClientCallbacks;
+    gpSim->storageSize = pDeviceInfo->storageInfo.storageSize;
+    *pClientHandle = (CLIENT_HANDLE) 1;
+
+CleanUp:
+
+    return retStatus;
+}
+
+STATUS __wrap_freeKinesisVideoClient(PCLIENT_HANDLE pClientHandle)
+{
+    if (pClientHandle != NULL) {
+        *pClientHandle = INVALID_CLIENT_HANDLE_VALUE;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * Streams are matched to the channels by name, they get ready at the next service step
+ */
+STATUS __wrap_createKinesisVideoStream(CLIENT_HANDLE clientHandle, PStreamInfo pStreamInfo, PSTREAM_HANDLE pStreamHandle)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    PSimChannel pChannel = NULL;
+    UINT32 i;
+
+    UNUSED_PARAM(clientHandle);
+
+    CHK(gpSim != NULL && pStreamInfo != NULL && pStreamHandle != NULL, STATUS_NULL_ARG);
+    for (i = 0; i < gpSim->pConfig->channelCount && pChannel == NULL; i++) {
+        if (STRCMP(gpSim->pChannels[i].name, pStreamInfo->name) == 0) {
+            pChannel = &gpSim->pChannels[i];
+        }
+    }
+    CHK(pChannel != NULL && !IS_VALID_STREAM_HANDLE(pChannel->streamHandle), STATUS_INVALID_ARG);
+
+    pChannel->streamHandle = (STREAM_HANDLE) (pChannel - gpSim->pChannels + 1);
+    pChannel->bufferDuration = pStreamInfo->streamCaps.bufferDuration;
+    *pStreamHandle = pChannel->streamHandle;
+
+CleanUp:
+
+    return retStatus;
+}
+
+STATUS __wrap_stopKinesisVideoStreamSync(STREAM_HANDLE streamHandle)
+{
+    // the run is measured up to the stop time, what is left buffered is not waited for
+    return simFindChannel(gpSim, streamHandle) != NULL ? STATUS_SUCCESS : STATUS_INVALID_ARG;
+}
+
+STATUS __wrap_freeKinesisVideoStream(PSTREAM_HANDLE pStreamHandle)
+{
+    if (pStreamHandle != NULL) {
+        *pStreamHandle = INVALID_STREAM_HANDLE_VALUE;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * The put path of kvs ends here: the frame is checked, stored and the put thread charged for it
+ */
+STATUS __wrap_putKinesisVideoFrame(STREAM_HANDLE streamHandle, PFrame pFrame)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    PSimChannel pChannel = simFindChannel(gpSim, streamHandle);
+
+    CHK(pChannel != NULL && pFrame != NULL, STATUS_NULL_ARG);
+    CHK(pChannel->ready, STATUS_INVALID_OPERATION);
+
+    simCheckFrame(gpSim, pChannel, pFrame);
+    simStoreFrame(gpSim, pChannel, pFrame);
+    simAdvance(gpSim, MAX(gSimTime + gpSim->pConfig->putCost, gpSim->stallTime), FALSE);
+
+CleanUp:
+
+    return retStatus;
+}
+
+STATUS __wrap_kinesisVideoStreamFormatChanged(STREAM_HANDLE streamHandle, UINT32 codecPrivateDataSize, PBYTE pCodecPrivateData, UINT64 trackId)
+{
+    UNUSED_PARAM(codecPrivateDataSize);
+    UNUSED_PARAM(pCodecPrivateData);
+    UNUSED_PARAM(trackId);
+
+    return simFindChannel(gpSim, streamHandle) != NULL ? STATUS_SUCCESS : STATUS_INVALID_ARG;
+}
+
+STATUS __wrap_getKinesisVideoMetrics(CLIENT_HANDLE clientHandle, PClientMetrics pClientMetrics)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+
+    UNUSED_PARAM(clientHandle);
+
+    CHK(gpSim != NULL && pClientMetrics != NULL, STATUS_NULL_ARG);
+    pClientMetrics->contentStoreSize = gpSim->storageSize;
+    pClientMetrics->contentStoreAllocatedSize = MIN(gpSim->bufferedBytes, gpSim->storageSize);
+    pClientMetrics->contentStoreAvailableSize = gpSim->storageSize - pClientMetrics->contentStoreAllocatedSize;
+    pClientMetrics->totalContentViewsSize = gpSim->bufferedBytes;
+
+CleanUp:
+
+    return retStatus;
+}
+
+STATUS __wrap_getKinesisVideoStreamMetrics(STREAM_HANDLE streamHandle, PStreamMetrics pStreamMetrics)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    PSimChannel pChannel = simFindChannel(gpSim, streamHandle);
+
+    CHK(pChannel != NULL && pStreamMetrics != NULL, STATUS_NULL_ARG);
+    pStreamMetrics->currentViewDuration = simGetBufferedDuration(pChannel);
+    pStreamMetrics->overallViewDuration = pStreamMetrics->currentViewDuration;
+    pStreamMetrics->currentViewSize = pChannel->bufferedBytes;
+    pStreamMetrics->overallViewSize = pChannel->bufferedBytes;
+    pStreamMetrics->currentTransferRate = gpSim->pConfig->bandwidth / 8;
+
+CleanUp:
+
+    return retStatus;
+}
+
+STATUS __wrap_kinesisVideoStreamResetConnection(STREAM_HANDLE streamHandle)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    PSimChannel pChannel = simFindChannel(gpSim, streamHandle);
+
+    CHK(pChannel != NULL, STATUS_INVALID_ARG);
+    simResendFragments(pChannel);
+
+CleanUp:
+
+    return retStatus;
+}
+
+STATUS __wrap_kinesisVideoStreamResetStream(STREAM_HANDLE streamHandle)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    PSimChannel pChannel = simFindChannel(gpSim, streamHandle);
+
+    CHK(pChannel != NULL, STATUS_INVALID_ARG);
+    // what was buffered is gone, the stream starts over at the next key frame
+    while (pChannel->fragmentCount != 0) {
+        simEvictFragment(gpSim, pChannel);
+    }
+    pChannel->videoTrack.put = FALSE;
+
+CleanUp:
+
+    return retStatus;
+}
+
+STATUS simRun(PSimConfig pConfig)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    Sim sim;
+    PSimChannel pChannel;
+    CHAR directory[] = "/tmp/kvssim-XXXXXX", channelListPath[MAX_PATH_LEN + 1], duration[32], size[32], threshold[32];
+    PCHAR argv[SIM_MAX_ARGUMENTS];
+    FILE* pListFile = NULL;
+    UINT64 wallStart, wallTime, framesPut = 0, framesDropped = 0, gopBreaks = 0, evicted = 0, persisted = 0, resent = 0;
+    UINT64 ackLatencyMax = 0, ackP50 = 0, ackP90 = 0, ackP99 = 0;
+    INT32 argc = 0, stdoutFd = -1, result;
+    UINT32 i;
+    BOOL directoryCreated = FALSE;
+
+    MEMSET(&sim, 0x00, SIZEOF(Sim));
+    sim.pConfig = pConfig;
+    sim.nextStepTime = gSimTime;
+    CHK(NULL != (sim.pChannels = (PSimChannel) MEMCALLOC(pConfig->channelCount, SIZEOF(SimChannel))), STATUS_NOT_ENOUGH_MEMORY);
+
+    CHK(mkdtemp(directory) != NULL, STATUS_INVALID_OPERATION);
+    directoryCreated = TRUE;
+    SNPRINTF(channelListPath, MAX_PATH_LEN, "%s/channels.txt", directory);
+    CHK(NULL != (pListFile = FOPEN(channelListPath, "w")), STATUS_OPEN_FILE_FAILED);
+    for (i = 0; i < pConfig->channelCount; i++) {
+        pChannel = &sim.pChannels[i];
+        SNPRINTF(pChannel->name, SIZEOF(pChannel->name), "channel-%u", i);
+        SNPRINTF(pChannel->archivePath, MAX_PATH_LEN, "%s/%s%s", directory, pChannel->name, CHANNEL_ARCHIVE_EXTENSION);
+        pChannel->randomSeed = pConfig->seed + i;
+        pChannel->streamHandle = INVALID_STREAM_HANDLE_VALUE;
+        metricsHistogramInit(&pChannel->ackLatency, gSimAckLatencyBounds, ARRAY_SIZE(gSimAckLatencyBounds), 0.001);
+        CHK_STATUS(simWriteArchive(pChannel, pConfig));
+        fprintf(pListFile, "%s %s\n", pChannel->name, pChannel->archivePath);
+    }
+    CHK(FCLOSE(pListFile) == 0, STATUS_WRITE_TO_FILE_FAILED);
+    pListFile = NULL;
+
+    // one put thread like the model has, recovery left to the SDK, which the model is, and a log nothing waits on
+    SNPRINTF(duration, SIZEOF(duration), "%" PRIu64, (UINT64) (pConfig->duration / HUNDREDS_OF_NANOS_IN_A_SECOND));
+    SNPRINTF(size, SIZEOF(size), "%" PRIu64, pConfig->bufferSize / 1024);
+    SNPRINTF(threshold, SIZEOF(threshold), "%" PRIu64, (UINT64) (pConfig->lateThreshold / HUNDREDS_OF_NANOS_IN_A_MILLISECOND));
+    argv[argc++] = (PCHAR) "kvs";
+    argv[argc++] = (PCHAR) "--channel-list";
+    argv[argc++] = channelListPath;
+    argv[argc++] = (PCHAR) "--workers";
+    argv[argc++] = (PCHAR) "1";
+    argv[argc++] = (PCHAR) "--recovery";
+    argv[argc++] = (PCHAR) "off";
+    argv[argc++] = (PCHAR) "--log-mode";
+    argv[argc++] = (PCHAR) "sync";
+    argv[argc++] = (PCHAR) "--log-level";
+    argv[argc++] = (PCHAR) "warn";
+    argv[argc++] = (PCHAR) "--duration";
+    argv[argc++] = duration;
+    argv[argc++] = (PCHAR) "--size";
+    argv[argc++] = size;
+    argv[argc++] = (PCHAR) "--late-policy";
+    argv[argc++] = pConfig->latePolicy;
+    argv[argc++] = (PCHAR) "--late-threshold";
+    argv[argc++] = threshold;
+    argv[argc] = NULL;
+
+    // never used by the model, kvs only checks they are set
+    setenv(ACCESS_KEY_ENV_VAR, "SIMULATED", 0);
+    setenv(SECRET_KEY_ENV_VAR, "SIMULATED", 0);
+
+    // everything reading the time from here on reads the virtual clock, the SDK helpers included
+    gpSim = &sim;
+    pacerSetClock(simGetTime, simWait);
+    globalGetTime = simGetTime;
+    globalThreadSleep = simSleep;
+
+    // what kvs prints goes to stderr, stdout keeps the JSON line only
+    fflush(stdout);
+    CHK((stdoutFd = dup(STDOUT_FILENO)) >= 0 && dup2(STDERR_FILENO, STDOUT_FILENO) >= 0, STATUS_INVALID_OPERATION);
+    // getopt starts over on the arguments of kvs
+    optind = 0;
+    wallStart = simGetWallTime();
+    result = kvsMain(argc, argv);
+    wallTime = simGetWallTime() - wallStart;
+    fflush(stdout);
+    CHK(dup2(stdoutFd, STDOUT_FILENO) >= 0, STATUS_INVALID_OPERATION);
+    CHK_STATUS((STATUS) result);
+
+    for (i = 0; i < pConfig->channelCount; i++) {
+        pChannel = &sim.pChannels[i];
+        framesPut += pChannel->framesPut;
+        framesDropped += pChannel->framesDropped;
+        gopBreaks += pChannel->gopBreaks;
+        evicted += pChannel->evictedFragments;
+        persisted += pChannel->bytesPersisted;
+        resent += pChannel->bytesResent;
+        ackP50 = MAX(ackP50, simGetPercentile(&pChannel->ackLatency, 50));
+        ackP90 = MAX(ackP90, simGetPercentile(&pChannel->ackLatency, 90));
+        ackP99 = MAX(ackP99, simGetPercentile(&pChannel->ackLatency, 99));
+        ackLatencyMax = MAX(ackLatencyMax, (UINT64) pChannel->ackLatency.max);
+    }
+
+    fprintf(pConfig->pOutput,
+            "{\"channels\":%u,\"bitrateKbps\":%" PRIu64 ",\"bandwidthKbps\":%" PRIu64 ",\"bufferKB\":%" PRIu64 ",\"events\":%u"
+            ",\"simulatedSeconds\":%" PRIu64 ",\"wallMs\":%" PRIu64 ",\"speedup\":%.0f,\"framesPut\":%" PRIu64 ",\"framesDropped\":%" PRIu64
+            ",\"gopBreaks\":%" PRIu64 ",\"evictedFragments\":%" PRIu64 ",\"pressureEvents\":%" PRIu64
+            ",\"maxBufferKB\":%" PRIu64 ",\"maxBufferedMs\":%" PRIu64
+            ",\"ackLatencyMsP50\":%" PRIu64 ",\"ackLatencyMsP90\":%" PRIu64 ",\"ackLatencyMsP99\":%" PRIu64 ",\"ackLatencyMsMax\":%" PRIu64
+            ",\"persistedKbps\":%.0f,\"resentKB\":%" PRIu64 ",\"violations\":%" PRIu64 "}\n",
+            pConfig->channelCount, pConfig->bitrate / 1000, pConfig->bandwidth / 1000, pConfig->bufferSize / 1024, pConfig->eventCount,
+            (UINT64) (pConfig->duration / HUNDREDS_OF_NANOS_IN_A_SECOND), (UINT64) (wallTime / HUNDREDS_OF_NANOS_IN_A_MILLISECOND),
+            wallTime == 0 ? 0.0 : (DOUBLE) pConfig->duration / wallTime, framesPut, framesDropped, gopBreaks, evicted,
+            sim.pressureEvents, sim.maxBufferedBytes / 1024, (UINT64) (sim.maxBufferedDuration / HUNDREDS_OF_NANOS_IN_A_MILLISECOND),
+            ackP50, ackP90, ackP99, ackLatencyMax,
+            (DOUBLE) persisted * 8 / 1000 / pConfig->channelCount / (pConfig->duration / HUNDREDS_OF_NANOS_IN_A_SECOND), resent / 1024,
+            sim.violations);
+    fflush(pConfig->pOutput);
+
+    CHK(sim.violations == 0, STATUS_SIM_INVARIANT_VIOLATED);
+
+CleanUp:
+
+    if (stdoutFd >= 0) {
+        close(stdoutFd);
+    }
+
+    if (pListFile != NULL) {
+        FCLOSE(pListFile);
+    }
+
+    if (directoryCreated) {
+        for (i = 0; i < pConfig->channelCount; i++) {
+            unlink(sim.pChannels[i].archivePath);
+        }
+        unlink(channelListPath);
+        rmdir(directory);
+    }
+
+    SAFE_MEMFREE(sim.pChannels);
+
+    return retStatus;
+}
+
+INT32 main(INT32 argc, CHAR *argv[])
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    PCHAR outputPath = NULL;
+    PACER_LATE_POLICY latePolicy;
+    INT32 choice, option_index = 0;
+    UINT64 value;
+    SimConfig config;
+
+    MEMSET(&config, 0x00, SIZEOF(config));
+    config.duration = DEFAULT_SIM_DURATION * HUNDREDS_OF_NANOS_IN_A_SECOND;
+    config.channelCount = DEFAULT_SIM_CHANNELS;
+    config.fps = DEFAULT_SIM_FPS;
+    config.bitrate = DEFAULT_SIM_BITRATE * 1000;
+    config.keyFrameInterval = DEFAULT_SIM_KEY_FRAME_INTERVAL * HUNDREDS_OF_NANOS_IN_A_MILLISECOND;
+    config.bufferSize = DEFAULT_SIM_BUFFER_SIZE * 1024;
+    config.ackLatency = DEFAULT_SIM_ACK_LATENCY * HUNDREDS_OF_NANOS_IN_A_MILLISECOND;
+    config.bandwidth = DEFAULT_SIM_BANDWIDTH * 1000;
+    config.putCost = DEFAULT_SIM_PUT_COST * HUNDREDS_OF_NANOS_IN_A_MICROSECOND;
+    config.latePolicy = (PCHAR) DEFAULT_SIM_LATE_POLICY;
+    config.lateThreshold = DEFAULT_PACER_LATE_THRESHOLD;
+    config.seed = DEFAULT_SIM_SEED;
+    config.pOutput = stdout;
+
+    while ((choice = getopt_long(argc, argv, ":D:c:f:b:k:as:L:B:p:l:t:e:r:o:h", long_options, &option_index)) != -1) {
+        switch (choice) {
+        case 'D':
+            CHK_STATUS(STRTOUI64(optarg, NULL, 10, &value));
+            CHK(value != 0, STATUS_INVALID_ARG);
+            config.duration = value * HUNDREDS_OF_NANOS_IN_A_SECOND;
+            break;
+        case 'c':
+            CHK_STATUS(STRTOUI64(optarg, NULL, 10, &value));
+            CHK(value != 0 && value <= MAX_CHANNEL_COUNT, STATUS_INVALID_ARG);
+            config.channelCount = (UINT32) value;
+            break;
+        case 'f':
+            CHK_STATUS(STRTOUI64(optarg, NULL, 10, &config.fps));
+            CHK(config.fps != 0, STATUS_INVALID_ARG);
+            break;
+        case 'b':
+            CHK_STATUS(STRTOUI64(optarg, NULL, 10, &value));
+            CHK(value != 0, STATUS_INVALID_ARG);
+            config.bitrate = value * 1000;
+            break;
+        case 'k':
+            CHK_STATUS(STRTOUI64(optarg, NULL, 10, &value));
+            CHK(value != 0, STATUS_INVALID_ARG);
+            config.keyFrameInterval = value * HUNDREDS_OF_NANOS_IN_A_MILLISECOND;
+            break;
+        case 'a':
+            config.audio = TRUE;
+            break;
+        case 's':
+            CHK_STATUS(STRTOUI64(optarg, NULL, 10, &value));
+            CHK(value != 0, STATUS_INVALID_ARG);
+            config.bufferSize = value * 1024;
+            break;
+        case 'L':
+            CHK_STATUS(STRTOUI64(optarg, NULL, 10, &value));
+            config.ackLatency = value * HUNDREDS_OF_NANOS_IN_A_MILLISECOND;
+            break;
+        case 'B':
+            CHK_STATUS(STRTOUI64(optarg, NULL, 10, &value));
+            CHK(value != 0, STATUS_INVALID_ARG);
+            config.bandwidth = value * 1000;
+            break;
+        case 'p':
+            CHK_STATUS(STRTOUI64(optarg, NULL, 10, &value));
+            config.putCost = value * HUNDREDS_OF_NANOS_IN_A_MICROSECOND;
+            break;
+        case 'l':
+            if (STATUS_FAILED(pacerParseLatePolicy(optarg, &latePolicy))) {
+                fprintf(stderr, "%s: invalid late policy '%s'\n", argv[0], optarg);
+                displaySimUsage(1);
+            }
+            config.latePolicy = optarg;
+            break;
+        case 't':
+            CHK_STATUS(STRTOUI64(optarg, NULL, 10, &value));
+            config.lateThreshold = value * HUNDREDS_OF_NANOS_IN_A_MILLISECOND;
+            break;
+        case 'e':
+            if (STATUS_FAILED(simParseEvents(optarg, &config))) {
+                fprintf(stderr, "%s: invalid events '%s'\n", argv[0], optarg);
+                displaySimUsage(1);
+            }
+            break;
+        case 'r':
+            CHK_STATUS(STRTOUI64(optarg, NULL, 10, &value));
+            config.seed = (UINT32) value;
+            break;
+        case 'o':
+            outputPath = optarg;
+            break;
+        case 'h':
+            displaySimUsage(0);
+            break;
+        case ':':
+            fprintf(stderr, "%s: option '-%c' requires an argument\n", argv[0], optopt);
+            displaySimUsage(1);
+            break;
+        default:
+            displaySimUsage(1);
+        }
+    }
+
+    if (outputPath != NULL) {
+        CHK(NULL != (config.pOutput = FOPEN(outputPath, "a")), STATUS_OPEN_FILE_FAILED);
+    }
+
+    CHK_STATUS(simRun(&config));
+
+CleanUp:
+
+    if (config.pOutput != NULL && config.pOutput != stdout) {
+        FCLOSE(config.pOutput);
+    }
+
+    if (STATUS_FAILED(retStatus) && retStatus != STATUS_SIM_INVARIANT_VIOLATED) {
+        printf("Failed with status 0x%08x\n", retStatus);
+    }
+
+    return (INT32) retStatus;
+}
@@ -0,0 +1,451 @@
+/*
+ * Copyright (C) 2020 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdint.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "MemoryArena.h"
+
+#define MEMORY_ARENA_MAGIC                  0x4B564D41
+
+typedef struct {
+    UINT32 magic;
+    UINT16 classIndex;
+    UINT16 tag;
+    UINT64 size;
+} MemoryArenaHeader, *PMemoryArenaHeader;
+
+static MemoryArena gMemoryArena;
+// zero is MEMORY_TAG_SDK, what every thread kvs did not tag is charged to
+static __thread MEMORY_TAG gMemoryArenaTag;
+
+static PCHAR gMemoryTagNames[MEMORY_TAG_COUNT] = {(PCHAR) "sdk", (PCHAR) "app", (PCHAR) "content-store", (PCHAR) "frames",
+                                                  (PCHAR) "logging"};
+
+STATIC UINT32 memoryArenaClassIndex(SIZE_T blockSize)
+{
+    UINT32 log2;
+
+    if (blockSize <= 128) {
+        return blockSize <= 32 ? 0 : (UINT32) ((blockSize + 15) / 16 - 2);
+    }
+
+    log2 = 63 - (UINT32) __builtin_clzll((UINT64) blockSize - 1);
+
+    return 7 + (log2 - 7) * 4 + (UINT32) ((blockSize - 1) >> (log2 - 2)) - 4;
+}
+
+STATIC SIZE_T memoryArenaClassSize(UINT32 index)
+{
+    if (index < 7) {
+        return (SIZE_T) (index + 2) * 16;
+    }
+
+    return (SIZE_T) (5 + (index - 7) % 4) << (5 + (index - 7) / 4);
+}
+
+STATIC VOID memoryArenaCharge(PMemoryTagStats pStats, SIZE_T size)
+{
+    SIZE_T bytes = ATOMIC_ADD(&pStats->bytes, size) + size, highWater = ATOMIC_LOAD(&pStats->highWater);
+
+    ATOMIC_INCREMENT(&pStats->allocations);
+    while (bytes > highWater && !ATOMIC_COMPARE_EXCHANGE(&pStats->highWater, &highWater, bytes));
+}
+
+STATIC VOID memoryArenaChargeTag(MEMORY_TAG tag, SIZE_T size)
+{
+    memoryArenaCharge(&gMemoryArena.tags[tag], size);
+    memoryArenaCharge(&gMemoryArena.total, size);
+}
+
+STATIC VOID memoryArenaRefundTag(MEMORY_TAG tag, SIZE_T size)
+{
+    ATOMIC_SUBTRACT(&gMemoryArena.tags[tag].bytes, size);
+    ATOMIC_DECREMENT(&gMemoryArena.tags[tag].allocations);
+    ATOMIC_SUBTRACT(&gMemoryArena.total.bytes, size);
+    ATOMIC_DECREMENT(&gMemoryArena.total.allocations);
+}
+
+STATIC BOOL memoryArenaOwns(PVOID pointer)
+{
+    return (PBYTE) pointer >= gMemoryArena.pBase && (PBYTE) pointer < gMemoryArena.pBase + gMemoryArena.size;
+}
+
+/**
+ * Takes the slab out of the arena and opens its pages, FALSE once the arena is used up
+ */
+STATIC BOOL memoryArenaCarve(PMemoryArenaClass pClass, SIZE_T slabSize)
+{
+    SIZE_T carved = ATOMIC_LOAD(&gMemoryArena.carved), pageSize = (SIZE_T) getpagesize(), start, end;
+
+    do {
+        if (carved + slabSize > gMemoryArena.size) {
+            return FALSE;
+        }
+    } while (!ATOMIC_COMPARE_EXCHANGE(&gMemoryArena.carved, &carved, carved + slabSize));
+
+    // Slabs are not page aligned, a page shared with the slab before is opened twice. With the process locked into
+    // memory the pages opened are faulted in and locked here, off the path of the blocks handed out later.
+    start = carved / pageSize * pageSize;
+    end = (carved + slabSize + pageSize - 1) / pageSize * pageSize;
+    if (mprotect(gMemoryArena.pBase + start, end - start, PROT_READ | PROT_WRITE) != 0) {
+        return FALSE;
+    }
+
+    pClass->cursor = carved;
+    pClass->end = carved + slabSize;
+
+    return TRUE;
+}
+
+/**
+ * A block of the class of the size, NULL once the arena is used up
+ */
+STATIC PVOID memoryArenaAllocBlock(SIZE_T size, MEMORY_TAG tag)
+{
+    UINT32 index = memoryArenaClassIndex(size + MEMORY_ARENA_HEADER_SIZE);
+    SIZE_T blockSize = memoryArenaClassSize(index);
+    PMemoryArenaClass pClass = &gMemoryArena.classes[index];
+    PMemoryArenaHeader pHeader = NULL;
+
+    pthread_mutex_lock(&pClass->lock);
+    if (pClass->pFree != NULL) {
+        pHeader = (PMemoryArenaHeader) pClass->pFree;
+        pClass->pFree = *(PBYTE*) pClass->pFree;
+    } else {
+        // the pages of a slab are only touched as its blocks are handed out
+        if (pClass->end - pClass->cursor < blockSize && !memoryArenaCarve(pClass, MAX(MEMORY_ARENA_SLAB_SIZE / blockSize, 1) * blockSize)) {
+            memoryArenaCarve(pClass, blockSize);
+        }
+
+        if (pClass->end - pClass->cursor >= blockSize) {
+            pHeader = (PMemoryArenaHeader) (gMemoryArena.pBase + pClass->cursor);
+            pClass->cursor += blockSize;
+        }
+    }
+    pthread_mutex_unlock(&pClass->lock);
+
+    if (pHeader == NULL) {
+        return NULL;
+    }
+
+    pHeader->magic = MEMORY_ARENA_MAGIC;
+    pHeader->classIndex = (UINT16) index;
+    pHeader->tag = (UINT16) tag;
+    pHeader->size = size;
+    memoryArenaChargeTag(tag, size);
+
+    return pHeader + 1;
+}
+
+STATIC VOID memoryArenaFreeBlock(PMemoryArenaHeader pHeader)
+{
+    PMemoryArenaClass pClass = &gMemoryArena.classes[pHeader->classIndex];
+
+    memoryArenaRefundTag((MEMORY_TAG) pHeader->tag, (SIZE_T) pHeader->size);
+
+    pthread_mutex_lock(&pClass->lock);
+    *(PBYTE*) pHeader = pClass->pFree;
+    pClass->pFree = (PBYTE) pHeader;
+    pthread_mutex_unlock(&pClass->lock);
+}
+
+/**
+ * A mapping of its own, page aligned. NULL when the table is full or the alignment is larger than a page.
+ */
+STATIC PVOID memoryArenaAllocLarge(SIZE_T size, SIZE_T alignment, MEMORY_TAG tag)
+{
+    SIZE_T pageSize = (SIZE_T) getpagesize(), mappingSize = (size + pageSize - 1) / pageSize * pageSize;
+    PMemoryArenaLargeBlock pBlock;
+    PVOID pMapping = NULL;
+
+    if (alignment > pageSize || size == 0) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&gMemoryArena.largeLock);
+    if (gMemoryArena.largeCount < MEMORY_ARENA_MAX_LARGE_BLOCKS) {
+        pMapping = mmap(NULL, mappingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (pMapping == MAP_FAILED) {
+            pMapping = NULL;
+        } else {
+            pBlock = &gMemoryArena.largeBlocks[gMemoryArena.largeCount++];
+            pBlock->pointer = pMapping;
+            pBlock->pMapping = pMapping;
+            pBlock->mappingSize = mappingSize;
+            pBlock->size = size;
+            pBlock->tag = tag;
+        }
+    }
+    pthread_mutex_unlock(&gMemoryArena.largeLock);
+
+    if (pMapping != NULL) {
+        ATOMIC_ADD(&gMemoryArena.largeBytes, mappingSize);
+        memoryArenaChargeTag(tag, size);
+    }
+
+    return pMapping;
+}
+
+/**
+ * Copies the large block of the pointer, taken out of the table when removing. FALSE when the pointer is not one.
+ */
+STATIC BOOL memoryArenaFindLarge(PVOID pointer, PMemoryArenaLargeBlock pCopy, BOOL remove)
+{
+    UINT32 i;
+    BOOL found = FALSE;
+
+    pthread_mutex_lock(&gMemoryArena.largeLock);
+    for (i = 0; i < gMemoryArena.largeCount && gMemoryArena.largeBlocks[i].pointer != pointer; i++);
+    if (i < gMemoryArena.largeCount) {
+        *pCopy = gMemoryArena.largeBlocks[i];
+        if (remove) {
+            gMemoryArena.largeBlocks[i] = gMemoryArena.largeBlocks[--gMemoryArena.largeCount];
+        }
+        found = TRUE;
+    }
+    pthread_mutex_unlock(&gMemoryArena.largeLock);
+
+    return found;
+}
+
+STATIC VOID memoryArenaReleaseLarge(PMemoryArenaLargeBlock pBlock)
+{
+    memoryArenaRefundTag(pBlock->tag, pBlock->size);
+    ATOMIC_SUBTRACT(&gMemoryArena.largeBytes, pBlock->mappingSize);
+    munmap(pBlock->pMapping, pBlock->mappingSize);
+}
+
+STATIC PVOID memoryArenaAlignAlloc(SIZE_T size, SIZE_T alignment)
+{
+    MEMORY_TAG tag = gMemoryArenaTag;
+    PVOID pointer = NULL;
+
+    if (alignment <= MEMORY_ARENA_HEADER_SIZE && size <= MEMORY_ARENA_MAX_BLOCK_SIZE - MEMORY_ARENA_HEADER_SIZE) {
+        pointer = memoryArenaAllocBlock(size, tag);
+    } else {
+        pointer = memoryArenaAllocLarge(size, alignment, tag);
+    }
+
+    if (pointer == NULL && size != 0) {
+        ATOMIC_INCREMENT(&gMemoryArena.overflows);
+        pointer = alignment <= MEMORY_ARENA_HEADER_SIZE ? gMemoryArena.previousAlloc(size) : gMemoryArena.previousAlignAlloc(size, alignment);
+    }
+
+    return pointer;
+}
+
+STATIC PVOID memoryArenaAlloc(SIZE_T size)
+{
+    return memoryArenaAlignAlloc(size, MEMORY_ARENA_HEADER_SIZE);
+}
+
+STATIC PVOID memoryArenaCalloc(SIZE_T count, SIZE_T size)
+{
+    PVOID pointer = NULL;
+    SIZE_T total;
+
+    if (size != 0 && count > SIZE_MAX / size) {
+        return NULL;
+    }
+
+    total = count * size;
+    if (total <= MEMORY_ARENA_MAX_BLOCK_SIZE - MEMORY_ARENA_HEADER_SIZE) {
+        if ((pointer = memoryArenaAllocBlock(total, gMemoryArenaTag)) != NULL) {
+            MEMSET(pointer, 0x00, total);
+        }
+    } else {
+        // fresh mappings are zeroed, clearing them would fault every page of the content store in
+        pointer = memoryArenaAllocLarge(total, MEMORY_ARENA_HEADER_SIZE, gMemoryArenaTag);
+    }
+
+    if (pointer == NULL && total != 0) {
+        ATOMIC_INCREMENT(&gMemoryArena.overflows);
+        pointer = gMemoryArena.previousCalloc(count, size);
+    }
+
+    return pointer;
+}
+
+STATIC VOID memoryArenaFree(PVOID pointer)
+{
+    MemoryArenaLargeBlock block;
+
+    if (pointer == NULL) {
+        return;
+    }
+
+    if (memoryArenaOwns(pointer)) {
+        memoryArenaFreeBlock((PMemoryArenaHeader) pointer - 1);
+    } else if (memoryArenaFindLarge(pointer, &block, TRUE)) {
+        memoryArenaReleaseLarge(&block);
+    } else {
+        // allocated before the start or after the arena ran out
+        gMemoryArena.previousFree(pointer);
+    }
+}
+
+STATIC PVOID memoryArenaRealloc(PVOID pointer, SIZE_T size)
+{
+    PMemoryArenaHeader pHeader;
+    MemoryArenaLargeBlock block;
+    PVOID pNew;
+    SIZE_T oldSize;
+
+    if (pointer == NULL) {
+        return memoryArenaAlloc(size);
+    }
+
+    if (size == 0) {
+        memoryArenaFree(pointer);
+        return NULL;
+    }
+
+    if (memoryArenaOwns(pointer)) {
+        pHeader = (PMemoryArenaHeader) pointer - 1;
+        if (size <= memoryArenaClassSize(pHeader->classIndex) - MEMORY_ARENA_HEADER_SIZE) {
+            // still fits its block
+            memoryArenaRefundTag((MEMORY_TAG) pHeader->tag, (SIZE_T) pHeader->size);
+            memoryArenaChargeTag((MEMORY_TAG) pHeader->tag, size);
+            pHeader->size = size;
+            return pointer;
+        }
+
+        oldSize = (SIZE_T) pHeader->size;
+    } else if (memoryArenaFindLarge(pointer, &block, FALSE)) {
+        oldSize = block.size;
+    } else {
+        return gMemoryArena.previousRealloc(pointer, size);
+    }
+
+    if (NULL != (pNew = memoryArenaAlloc(size))) {
+        MEMCPY(pNew, pointer, MIN(oldSize, size));
+        memoryArenaFree(pointer);
+    }
+
+    return pNew;
+}
+
+STATUS memoryArenaStart(UINT64 size)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    PMemoryArena pArena = &gMemoryArena;
+    PVOID pMapping;
+    UINT32 i;
+
+    CHK(!ATOMIC_LOAD_BOOL(&pArena->started), STATUS_INVALID_OPERATION);
+    CHK(size >= MEMORY_ARENA_SLAB_SIZE, STATUS_INVALID_ARG);
+
+    // Reserved without access, the slabs are opened as they are carved. The pages only count once blocks on them are
+    // handed out, and locking the process into memory leaves the rest of the reservation alone.
+    pMapping = mmap(NULL, (SIZE_T) size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    CHK(pMapping != MAP_FAILED, STATUS_NOT_ENOUGH_MEMORY);
+
+    MEMSET(pArena, 0x00, SIZEOF(MemoryArena));
+    pArena->pBase = (PBYTE) pMapping;
+    pArena->size = size;
+    for (i = 0; i < MEMORY_ARENA_CLASS_COUNT; i++) {
+        pthread_mutex_init(&pArena->classes[i].lock, NULL);
+    }
+    pthread_mutex_init(&pArena->largeLock, NULL);
+
+    pArena->previousAlloc = globalMemAlloc;
+    pArena->previousAlignAlloc = globalMemAlignAlloc;
+    pArena->previousCalloc = globalMemCalloc;
+    pArena->previousFree = globalMemFree;
+    pArena->previousRealloc = globalMemRealloc;
+    ATOMIC_STORE_BOOL(&pArena->started, TRUE);
+    globalMemAlloc = memoryArenaAlloc;
+    globalMemAlignAlloc = memoryArenaAlignAlloc;
+    globalMemCalloc = memoryArenaCalloc;
+    globalMemFree = memoryArenaFree;
+    globalMemRealloc = memoryArenaRealloc;
+    gMemoryArenaTag = MEMORY_TAG_APP;
+
+CleanUp:
+
+    return retStatus;
+}
+
+BOOL memoryArenaStarted()
+{
+    return ATOMIC_LOAD_BOOL(&gMemoryArena.started);
+}
+
+MEMORY_TAG memoryArenaSetTag(MEMORY_TAG tag)
+{
+    MEMORY_TAG previous = gMemoryArenaTag;
+
+    gMemoryArenaTag = tag;
+
+    return previous;
+}
+
+PCHAR memoryArenaGetTagName(MEMORY_TAG tag)
+{
+    return tag < MEMORY_TAG_COUNT ? gMemoryTagNames[tag] : (PCHAR) "unknown";
+}
+
+STATIC VOID memoryArenaCopyTagStats(PMemoryTagStats pFrom, PMemoryTagStats pTo)
+{
+    pTo->bytes = ATOMIC_LOAD(&pFrom->bytes);
+    pTo->highWater = ATOMIC_LOAD(&pFrom->highWater);
+    pTo->allocations = ATOMIC_LOAD(&pFrom->allocations);
+}
+
+VOID memoryArenaGetStats(PMemoryArenaStats pStats)
+{
+    UINT32 i;
+
+    MEMSET(pStats, 0x00, SIZEOF(MemoryArenaStats));
+    for (i = 0; i < MEMORY_TAG_COUNT; i++) {
+        memoryArenaCopyTagStats(&gMemoryArena.tags[i], &pStats->tags[i]);
+    }
+
+    memoryArenaCopyTagStats(&gMemoryArena.total, &pStats->total);
+    pStats->arenaSize = gMemoryArena.size;
+    pStats->arenaCarved = (UINT64) ATOMIC_LOAD(&gMemoryArena.carved);
+    pStats->largeBytes = (UINT64) ATOMIC_LOAD(&gMemoryArena.largeBytes);
+    pStats->overflows = (UINT64) ATOMIC_LOAD(&gMemoryArena.overflows);
+}
+
+VOID memoryArenaPrintStats()
+{
+    MemoryArenaStats stats;
+    UINT32 i;
+
+    if (!memoryArenaStarted()) {
+        return;
+    }
+
+    memoryArenaGetStats(&stats);
+    printf("Memory arena: %" PRIu64 " KB of %" PRIu64 " KB carved into slabs, %" PRIu64 " KB of large blocks mapped, %" PRIu64
+           " allocations overflowed\n",
+           stats.arenaCarved >> 10, stats.arenaSize >> 10, stats.largeBytes >> 10, stats.overflows);
+    for (i = 0; i < MEMORY_TAG_COUNT; i++) {
+        printf("Memory %s: %" PRIu64 " KB in %" PRIu64 " allocations, at most %" PRIu64 " KB\n", gMemoryTagNames[i],
+               (UINT64) stats.tags[i].bytes >> 10, (UINT64) stats.tags[i].allocations, (UINT64) stats.tags[i].highWater >> 10);
+    }
+    printf("Memory total: %" PRIu64 " KB in %" PRIu64 " allocations, at most %" PRIu64 " KB\n", (UINT64) stats.total.bytes >> 10,
+           (UINT64) stats.total.allocations, (UINT64) stats.total.highWater >> 10);
+}
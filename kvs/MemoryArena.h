@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2020 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __KVS_MEMORY_ARENA_H__
+#define __KVS_MEMORY_ARENA_H__
+
+#include <pthread.h>
+
+#include "KvsApp.h"
+
+#define DEFAULT_MEMORY_ARENA_SIZE           (8 * 1024 * 1024)
+// blocks are carved from the arena this much at a time per size class
+#define MEMORY_ARENA_SLAB_SIZE              (64 * 1024)
+// 16 byte steps up to 128, then four classes per doubling up to 256 KB, the block header included
+#define MEMORY_ARENA_CLASS_COUNT            51
+#define MEMORY_ARENA_MAX_BLOCK_SIZE         (256 * 1024)
+#define MEMORY_ARENA_HEADER_SIZE            16
+// larger allocations are mapped one by one and unmapped when freed, the content store among them
+#define MEMORY_ARENA_MAX_LARGE_BLOCKS       256
+
+/**
+ * What an allocation is charged to. Threads kvs never tagged are the SDK's own, its state machine and its upload
+ * threads, so that is what they are charged to. Only what goes through the SDK hooks is seen: curl and OpenSSL allocate
+ * from libc directly and show up in the resident size alone.
+ */
+typedef enum {
+    MEMORY_TAG_SDK,
+    MEMORY_TAG_APP,
+    MEMORY_TAG_CONTENT_STORE,
+    MEMORY_TAG_FRAMES,
+    MEMORY_TAG_LOGGING,
+    MEMORY_TAG_COUNT,
+} MEMORY_TAG;
+
+typedef struct {
+    // requested bytes in use
+    volatile SIZE_T bytes;
+    volatile SIZE_T highWater;
+    volatile SIZE_T allocations;
+} MemoryTagStats, *PMemoryTagStats;
+
+typedef struct {
+    MemoryTagStats tags[MEMORY_TAG_COUNT];
+    MemoryTagStats total;
+    UINT64 arenaSize;
+    // carved into slabs so far, what the small allocations cost at most
+    UINT64 arenaCarved;
+    UINT64 largeBytes;
+    // went to the allocator installed before because the arena or the table of large blocks was full
+    UINT64 overflows;
+} MemoryArenaStats, *PMemoryArenaStats;
+
+typedef struct {
+    pthread_mutex_t lock;
+    // freed blocks, linked through their first bytes
+    PBYTE pFree;
+    // offsets of the rest of the slab being carved
+    SIZE_T cursor;
+    SIZE_T end;
+} MemoryArenaClass, *PMemoryArenaClass;
+
+typedef struct {
+    PVOID pointer;
+    PVOID pMapping;
+    SIZE_T mappingSize;
+    SIZE_T size;
+    MEMORY_TAG tag;
+} MemoryArenaLargeBlock, *PMemoryArenaLargeBlock;
+
+/**
+ * Allocator behind the SDK memory hooks, so the SDK and kvs allocate from it alike.
+ *
+ * Small blocks come from size classes carved out of one arena reserved at startup. A freed block goes back to the
+ * free list of its class and is only ever reused for the same class, so the memory of the process follows the peak
+ * of every class rather than growing with the fragmentation of a general purpose heap over days of per frame churn.
+ * Blocks above MEMORY_ARENA_MAX_BLOCK_SIZE are mapped on their own and unmapped when freed. Every allocation is
+ * charged to the tag of the calling thread.
+ */
+typedef struct {
+    volatile ATOMIC_BOOL started;
+    PBYTE pBase;
+    UINT64 size;
+    volatile SIZE_T carved;
+    MemoryArenaClass classes[MEMORY_ARENA_CLASS_COUNT];
+    pthread_mutex_t largeLock;
+    MemoryArenaLargeBlock largeBlocks[MEMORY_ARENA_MAX_LARGE_BLOCKS];
+    UINT32 largeCount;
+    volatile SIZE_T largeBytes;
+    volatile SIZE_T overflows;
+    MemoryTagStats tags[MEMORY_TAG_COUNT];
+    MemoryTagStats total;
+    // the hooks installed before, blocks allocated through them before the start are freed through them
+    memAlloc previousAlloc;
+    memAlignAlloc previousAlignAlloc;
+    memCalloc previousCalloc;
+    memFree previousFree;
+    memRealloc previousRealloc;
+} MemoryArena, *PMemoryArena;
+
+/**
+ * Reserves the arena and installs the SDK memory hooks. The calling thread is tagged MEMORY_TAG_APP. There is no
+ * stop, blocks handed out may be freed until the process exits.
+ */
+STATUS memoryArenaStart(UINT64);
+
+BOOL memoryArenaStarted();
+
+/**
+ * Charges the allocations of the calling thread to the tag from now on, returns the previous one to restore a scope
+ */
+MEMORY_TAG memoryArenaSetTag(MEMORY_TAG);
+
+PCHAR memoryArenaGetTagName(MEMORY_TAG);
+VOID memoryArenaGetStats(PMemoryArenaStats);
+VOID memoryArenaPrintStats();
+
+#endif /* __KVS_MEMORY_ARENA_H__ */
@@ -0,0 +1,1111 @@
+/*
+ * Copyright (C) 2020 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "Metrics.h"
+#include "Pacer.h"
+
+// put latency in microseconds
+static const UINT64 gPutLatencyBounds[] = {10, 25, 50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000};
+// ack latency in milliseconds
+static const UINT64 gAckLatencyBounds[] = {50, 100, 250, 500, 1000, 2500, 5000, 10000, 30000, 60000};
+// buffer fill per mille
+static const UINT64 gBufferFillBounds[] = {50, 100, 250, 500, 750, 900, 1000};
+
+static const PCHAR gTrackNames[METRICS_TRACK_COUNT] = {(PCHAR) "video", (PCHAR) "audio"};
+static const PCHAR gDropReasonNames[METRICS_DROP_REASON_COUNT] = {
+    (PCHAR) "late",
+    (PCHAR) "storage_pressure",
+    (PCHAR) "buffer_duration_pressure",
+    (PCHAR) "sdk",
+};
+static const PCHAR gAckNames[METRICS_ACK_COUNT] = {(PCHAR) "buffering", (PCHAR) "received", (PCHAR) "persisted", (PCHAR) "error"};
+static const PCHAR gStartupNames[METRICS_STARTUP_COUNT] = {(PCHAR) "stream_ready", (PCHAR) "first_put", (PCHAR) "first_ack"};
+
+static const CHAR gMetricsResponseHeader[] = "HTTP/1.0 200 OK\r\n"
+                                             "Content-Type: text/plain; version=0.0.4\r\n"
+                                             "Connection: close\r\n"
+                                             "\r\n";
+
+VOID metricsHistogramInit(PMetricsHistogram pHistogram, const UINT64* pBounds, UINT32 boundCount, DOUBLE unitScale)
+{
+    MEMSET(pHistogram, 0x00, SIZEOF(MetricsHistogram));
+    pHistogram->pBounds = pBounds;
+    pHistogram->boundCount = MIN(boundCount, METRICS_HISTOGRAM_MAX_BOUNDS);
+    pHistogram->unitScale = unitScale;
+}
+
+VOID metricsHistogramObserve(PMetricsHistogram pHistogram, UINT64 value)
+{
+    UINT64 max = METRICS_ATOMIC_LOAD(&pHistogram->max);
+    UINT32 i;
+
+    for (i = 0; i < pHistogram->boundCount && value > pHistogram->pBounds[i]; i++);
+
+    METRICS_ATOMIC_INCREMENT(&pHistogram->buckets[i]);
+    METRICS_ATOMIC_INCREMENT(&pHistogram->count);
+    METRICS_ATOMIC_ADD(&pHistogram->sum, value);
+    while (value > max && !METRICS_ATOMIC_COMPARE_EXCHANGE(&pHistogram->max, &max, value));
+}
+
+VOID channelMetricsInit(PChannelMetrics pMetrics)
+{
+    UINT32 i;
+
+    MEMSET(pMetrics, 0x00, SIZEOF(ChannelMetrics));
+    for (i = 0; i < METRICS_TRACK_COUNT; i++) {
+        metricsHistogramInit(&pMetrics->putLatency[i], gPutLatencyBounds, ARRAY_SIZE(gPutLatencyBounds), 1e-6);
+    }
+
+    metricsHistogramInit(&pMetrics->receivedAckLatency, gAckLatencyBounds, ARRAY_SIZE(gAckLatencyBounds), 1e-3);
+    metricsHistogramInit(&pMetrics->persistedAckLatency, gAckLatencyBounds, ARRAY_SIZE(gAckLatencyBounds), 1e-3);
+    metricsHistogramInit(&pMetrics->bufferFill, gBufferFillBounds, ARRAY_SIZE(gBufferFillBounds), 1e-3);
+}
+
+VOID channelMetricsRecordPut(PChannelMetrics pMetrics, METRICS_TRACK track, UINT32 size, UINT64 latency, UINT64 cpuTimeNs)
+{
+    METRICS_ATOMIC_INCREMENT(&pMetrics->putFrames[track]);
+    METRICS_ATOMIC_ADD(&pMetrics->putBytes[track], size);
+    METRICS_ATOMIC_ADD(&pMetrics->putCpuTimeNs, cpuTimeNs);
+    metricsHistogramObserve(&pMetrics->putLatency[track], latency / HUNDREDS_OF_NANOS_IN_A_MICROSECOND);
+}
+
+VOID channelMetricsRecordDrop(PChannelMetrics pMetrics, METRICS_DROP_REASON reason)
+{
+    METRICS_ATOMIC_INCREMENT(&pMetrics->droppedFrames[reason]);
+}
+
+VOID channelMetricsRecordError(PChannelMetrics pMetrics, STATUS status)
+{
+    UINT64 current;
+    UINT32 i;
+
+    // slots are claimed once and never released, so a status always lands in the same slot
+    for (i = 0; i < METRICS_MAX_ERROR_CODES; i++) {
+        current = METRICS_ATOMIC_LOAD(&pMetrics->errors[i].status);
+        if (current == 0) {
+            if (METRICS_ATOMIC_COMPARE_EXCHANGE(&pMetrics->errors[i].status, &current, (UINT64) status) || current == (UINT64) status) {
+                METRICS_ATOMIC_INCREMENT(&pMetrics->errors[i].count);
+                return;
+            }
+        } else if (current == (UINT64) status) {
+            METRICS_ATOMIC_INCREMENT(&pMetrics->errors[i].count);
+            return;
+        }
+    }
+
+    METRICS_ATOMIC_INCREMENT(&pMetrics->otherErrors);
+}
+
+UINT64 channelMetricsRecordAck(PChannelMetrics pMetrics, PFragmentAck pAck, UINT64 now)
+{
+    PMetricsPendingAck pPending;
+    UINT32 i;
+
+    switch (pAck->ackType) {
+        case FRAGMENT_ACK_TYPE_BUFFERING:
+            METRICS_ATOMIC_INCREMENT(&pMetrics->acks[METRICS_ACK_BUFFERING]);
+            pPending = &pMetrics->pendingAcks[pMetrics->pendingAckHead++ % METRICS_ACK_RING_SIZE];
+            pPending->timestamp = pAck->timestamp;
+            pPending->bufferingTime = now;
+            return 0;
+        case FRAGMENT_ACK_TYPE_RECEIVED:
+            METRICS_ATOMIC_INCREMENT(&pMetrics->acks[METRICS_ACK_RECEIVED]);
+            break;
+        case FRAGMENT_ACK_TYPE_PERSISTED:
+            METRICS_ATOMIC_INCREMENT(&pMetrics->acks[METRICS_ACK_PERSISTED]);
+            break;
+        case FRAGMENT_ACK_TYPE_ERROR:
+            METRICS_ATOMIC_INCREMENT(&pMetrics->acks[METRICS_ACK_ERROR]);
+            return 0;
+        default:
+            return 0;
+    }
+
+    // newest first, acks arrive in fragment order
+    for (i = 1; i <= METRICS_ACK_RING_SIZE && i <= pMetrics->pendingAckHead; i++) {
+        pPending = &pMetrics->pendingAcks[(pMetrics->pendingAckHead - i) % METRICS_ACK_RING_SIZE];
+        if (pPending->timestamp == pAck->timestamp && pPending->bufferingTime != 0) {
+            metricsHistogramObserve(pAck->ackType == FRAGMENT_ACK_TYPE_RECEIVED ? &pMetrics->receivedAckLatency : &pMetrics->persistedAckLatency,
+                                    (now - pPending->bufferingTime) / HUNDREDS_OF_NANOS_IN_A_MILLISECOND);
+            return now - pPending->bufferingTime;
+        }
+    }
+
+    return 0;
+}
+
+VOID channelMetricsRecordBuffer(PChannelMetrics pMetrics, UINT64 bufferedBytes, UINT64 bufferedDuration, UINT64 bufferDuration,
+                                UINT64 transferRate)
+{
+    METRICS_ATOMIC_STORE(&pMetrics->bufferedBytes, bufferedBytes);
+    METRICS_ATOMIC_STORE(&pMetrics->bufferedDuration, bufferedDuration);
+    METRICS_ATOMIC_STORE(&pMetrics->transferRate, transferRate);
+    if (bufferDuration != 0) {
+        metricsHistogramObserve(&pMetrics->bufferFill, bufferedDuration * 1000 / bufferDuration);
+    }
+}
+
+BOOL channelMetricsRecordStartup(PChannelMetrics pMetrics, METRICS_STARTUP milestone, UINT64 elapsed)
+{
+    UINT64 expected = 0;
+
+    // a milestone reached within the first microsecond still has to read as reached
+    return METRICS_ATOMIC_COMPARE_EXCHANGE(&pMetrics->startupTimes[milestone], &expected,
+                                   MAX(elapsed / HUNDREDS_OF_NANOS_IN_A_MICROSECOND, 1));
+}
+
+STATUS metricsBufferPrintf(PMetricsBuffer pBuffer, const CHAR* format, ...)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    va_list args;
+    INT32 length;
+    UINT32 capacity;
+    PCHAR data;
+
+    while (TRUE) {
+        va_start(args, format);
+        length = vsnprintf(pBuffer->data + pBuffer->size, pBuffer->capacity - pBuffer->size, format, args);
+        va_end(args);
+        CHK(length >= 0, STATUS_INVALID_ARG);
+
+        if (pBuffer->size + (UINT32) length < pBuffer->capacity) {
+            pBuffer->size += (UINT32) length;
+            break;
+        }
+
+        capacity = MAX(pBuffer->capacity * 2, pBuffer->size + (UINT32) length + 1);
+        CHK(NULL != (data = (PCHAR) MEMREALLOC(pBuffer->data, capacity)), STATUS_NOT_ENOUGH_MEMORY);
+        pBuffer->data = data;
+        pBuffer->capacity = capacity;
+    }
+
+CleanUp:
+
+    return retStatus;
+}
+
+STATUS metricsWriteFamily(PMetricsBuffer pBuffer, PCHAR name, PCHAR type, PCHAR help)
+{
+    return metricsBufferPrintf(pBuffer, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+STATIC STATUS metricsWriteHistogram(PMetricsBuffer pBuffer, PCHAR name, PCHAR labels, PMetricsHistogram pHistogram)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    UINT64 cumulative = 0;
+    UINT32 i;
+
+    for (i = 0; i < pHistogram->boundCount; i++) {
+        cumulative += (UINT64) METRICS_ATOMIC_LOAD(&pHistogram->buckets[i]);
+        CHK_STATUS(metricsBufferPrintf(pBuffer, "%s_bucket{%s,le=\"%g\"} %" PRIu64 "\n", name, labels,
+                                       pHistogram->pBounds[i] * pHistogram->unitScale, cumulative));
+    }
+
+    cumulative += (UINT64) METRICS_ATOMIC_LOAD(&pHistogram->buckets[i]);
+    CHK_STATUS(metricsBufferPrintf(pBuffer, "%s_bucket{%s,le=\"+Inf\"} %" PRIu64 "\n", name, labels, cumulative));
+    CHK_STATUS(metricsBufferPrintf(pBuffer, "%s_sum{%s} %g\n", name, labels, (UINT64) METRICS_ATOMIC_LOAD(&pHistogram->sum) * pHistogram->unitScale));
+    CHK_STATUS(metricsBufferPrintf(pBuffer, "%s_count{%s} %" PRIu64 "\n", name, labels, (UINT64) METRICS_ATOMIC_LOAD(&pHistogram->count)));
+
+CleanUp:
+
+    return retStatus;
+}
+
+STATUS metricsWriteChannels(PMetricsBuffer pBuffer, PChannelMetrics* ppMetrics, PCHAR* ppNames, UINT32 count)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    CHAR labels[MAX_STREAM_NAME_LEN + 64];
+    PChannelMetrics pMetrics;
+    UINT32 i, j;
+
+    CHK_STATUS(metricsWriteFamily(pBuffer, (PCHAR) "kvs_put_frames_total", (PCHAR) "counter", (PCHAR) "Frames put into the stream"));
+    for (i = 0; i < count; i++) {
+        for (j = 0; j < METRICS_TRACK_COUNT; j++) {
+            CHK_STATUS(metricsBufferPrintf(pBuffer, "kvs_put_frames_total{channel=\"%s\",track=\"%s\"} %" PRIu64 "\n", ppNames[i],
+                                           gTrackNames[j], (UINT64) METRICS_ATOMIC_LOAD(&ppMetrics[i]->putFrames[j])));
+        }
+    }
+
+    CHK_STATUS(metricsWriteFamily(pBuffer, (PCHAR) "kvs_put_bytes_total", (PCHAR) "counter", (PCHAR) "Frame bytes put into the stream"));
+    for (i = 0; i < count; i++) {
+        for (j = 0; j < METRICS_TRACK_COUNT; j++) {
+            CHK_STATUS(metricsBufferPrintf(pBuffer, "kvs_put_bytes_total{channel=\"%s\",track=\"%s\"} %" PRIu64 "\n", ppNames[i],
+                                           gTrackNames[j], (UINT64) METRICS_ATOMIC_LOAD(&ppMetrics[i]->putBytes[j])));
+        }
+    }
+
+    CHK_STATUS(metricsWriteFamily(pBuffer, (PCHAR) "kvs_put_cpu_seconds_total", (PCHAR) "counter",
+                                  (PCHAR) "Thread CPU time spent in putKinesisVideoFrame"));
+    for (i = 0; i < count; i++) {
+        CHK_STATUS(metricsBufferPrintf(pBuffer, "kvs_put_cpu_seconds_total{channel=\"%s\"} %.6f\n", ppNames[i],
+                                       (UINT64) METRICS_ATOMIC_LOAD(&ppMetrics[i]->putCpuTimeNs) / 1e9));
+    }
+
+    CHK_STATUS(metricsWriteFamily(pBuffer, (PCHAR) "kvs_put_latency_seconds", (PCHAR) "histogram",
+                                  (PCHAR) "Wall time of putKinesisVideoFrame calls"));
+    for (i = 0; i < count; i++) {
+        for (j = 0; j < METRICS_TRACK_COUNT; j++) {
+            SNPRINTF(labels, SIZEOF(labels), "channel=\"%s\",track=\"%s\"", ppNames[i], gTrackNames[j]);
+            CHK_STATUS(metricsWriteHistogram(pBuffer, (PCHAR) "kvs_put_latency_seconds", labels, &ppMetrics[i]->putLatency[j]));
+        }
+    }
+
+    CHK_STATUS(metricsWriteFamily(pBuffer, (PCHAR) "kvs_put_latency_max_seconds", (PCHAR) "gauge",
+                                  (PCHAR) "Longest putKinesisVideoFrame call"));
+    for (i = 0; i < count; i++) {
+        for (j = 0; j < METRICS_TRACK_COUNT; j++) {
+            CHK_STATUS(metricsBufferPrintf(pBuffer, "kvs_put_latency_max_seconds{channel=\"%s\",track=\"%s\"} %g\n", ppNames[i], gTrackNames[j],
+                                           (UINT64) METRICS_ATOMIC_LOAD(&ppMetrics[i]->putLatency[j].max) * ppMetrics[i]->putLatency[j].unitScale));
+        }
+    }
+
+    CHK_STATUS(metricsWriteFamily(pBuffer, (PCHAR) "kvs_dropped_frames_total", (PCHAR) "counter", (PCHAR) "Frames not put by reason"));
+    for (i = 0; i < count; i++) {
+        for (j = 0; j < METRICS_DROP_REASON_COUNT; j++) {
+            CHK_STATUS(metricsBufferPrintf(pBuffer, "kvs_dropped_frames_total{channel=\"%s\",reason=\"%s\"} %" PRIu64 "\n", ppNames[i],
+                                           gDropReasonNames[j], (UINT64) METRICS_ATOMIC_LOAD(&ppMetrics[i]->droppedFrames[j])));
+        }
+    }
+
+    CHK_STATUS(metricsWriteFamily(pBuffer, (PCHAR) "kvs_errors_total", (PCHAR) "counter", (PCHAR) "Put and stream errors by status code"));
+    for (i = 0; i < count; i++) {
+        pMetrics = ppMetrics[i];
+        for (j = 0; j < METRICS_MAX_ERROR_CODES && METRICS_ATOMIC_LOAD(&pMetrics->errors[j].status) != 0; j++) {
+            CHK_STATUS(metricsBufferPrintf(pBuffer, "kvs_errors_total{channel=\"%s\",status=\"0x%08x\"} %" PRIu64 "\n", ppNames[i],
+                                           (UINT32) METRICS_ATOMIC_LOAD(&pMetrics->errors[j].status), (UINT64) METRICS_ATOMIC_LOAD(&pMetrics->errors[j].count)));
+        }
+
+        CHK_STATUS(metricsBufferPrintf(pBuffer, "kvs_errors_total{channel=\"%s\",status=\"other\"} %" PRIu64 "\n", ppNames[i],
+                                       (UINT64) METRICS_ATOMIC_LOAD(&pMetrics->otherErrors)));
+    }
+
+    CHK_STATUS(metricsWriteFamily(pBuffer, (PCHAR) "kvs_fragment_acks_total", (PCHAR) "counter", (PCHAR) "Fragment acks by type"));
+    for (i = 0; i < count; i++) {
+        for (j = 0; j < METRICS_ACK_COUNT; j++) {
+            CHK_STATUS(metricsBufferPrintf(pBuffer, "kvs_fragment_acks_total{channel=\"%s\",type=\"%s\"} %" PRIu64 "\n", ppNames[i],
+                                           gAckNames[j], (UINT64) METRICS_ATOMIC_LOAD(&ppMetrics[i]->acks[j])));
+        }
+    }
+
+    CHK_STATUS(metricsWriteFamily(pBuffer, (PCHAR) "kvs_fragment_ack_latency_seconds", (PCHAR) "histogram",
+                                  (PCHAR) "Time from the buffering ack of a fragment to its received and persisted acks"));
+    for (i = 0; i < count; i++) {
+        SNPRINTF(labels, SIZEOF(labels), "channel=\"%s\",ack=\"received\"", ppNames[i]);
+        CHK_STATUS(metricsWriteHistogram(pBuffer, (PCHAR) "kvs_fragment_ack_latency_seconds", labels, &ppMetrics[i]->receivedAckLatency));
+        SNPRINTF(labels, SIZEOF(labels), "channel=\"%s\",ack=\"persisted\"", ppNames[i]);
+        CHK_STATUS(metricsWriteHistogram(pBuffer, (PCHAR) "kvs_fragment_ack_latency_seconds", labels, &ppMetrics[i]->persistedAckLatency));
+    }
+
+    CHK_STATUS(metricsWriteFamily(pBuffer, (PCHAR) "kvs_buffered_bytes", (PCHAR) "gauge", (PCHAR) "Bytes buffered in the stream"));
+    for (i = 0; i < count; i++) {
+        CHK_STATUS(metricsBufferPrintf(pBuffer, "kvs_buffered_bytes{channel=\"%s\"} %" PRIu64 "\n", ppNames[i],
+                                       (UINT64) METRICS_ATOMIC_LOAD(&ppMetrics[i]->bufferedBytes)));
+    }
+
+    CHK_STATUS(metricsWriteFamily(pBuffer, (PCHAR) "kvs_buffered_seconds", (PCHAR) "gauge", (PCHAR) "Duration buffered in the stream"));
+    for (i = 0; i < count; i++) {
+        CHK_STATUS(metricsBufferPrintf(pBuffer, "kvs_buffered_seconds{channel=\"%s\"} %.3f\n", ppNames[i],
+                                       (DOUBLE) METRICS_ATOMIC_LOAD(&ppMetrics[i]->bufferedDuration) / HUNDREDS_OF_NANOS_IN_A_SECOND));
+    }
+
+    CHK_STATUS(metricsWriteFamily(pBuffer, (PCHAR) "kvs_buffer_fill_ratio", (PCHAR) "histogram",
+                                  (PCHAR) "Buffered duration against the stream buffer duration, sampled every second"));
+    for (i = 0; i < count; i++) {
+        SNPRINTF(labels, SIZEOF(labels), "channel=\"%s\"", ppNames[i]);
+        CHK_STATUS(metricsWriteHistogram(pBuffer, (PCHAR) "kvs_buffer_fill_ratio", labels, &ppMetrics[i]->bufferFill));
+    }
+
+    CHK_STATUS(metricsWriteFamily(pBuffer, (PCHAR) "kvs_transfer_rate_bytes", (PCHAR) "gauge", (PCHAR) "Upload rate of the stream per second"));
+    for (i = 0; i < count; i++) {
+        CHK_STATUS(metricsBufferPrintf(pBuffer, "kvs_transfer_rate_bytes{channel=\"%s\"} %" PRIu64 "\n", ppNames[i],
+                                       (UINT64) METRICS_ATOMIC_LOAD(&ppMetrics[i]->transferRate)));
+    }
+
+    CHK_STATUS(metricsWriteFamily(pBuffer, (PCHAR) "kvs_startup_seconds", (PCHAR) "gauge",
+                                  (PCHAR) "Time from the process start to the stream being ready, its first put and its first ack"));
+    for (i = 0; i < count; i++) {
+        for (j = 0; j < METRICS_STARTUP_COUNT; j++) {
+            if (METRICS_ATOMIC_LOAD(&ppMetrics[i]->startupTimes[j]) != 0) {
+                CHK_STATUS(metricsBufferPrintf(pBuffer, "kvs_startup_seconds{channel=\"%s\",milestone=\"%s\"} %.6f\n", ppNames[i],
+                                               gStartupNames[j], (UINT64) METRICS_ATOMIC_LOAD(&ppMetrics[i]->startupTimes[j]) / 1e6));
+            }
+        }
+    }
+
+CleanUp:
+
+    return retStatus;
+}
+
+VOID channelMetricsPrintSummary(PChannelMetrics pMetrics, PCHAR name, UINT64 duration)
+{
+    DOUBLE seconds = (DOUBLE) duration / HUNDREDS_OF_NANOS_IN_A_SECOND;
+    UINT64 frames = 0, bytes = 0, dropped = 0, errors = (UINT64) METRICS_ATOMIC_LOAD(&pMetrics->otherErrors), maxPutLatency = 0;
+    UINT32 i;
+
+    for (i = 0; i < METRICS_TRACK_COUNT; i++) {
+        frames += (UINT64) METRICS_ATOMIC_LOAD(&pMetrics->putFrames[i]);
+        bytes += (UINT64) METRICS_ATOMIC_LOAD(&pMetrics->putBytes[i]);
+        maxPutLatency = MAX(maxPutLatency, (UINT64) METRICS_ATOMIC_LOAD(&pMetrics->putLatency[i].max));
+    }
+
+    for (i = 0; i < METRICS_DROP_REASON_COUNT; i++) {
+        dropped += (UINT64) METRICS_ATOMIC_LOAD(&pMetrics->droppedFrames[i]);
+    }
+
+    for (i = 0; i < METRICS_MAX_ERROR_CODES; i++) {
+        errors += (UINT64) METRICS_ATOMIC_LOAD(&pMetrics->errors[i].count);
+    }
+
+    printf("Channel %s: %" PRIu64 " frames, %" PRIu64 " KB, %" PRIu64 " dropped, %" PRIu64 " errors, put CPU %.3f%% of a core, slowest put %.3f ms\n",
+           name, frames, bytes >> 10, dropped, errors, seconds <= 0 ? 0.0 : 100.0 * METRICS_ATOMIC_LOAD(&pMetrics->putCpuTimeNs) / 1e9 / seconds,
+           maxPutLatency / 1000.0);
+}
+
+VOID channelMetricsPrintStartup(PChannelMetrics pMetrics, PCHAR name)
+{
+    CHAR times[METRICS_STARTUP_COUNT][16];
+    UINT64 time;
+    UINT32 i;
+
+    for (i = 0; i < METRICS_STARTUP_COUNT; i++) {
+        time = METRICS_ATOMIC_LOAD(&pMetrics->startupTimes[i]);
+        if (time == 0) {
+            STRCPY(times[i], "-");
+        } else {
+            SNPRINTF(times[i], SIZEOF(times[i]), "%.3f s", (UINT64) time / 1e6);
+        }
+    }
+
+    printf("Channel %s startup: stream ready after %s, first put after %s, first ack after %s\n", name,
+           times[METRICS_STARTUP_STREAM_READY], times[METRICS_STARTUP_FIRST_PUT], times[METRICS_STARTUP_FIRST_ACK]);
+}
+
+/**
+ * Samples the buffer levels from the metrics server thread, never from the put path
+ */
+VOID metricsSampleSources(UINT64 customData)
+{
+    PMetricsSources pSources = (PMetricsSources) customData;
+    ClientMetrics clientMetrics;
+    StreamMetrics streamMetrics;
+    PMetricsChannel pChannel;
+    UINT32 i;
+
+    clientMetrics.version = CLIENT_METRICS_CURRENT_VERSION;
+    if (IS_VALID_CLIENT_HANDLE(pSources->clientHandle) && STATUS_SUCCEEDED(getKinesisVideoMetrics(pSources->clientHandle, &clientMetrics))) {
+        METRICS_ATOMIC_STORE(&pSources->contentStoreSize, clientMetrics.contentStoreSize);
+        METRICS_ATOMIC_STORE(&pSources->contentStoreAvailableSize, clientMetrics.contentStoreAvailableSize);
+    }
+
+    for (i = 0; i < pSources->channelCount; i++) {
+        pChannel = &pSources->channels[i];
+        streamMetrics.version = STREAM_METRICS_CURRENT_VERSION;
+        if (IS_VALID_STREAM_HANDLE(pChannel->streamHandle) &&
+            STATUS_SUCCEEDED(getKinesisVideoStreamMetrics(pChannel->streamHandle, &streamMetrics))) {
+            channelMetricsRecordBuffer(pChannel->pMetrics, streamMetrics.currentViewSize, streamMetrics.currentViewDuration,
+                                       pChannel->bufferDuration, streamMetrics.currentTransferRate);
+        }
+    }
+}
+
+STATIC STATUS metricsWriteFramePool(PMetricsBuffer pBuffer, PFramePool pPool)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    FramePoolClass classes[FRAME_POOL_MAX_CLASS_COUNT];
+    FramePoolStats stats;
+    UINT32 count, i;
+
+    framePoolGetStats(pPool, &stats);
+    framePoolGetClasses(pPool, classes, &count);
+
+    CHK_STATUS(metricsWriteFamily(pBuffer, (PCHAR) "kvs_frame_pool_heap_allocations_total", (PCHAR) "counter",
+                                  (PCHAR) "Heap allocations made by the frame pool, all at startup"));
+    CHK_STATUS(metricsBufferPrintf(pBuffer, "kvs_frame_pool_heap_allocations_total %" PRIu64 "\n", stats.heapAllocations));
+    CHK_STATUS(metricsWriteFamily(pBuffer, (PCHAR) "kvs_frame_pool_gets_total", (PCHAR) "counter", (PCHAR) "Frame buffers taken from the pool"));
+    CHK_STATUS(metricsBufferPrintf(pBuffer, "kvs_frame_pool_gets_total %" PRIu64 "\n", stats.gets));
+    CHK_STATUS(metricsWriteFamily(pBuffer, (PCHAR) "kvs_frame_pool_waits_total", (PCHAR) "counter",
+                                  (PCHAR) "Frame buffer requests which waited for the pool"));
+    CHK_STATUS(metricsBufferPrintf(pBuffer, "kvs_frame_pool_waits_total %" PRIu64 "\n", stats.waits));
+    CHK_STATUS(metricsWriteFamily(pBuffer, (PCHAR) "kvs_frame_pool_in_use_bytes", (PCHAR) "gauge", (PCHAR) "Frame pool bytes in use"));
+    CHK_STATUS(metricsBufferPrintf(pBuffer, "kvs_frame_pool_in_use_bytes %" PRIu64 "\n", stats.inUseBytes));
+    CHK_STATUS(metricsWriteFamily(pBuffer, (PCHAR) "kvs_frame_pool_in_use_high_water_bytes", (PCHAR) "gauge",
+                                  (PCHAR) "Most frame pool bytes ever in use"));
+    CHK_STATUS(metricsBufferPrintf(pBuffer, "kvs_frame_pool_in_use_high_water_bytes %" PRIu64 "\n", stats.inUseBytesHighWater));
+    CHK_STATUS(metricsWriteFamily(pBuffer, (PCHAR) "kvs_frame_pool_buffers", (PCHAR) "gauge", (PCHAR) "Frame buffers per size class"));
+    for (i = 0; i < count; i++) {
+        CHK_STATUS(metricsBufferPrintf(pBuffer, "kvs_frame_pool_buffers{size=\"%u\"} %u\n", classes[i].size, classes[i].count));
+    }
+    CHK_STATUS(metricsWriteFamily(pBuffer, (PCHAR) "kvs_frame_pool_high_water_buffers", (PCHAR) "gauge",
+                                  (PCHAR) "Most frame buffers ever in use per size class"));
+    for (i = 0; i < count; i++) {
+        CHK_STATUS(metricsBufferPrintf(pBuffer, "kvs_frame_pool_high_water_buffers{size=\"%u\"} %u\n", classes[i].size, classes[i].highWater));
+    }
+
+CleanUp:
+
+    return retStatus;
+}
+
+STATIC STATUS metricsWriteLog(PMetricsBuffer pBuffer)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    AsyncLogStats stats;
+
+    asyncLogGetStats(&stats);
+
+    CHK_STATUS(metricsWriteFamily(pBuffer, (PCHAR) "kvs_log_records_total", (PCHAR) "counter", (PCHAR) "Log records handed to the async logger"));
+    CHK_STATUS(metricsBufferPrintf(pBuffer, "kvs_log_records_total %" PRIu64 "\n", stats.records));
+    CHK_STATUS(metricsWriteFamily(pBuffer, (PCHAR) "kvs_log_dropped_total", (PCHAR) "counter", (PCHAR) "Log records not written by reason"));
+    CHK_STATUS(metricsBufferPrintf(pBuffer, "kvs_log_dropped_total{reason=\"ring_full\"} %" PRIu64 "\n", stats.dropped));
+    CHK_STATUS(metricsBufferPrintf(pBuffer, "kvs_log_dropped_total{reason=\"rate_limit\"} %" PRIu64 "\n", stats.suppressed));
+
+CleanUp:
+
+    return retStatus;
+}
+
+STATIC STATUS metricsWriteMemory(PMetricsBuffer pBuffer)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    MemoryArenaStats stats;
+    UINT32 i;
+
+    memoryArenaGetStats(&stats);
+
+    CHK_STATUS(metricsWriteFamily(pBuffer, (PCHAR) "kvs_memory_bytes", (PCHAR) "gauge", (PCHAR) "Bytes allocated through the SDK hooks by tag"));
+    for (i = 0; i < MEMORY_TAG_COUNT; i++) {
+        CHK_STATUS(metricsBufferPrintf(pBuffer, "kvs_memory_bytes{tag=\"%s\"} %" PRIu64 "\n", memoryArenaGetTagName((MEMORY_TAG) i),
+                                       (UINT64) stats.tags[i].bytes));
+    }
+    CHK_STATUS(metricsWriteFamily(pBuffer, (PCHAR) "kvs_memory_high_water_bytes", (PCHAR) "gauge",
+                                  (PCHAR) "Most bytes allocated through the SDK hooks at once by tag"));
+    for (i = 0; i < MEMORY_TAG_COUNT; i++) {
+        CHK_STATUS(metricsBufferPrintf(pBuffer, "kvs_memory_high_water_bytes{tag=\"%s\"} %" PRIu64 "\n", memoryArenaGetTagName((MEMORY_TAG) i),
+                                       (UINT64) stats.tags[i].highWater));
+    }
+    CHK_STATUS(metricsBufferPrintf(pBuffer, "kvs_memory_high_water_bytes{tag=\"all\"} %" PRIu64 "\n", (UINT64) stats.total.highWater));
+    CHK_STATUS(metricsWriteFamily(pBuffer, (PCHAR) "kvs_memory_arena_carved_bytes", (PCHAR) "gauge",
+                                  (PCHAR) "Arena carved into size class slabs, never handed back"));
+    CHK_STATUS(metricsBufferPrintf(pBuffer, "kvs_memory_arena_carved_bytes %" PRIu64 "\n", stats.arenaCarved));
+    CHK_STATUS(metricsWriteFamily(pBuffer, (PCHAR) "kvs_memory_arena_overflows_total", (PCHAR) "counter",
+                                  (PCHAR) "Allocations which did not fit the arena and went to the system allocator"));
+    CHK_STATUS(metricsBufferPrintf(pBuffer, "kvs_memory_arena_overflows_total %" PRIu64 "\n", stats.overflows));
+
+CleanUp:
+
+    return retStatus;
+}
+
+STATIC STATUS metricsWriteSpools(PMetricsBuffer pBuffer, PMetricsSources pSources)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    PMetricsChannel pChannel;
+    PSpoolStats pStats;
+    UINT32 i;
+
+    CHK_STATUS(metricsWriteFamily(pBuffer, (PCHAR) "kvs_spool_frames_total", (PCHAR) "counter",
+                                  (PCHAR) "Frames written to the spool during outages and replayed from it"));
+    for (i = 0; i < pSources->channelCount; i++) {
+        pChannel = &pSources->channels[i];
+        if (pChannel->pSpool != NULL) {
+            pStats = &pChannel->pSpool->stats;
+            CHK_STATUS(metricsBufferPrintf(pBuffer, "kvs_spool_frames_total{channel=\"%s\",op=\"spooled\"} %" PRIu64 "\n", pChannel->name,
+                                           (UINT64) ATOMIC_LOAD(&pStats->spooledFrames)));
+            CHK_STATUS(metricsBufferPrintf(pBuffer, "kvs_spool_frames_total{channel=\"%s\",op=\"replayed\"} %" PRIu64 "\n", pChannel->name,
+                                           (UINT64) ATOMIC_LOAD(&pStats->replayedFrames)));
+        }
+    }
+    CHK_STATUS(metricsWriteFamily(pBuffer, (PCHAR) "kvs_spool_refused_gops_total", (PCHAR) "counter",
+                                  (PCHAR) "GOPs dropped because the spool was full or its write budget spent"));
+    for (i = 0; i < pSources->channelCount; i++) {
+        pChannel = &pSources->channels[i];
+        if (pChannel->pSpool != NULL) {
+            CHK_STATUS(metricsBufferPrintf(pBuffer, "kvs_spool_refused_gops_total{channel=\"%s\"} %" PRIu64 "\n", pChannel->name,
+                                           (UINT64) ATOMIC_LOAD(&pChannel->pSpool->stats.refusedGops)));
+        }
+    }
+    CHK_STATUS(metricsWriteFamily(pBuffer, (PCHAR) "kvs_spool_written_bytes_total", (PCHAR) "counter",
+                                  (PCHAR) "Bytes written to the spool file, whole blocks"));
+    for (i = 0; i < pSources->channelCount; i++) {
+        pChannel = &pSources->channels[i];
+        if (pChannel->pSpool != NULL) {
+            CHK_STATUS(metricsBufferPrintf(pBuffer, "kvs_spool_written_bytes_total{channel=\"%s\"} %" PRIu64 "\n", pChannel->name,
+                                           (UINT64) ATOMIC_LOAD(&pChannel->pSpool->stats.blocksWritten) * SPOOL_BLOCK_SIZE));
+        }
+    }
+    CHK_STATUS(metricsWriteFamily(pBuffer, (PCHAR) "kvs_spool_used_bytes", (PCHAR) "gauge", (PCHAR) "Spool bytes waiting for replay"));
+    for (i = 0; i < pSources->channelCount; i++) {
+        pChannel = &pSources->channels[i];
+        if (pChannel->pSpool != NULL) {
+            CHK_STATUS(metricsBufferPrintf(pBuffer, "kvs_spool_used_bytes{channel=\"%s\"} %" PRIu64 "\n", pChannel->name,
+                                           (UINT64) ATOMIC_LOAD(&pChannel->pSpool->stats.usedBytes)));
+        }
+    }
+
+CleanUp:
+
+    return retStatus;
+}
+
+STATIC STATUS metricsWriteTimestamps(PMetricsBuffer pBuffer, PMetricsSources pSources)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    PMetricsChannel pChannel;
+    UINT32 i, j;
+
+    CHK_STATUS(metricsWriteFamily(pBuffer, (PCHAR) "kvs_timestamp_discontinuities_total", (PCHAR) "counter",
+                                  (PCHAR) "Capture clock gaps the track timestamps stepped over"));
+    for (i = 0; i < pSources->channelCount; i++) {
+        pChannel = &pSources->channels[i];
+        for (j = 0; j < METRICS_TRACK_COUNT && pChannel->pClocks[j] != NULL; j++) {
+            CHK_STATUS(metricsBufferPrintf(pBuffer, "kvs_timestamp_discontinuities_total{channel=\"%s\",track=\"%s\"} %" PRIu64 "\n",
+                                           pChannel->name, gTrackNames[j], (UINT64) ATOMIC_LOAD(&pChannel->pClocks[j]->stats.discontinuities)));
+        }
+    }
+    CHK_STATUS(metricsWriteFamily(pBuffer, (PCHAR) "kvs_timestamp_error_seconds", (PCHAR) "gauge",
+                                  (PCHAR) "Capture time minus timestamp of the last frame, what slewing still has to make up"));
+    for (i = 0; i < pSources->channelCount; i++) {
+        pChannel = &pSources->channels[i];
+        for (j = 0; j < METRICS_TRACK_COUNT && pChannel->pClocks[j] != NULL; j++) {
+            CHK_STATUS(metricsBufferPrintf(pBuffer, "kvs_timestamp_error_seconds{channel=\"%s\",track=\"%s\"} %.6f\n", pChannel->name,
+                                           gTrackNames[j],
+                                           (DOUBLE) (INT64) ATOMIC_LOAD(&pChannel->pClocks[j]->stats.error) / HUNDREDS_OF_NANOS_IN_A_SECOND));
+        }
+    }
+
+CleanUp:
+
+    return retStatus;
+}
+
+STATIC STATUS metricsWriteBitrates(PMetricsBuffer pBuffer, PMetricsSources pSources)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    PMetricsChannel pChannel;
+    PBandwidthEstimator pEstimator;
+    UINT32 i;
+
+    CHK_STATUS(metricsWriteFamily(pBuffer, (PCHAR) "kvs_encoder_bitrate_bps", (PCHAR) "gauge", (PCHAR) "Bitrate asked of the encoder"));
+    for (i = 0; i < pSources->channelCount; i++) {
+        pChannel = &pSources->channels[i];
+        if (pChannel->pBandwidthEstimator != NULL) {
+            CHK_STATUS(metricsBufferPrintf(pBuffer, "kvs_encoder_bitrate_bps{channel=\"%s\"} %" PRIu64 "\n", pChannel->name,
+                                           bandwidthEstimatorGetBitrate(pChannel->pBandwidthEstimator)));
+        }
+    }
+    CHK_STATUS(metricsWriteFamily(pBuffer, (PCHAR) "kvs_bandwidth_estimate_bps", (PCHAR) "gauge",
+                                  (PCHAR) "Smoothed rate the fragments were delivered at"));
+    for (i = 0; i < pSources->channelCount; i++) {
+        pChannel = &pSources->channels[i];
+        if (pChannel->pBandwidthEstimator != NULL) {
+            CHK_STATUS(metricsBufferPrintf(pBuffer, "kvs_bandwidth_estimate_bps{channel=\"%s\"} %" PRIu64 "\n", pChannel->name,
+                                           (UINT64) ATOMIC_LOAD(&pChannel->pBandwidthEstimator->stats.estimate)));
+        }
+    }
+    CHK_STATUS(metricsWriteFamily(pBuffer, (PCHAR) "kvs_queue_delay_seconds", (PCHAR) "gauge",
+                                  (PCHAR) "Time from put to ack of the last fragment over the smallest seen"));
+    for (i = 0; i < pSources->channelCount; i++) {
+        pChannel = &pSources->channels[i];
+        if (pChannel->pBandwidthEstimator != NULL) {
+            CHK_STATUS(metricsBufferPrintf(pBuffer, "kvs_queue_delay_seconds{channel=\"%s\"} %.3f\n", pChannel->name,
+                                           (DOUBLE) ATOMIC_LOAD(&pChannel->pBandwidthEstimator->stats.queueDelay) / HUNDREDS_OF_NANOS_IN_A_SECOND));
+        }
+    }
+    CHK_STATUS(metricsWriteFamily(pBuffer, (PCHAR) "kvs_bitrate_changes_total", (PCHAR) "counter", (PCHAR) "Bitrate changes by direction"));
+    for (i = 0; i < pSources->channelCount; i++) {
+        pChannel = &pSources->channels[i];
+        if ((pEstimator = pChannel->pBandwidthEstimator) != NULL) {
+            CHK_STATUS(metricsBufferPrintf(pBuffer, "kvs_bitrate_changes_total{channel=\"%s\",direction=\"down\"} %" PRIu64 "\n",
+                                           pChannel->name, (UINT64) ATOMIC_LOAD(&pEstimator->stats.decreases)));
+            CHK_STATUS(metricsBufferPrintf(pBuffer, "kvs_bitrate_changes_total{channel=\"%s\",direction=\"up\"} %" PRIu64 "\n",
+                                           pChannel->name, (UINT64) ATOMIC_LOAD(&pEstimator->stats.increases)));
+        }
+    }
+    CHK_STATUS(metricsWriteFamily(pBuffer, (PCHAR) "kvs_encoder_key_frame_requests_total", (PCHAR) "counter",
+                                  (PCHAR) "Key frames asked of the encoder to end a drop"));
+    for (i = 0; i < pSources->channelCount; i++) {
+        pChannel = &pSources->channels[i];
+        if (pChannel->pBandwidthEstimator != NULL) {
+            CHK_STATUS(metricsBufferPrintf(pBuffer, "kvs_encoder_key_frame_requests_total{channel=\"%s\"} %" PRIu64 "\n",
+                                           pChannel->name, (UINT64) ATOMIC_LOAD(&pChannel->pEncoderControl->stats.keyFrameRequests)));
+        }
+    }
+
+CleanUp:
+
+    return retStatus;
+}
+
+STATIC STATUS metricsWriteRecoveries(PMetricsBuffer pBuffer, PMetricsSources pSources)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    PMetricsChannel pChannel;
+    PRecoveryStats pStats;
+    UINT32 i;
+
+    CHK_STATUS(metricsWriteFamily(pBuffer, (PCHAR) "kvs_recovery_state", (PCHAR) "gauge",
+                                  (PCHAR) "0 healthy, 1 waiting out a backoff, 2 reset and waiting for an ack, 3 failed"));
+    for (i = 0; i < pSources->channelCount; i++) {
+        pChannel = &pSources->channels[i];
+        CHK_STATUS(metricsBufferPrintf(pBuffer, "kvs_recovery_state{channel=\"%s\"} %" PRIu64 "\n", pChannel->name,
+                                       (UINT64) ATOMIC_LOAD(&pChannel->pRecoveryStream->stats.state)));
+    }
+    CHK_STATUS(metricsWriteFamily(pBuffer, (PCHAR) "kvs_recovery_resets_total", (PCHAR) "counter", (PCHAR) "Resets made to recover by kind"));
+    for (i = 0; i < pSources->channelCount; i++) {
+        pChannel = &pSources->channels[i];
+        pStats = &pChannel->pRecoveryStream->stats;
+        CHK_STATUS(metricsBufferPrintf(pBuffer, "kvs_recovery_resets_total{channel=\"%s\",action=\"connection\"} %" PRIu64 "\n",
+                                       pChannel->name, (UINT64) pStats->resets[RECOVERY_ACTION_RESET_CONNECTION]));
+        CHK_STATUS(metricsBufferPrintf(pBuffer, "kvs_recovery_resets_total{channel=\"%s\",action=\"stream\"} %" PRIu64 "\n",
+                                       pChannel->name, (UINT64) pStats->resets[RECOVERY_ACTION_RESET_STREAM]));
+    }
+    CHK_STATUS(metricsWriteFamily(pBuffer, (PCHAR) "kvs_recoveries_total", (PCHAR) "counter", (PCHAR) "Failures the stream came back from"));
+    for (i = 0; i < pSources->channelCount; i++) {
+        pChannel = &pSources->channels[i];
+        CHK_STATUS(metricsBufferPrintf(pBuffer, "kvs_recoveries_total{channel=\"%s\"} %" PRIu64 "\n", pChannel->name,
+                                       (UINT64) pChannel->pRecoveryStream->stats.recoveries));
+    }
+    CHK_STATUS(metricsWriteFamily(pBuffer, (PCHAR) "kvs_recovery_seconds_total", (PCHAR) "counter",
+                                  (PCHAR) "Time from the first error to the first ack after the reset, summed over recoveries"));
+    for (i = 0; i < pSources->channelCount; i++) {
+        pChannel = &pSources->channels[i];
+        CHK_STATUS(metricsBufferPrintf(pBuffer, "kvs_recovery_seconds_total{channel=\"%s\"} %.3f\n", pChannel->name,
+                                       (DOUBLE) pChannel->pRecoveryStream->stats.totalRecoveryTime / HUNDREDS_OF_NANOS_IN_A_SECOND));
+    }
+    CHK_STATUS(metricsWriteFamily(pBuffer, (PCHAR) "kvs_recovery_seconds_max", (PCHAR) "gauge", (PCHAR) "Longest recovery so far"));
+    for (i = 0; i < pSources->channelCount; i++) {
+        pChannel = &pSources->channels[i];
+        CHK_STATUS(metricsBufferPrintf(pBuffer, "kvs_recovery_seconds_max{channel=\"%s\"} %.3f\n", pChannel->name,
+                                       (DOUBLE) pChannel->pRecoveryStream->stats.maxRecoveryTime / HUNDREDS_OF_NANOS_IN_A_SECOND));
+    }
+    CHK_STATUS(metricsWriteFamily(pBuffer, (PCHAR) "kvs_recovery_frames_lost_total", (PCHAR) "counter",
+                                  (PCHAR) "Frames dropped while the stream was not healthy"));
+    for (i = 0; i < pSources->channelCount; i++) {
+        pChannel = &pSources->channels[i];
+        CHK_STATUS(metricsBufferPrintf(pBuffer, "kvs_recovery_frames_lost_total{channel=\"%s\"} %" PRIu64 "\n", pChannel->name,
+                                       (UINT64) ATOMIC_LOAD(&pChannel->pRecoveryStream->stats.framesLost)));
+    }
+
+CleanUp:
+
+    return retStatus;
+}
+
+STATIC STATUS metricsWriteFragments(PMetricsBuffer pBuffer, PMetricsSources pSources)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    PMetricsChannel pChannel;
+    UINT32 i;
+
+    CHK_STATUS(metricsWriteFamily(pBuffer, (PCHAR) "kvs_fragment_duration_seconds", (PCHAR) "gauge",
+                                  (PCHAR) "Fragment duration asked for by the controller"));
+    for (i = 0; i < pSources->channelCount; i++) {
+        pChannel = &pSources->channels[i];
+        CHK_STATUS(metricsBufferPrintf(pBuffer, "kvs_fragment_duration_seconds{channel=\"%s\"} %.3f\n", pChannel->name,
+                                       (DOUBLE) ATOMIC_LOAD(&pChannel->pFragmentController->stats.duration) / HUNDREDS_OF_NANOS_IN_A_SECOND));
+    }
+
+    CHK_STATUS(metricsWriteFamily(pBuffer, (PCHAR) "kvs_fragment_observed_duration_seconds", (PCHAR) "gauge",
+                                  (PCHAR) "Duration of the last fragment acked"));
+    for (i = 0; i < pSources->channelCount; i++) {
+        pChannel = &pSources->channels[i];
+        CHK_STATUS(metricsBufferPrintf(pBuffer, "kvs_fragment_observed_duration_seconds{channel=\"%s\"} %.3f\n", pChannel->name,
+                                       (DOUBLE) ATOMIC_LOAD(&pChannel->pFragmentController->stats.observedDuration) /
+                                           HUNDREDS_OF_NANOS_IN_A_SECOND));
+    }
+
+    CHK_STATUS(metricsWriteFamily(pBuffer, (PCHAR) "kvs_fragment_overhead_seconds", (PCHAR) "gauge",
+                                  (PCHAR) "Time every fragment costs on top of its duration until it is persisted"));
+    for (i = 0; i < pSources->channelCount; i++) {
+        pChannel = &pSources->channels[i];
+        CHK_STATUS(metricsBufferPrintf(pBuffer, "kvs_fragment_overhead_seconds{channel=\"%s\"} %.3f\n", pChannel->name,
+                                       (DOUBLE) ATOMIC_LOAD(&pChannel->pFragmentController->stats.overhead) / HUNDREDS_OF_NANOS_IN_A_SECOND));
+    }
+
+    CHK_STATUS(metricsWriteFamily(pBuffer, (PCHAR) "kvs_fragment_decisions_total", (PCHAR) "counter",
+                                  (PCHAR) "Changes of the fragment duration asked for"));
+    for (i = 0; i < pSources->channelCount; i++) {
+        pChannel = &pSources->channels[i];
+        CHK_STATUS(metricsBufferPrintf(pBuffer, "kvs_fragment_decisions_total{channel=\"%s\"} %" PRIu64 "\n", pChannel->name,
+                                       (UINT64) ATOMIC_LOAD(&pChannel->pFragmentController->stats.decisions)));
+    }
+
+    CHK_STATUS(metricsWriteFamily(pBuffer, (PCHAR) "kvs_encoder_requests_total", (PCHAR) "counter",
+                                  (PCHAR) "Requests sent to the encoder by result"));
+    for (i = 0; i < pSources->channelCount; i++) {
+        pChannel = &pSources->channels[i];
+        if (pChannel->pEncoderControl != NULL) {
+            CHK_STATUS(metricsBufferPrintf(pBuffer, "kvs_encoder_requests_total{channel=\"%s\",result=\"delivered\"} %" PRIu64 "\n",
+                                           pChannel->name,
+                                           (UINT64) (ATOMIC_LOAD(&pChannel->pEncoderControl->stats.requests) -
+                                                     ATOMIC_LOAD(&pChannel->pEncoderControl->stats.failures))));
+            CHK_STATUS(metricsBufferPrintf(pBuffer, "kvs_encoder_requests_total{channel=\"%s\",result=\"failed\"} %" PRIu64 "\n",
+                                           pChannel->name, (UINT64) ATOMIC_LOAD(&pChannel->pEncoderControl->stats.failures)));
+        }
+    }
+
+CleanUp:
+
+    return retStatus;
+}
+
+STATIC STATUS metricsWriteSchedulers(PMetricsBuffer pBuffer, PMetricsSources pSources)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    UINT32 i, count = (UINT32) ATOMIC_LOAD(&pSources->schedulerCount);
+
+    CHK_STATUS(metricsWriteFamily(pBuffer, (PCHAR) "kvs_scheduler_wakeups_total", (PCHAR) "counter", (PCHAR) "Wakeups of the put threads"));
+    for (i = 0; i < count; i++) {
+        CHK_STATUS(metricsBufferPrintf(pBuffer, "kvs_scheduler_wakeups_total{scheduler=\"%u\"} %" PRIu64 "\n", i,
+                                       (UINT64) ATOMIC_LOAD(&pSources->ppSchedulers[i]->stats.wakeups)));
+    }
+
+    CHK_STATUS(metricsWriteFamily(pBuffer, (PCHAR) "kvs_scheduler_frames_total", (PCHAR) "counter",
+                                  (PCHAR) "Frames dispatched by the put threads"));
+    for (i = 0; i < count; i++) {
+        CHK_STATUS(metricsBufferPrintf(pBuffer, "kvs_scheduler_frames_total{scheduler=\"%u\"} %" PRIu64 "\n", i,
+                                       (UINT64) ATOMIC_LOAD(&pSources->ppSchedulers[i]->stats.dispatchedFrames)));
+    }
+
+    CHK_STATUS(metricsWriteFamily(pBuffer, (PCHAR) "kvs_scheduler_coalesced_frames_total", (PCHAR) "counter",
+                                  (PCHAR) "Frames put ahead of their deadline on the wakeup of another frame"));
+    for (i = 0; i < count; i++) {
+        CHK_STATUS(metricsBufferPrintf(pBuffer, "kvs_scheduler_coalesced_frames_total{scheduler=\"%u\"} %" PRIu64 "\n", i,
+                                       (UINT64) ATOMIC_LOAD(&pSources->ppSchedulers[i]->stats.coalescedFrames)));
+    }
+
+CleanUp:
+
+    return retStatus;
+}
+
+STATIC STATUS metricsWriteBackfills(PMetricsBuffer pBuffer, PMetricsSources pSources)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    PMetricsChannel pChannel;
+    UINT32 i;
+
+    CHK_STATUS(metricsWriteFamily(pBuffer, (PCHAR) "kvs_backfill_media_seconds", (PCHAR) "gauge",
+                                  (PCHAR) "Recording time put so far, its rate is the speed relative to real time"));
+    for (i = 0; i < pSources->channelCount; i++) {
+        pChannel = &pSources->channels[i];
+        CHK_STATUS(metricsBufferPrintf(pBuffer, "kvs_backfill_media_seconds{channel=\"%s\"} %.3f\n", pChannel->name,
+                                       (DOUBLE) ATOMIC_LOAD(pChannel->pBackfillMediaTime) / 1000));
+    }
+
+CleanUp:
+
+    return retStatus;
+}
+
+STATIC STATUS metricsWriteSegments(PMetricsBuffer pBuffer, PMetricsSources pSources)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    PMetricsChannel pChannel;
+    PSegmentWatcher pWatcher;
+    UINT32 i;
+
+    CHK_STATUS(metricsWriteFamily(pBuffer, (PCHAR) "kvs_segments_total", (PCHAR) "counter",
+                                  (PCHAR) "Segments of the watched directories by what became of them"));
+    for (i = 0; i < pSources->channelCount; i++) {
+        pChannel = &pSources->channels[i];
+        if ((pWatcher = pChannel->pSegmentWatcher) != NULL) {
+            CHK_STATUS(metricsBufferPrintf(pBuffer, "kvs_segments_total{channel=\"%s\",result=\"read\"} %" PRIu64 "\n", pChannel->name,
+                                           (UINT64) ATOMIC_LOAD(&pWatcher->stats.segments)));
+            CHK_STATUS(metricsBufferPrintf(pBuffer, "kvs_segments_total{channel=\"%s\",result=\"retired\"} %" PRIu64 "\n", pChannel->name,
+                                           (UINT64) ATOMIC_LOAD(&pWatcher->stats.retired)));
+            CHK_STATUS(metricsBufferPrintf(pBuffer, "kvs_segments_total{channel=\"%s\",result=\"kept\"} %" PRIu64 "\n", pChannel->name,
+                                           (UINT64) ATOMIC_LOAD(&pWatcher->stats.kept)));
+        }
+    }
+
+CleanUp:
+
+    return retStatus;
+}
+
+STATUS metricsWriteSources(UINT64 customData, PMetricsBuffer pBuffer)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    PMetricsSources pSources = (PMetricsSources) customData;
+    PMetricsChannel pFirst = &pSources->channels[0];
+    PChannelMetrics pMetrics[MAX_CHANNEL_COUNT];
+    PCHAR pNames[MAX_CHANNEL_COUNT];
+    BOOL bitrateControl = FALSE;
+    UINT32 i;
+
+    // on the metrics thread, the growth of the buffer is kvs's own
+    memoryArenaSetTag(MEMORY_TAG_APP);
+
+    CHK_STATUS(metricsWriteFamily(pBuffer, (PCHAR) "kvs_content_store_bytes", (PCHAR) "gauge", (PCHAR) "Size of the shared content store"));
+    CHK_STATUS(metricsBufferPrintf(pBuffer, "kvs_content_store_bytes %" PRIu64 "\n", (UINT64) METRICS_ATOMIC_LOAD(&pSources->contentStoreSize)));
+    CHK_STATUS(metricsWriteFamily(pBuffer, (PCHAR) "kvs_content_store_available_bytes", (PCHAR) "gauge",
+                                  (PCHAR) "Free space in the shared content store"));
+    CHK_STATUS(metricsBufferPrintf(pBuffer, "kvs_content_store_available_bytes %" PRIu64 "\n",
+                                   (UINT64) METRICS_ATOMIC_LOAD(&pSources->contentStoreAvailableSize)));
+
+    for (i = 0; i < pSources->channelCount; i++) {
+        pMetrics[i] = pSources->channels[i].pMetrics;
+        pNames[i] = pSources->channels[i].name;
+        bitrateControl = bitrateControl || pSources->channels[i].pBandwidthEstimator != NULL;
+    }
+
+    CHK_STATUS(metricsWriteChannels(pBuffer, pMetrics, pNames, pSources->channelCount));
+
+    if (pSources->pFramePool != NULL) {
+        CHK_STATUS(metricsWriteFramePool(pBuffer, pSources->pFramePool));
+        CHK_STATUS(metricsWriteSegments(pBuffer, pSources));
+    }
+
+    CHK_STATUS(metricsWriteLog(pBuffer));
+    CHK_STATUS(metricsWriteSchedulers(pBuffer, pSources));
+
+    if (memoryArenaStarted()) {
+        CHK_STATUS(metricsWriteMemory(pBuffer));
+    }
+
+    // the options behind the rest apply to every channel alike
+    if (pFirst->pSpool != NULL) {
+        CHK_STATUS(metricsWriteSpools(pBuffer, pSources));
+    }
+
+    if (pFirst->pClocks[METRICS_TRACK_VIDEO] != NULL) {
+        CHK_STATUS(metricsWriteTimestamps(pBuffer, pSources));
+    }
+
+    if (pFirst->pFragmentController != NULL) {
+        CHK_STATUS(metricsWriteFragments(pBuffer, pSources));
+    }
+
+    if (bitrateControl) {
+        CHK_STATUS(metricsWriteBitrates(pBuffer, pSources));
+    }
+
+    if (pFirst->pRecoveryStream != NULL) {
+        CHK_STATUS(metricsWriteRecoveries(pBuffer, pSources));
+    }
+
+    if (pFirst->pBackfillMediaTime != NULL) {
+        CHK_STATUS(metricsWriteBackfills(pBuffer, pSources));
+    }
+
+CleanUp:
+
+    return retStatus;
+}
+
+STATIC VOID metricsServeConnection(PMetricsServer pServer, INT32 fd)
+{
+    CHAR request[METRICS_MAX_REQUEST_SIZE];
+    struct pollfd pollFd;
+    UINT32 received = 0, sent = 0;
+    ssize_t result;
+
+    pollFd.fd = fd;
+    pollFd.events = POLLIN;
+
+    // the request itself does not matter, read its head so the client sees a clean close
+    while (received < SIZEOF(request) - 1 && poll(&pollFd, 1, METRICS_REQUEST_TIMEOUT_MS) > 0) {
+        result = read(fd, request + received, SIZEOF(request) - 1 - received);
+        if (result <= 0) {
+            break;
+        }
+
+        received += (UINT32) result;
+        request[received] = '\0';
+        if (STRSTR(request, "\r\n\r\n") != NULL || STRSTR(request, "\n\n") != NULL) {
+            break;
+        }
+    }
+
+    pServer->buffer.size = 0;
+    if (STATUS_FAILED(metricsBufferPrintf(&pServer->buffer, "%s", gMetricsResponseHeader)) ||
+        STATUS_FAILED(pServer->writeFn(pServer->customData, &pServer->buffer))) {
+        return;
+    }
+
+    while (sent < pServer->buffer.size) {
+        result = send(fd, pServer->buffer.data + sent, pServer->buffer.size - sent, MSG_NOSIGNAL);
+        if (result <= 0) {
+            break;
+        }
+
+        sent += (UINT32) result;
+    }
+}
+
+STATIC PVOID metricsServerRoutine(PVOID args)
+{
+    PMetricsServer pServer = (PMetricsServer) args;
+    struct pollfd pollFds[2];
+    UINT64 nextSampleTime = pacerGetTime(), now;
+    INT32 fd, timeout;
+
+    pollFds[0].fd = pServer->listenFd;
+    pollFds[0].events = POLLIN;
+    pollFds[1].fd = pServer->stopFd;
+    pollFds[1].events = POLLIN;
+
+    while (TRUE) {
+        now = pacerGetTime();
+        if (now >= nextSampleTime) {
+            if (pServer->sampleFn != NULL) {
+                pServer->sampleFn(pServer->customData);
+            }
+
+            nextSampleTime = now + METRICS_SAMPLE_INTERVAL;
+        }
+
+        timeout = (INT32) ((nextSampleTime - now) / HUNDREDS_OF_NANOS_IN_A_MILLISECOND) + 1;
+        if (poll(pollFds, 2, timeout) < 0 && errno != EINTR) {
+            DLOGE("Metrics server poll failed with errno %d", errno);
+            break;
+        }
+
+        if ((pollFds[1].revents & POLLIN) != 0) {
+            break;
+        }
+
+        if ((pollFds[0].revents & POLLIN) != 0 && (fd = accept(pServer->listenFd, NULL, NULL)) >= 0) {
+            metricsServeConnection(pServer, fd);
+            close(fd);
+        }
+    }
+
+    return NULL;
+}
+
+STATUS createMetricsServer(PCHAR address, MetricsWriteFunc writeFn, MetricsSampleFunc sampleFn, UINT64 customData,
+                           PMetricsServer* ppServer)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    PMetricsServer pServer = NULL;
+    struct sockaddr_in inetAddress;
+    struct sockaddr_un unixAddress;
+    UINT64 port = 0;
+    INT32 enable = 1;
+
+    CHK(address != NULL && writeFn != NULL && ppServer != NULL, STATUS_NULL_ARG);
+    CHK(STRLEN(address) < SIZEOF(unixAddress.sun_path), STATUS_INVALID_ARG);
+
+    CHK(NULL != (pServer = (PMetricsServer) MEMCALLOC(1, SIZEOF(MetricsServer))), STATUS_NOT_ENOUGH_MEMORY);
+    STRNCPY(pServer->address, address, MAX_PATH_LEN);
+    pServer->listenFd = -1;
+    pServer->stopFd = -1;
+    pServer->tid = INVALID_TID_VALUE;
+    pServer->writeFn = writeFn;
+    pServer->sampleFn = sampleFn;
+    pServer->customData = customData;
+    CHK(NULL != (pServer->buffer.data = (PCHAR) MEMALLOC(METRICS_INITIAL_BUFFER_SIZE)), STATUS_NOT_ENOUGH_MEMORY);
+    pServer->buffer.capacity = METRICS_INITIAL_BUFFER_SIZE;
+
+    pServer->unixSocket = STATUS_FAILED(STRTOUI64(address, NULL, 10, &port));
+    if (pServer->unixSocket) {
+        MEMSET(&unixAddress, 0x00, SIZEOF(unixAddress));
+        unixAddress.sun_family = AF_UNIX;
+        STRCPY(unixAddress.sun_path, address);
+        // a socket left behind by an earlier run
+        unlink(address);
+        CHK((pServer->listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) >= 0, STATUS_INVALID_OPERATION);
+        CHK(bind(pServer->listenFd, (struct sockaddr*) &unixAddress, SIZEOF(unixAddress)) == 0, STATUS_INVALID_OPERATION);
+    } else {
+        CHK(port != 0 && port <= 0xffff, STATUS_INVALID_ARG);
+        MEMSET(&inetAddress, 0x00, SIZEOF(inetAddress));
+        inetAddress.sin_family = AF_INET;
+        inetAddress.sin_port = htons((UINT16) port);
+        // local scraping only
+        inetAddress.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        CHK((pServer->listenFd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0)) >= 0, STATUS_INVALID_OPERATION);
+        setsockopt(pServer->listenFd, SOL_SOCKET, SO_REUSEADDR, &enable, SIZEOF(enable));
+        CHK(bind(pServer->listenFd, (struct sockaddr*) &inetAddress, SIZEOF(inetAddress)) == 0, STATUS_INVALID_OPERATION);
+    }
+
+    CHK(listen(pServer->listenFd, 8) == 0, STATUS_INVALID_OPERATION);
+    CHK((pServer->stopFd = eventfd(0, EFD_CLOEXEC)) >= 0, STATUS_INVALID_OPERATION);
+    CHK_STATUS(THREAD_CREATE(&pServer->tid, metricsServerRoutine, (PVOID) pServer));
+
+CleanUp:
+
+    if (STATUS_FAILED(retStatus)) {
+        if (address != NULL) {
+            DLOGE("Failed to serve metrics on %s", address);
+        }
+
+        freeMetricsServer(&pServer);
+    }
+
+    if (ppServer != NULL) {
+        *ppServer = pServer;
+    }
+
+    return retStatus;
+}
+
+STATUS freeMetricsServer(PMetricsServer* ppServer)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    PMetricsServer pServer;
+    UINT64 value = 1;
+
+    CHK(ppServer != NULL, STATUS_NULL_ARG);
+
+    pServer = *ppServer;
+    CHK(pServer != NULL, retStatus);
+
+    if (IS_VALID_TID_VALUE(pServer->tid)) {
+        if (write(pServer->stopFd, &value, SIZEOF(value)) != SIZEOF(value)) {
+            DLOGW("Failed to stop the metrics server");
+        }
+
+        THREAD_JOIN(pServer->tid, NULL);
+    }
+
+    if (pServer->listenFd >= 0) {
+        close(pServer->listenFd);
+        if (pServer->unixSocket) {
+            unlink(pServer->address);
+        }
+    }
+
+    if (pServer->stopFd >= 0) {
+        close(pServer->stopFd);
+    }
+
+    SAFE_MEMFREE(pServer->buffer.data);
+    MEMFREE(pServer);
+    *ppServer = NULL;
+
+CleanUp:
+
+    return retStatus;
+}
@@ -0,0 +1,275 @@
+/*
+ * Copyright (C) 2020 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __KVS_METRICS_H__
+#define __KVS_METRICS_H__
+
+#include "KvsApp.h"
+#include "Channel.h"
+#include "FramePool.h"
+#include "AsyncLog.h"
+#include "MemoryArena.h"
+#include "Spool.h"
+#include "CaptureClock.h"
+#include "BandwidthEstimator.h"
+#include "EncoderControl.h"
+#include "FragmentController.h"
+#include "Recovery.h"
+#include "SegmentWatcher.h"
+#include "Scheduler.h"
+
+#define METRICS_HISTOGRAM_MAX_BOUNDS        16
+#define METRICS_MAX_ERROR_CODES             16
+#define METRICS_ACK_RING_SIZE               32
+#define METRICS_SAMPLE_INTERVAL             (1 * HUNDREDS_OF_NANOS_IN_A_SECOND)
+#define METRICS_MAX_REQUEST_SIZE            4096
+#define METRICS_REQUEST_TIMEOUT_MS          200
+#define METRICS_INITIAL_BUFFER_SIZE         (16 * 1024)
+
+// The metrics are 64 bit on every target, bytes and nanoseconds summed into a SIZE_T wrap within hours on 32 bit. The
+// SDK atomics only take a SIZE_T, so these use the compiler builtins, a 32 bit target without 8 byte atomics links
+// libatomic for them.
+#define METRICS_ATOMIC_LOAD(p)              __atomic_load_n((p), __ATOMIC_SEQ_CST)
+#define METRICS_ATOMIC_STORE(p, v)          __atomic_store_n((p), (UINT64) (v), __ATOMIC_SEQ_CST)
+#define METRICS_ATOMIC_ADD(p, v)            __atomic_fetch_add((p), (UINT64) (v), __ATOMIC_SEQ_CST)
+#define METRICS_ATOMIC_INCREMENT(p)         METRICS_ATOMIC_ADD((p), 1)
+#define METRICS_ATOMIC_COMPARE_EXCHANGE(p, pExpected, v)                                                                  \
+    __atomic_compare_exchange_n((p), (pExpected), (UINT64) (v), FALSE, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)
+
+typedef enum {
+    METRICS_TRACK_VIDEO,
+    METRICS_TRACK_AUDIO,
+    METRICS_TRACK_COUNT,
+} METRICS_TRACK;
+
+typedef enum {
+    // later than the pacer late threshold
+    METRICS_DROP_REASON_LATE,
+    METRICS_DROP_REASON_STORAGE_PRESSURE,
+    METRICS_DROP_REASON_BUFFER_DURATION_PRESSURE,
+    // dropped inside the SDK, droppedFrameReportFn
+    METRICS_DROP_REASON_SDK,
+    METRICS_DROP_REASON_COUNT,
+} METRICS_DROP_REASON;
+
+typedef enum {
+    METRICS_ACK_BUFFERING,
+    METRICS_ACK_RECEIVED,
+    METRICS_ACK_PERSISTED,
+    METRICS_ACK_ERROR,
+    METRICS_ACK_COUNT,
+} METRICS_ACK;
+
+typedef enum {
+    // the stream is described, has an endpoint and a token
+    METRICS_STARTUP_STREAM_READY,
+    METRICS_STARTUP_FIRST_PUT,
+    METRICS_STARTUP_FIRST_ACK,
+    METRICS_STARTUP_COUNT,
+} METRICS_STARTUP;
+
+/**
+ * Fixed bucket histogram updated with atomic adds only. Observations and bounds are integers in the unit of the
+ * histogram, the unit scale turns them into the base unit on export.
+ */
+typedef struct {
+    const UINT64* pBounds;
+    UINT32 boundCount;
+    DOUBLE unitScale;
+    // one more bucket than bounds, the last one catches everything above
+    volatile UINT64 buckets[METRICS_HISTOGRAM_MAX_BOUNDS + 1];
+    volatile UINT64 count;
+    volatile UINT64 sum;
+    // largest observation, the buckets stop well before the worst case
+    volatile UINT64 max;
+} MetricsHistogram, *PMetricsHistogram;
+
+typedef struct {
+    volatile UINT64 status;
+    volatile UINT64 count;
+} MetricsErrorCount, *PMetricsErrorCount;
+
+typedef struct {
+    UINT64 timestamp;
+    UINT64 bufferingTime;
+} MetricsPendingAck, *PMetricsPendingAck;
+
+/**
+ * Everything measured about one stream. Writers never lock, the exporter reads with atomic loads.
+ */
+typedef struct {
+    volatile UINT64 putFrames[METRICS_TRACK_COUNT];
+    volatile UINT64 putBytes[METRICS_TRACK_COUNT];
+    // thread CPU time spent inside putKinesisVideoFrame
+    volatile UINT64 putCpuTimeNs;
+    MetricsHistogram putLatency[METRICS_TRACK_COUNT];
+    volatile UINT64 droppedFrames[METRICS_DROP_REASON_COUNT];
+    MetricsErrorCount errors[METRICS_MAX_ERROR_CODES];
+    volatile UINT64 otherErrors;
+
+    volatile UINT64 acks[METRICS_ACK_COUNT];
+    // time from the buffering ack to the received and persisted acks of the same fragment
+    MetricsHistogram receivedAckLatency;
+    MetricsHistogram persistedAckLatency;
+    // only touched from the ack callback of the stream
+    MetricsPendingAck pendingAcks[METRICS_ACK_RING_SIZE];
+    UINT32 pendingAckHead;
+
+    // sampled off the put path every METRICS_SAMPLE_INTERVAL
+    volatile UINT64 bufferedBytes;
+    volatile UINT64 bufferedDuration;
+    volatile UINT64 transferRate;
+    // buffered duration against the stream buffer duration, per mille
+    MetricsHistogram bufferFill;
+
+    // microseconds from the process start to each startup milestone, 0 until it is reached
+    volatile UINT64 startupTimes[METRICS_STARTUP_COUNT];
+} ChannelMetrics, *PChannelMetrics;
+
+/**
+ * Growable text buffer the exposition is written into
+ */
+typedef struct {
+    PCHAR data;
+    UINT32 size;
+    UINT32 capacity;
+} MetricsBuffer, *PMetricsBuffer;
+
+/**
+ * Writes the Prometheus text of the whole process into the buffer
+ */
+typedef STATUS (*MetricsWriteFunc)(UINT64, PMetricsBuffer);
+
+/**
+ * Called every METRICS_SAMPLE_INTERVAL from the server thread to sample gauges
+ */
+typedef VOID (*MetricsSampleFunc)(UINT64);
+
+/**
+ * Serves GET requests for the metrics over HTTP on 127.0.0.1:<port> or on a Unix socket path.
+ */
+typedef struct {
+    CHAR address[MAX_PATH_LEN + 1];
+    BOOL unixSocket;
+    INT32 listenFd;
+    INT32 stopFd;
+    TID tid;
+    MetricsWriteFunc writeFn;
+    MetricsSampleFunc sampleFn;
+    UINT64 customData;
+    MetricsBuffer buffer;
+} MetricsServer, *PMetricsServer;
+
+/**
+ * One channel as the exporter sees it. What kvs does not run for the channel is NULL.
+ */
+typedef struct {
+    PCHAR name;
+    PChannelMetrics pMetrics;
+    STREAM_HANDLE streamHandle;
+    UINT64 bufferDuration;
+    PSpool pSpool;
+    // capture timestamps only, the audio clock only when the channel has audio
+    PCaptureTrackClock pClocks[METRICS_TRACK_COUNT];
+    // bitrate control only
+    PBandwidthEstimator pBandwidthEstimator;
+    PEncoderControl pEncoderControl;
+    // fragment control only
+    PFragmentController pFragmentController;
+    // NULL with '--recovery off'
+    PRecoveryStream pRecoveryStream;
+    // milliseconds of recording put, backfill only
+    volatile SIZE_T* pBackfillMediaTime;
+    PSegmentWatcher pSegmentWatcher;
+} MetricsChannel, *PMetricsChannel;
+
+/**
+ * Everything the process exports, the custom data of metricsWriteSources and metricsSampleSources
+ */
+typedef struct {
+    CLIENT_HANDLE clientHandle;
+    MetricsChannel channels[MAX_CHANNEL_COUNT];
+    UINT32 channelCount;
+    PFramePool pFramePool;
+    // filled in as the put threads start
+    PScheduler* ppSchedulers;
+    volatile SIZE_T schedulerCount;
+    // sampled every METRICS_SAMPLE_INTERVAL
+    volatile UINT64 contentStoreSize;
+    volatile UINT64 contentStoreAvailableSize;
+} MetricsSources, *PMetricsSources;
+
+VOID metricsHistogramInit(PMetricsHistogram, const UINT64*, UINT32, DOUBLE);
+VOID metricsHistogramObserve(PMetricsHistogram, UINT64);
+
+VOID channelMetricsInit(PChannelMetrics);
+VOID channelMetricsRecordPut(PChannelMetrics, METRICS_TRACK, UINT32, UINT64, UINT64);
+VOID channelMetricsRecordDrop(PChannelMetrics, METRICS_DROP_REASON);
+VOID channelMetricsRecordError(PChannelMetrics, STATUS);
+
+/**
+ * Returns the time since the buffering ack of the same fragment for a received or persisted ack, 0 otherwise
+ */
+UINT64 channelMetricsRecordAck(PChannelMetrics, PFragmentAck, UINT64);
+
+VOID channelMetricsRecordBuffer(PChannelMetrics, UINT64, UINT64, UINT64, UINT64);
+
+/**
+ * Records the time since the process start a milestone was first reached at. Returns TRUE the first time only.
+ */
+BOOL channelMetricsRecordStartup(PChannelMetrics, METRICS_STARTUP, UINT64);
+
+/**
+ * Appends the metrics of all channels labelled with their names, samples are grouped per family
+ */
+STATUS metricsWriteChannels(PMetricsBuffer, PChannelMetrics*, PCHAR*, UINT32);
+
+/**
+ * Prints the exit summary of one channel over the given duration
+ */
+VOID channelMetricsPrintSummary(PChannelMetrics, PCHAR, UINT64);
+
+/**
+ * Prints the startup milestones of one channel reached so far
+ */
+VOID channelMetricsPrintStartup(PChannelMetrics, PCHAR);
+
+STATUS metricsBufferPrintf(PMetricsBuffer, const CHAR*, ...);
+
+/**
+ * Appends one metric family header, every family is written once
+ */
+STATUS metricsWriteFamily(PMetricsBuffer, PCHAR, PCHAR, PCHAR);
+
+/**
+ * Starts serving the metrics. The address is a TCP port on the loopback interface or a Unix socket path.
+ */
+STATUS createMetricsServer(PCHAR, MetricsWriteFunc, MetricsSampleFunc, UINT64, PMetricsServer*);
+STATUS freeMetricsServer(PMetricsServer*);
+
+/**
+ * MetricsSampleFunc and MetricsWriteFunc over a PMetricsSources
+ */
+VOID metricsSampleSources(UINT64);
+STATUS metricsWriteSources(UINT64, PMetricsBuffer);
+
+#endif /* __KVS_METRICS_H__ */
@@ -0,0 +1,834 @@
+/*
+ * Copyright (C) 2020 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+
+#include "MockEndpoint.h"
+#include "Pacer.h"
+
+#define MKV_CLUSTER_ID_0                    0x1F
+#define MKV_CLUSTER_ID_1                    0x43
+#define MKV_CLUSTER_ID_2                    0xB6
+#define MKV_CLUSTER_ID_3                    0x75
+#define MKV_TIMECODE_ID                     0xE7
+#define MOCK_FRAGMENT_NUMBER_BASE           91343852333181432ULL
+
+// frame latency in milliseconds
+static const UINT64 gFrameLatencyBounds[] = {1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 2000, 5000, 10000};
+
+typedef enum {
+    MOCK_BODY_CHUNK_SIZE,
+    MOCK_BODY_CHUNK_DATA,
+    MOCK_BODY_CHUNK_DATA_END,
+    MOCK_BODY_CHUNK_TRAILER,
+    MOCK_BODY_DONE,
+} MOCK_BODY_STATE;
+
+typedef struct {
+    UINT64 dueTime;
+    UINT64 timecode;
+    UINT64 number;
+    PCHAR eventType;
+} MockAck, *PMockAck;
+
+typedef struct {
+    PMockEndpoint pEndpoint;
+    INT32 fd;
+    BYTE in[MOCK_ENDPOINT_MAX_HEAD_SIZE + 1];
+    UINT32 inSize;
+
+    // PutMedia session
+    BOOL chunked;
+    UINT64 bodyRemaining;
+    MOCK_BODY_STATE bodyState;
+    CHAR chunkLine[32];
+    UINT32 chunkLineSize;
+    UINT64 chunkRemaining;
+    BYTE scan[MOCK_ENDPOINT_READ_SIZE + MOCK_ENDPOINT_SCAN_CARRY];
+    UINT32 scanSize;
+    BOOL inFragment;
+    UINT64 fragmentTimecode;
+    UINT64 fragmentNumber;
+    MockAck acks[MOCK_ENDPOINT_MAX_PENDING_ACKS];
+    UINT32 ackHead;
+    UINT32 ackCount;
+    UINT32 randomSeed;
+    BOOL failed;
+} MockConnection, *PMockConnection;
+
+STATIC BOOL mockSendAll(INT32 fd, PCHAR data, UINT32 size)
+{
+    ssize_t result;
+
+    while (size > 0) {
+        result = send(fd, data, size, MSG_NOSIGNAL);
+        if (result < 0 && errno == EINTR) {
+            continue;
+        } else if (result <= 0) {
+            return FALSE;
+        }
+
+        data += result;
+        size -= (UINT32) result;
+    }
+
+    return TRUE;
+}
+
+STATIC BOOL mockSendResponse(INT32 fd, PCHAR body)
+{
+    CHAR head[256];
+
+    SNPRINTF(head, SIZEOF(head), "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: %u\r\n\r\n", (UINT32) STRLEN(body));
+
+    return mockSendAll(fd, head, (UINT32) STRLEN(head)) && mockSendAll(fd, body, (UINT32) STRLEN(body));
+}
+
+STATIC VOID mockQueueAck(PMockConnection pConnection, UINT64 dueTime, PCHAR eventType)
+{
+    PMockAck pAck;
+
+    if (pConnection->ackCount == MOCK_ENDPOINT_MAX_PENDING_ACKS) {
+        // the producer is far ahead of the acks, forget the oldest one
+        pConnection->ackHead = (pConnection->ackHead + 1) % MOCK_ENDPOINT_MAX_PENDING_ACKS;
+        pConnection->ackCount--;
+    }
+
+    pAck = &pConnection->acks[(pConnection->ackHead + pConnection->ackCount++) % MOCK_ENDPOINT_MAX_PENDING_ACKS];
+    pAck->dueTime = dueTime;
+    pAck->timecode = pConnection->fragmentTimecode;
+    pAck->number = pConnection->fragmentNumber;
+    pAck->eventType = eventType;
+}
+
+STATIC BOOL mockSendAck(PMockConnection pConnection, PCHAR eventType, UINT64 timecode, UINT64 number)
+{
+    CHAR ack[256], chunk[300];
+    INT32 length;
+
+    length = SNPRINTF(ack, SIZEOF(ack), "{\"EventType\":\"%s\",\"FragmentTimecode\":%" PRIu64 ",\"FragmentNumber\":\"%" PRIu64 "\"%s}", eventType,
+                      timecode, (UINT64) (MOCK_FRAGMENT_NUMBER_BASE + number),
+                      STRCMP(eventType, "ERROR") == 0 ? ",\"ErrorId\":" MOCK_ENDPOINT_FAULT_ERROR_ID : "");
+    length = SNPRINTF(chunk, SIZEOF(chunk), "%x\r\n%s\r\n", length, ack);
+    if (!mockSendAll(pConnection->fd, chunk, (UINT32) length)) {
+        pConnection->failed = TRUE;
+        return FALSE;
+    }
+
+    ATOMIC_INCREMENT(&pConnection->pEndpoint->stats.acksSent);
+
+    return TRUE;
+}
+
+STATIC BOOL mockFlushAcks(PMockConnection pConnection, UINT64 now)
+{
+    PMockAck pAck;
+
+    while (pConnection->ackCount != 0 && pConnection->acks[pConnection->ackHead].dueTime <= now) {
+        pAck = &pConnection->acks[pConnection->ackHead];
+        if (!mockSendAck(pConnection, pAck->eventType, pAck->timecode, pAck->number)) {
+            return FALSE;
+        }
+
+        pConnection->ackHead = (pConnection->ackHead + 1) % MOCK_ENDPOINT_MAX_PENDING_ACKS;
+        pConnection->ackCount--;
+    }
+
+    return TRUE;
+}
+
+STATIC VOID mockCompleteFragment(PMockConnection pConnection, UINT64 now)
+{
+    PMockEndpoint pEndpoint = pConnection->pEndpoint;
+
+    if (!pConnection->inFragment) {
+        return;
+    }
+
+    pConnection->inFragment = FALSE;
+    if ((UINT32) (rand_r(&pConnection->randomSeed) % 100) < pEndpoint->config.lossPercent) {
+        ATOMIC_INCREMENT(&pEndpoint->stats.lostFragments);
+        return;
+    }
+
+    mockQueueAck(pConnection, now + pEndpoint->config.ackLatency, (PCHAR) "RECEIVED");
+    mockQueueAck(pConnection, now + pEndpoint->config.ackLatency, (PCHAR) "PERSISTED");
+}
+
+/**
+ * Fails the session the way the service or the network does, half the time with an error ack and otherwise by resetting
+ * the connection. Either way the session ends, the producer has to start a new one.
+ */
+STATIC VOID mockInjectFault(PMockConnection pConnection, UINT64 timecode)
+{
+    struct linger linger;
+
+    ATOMIC_INCREMENT(&pConnection->pEndpoint->stats.faults);
+    if (rand_r(&pConnection->randomSeed) % 2 == 0) {
+        mockSendAck(pConnection, (PCHAR) "ERROR", timecode, pConnection->fragmentNumber);
+    } else {
+        // the close sends a reset instead of a fin
+        linger.l_onoff = 1;
+        linger.l_linger = 0;
+        setsockopt(pConnection->fd, SOL_SOCKET, SO_LINGER, &linger, SIZEOF(linger));
+    }
+
+    pConnection->failed = TRUE;
+}
+
+STATIC VOID mockStartFragment(PMockConnection pConnection, UINT64 timecode, UINT64 now)
+{
+    if (pConnection->failed) {
+        return;
+    }
+
+    mockCompleteFragment(pConnection, now);
+
+    pConnection->inFragment = TRUE;
+    pConnection->fragmentTimecode = timecode;
+    pConnection->fragmentNumber++;
+    ATOMIC_INCREMENT(&pConnection->pEndpoint->stats.fragments);
+    if ((UINT32) (rand_r(&pConnection->randomSeed) % 100) < pConnection->pEndpoint->config.faultPercent) {
+        mockInjectFault(pConnection, timecode);
+        return;
+    }
+
+    // queued acks are all later than this one
+    mockSendAck(pConnection, (PCHAR) "BUFFERING", timecode, pConnection->fragmentNumber);
+}
+
+/**
+ * Returns the number of bytes at the position needed to decide on a cluster or timestamp marker, 0 when there is
+ * none there and MAX_UINT32 when more bytes are needed
+ */
+STATIC UINT32 mockScanAt(PMockConnection pConnection, PBYTE pCur, UINT32 available, UINT64 now)
+{
+    UINT32 sizeLength, timecodeLength, i;
+    UINT64 timecode = 0, timestamp = 0;
+    BYTE digit;
+
+    if (pCur[0] == MKV_CLUSTER_ID_0) {
+        if (available < 5) {
+            return MAX_UINT32;
+        }
+
+        if (pCur[1] != MKV_CLUSTER_ID_1 || pCur[2] != MKV_CLUSTER_ID_2 || pCur[3] != MKV_CLUSTER_ID_3 || pCur[4] == 0) {
+            return 0;
+        }
+
+        // cluster size vint, then the cluster timecode element
+        sizeLength = 1 + __builtin_clz((UINT32) pCur[4]) - 24;
+        if (available < 4 + sizeLength + 2) {
+            return MAX_UINT32;
+        }
+
+        if (pCur[4 + sizeLength] != MKV_TIMECODE_ID || (pCur[5 + sizeLength] & 0x80) == 0) {
+            return 0;
+        }
+
+        timecodeLength = pCur[5 + sizeLength] & 0x7f;
+        if (timecodeLength == 0 || timecodeLength > 8) {
+            return 0;
+        }
+
+        if (available < 6 + sizeLength + timecodeLength) {
+            return MAX_UINT32;
+        }
+
+        for (i = 0; i < timecodeLength; i++) {
+            timecode = (timecode << 8) | pCur[6 + sizeLength + i];
+        }
+
+        mockStartFragment(pConnection, timecode, now);
+
+        return 6 + sizeLength + timecodeLength;
+    }
+
+    if (pCur[0] == MOCK_ENDPOINT_TIMESTAMP_MARKER[0]) {
+        if (available < MOCK_ENDPOINT_TIMESTAMP_LEN) {
+            return MAX_UINT32;
+        }
+
+        if (MEMCMP(pCur, MOCK_ENDPOINT_TIMESTAMP_MARKER, MOCK_ENDPOINT_TIMESTAMP_MARKER_LEN) != 0) {
+            return 0;
+        }
+
+        for (i = MOCK_ENDPOINT_TIMESTAMP_MARKER_LEN; i < MOCK_ENDPOINT_TIMESTAMP_LEN; i++) {
+            digit = pCur[i];
+            if (digit >= '0' && digit <= '9') {
+                timestamp = (timestamp << 4) | (UINT64) (digit - '0');
+            } else if (digit >= 'a' && digit <= 'f') {
+                timestamp = (timestamp << 4) | (UINT64) (digit - 'a' + 10);
+            } else {
+                return 0;
+            }
+        }
+
+        if (timestamp <= now) {
+            metricsHistogramObserve(&pConnection->pEndpoint->stats.frameLatency, (now - timestamp) / HUNDREDS_OF_NANOS_IN_A_MILLISECOND);
+        }
+
+        return MOCK_ENDPOINT_TIMESTAMP_LEN;
+    }
+
+    return 0;
+}
+
+/**
+ * Scans PutMedia payload bytes. A match cut by the end of the data is carried over to the next call.
+ */
+STATIC VOID mockScanBody(PMockConnection pConnection, PBYTE pData, UINT32 size, UINT64 now)
+{
+    UINT32 offset = 0, consumed, copy;
+
+    ATOMIC_ADD(&pConnection->pEndpoint->stats.bytesReceived, (SIZE_T) size);
+
+    while (size > 0) {
+        copy = MIN(size, SIZEOF(pConnection->scan) - pConnection->scanSize);
+        MEMCPY(pConnection->scan + pConnection->scanSize, pData, copy);
+        pConnection->scanSize += copy;
+        pData += copy;
+        size -= copy;
+
+        for (offset = 0; offset < pConnection->scanSize; offset++) {
+            consumed = mockScanAt(pConnection, pConnection->scan + offset, pConnection->scanSize - offset, now);
+            if (consumed == MAX_UINT32) {
+                break;
+            } else if (consumed != 0) {
+                offset += consumed - 1;
+            }
+        }
+
+        // the carry is shorter than the longest match
+        pConnection->scanSize -= MIN(offset, pConnection->scanSize);
+        MEMMOVE(pConnection->scan, pConnection->scan + offset, pConnection->scanSize);
+    }
+}
+
+/**
+ * Strips the chunked transfer encoding and feeds the payload to the scanner
+ */
+STATIC VOID mockDecodeBody(PMockConnection pConnection, PBYTE pData, UINT32 size, UINT64 now)
+{
+    UINT32 take;
+    CHAR c;
+
+    if (!pConnection->chunked) {
+        take = (UINT32) MIN(size, pConnection->bodyRemaining);
+        mockScanBody(pConnection, pData, take, now);
+        pConnection->bodyRemaining -= take;
+        if (pConnection->bodyRemaining == 0) {
+            pConnection->bodyState = MOCK_BODY_DONE;
+        }
+
+        return;
+    }
+
+    while (size > 0 && pConnection->bodyState != MOCK_BODY_DONE) {
+        switch (pConnection->bodyState) {
+            case MOCK_BODY_CHUNK_SIZE:
+            case MOCK_BODY_CHUNK_TRAILER:
+                c = (CHAR) *pData++;
+                size--;
+                if (c != '\n') {
+                    if (c != '\r' && pConnection->chunkLineSize < SIZEOF(pConnection->chunkLine) - 1) {
+                        pConnection->chunkLine[pConnection->chunkLineSize++] = c;
+                    }
+                    break;
+                }
+
+                pConnection->chunkLine[pConnection->chunkLineSize] = '\0';
+                if (pConnection->bodyState == MOCK_BODY_CHUNK_TRAILER) {
+                    // an empty line ends the trailer
+                    if (pConnection->chunkLineSize == 0) {
+                        pConnection->bodyState = MOCK_BODY_DONE;
+                    }
+                } else {
+                    pConnection->chunkRemaining = strtoull(pConnection->chunkLine, NULL, 16);
+                    pConnection->bodyState = pConnection->chunkRemaining == 0 ? MOCK_BODY_CHUNK_TRAILER : MOCK_BODY_CHUNK_DATA;
+                }
+
+                pConnection->chunkLineSize = 0;
+                break;
+
+            case MOCK_BODY_CHUNK_DATA:
+                take = (UINT32) MIN(size, pConnection->chunkRemaining);
+                mockScanBody(pConnection, pData, take, now);
+                pData += take;
+                size -= take;
+                pConnection->chunkRemaining -= take;
+                if (pConnection->chunkRemaining == 0) {
+                    pConnection->bodyState = MOCK_BODY_CHUNK_DATA_END;
+                }
+                break;
+
+            case MOCK_BODY_CHUNK_DATA_END:
+                if (*pData++ == '\n') {
+                    pConnection->bodyState = MOCK_BODY_CHUNK_SIZE;
+                }
+                size--;
+                break;
+
+            default:
+                size = 0;
+                break;
+        }
+    }
+}
+
+STATIC VOID mockServePutMedia(PMockConnection pConnection, BOOL expectContinue)
+{
+    PMockEndpoint pEndpoint = pConnection->pEndpoint;
+    static const CHAR continueHead[] = "HTTP/1.1 100 Continue\r\n\r\n";
+    static const CHAR responseHead[] = "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nTransfer-Encoding: chunked\r\n\r\n";
+    static const CHAR responseEnd[] = "0\r\n\r\n";
+    BYTE buffer[MOCK_ENDPOINT_READ_SIZE];
+    struct pollfd pollFd;
+    UINT64 now, startTime = pacerGetTime(), received = 0, allowed;
+    INT32 timeout;
+    UINT32 readSize;
+    ssize_t result;
+
+    ATOMIC_INCREMENT(&pEndpoint->stats.putMediaSessions);
+    pConnection->randomSeed = (UINT32) startTime;
+
+    if ((expectContinue && !mockSendAll(pConnection->fd, (PCHAR) continueHead, SIZEOF(continueHead) - 1)) ||
+        !mockSendAll(pConnection->fd, (PCHAR) responseHead, SIZEOF(responseHead) - 1)) {
+        return;
+    }
+
+    // body bytes read along with the request head
+    now = pacerGetTime();
+    received = pConnection->inSize;
+    mockDecodeBody(pConnection, pConnection->in, pConnection->inSize, now);
+    pConnection->inSize = 0;
+
+    pollFd.fd = pConnection->fd;
+    while (!ATOMIC_LOAD_BOOL(&pEndpoint->shutdown)) {
+        if (ATOMIC_LOAD_BOOL(&pEndpoint->linkDown)) {
+            // the producer sees its writes stall and no acks coming back
+            THREAD_SLEEP(MOCK_ENDPOINT_LINK_POLL_INTERVAL);
+            continue;
+        }
+
+        now = pacerGetTime();
+        if (pConnection->bodyState == MOCK_BODY_DONE) {
+            mockCompleteFragment(pConnection, now);
+        }
+
+        if (!mockFlushAcks(pConnection, now) || pConnection->failed) {
+            return;
+        }
+
+        if (pConnection->bodyState == MOCK_BODY_DONE && pConnection->ackCount == 0) {
+            break;
+        }
+
+        timeout = -1;
+        readSize = SIZEOF(buffer);
+        pollFd.events = pConnection->bodyState == MOCK_BODY_DONE ? 0 : POLLIN;
+        if (pEndpoint->config.bandwidth != 0 && pConnection->bodyState != MOCK_BODY_DONE) {
+            // a little burst on top of the rate so reads are not byte sized
+            allowed = pEndpoint->config.bandwidth * (now - startTime) / HUNDREDS_OF_NANOS_IN_A_SECOND + SIZEOF(buffer);
+            if (allowed <= received) {
+                pollFd.events = 0;
+                timeout = (INT32) ((received - allowed) * 1000 / pEndpoint->config.bandwidth) + 1;
+            } else {
+                readSize = (UINT32) MIN(readSize, allowed - received);
+            }
+        }
+
+        if (pConnection->ackCount != 0) {
+            allowed = pConnection->acks[pConnection->ackHead].dueTime;
+            allowed = allowed > now ? (allowed - now) / HUNDREDS_OF_NANOS_IN_A_MILLISECOND + 1 : 0;
+            timeout = timeout < 0 ? (INT32) allowed : MIN(timeout, (INT32) allowed);
+        }
+
+        if (poll(&pollFd, 1, timeout) < 0 && errno != EINTR) {
+            return;
+        }
+
+        if ((pollFd.revents & (POLLIN | POLLHUP | POLLERR)) != 0) {
+            result = read(pConnection->fd, buffer, readSize);
+            if (result <= 0) {
+                // the producer went away, nobody is left to ack
+                break;
+            }
+
+            received += (UINT64) result;
+            mockDecodeBody(pConnection, buffer, (UINT32) result, pacerGetTime());
+        }
+    }
+
+    mockSendAll(pConnection->fd, (PCHAR) responseEnd, SIZEOF(responseEnd) - 1);
+}
+
+STATIC BOOL mockReadMore(PMockConnection pConnection)
+{
+    ssize_t result;
+
+    if (pConnection->inSize == MOCK_ENDPOINT_MAX_HEAD_SIZE) {
+        return FALSE;
+    }
+
+    do {
+        result = read(pConnection->fd, pConnection->in + pConnection->inSize, MOCK_ENDPOINT_MAX_HEAD_SIZE - pConnection->inSize);
+    } while (result < 0 && errno == EINTR);
+
+    if (result <= 0) {
+        return FALSE;
+    }
+
+    pConnection->inSize += (UINT32) result;
+    pConnection->in[pConnection->inSize] = '\0';
+
+    return TRUE;
+}
+
+STATIC VOID mockConsume(PMockConnection pConnection, UINT32 size)
+{
+    pConnection->inSize -= size;
+    MEMMOVE(pConnection->in, pConnection->in + size, pConnection->inSize);
+    pConnection->in[pConnection->inSize] = '\0';
+}
+
+STATIC VOID mockServeConnection(PMockConnection pConnection)
+{
+    PMockEndpoint pEndpoint = pConnection->pEndpoint;
+    CHAR path[128], streamName[MAX_STREAM_NAME_LEN + 1], body[1024];
+    PCHAR pHeadEnd, pHeader, pValue;
+    UINT32 headSize, contentLength;
+    BOOL chunked, expectContinue;
+
+    while (!ATOMIC_LOAD_BOOL(&pEndpoint->shutdown)) {
+        while ((pHeadEnd = STRSTR((PCHAR) pConnection->in, "\r\n\r\n")) == NULL) {
+            if (!mockReadMore(pConnection)) {
+                return;
+            }
+        }
+
+        ATOMIC_INCREMENT(&pEndpoint->stats.requests);
+        headSize = (UINT32) (pHeadEnd - (PCHAR) pConnection->in) + 4;
+        *pHeadEnd = '\0';
+
+        if (sscanf((PCHAR) pConnection->in, "%*s %127s", path) != 1) {
+            return;
+        }
+
+        contentLength = 0;
+        chunked = FALSE;
+        expectContinue = FALSE;
+        for (pHeader = STRSTR((PCHAR) pConnection->in, "\r\n"); pHeader != NULL; pHeader = STRSTR(pHeader + 2, "\r\n")) {
+            pValue = STRCHR(pHeader + 2, ':');
+            if (pValue == NULL) {
+                continue;
+            }
+
+            if (STRNCMPI(pHeader + 2, "content-length:", 15) == 0) {
+                contentLength = (UINT32) strtoul(pValue + 1, NULL, 10);
+            } else if (STRNCMPI(pHeader + 2, "transfer-encoding:", 18) == 0) {
+                chunked = TRUE;
+            } else if (STRNCMPI(pHeader + 2, "expect:", 7) == 0) {
+                expectContinue = TRUE;
+            }
+        }
+
+        mockConsume(pConnection, headSize);
+
+        // requests made while the link is cut are answered once it is back, or time out on the producer side
+        while (ATOMIC_LOAD_BOOL(&pEndpoint->linkDown) && !ATOMIC_LOAD_BOOL(&pEndpoint->shutdown)) {
+            THREAD_SLEEP(MOCK_ENDPOINT_LINK_POLL_INTERVAL);
+        }
+
+        if (STRCMP(path, "/putMedia") == 0) {
+            pConnection->chunked = chunked;
+            pConnection->bodyRemaining = chunked ? 0 : contentLength;
+            pConnection->bodyState = chunked || contentLength != 0 ? MOCK_BODY_CHUNK_SIZE : MOCK_BODY_DONE;
+            mockServePutMedia(pConnection, expectContinue);
+            return;
+        }
+
+        if (expectContinue && !mockSendAll(pConnection->fd, (PCHAR) "HTTP/1.1 100 Continue\r\n\r\n", 25)) {
+            return;
+        }
+
+        // control plane bodies are small JSON documents
+        while (pConnection->inSize < contentLength) {
+            if (!mockReadMore(pConnection)) {
+                return;
+            }
+        }
+
+        STRCPY(streamName, "stream");
+        pValue = STRSTR((PCHAR) pConnection->in, "\"StreamName\"");
+        if (pValue != NULL && (pValue = STRCHR(pValue + 12, '"')) != NULL) {
+            sscanf(pValue + 1, "%256[^\"]", streamName);
+        }
+
+        mockConsume(pConnection, contentLength);
+
+        if (STRCMP(path, "/describeStream") == 0) {
+            SNPRINTF(body, SIZEOF(body),
+                     "{\"StreamInfo\":{\"CreationTime\":1600000000,\"DataRetentionInHours\":2,\"DeviceName\":\"kvsmock\","
+                     "\"KmsKeyId\":\"arn:aws:kms:us-west-2:000000000000:alias/aws/kinesisvideo\",\"MediaType\":\"video/h264\","
+                     "\"StreamARN\":\"arn:aws:kinesisvideo:us-west-2:000000000000:stream/%s/0\",\"StreamName\":\"%s\","
+                     "\"Status\":\"ACTIVE\",\"Version\":\"1\"}}",
+                     streamName, streamName);
+        } else if (STRCMP(path, "/createStream") == 0) {
+            SNPRINTF(body, SIZEOF(body), "{\"StreamARN\":\"arn:aws:kinesisvideo:us-west-2:000000000000:stream/%s/0\"}", streamName);
+        } else if (STRCMP(path, "/getDataEndpoint") == 0) {
+            SNPRINTF(body, SIZEOF(body), "{\"DataEndpoint\":\"http://127.0.0.1:%u\"}", pEndpoint->port);
+        } else {
+            STRCPY(body, "{}");
+        }
+
+        if (!mockSendResponse(pConnection->fd, body)) {
+            return;
+        }
+    }
+}
+
+STATIC PVOID mockConnectionRoutine(PVOID args)
+{
+    PMockConnection pConnection = (PMockConnection) args;
+    PMockEndpoint pEndpoint = pConnection->pEndpoint;
+    UINT32 i;
+
+    mockServeConnection(pConnection);
+
+    MUTEX_LOCK(pEndpoint->lock);
+    for (i = 0; i < MOCK_ENDPOINT_MAX_CONNECTIONS; i++) {
+        if (pEndpoint->connectionFds[i] == pConnection->fd) {
+            pEndpoint->connectionFds[i] = -1;
+            break;
+        }
+    }
+
+    close(pConnection->fd);
+    pEndpoint->activeConnections--;
+    CVAR_BROADCAST(pEndpoint->idleCvar);
+    MUTEX_UNLOCK(pEndpoint->lock);
+
+    MEMFREE(pConnection);
+
+    return NULL;
+}
+
+STATIC PVOID mockAcceptRoutine(PVOID args)
+{
+    PMockEndpoint pEndpoint = (PMockEndpoint) args;
+    PMockConnection pConnection;
+    struct pollfd pollFds[2];
+    TID tid;
+    INT32 fd;
+    UINT32 i;
+
+    pollFds[0].fd = pEndpoint->listenFd;
+    pollFds[0].events = POLLIN;
+    pollFds[1].fd = pEndpoint->stopFd;
+    pollFds[1].events = POLLIN;
+
+    while (!ATOMIC_LOAD_BOOL(&pEndpoint->shutdown)) {
+        if (poll(pollFds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+
+        if ((pollFds[1].revents & POLLIN) != 0) {
+            break;
+        }
+
+        if ((pollFds[0].revents & POLLIN) == 0 || (fd = accept(pEndpoint->listenFd, NULL, NULL)) < 0) {
+            continue;
+        }
+
+        ATOMIC_INCREMENT(&pEndpoint->stats.connections);
+        pConnection = (PMockConnection) MEMCALLOC(1, SIZEOF(MockConnection));
+
+        MUTEX_LOCK(pEndpoint->lock);
+        for (i = 0; i < MOCK_ENDPOINT_MAX_CONNECTIONS && pEndpoint->connectionFds[i] >= 0; i++);
+        if (pConnection == NULL || i == MOCK_ENDPOINT_MAX_CONNECTIONS) {
+            MUTEX_UNLOCK(pEndpoint->lock);
+            close(fd);
+            SAFE_MEMFREE(pConnection);
+            continue;
+        }
+
+        pConnection->pEndpoint = pEndpoint;
+        pConnection->fd = fd;
+        pEndpoint->connectionFds[i] = fd;
+        pEndpoint->activeConnections++;
+        if (STATUS_FAILED(THREAD_CREATE(&tid, mockConnectionRoutine, (PVOID) pConnection))) {
+            pEndpoint->connectionFds[i] = -1;
+            pEndpoint->activeConnections--;
+            close(fd);
+            MEMFREE(pConnection);
+        } else {
+            THREAD_DETACH(tid);
+        }
+        MUTEX_UNLOCK(pEndpoint->lock);
+    }
+
+    return NULL;
+}
+
+STATUS createMockEndpoint(PMockEndpointConfig pConfig, PMockEndpoint* ppEndpoint)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    PMockEndpoint pEndpoint = NULL;
+    struct sockaddr_in address;
+    socklen_t addressLength = SIZEOF(address);
+    INT32 enable = 1;
+    UINT32 i;
+
+    CHK(pConfig != NULL && ppEndpoint != NULL, STATUS_NULL_ARG);
+    CHK(pConfig->lossPercent <= 100 && pConfig->faultPercent <= 100, STATUS_INVALID_ARG);
+
+    CHK(NULL != (pEndpoint = (PMockEndpoint) MEMCALLOC(1, SIZEOF(MockEndpoint))), STATUS_NOT_ENOUGH_MEMORY);
+    pEndpoint->config = *pConfig;
+    pEndpoint->listenFd = -1;
+    pEndpoint->stopFd = -1;
+    pEndpoint->acceptTid = INVALID_TID_VALUE;
+    for (i = 0; i < MOCK_ENDPOINT_MAX_CONNECTIONS; i++) {
+        pEndpoint->connectionFds[i] = -1;
+    }
+    metricsHistogramInit(&pEndpoint->stats.frameLatency, gFrameLatencyBounds, ARRAY_SIZE(gFrameLatencyBounds), 1e-3);
+
+    pEndpoint->lock = MUTEX_CREATE(FALSE);
+    pEndpoint->idleCvar = CVAR_CREATE();
+    CHK(IS_VALID_MUTEX_VALUE(pEndpoint->lock) && IS_VALID_CVAR_VALUE(pEndpoint->idleCvar), STATUS_NOT_ENOUGH_MEMORY);
+
+    MEMSET(&address, 0x00, SIZEOF(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(pConfig->port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    CHK((pEndpoint->listenFd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0)) >= 0, STATUS_INVALID_OPERATION);
+    setsockopt(pEndpoint->listenFd, SOL_SOCKET, SO_REUSEADDR, &enable, SIZEOF(enable));
+    CHK(bind(pEndpoint->listenFd, (struct sockaddr*) &address, SIZEOF(address)) == 0, STATUS_INVALID_OPERATION);
+    CHK(listen(pEndpoint->listenFd, MOCK_ENDPOINT_MAX_CONNECTIONS) == 0, STATUS_INVALID_OPERATION);
+    CHK(getsockname(pEndpoint->listenFd, (struct sockaddr*) &address, &addressLength) == 0, STATUS_INVALID_OPERATION);
+    pEndpoint->port = ntohs(address.sin_port);
+
+    CHK((pEndpoint->stopFd = eventfd(0, EFD_CLOEXEC)) >= 0, STATUS_INVALID_OPERATION);
+    CHK_STATUS(THREAD_CREATE(&pEndpoint->acceptTid, mockAcceptRoutine, (PVOID) pEndpoint));
+
+CleanUp:
+
+    if (STATUS_FAILED(retStatus)) {
+        freeMockEndpoint(&pEndpoint);
+    }
+
+    if (ppEndpoint != NULL) {
+        *ppEndpoint = pEndpoint;
+    }
+
+    return retStatus;
+}
+
+STATUS freeMockEndpoint(PMockEndpoint* ppEndpoint)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    PMockEndpoint pEndpoint;
+    UINT64 value = 1;
+    UINT32 i;
+
+    CHK(ppEndpoint != NULL, STATUS_NULL_ARG);
+
+    pEndpoint = *ppEndpoint;
+    CHK(pEndpoint != NULL, retStatus);
+
+    ATOMIC_STORE_BOOL(&pEndpoint->shutdown, TRUE);
+    if (IS_VALID_TID_VALUE(pEndpoint->acceptTid)) {
+        if (write(pEndpoint->stopFd, &value, SIZEOF(value)) != SIZEOF(value)) {
+            DLOGW("Failed to stop the mock endpoint");
+        }
+
+        THREAD_JOIN(pEndpoint->acceptTid, NULL);
+    }
+
+    if (IS_VALID_MUTEX_VALUE(pEndpoint->lock)) {
+        // wake up every connection and wait for them to go
+        MUTEX_LOCK(pEndpoint->lock);
+        for (i = 0; i < MOCK_ENDPOINT_MAX_CONNECTIONS; i++) {
+            if (pEndpoint->connectionFds[i] >= 0) {
+                shutdown(pEndpoint->connectionFds[i], SHUT_RDWR);
+            }
+        }
+
+        while (pEndpoint->activeConnections != 0) {
+            CVAR_WAIT(pEndpoint->idleCvar, pEndpoint->lock, INFINITE_TIME_VALUE);
+        }
+        MUTEX_UNLOCK(pEndpoint->lock);
+        MUTEX_FREE(pEndpoint->lock);
+    }
+
+    if (IS_VALID_CVAR_VALUE(pEndpoint->idleCvar)) {
+        CVAR_FREE(pEndpoint->idleCvar);
+    }
+
+    if (pEndpoint->listenFd >= 0) {
+        close(pEndpoint->listenFd);
+    }
+
+    if (pEndpoint->stopFd >= 0) {
+        close(pEndpoint->stopFd);
+    }
+
+    MEMFREE(pEndpoint);
+    *ppEndpoint = NULL;
+
+CleanUp:
+
+    return retStatus;
+}
+
+VOID mockEndpointGetLatencyPercentiles(PMockEndpoint pEndpoint, PUINT64 pP50, PUINT64 pP90, PUINT64 pP99)
+{
+    PMetricsHistogram pHistogram = &pEndpoint->stats.frameLatency;
+    UINT64 count = (UINT64) METRICS_ATOMIC_LOAD(&pHistogram->count), cumulative = 0, bound;
+    PUINT64 pTargets[3] = {pP50, pP90, pP99};
+    UINT64 thresholds[3] = {count * 50, count * 90, count * 99};
+    UINT32 i, t = 0;
+
+    *pP50 = *pP90 = *pP99 = 0;
+    for (i = 0; i <= pHistogram->boundCount && t < 3 && count != 0; i++) {
+        cumulative += (UINT64) METRICS_ATOMIC_LOAD(&pHistogram->buckets[i]);
+        // the overflow bucket reports twice the last bound
+        bound = i < pHistogram->boundCount ? pHistogram->pBounds[i] : pHistogram->pBounds[i - 1] * 2;
+        while (t < 3 && cumulative * 100 >= thresholds[t]) {
+            *pTargets[t++] = bound;
+        }
+    }
+}
+
+VOID mockEndpointSetLinkDown(PMockEndpoint pEndpoint, BOOL linkDown)
+{
+    ATOMIC_STORE_BOOL(&pEndpoint->linkDown, linkDown);
+}
@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2020 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __KVS_MOCK_ENDPOINT_H__
+#define __KVS_MOCK_ENDPOINT_H__
+
+#include "Metrics.h"
+
+#define MOCK_ENDPOINT_MAX_CONNECTIONS       64
+#define MOCK_ENDPOINT_MAX_HEAD_SIZE         (16 * 1024)
+#define MOCK_ENDPOINT_READ_SIZE             (64 * 1024)
+#define MOCK_ENDPOINT_MAX_PENDING_ACKS      64
+#define MOCK_ENDPOINT_SCAN_CARRY            32
+// how often connections check whether a cut link came back
+#define MOCK_ENDPOINT_LINK_POLL_INTERVAL    (50 * HUNDREDS_OF_NANOS_IN_A_MILLISECOND)
+// ErrorId of the error acks of injected faults, an internal error of the service
+#define MOCK_ENDPOINT_FAULT_ERROR_ID        "5000"
+
+/**
+ * Written by the bench source into every frame, followed by pacerGetTime() as 16 hex digits
+ */
+#define MOCK_ENDPOINT_TIMESTAMP_MARKER      "KVSBENCH"
+#define MOCK_ENDPOINT_TIMESTAMP_MARKER_LEN  8
+#define MOCK_ENDPOINT_TIMESTAMP_LEN         (MOCK_ENDPOINT_TIMESTAMP_MARKER_LEN + 16)
+
+typedef struct {
+    // 0 picks a free port
+    UINT16 port;
+    // delay of the received and persisted acks after the fragment is complete, 100ns
+    UINT64 ackLatency;
+    // read rate cap in bytes per second per connection, 0 for none
+    UINT64 bandwidth;
+    // share of fragments whose received and persisted acks are never sent
+    UINT32 lossPercent;
+    // share of fragments failing their session with an error ack or a connection reset
+    UINT32 faultPercent;
+} MockEndpointConfig, *PMockEndpointConfig;
+
+typedef struct {
+    volatile SIZE_T connections;
+    volatile SIZE_T requests;
+    volatile SIZE_T putMediaSessions;
+    volatile SIZE_T bytesReceived;
+    volatile SIZE_T fragments;
+    volatile SIZE_T acksSent;
+    volatile SIZE_T lostFragments;
+    volatile SIZE_T faults;
+    // time from the bench source writing a frame to the frame arriving here, milliseconds
+    MetricsHistogram frameLatency;
+} MockEndpointStats, *PMockEndpointStats;
+
+/**
+ * Stand-in for the Kinesis Video Streams control plane and PutMedia over plain HTTP.
+ *
+ * describeStream always reports an active stream and getDataEndpoint points back at the mock. PutMedia bodies are
+ * decoded from chunked encoding and scanned for MKV clusters, every cluster gets a buffering ack right away and its
+ * received and persisted acks once the next one starts plus the configured latency.
+ */
+typedef struct {
+    MockEndpointConfig config;
+    UINT16 port;
+    INT32 listenFd;
+    INT32 stopFd;
+    TID acceptTid;
+    MUTEX lock;
+    CVAR idleCvar;
+    // guarded by lock
+    INT32 connectionFds[MOCK_ENDPOINT_MAX_CONNECTIONS];
+    UINT32 activeConnections;
+    volatile ATOMIC_BOOL shutdown;
+    // nothing is read, answered or acked while set, connections stay open
+    volatile ATOMIC_BOOL linkDown;
+    MockEndpointStats stats;
+} MockEndpoint, *PMockEndpoint;
+
+STATUS createMockEndpoint(PMockEndpointConfig, PMockEndpoint*);
+STATUS freeMockEndpoint(PMockEndpoint*);
+
+/**
+ * Returns the 50th, 90th and 99th percentile of the frame latency in milliseconds, bucket upper bounds
+ */
+VOID mockEndpointGetLatencyPercentiles(PMockEndpoint, PUINT64, PUINT64, PUINT64);
+
+/**
+ * Cuts or restores the link of every connection, new ones included, to simulate an outage
+ */
+VOID mockEndpointSetLinkDown(PMockEndpoint, BOOL);
+
+#endif /* __KVS_MOCK_ENDPOINT_H__ */
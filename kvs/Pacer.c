@@ -0,0 +1,214 @@
+/*
+ * Copyright (C) 2020 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <time.h>
+
+#include "Pacer.h"
+
+/**
+ * Upper bounds of the histogram buckets in 100ns, the last bucket is unbounded
+ */
+static const INT64 gPacerBucketBounds[PACER_HISTOGRAM_BUCKET_COUNT - 1] = {
+    -10 * HUNDREDS_OF_NANOS_IN_A_MILLISECOND,
+    -1 * HUNDREDS_OF_NANOS_IN_A_MILLISECOND,
+    0,
+    1 * HUNDREDS_OF_NANOS_IN_A_MILLISECOND,
+    2 * HUNDREDS_OF_NANOS_IN_A_MILLISECOND,
+    5 * HUNDREDS_OF_NANOS_IN_A_MILLISECOND,
+    10 * HUNDREDS_OF_NANOS_IN_A_MILLISECOND,
+    20 * HUNDREDS_OF_NANOS_IN_A_MILLISECOND,
+    50 * HUNDREDS_OF_NANOS_IN_A_MILLISECOND,
+    100 * HUNDREDS_OF_NANOS_IN_A_MILLISECOND,
+    200 * HUNDREDS_OF_NANOS_IN_A_MILLISECOND,
+    500 * HUNDREDS_OF_NANOS_IN_A_MILLISECOND,
+    1000 * HUNDREDS_OF_NANOS_IN_A_MILLISECOND,
+};
+
+static PacerClockFunc gPacerClockFn = NULL;
+static PacerWaitFunc gPacerWaitFn = NULL;
+
+UINT64 pacerGetTime()
+{
+    struct timespec now;
+
+    if (gPacerClockFn != NULL) {
+        return gPacerClockFn();
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (UINT64) now.tv_sec * HUNDREDS_OF_NANOS_IN_A_SECOND + (UINT64) now.tv_nsec / DEFAULT_TIME_UNIT_IN_NANOS;
+}
+
+VOID pacerSetClock(PacerClockFunc clockFn, PacerWaitFunc waitFn)
+{
+    gPacerClockFn = clockFn;
+    gPacerWaitFn = waitFn;
+}
+
+BOOL pacerWait(UINT64 deadline)
+{
+    if (gPacerWaitFn == NULL) {
+        return FALSE;
+    }
+
+    gPacerWaitFn(deadline);
+
+    return TRUE;
+}
+
+STATUS pacerInit(PPacer pPacer, PCHAR trackName, UINT64 startTime, PACER_LATE_POLICY latePolicy, UINT64 lateThreshold)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+
+    CHK(pPacer != NULL && trackName != NULL, STATUS_NULL_ARG);
+
+    MEMSET(pPacer, 0x00, SIZEOF(Pacer));
+    STRNCPY(pPacer->trackName, trackName, SIZEOF(pPacer->trackName) - 1);
+    pPacer->startTime = startTime;
+    pPacer->latePolicy = latePolicy;
+    pPacer->lateThreshold = lateThreshold;
+    pPacer->histogram.min = MAX_INT64;
+    pPacer->histogram.max = -MAX_INT64;
+
+CleanUp:
+
+    return retStatus;
+}
+
+STATIC VOID pacerRecordLateness(PPacerHistogram pHistogram, INT64 lateness)
+{
+    UINT32 i;
+
+    for (i = 0; i < PACER_HISTOGRAM_BUCKET_COUNT - 1 && lateness >= gPacerBucketBounds[i]; i++);
+
+    pHistogram->buckets[i]++;
+    pHistogram->count++;
+    pHistogram->sum += lateness;
+    pHistogram->min = MIN(pHistogram->min, lateness);
+    pHistogram->max = MAX(pHistogram->max, lateness);
+}
+
+UINT64 pacerGetFrameDeadline(PPacer pPacer, PFrame pFrame)
+{
+    return pPacer->startTime + pFrame->presentationTs;
+}
+
+STATUS pacerCheckFrame(PPacer pPacer, PFrame pFrame, UINT64 now, PBOOL pDrop)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    INT64 lateness;
+    BOOL drop = FALSE;
+
+    CHK(pPacer != NULL && pFrame != NULL && pDrop != NULL, STATUS_NULL_ARG);
+
+    lateness = (INT64) (now - pacerGetFrameDeadline(pPacer, pFrame));
+
+    if (pPacer->waitForKeyFrame && (pFrame->flags & FRAME_FLAG_KEY_FRAME) != 0) {
+        pPacer->waitForKeyFrame = FALSE;
+    }
+
+    if (pPacer->waitForKeyFrame) {
+        drop = TRUE;
+    } else if (lateness > (INT64) pPacer->lateThreshold) {
+        switch (pPacer->latePolicy) {
+            case PACER_LATE_POLICY_SKIP:
+                drop = TRUE;
+                break;
+            case PACER_LATE_POLICY_NEXT_KEY_FRAME:
+                // A late key frame is still put, the GOP behind it stays intact
+                if ((pFrame->flags & FRAME_FLAG_KEY_FRAME) == 0) {
+                    pPacer->waitForKeyFrame = TRUE;
+                    drop = TRUE;
+                }
+                break;
+            default:
+                break;
+        }
+    }
+
+    if (drop) {
+        pPacer->histogram.droppedFrames++;
+    } else {
+        pacerRecordLateness(&pPacer->histogram, lateness);
+    }
+
+CleanUp:
+
+    if (pDrop != NULL) {
+        *pDrop = drop;
+    }
+
+    return retStatus;
+}
+
+STATUS pacerParseLatePolicy(PCHAR value, PACER_LATE_POLICY* pLatePolicy)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+
+    CHK(value != NULL && pLatePolicy != NULL, STATUS_NULL_ARG);
+
+    if (STRCMP(value, "catch-up") == 0) {
+        *pLatePolicy = PACER_LATE_POLICY_CATCH_UP;
+    } else if (STRCMP(value, "skip") == 0) {
+        *pLatePolicy = PACER_LATE_POLICY_SKIP;
+    } else if (STRCMP(value, "key-frame") == 0) {
+        *pLatePolicy = PACER_LATE_POLICY_NEXT_KEY_FRAME;
+    } else {
+        CHK(FALSE, STATUS_INVALID_ARG);
+    }
+
+CleanUp:
+
+    return retStatus;
+}
+
+VOID pacerPrintStats(PPacer pPacer)
+{
+    PPacerHistogram pHistogram = &pPacer->histogram;
+    UINT32 i;
+
+    if (pHistogram->count == 0) {
+        printf("%s pacing: no frames put, %" PRIu64 " dropped\n", pPacer->trackName, pHistogram->droppedFrames);
+        return;
+    }
+
+    printf("%s pacing: %" PRIu64 " puts, %" PRIu64 " dropped late, lateness min %.2f ms, avg %.2f ms, max %.2f ms\n",
+           pPacer->trackName, pHistogram->count, pHistogram->droppedFrames,
+           (DOUBLE) pHistogram->min / HUNDREDS_OF_NANOS_IN_A_MILLISECOND,
+           (DOUBLE) pHistogram->sum / pHistogram->count / HUNDREDS_OF_NANOS_IN_A_MILLISECOND,
+           (DOUBLE) pHistogram->max / HUNDREDS_OF_NANOS_IN_A_MILLISECOND);
+
+    for (i = 0; i < PACER_HISTOGRAM_BUCKET_COUNT; i++) {
+        if (pHistogram->buckets[i] == 0) {
+            continue;
+        }
+
+        if (i == PACER_HISTOGRAM_BUCKET_COUNT - 1) {
+            printf("    >= %6.1f ms: %" PRIu64 "\n", (DOUBLE) gPacerBucketBounds[i - 1] / HUNDREDS_OF_NANOS_IN_A_MILLISECOND,
+                   pHistogram->buckets[i]);
+        } else {
+            printf("    <  %6.1f ms: %" PRIu64 "\n", (DOUBLE) gPacerBucketBounds[i] / HUNDREDS_OF_NANOS_IN_A_MILLISECOND,
+                   pHistogram->buckets[i]);
+        }
+    }
+}
@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2020 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __KVS_PACER_H__
+#define __KVS_PACER_H__
+
+#include "KvsApp.h"
+
+#define DEFAULT_PACER_LATE_THRESHOLD        (100 * HUNDREDS_OF_NANOS_IN_A_MILLISECOND)
+#define PACER_HISTOGRAM_BUCKET_COUNT        14
+
+/**
+ * What to do with a frame whose deadline passed by more than the late threshold
+ */
+typedef enum {
+    // put it right away, late frames go out back to back until the track is on schedule again
+    PACER_LATE_POLICY_CATCH_UP,
+    // drop the late frame and carry on with the next one
+    PACER_LATE_POLICY_SKIP,
+    // drop the late frame and everything after it up to the next key frame so no GOP is left broken
+    PACER_LATE_POLICY_NEXT_KEY_FRAME,
+} PACER_LATE_POLICY;
+
+/**
+ * Lateness of each put against its deadline. Negative is early.
+ */
+typedef struct {
+    UINT64 buckets[PACER_HISTOGRAM_BUCKET_COUNT];
+    UINT64 count;
+    INT64 sum;
+    INT64 min;
+    INT64 max;
+    UINT64 droppedFrames;
+} PacerHistogram, *PPacerHistogram;
+
+/**
+ * Paces a track against absolute deadlines, streamStart + presentationTs on the monotonic clock, so sleep
+ * errors never accumulate.
+ */
+typedef struct {
+    CHAR trackName[32];
+    // monotonic time of presentationTs 0, in 100ns
+    UINT64 startTime;
+    PACER_LATE_POLICY latePolicy;
+    UINT64 lateThreshold;
+    BOOL waitForKeyFrame;
+    PacerHistogram histogram;
+} Pacer, *PPacer;
+
+/**
+ * Replaces CLOCK_MONOTONIC as the time base, e.g. with a virtual clock
+ */
+typedef UINT64 (*PacerClockFunc)();
+
+/**
+ * Moves a virtual clock on towards the deadline, called instead of sleeping. It may return before the deadline when
+ * the clock has something else due first, the caller looks at what woke it up and waits again.
+ */
+typedef VOID (*PacerWaitFunc)(UINT64);
+
+/**
+ * CLOCK_MONOTONIC in 100ns, the time base of the pacer and of every deadline derived from it
+ */
+UINT64 pacerGetTime();
+
+/**
+ * Installs the clock pacerGetTime reads from now on and the wait which moves it, NULL for CLOCK_MONOTONIC. Set before
+ * any thread reads the time.
+ */
+VOID pacerSetClock(PacerClockFunc, PacerWaitFunc);
+
+/**
+ * Waits on the installed clock up to the deadline. Returns FALSE without waiting on CLOCK_MONOTONIC, the caller sleeps
+ * on its own timer then.
+ */
+BOOL pacerWait(UINT64);
+
+STATUS pacerInit(PPacer, PCHAR, UINT64, PACER_LATE_POLICY, UINT64);
+
+/**
+ * Monotonic time at which the frame is due
+ */
+UINT64 pacerGetFrameDeadline(PPacer, PFrame);
+
+/**
+ * Records how late the frame is at the given monotonic time. Sets the BOOL when the late policy drops the frame.
+ */
+STATUS pacerCheckFrame(PPacer, PFrame, UINT64, PBOOL);
+
+STATUS pacerParseLatePolicy(PCHAR, PACER_LATE_POLICY*);
+
+/**
+ * Prints the lateness histogram of the track
+ */
+VOID pacerPrintStats(PPacer);
+
+#endif /* __KVS_PACER_H__ */
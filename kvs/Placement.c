@@ -0,0 +1,203 @@
+/*
+ * Copyright (C) 2020 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// cpu_set_t and pthread_setaffinity_np
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+#include "Placement.h"
+
+STATIC VOID placementAddCpu(PThreadPlacement pPlacement, UINT32 cpu)
+{
+    if ((pPlacement->cpuMask[cpu / 64] & (1ULL << (cpu % 64))) == 0) {
+        pPlacement->cpuMask[cpu / 64] |= 1ULL << (cpu % 64);
+        pPlacement->cpuCount++;
+    }
+}
+
+STATIC BOOL placementHasCpu(PThreadPlacement pPlacement, UINT32 cpu)
+{
+    return (pPlacement->cpuMask[cpu / 64] & (1ULL << (cpu % 64))) != 0;
+}
+
+STATUS placementParseCpus(PCHAR value, PThreadPlacement pPlacement)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    PCHAR pCur = value, pEnd, pDash;
+    UINT64 first, last, cpu;
+
+    CHK(value != NULL && pPlacement != NULL, STATUS_NULL_ARG);
+
+    MEMSET(pPlacement->cpuMask, 0x00, SIZEOF(pPlacement->cpuMask));
+    pPlacement->cpuCount = 0;
+    while (pCur != NULL) {
+        pEnd = STRCHR(pCur, ',');
+        pDash = STRCHR(pCur, '-');
+        if (pDash != NULL && (pEnd == NULL || pDash < pEnd)) {
+            CHK_STATUS(STRTOUI64(pCur, pDash, 10, &first));
+            CHK_STATUS(STRTOUI64(pDash + 1, pEnd, 10, &last));
+        } else {
+            CHK_STATUS(STRTOUI64(pCur, pEnd, 10, &first));
+            last = first;
+        }
+
+        CHK(first <= last && last < PLACEMENT_MAX_CPU_COUNT, STATUS_INVALID_ARG);
+        for (cpu = first; cpu <= last; cpu++) {
+            placementAddCpu(pPlacement, (UINT32) cpu);
+        }
+
+        pCur = pEnd == NULL ? NULL : pEnd + 1;
+    }
+
+CleanUp:
+
+    return retStatus;
+}
+
+STATUS placementParsePolicy(PCHAR value, PThreadPlacement pPlacement)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    PCHAR pColon;
+    UINT64 priority = DEFAULT_PLACEMENT_PRIORITY;
+    UINT32 length;
+
+    CHK(value != NULL && pPlacement != NULL, STATUS_NULL_ARG);
+
+    pColon = STRCHR(value, ':');
+    length = pColon == NULL ? (UINT32) STRLEN(value) : (UINT32) (pColon - value);
+    if (length == STRLEN("fifo") && STRNCMPI(value, "fifo", length) == 0) {
+        pPlacement->policy = PLACEMENT_POLICY_FIFO;
+    } else if (length == STRLEN("rr") && STRNCMPI(value, "rr", length) == 0) {
+        pPlacement->policy = PLACEMENT_POLICY_RR;
+    } else {
+        CHK(FALSE, STATUS_INVALID_ARG);
+    }
+
+    if (pColon != NULL) {
+        CHK_STATUS(STRTOUI64(pColon + 1, NULL, 10, &priority));
+    }
+
+    CHK(priority >= (UINT64) sched_get_priority_min(SCHED_FIFO) && priority <= (UINT64) sched_get_priority_max(SCHED_FIFO),
+        STATUS_INVALID_ARG);
+    pPlacement->priority = (UINT32) priority;
+
+CleanUp:
+
+    return retStatus;
+}
+
+STATUS placementApply(PThreadPlacement pPlacement, TID tid)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    cpu_set_t cpus;
+    struct sched_param param;
+    UINT32 cpu;
+    INT32 error;
+
+    CHK(pPlacement != NULL, STATUS_NULL_ARG);
+
+    if (pPlacement->cpuCount != 0) {
+        CPU_ZERO(&cpus);
+        for (cpu = 0; cpu < PLACEMENT_MAX_CPU_COUNT && cpu < CPU_SETSIZE; cpu++) {
+            if (placementHasCpu(pPlacement, cpu)) {
+                CPU_SET(cpu, &cpus);
+            }
+        }
+
+        error = pthread_setaffinity_np((pthread_t) tid, SIZEOF(cpus), &cpus);
+        CHK_ERR(error == 0, STATUS_PLACEMENT_FAILED, "Failed to set the CPU affinity with errno %d", error);
+    }
+
+    if (pPlacement->policy != PLACEMENT_POLICY_DEFAULT) {
+        MEMSET(&param, 0x00, SIZEOF(param));
+        param.sched_priority = (INT32) pPlacement->priority;
+        error = pthread_setschedparam((pthread_t) tid, pPlacement->policy == PLACEMENT_POLICY_FIFO ? SCHED_FIFO : SCHED_RR, &param);
+        // EPERM without CAP_SYS_NICE or an RLIMIT_RTPRIO covering the priority
+        CHK_ERR(error == 0, STATUS_PLACEMENT_FAILED, "Failed to set the real-time policy with errno %d%s", error,
+                error == EPERM ? ", it takes CAP_SYS_NICE or an RLIMIT_RTPRIO of the priority" : "");
+    }
+
+CleanUp:
+
+    return retStatus;
+}
+
+STATUS placementLockMemory(UINT64 heapReserve)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    PBYTE pReserve = NULL;
+
+    // freed memory stays in the heap, a later allocation finds it locked instead of faulting a fresh page in
+    mallopt(M_TRIM_THRESHOLD, -1);
+    mallopt(M_MMAP_MAX, 0);
+
+    // EPERM or ENOMEM without CAP_IPC_LOCK or an RLIMIT_MEMLOCK covering the mappings
+    CHK_ERR(mlockall(MCL_CURRENT | MCL_FUTURE) == 0, STATUS_PLACEMENT_FAILED,
+            "Failed to lock the memory with errno %d, it takes CAP_IPC_LOCK or an RLIMIT_MEMLOCK above the mapped size", errno);
+
+    if (heapReserve != 0) {
+        CHK(NULL != (pReserve = (PBYTE) MEMALLOC(heapReserve)), STATUS_NOT_ENOUGH_MEMORY);
+        MEMSET(pReserve, 0x00, heapReserve);
+    }
+
+CleanUp:
+
+    SAFE_MEMFREE(pReserve);
+
+    return retStatus;
+}
+
+VOID placementDescribe(PThreadPlacement pPlacement, PCHAR pBuffer, UINT32 size)
+{
+    UINT32 cpu, last, length = 0;
+
+    pBuffer[0] = '\0';
+    if (pPlacement->cpuCount != 0) {
+        length += SNPRINTF(pBuffer + length, size - length, "cpus ");
+        for (cpu = 0; cpu < PLACEMENT_MAX_CPU_COUNT && length < size; cpu++) {
+            if (!placementHasCpu(pPlacement, cpu)) {
+                continue;
+            }
+
+            for (last = cpu; last + 1 < PLACEMENT_MAX_CPU_COUNT && placementHasCpu(pPlacement, last + 1); last++);
+            length += SNPRINTF(pBuffer + length, size - length, last == cpu ? "%s%u" : "%s%u-%u", pBuffer[length - 1] == ' ' ? "" : ",",
+                               cpu, last);
+            cpu = last;
+        }
+    }
+
+    if (pPlacement->policy != PLACEMENT_POLICY_DEFAULT && length < size) {
+        length += SNPRINTF(pBuffer + length, size - length, "%s%s:%u", length == 0 ? "" : " ",
+                           pPlacement->policy == PLACEMENT_POLICY_FIFO ? "fifo" : "rr", pPlacement->priority);
+    }
+
+    if (length == 0) {
+        SNPRINTF(pBuffer, size, "default");
+    }
+}
@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2020 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __KVS_PLACEMENT_H__
+#define __KVS_PLACEMENT_H__
+
+#include "KvsApp.h"
+
+#define PLACEMENT_MAX_CPU_COUNT             256
+#define PLACEMENT_CPU_MASK_WORDS            (PLACEMENT_MAX_CPU_COUNT / 64)
+#define DEFAULT_PLACEMENT_PRIORITY          50
+// what an allocation on the put path may find already faulted in once the memory is locked
+#define DEFAULT_PLACEMENT_HEAP_RESERVE      (8 * 1024 * 1024)
+
+typedef enum {
+    PLACEMENT_POLICY_DEFAULT,
+    PLACEMENT_POLICY_FIFO,
+    PLACEMENT_POLICY_RR,
+} PLACEMENT_POLICY;
+
+/**
+ * Where a group of threads runs: the CPUs it may run on and its scheduling policy. An empty mask leaves the affinity
+ * alone and PLACEMENT_POLICY_DEFAULT the policy.
+ */
+typedef struct {
+    UINT64 cpuMask[PLACEMENT_CPU_MASK_WORDS];
+    UINT32 cpuCount;
+    PLACEMENT_POLICY policy;
+    UINT32 priority;
+} ThreadPlacement, *PThreadPlacement;
+
+/**
+ * Parses a CPU list such as '2-3' or '0,4-5' into the mask
+ */
+STATUS placementParseCpus(PCHAR, PThreadPlacement);
+
+/**
+ * Parses '<fifo|rr>[:<priority>]' into the policy, the priority defaults to DEFAULT_PLACEMENT_PRIORITY
+ */
+STATUS placementParsePolicy(PCHAR, PThreadPlacement);
+
+/**
+ * Moves a running thread onto its CPUs and gives it its policy. Threads it creates afterwards inherit both, which is
+ * how the main thread hands its placement down to the network threads of the SDK.
+ */
+STATUS placementApply(PThreadPlacement, TID);
+
+/**
+ * Locks the pages mapped so far and every page mapped later into memory, faulting them in now or as they are mapped,
+ * so neither the archives, the frame pool, the content store nor the thread stacks fault on the put path. Freed heap
+ * memory is kept rather than handed back to the kernel and a reserve of it faulted in up front.
+ */
+STATUS placementLockMemory(UINT64);
+
+/**
+ * Describes the placement for the startup summary, e.g. 'cpus 2-3 fifo:50'
+ */
+VOID placementDescribe(PThreadPlacement, PCHAR, UINT32);
+
+#endif /* __KVS_PLACEMENT_H__ */
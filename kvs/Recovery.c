@@ -0,0 +1,358 @@
+/*
+ * Copyright (C) 2020 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "AsyncLog.h"
+#include "Pacer.h"
+#include "Recovery.h"
+
+static PCHAR gRecoveryActionNames[] = {(PCHAR) "none", (PCHAR) "connection", (PCHAR) "stream", (PCHAR) "fatal"};
+
+RECOVERY_ACTION recoveryClassifyError(STATUS status)
+{
+    switch (status) {
+        case STATUS_SUCCESS:
+            return RECOVERY_ACTION_NONE;
+
+        case STATUS_SERVICE_CALL_NOT_AUTHORIZED_ERROR:
+        case STATUS_SERVICE_CALL_RESOURCE_NOT_FOUND_ERROR:
+        case STATUS_SERVICE_CALL_RESOURCE_DELETED_ERROR:
+        case STATUS_ACK_ERR_STREAM_DELETED:
+        case STATUS_ACK_ERR_KMS_KEY_ACCESS_DENIED:
+        case STATUS_ACK_ERR_KMS_KEY_DISABLED:
+        case STATUS_ACK_ERR_KMS_KEY_NOT_FOUND:
+            return RECOVERY_ACTION_FATAL;
+
+        // the stream the service has is broken, a new connection would replay the same fragments
+        case STATUS_ACK_ERR_FRAGMENT_TIMECODE_NOT_MONOTONIC:
+        case STATUS_ACK_ERR_INVALID_MKV_DATA:
+        case STATUS_ACK_ERR_INVALID_PRODUCER_TIMESTAMP:
+        case STATUS_ACK_ERR_MULTI_TRACK_MKV:
+        case STATUS_ACK_ERR_STREAM_NOT_ACTIVE:
+            return RECOVERY_ACTION_RESET_STREAM;
+
+        // timeouts, dropped connections, throttling and internal service errors
+        default:
+            return RECOVERY_ACTION_RESET_CONNECTION;
+    }
+}
+
+PCHAR recoveryGetStateName(RECOVERY_STATE state)
+{
+    switch (state) {
+        case RECOVERY_STATE_HEALTHY:
+            return (PCHAR) "healthy";
+        case RECOVERY_STATE_BACKOFF:
+            return (PCHAR) "backoff";
+        case RECOVERY_STATE_VERIFYING:
+            return (PCHAR) "verifying";
+        default:
+            return (PCHAR) "failed";
+    }
+}
+
+STATIC VOID recoverySetState(PRecoveryStream pStream, RECOVERY_STATE state)
+{
+    pStream->state = state;
+    pStream->stats.state = (SIZE_T) state;
+}
+
+/**
+ * Exponential in the attempt with equal jitter, half the delay fixed and the other half random. Under the lock.
+ */
+STATIC UINT64 recoveryBackoff(PRecovery pRecovery, UINT32 attempt)
+{
+    UINT64 delay = pRecovery->maxBackoff;
+
+    if (attempt < 32 && (pRecovery->baseBackoff << attempt) < pRecovery->maxBackoff) {
+        delay = pRecovery->baseBackoff << attempt;
+    }
+
+    return delay / 2 + (UINT64) rand_r(&pRecovery->randomSeed) % (delay / 2 + 1);
+}
+
+/**
+ * Schedules the next reset of the stream after a reset which did not bring it back, under the lock
+ */
+STATIC VOID recoveryRetry(PRecoveryStream pStream, UINT64 now)
+{
+    PRecovery pRecovery = pStream->pRecovery;
+
+    pStream->attempt++;
+    if (pStream->action == RECOVERY_ACTION_RESET_CONNECTION && pStream->attempt >= RECOVERY_CONNECTION_ATTEMPTS) {
+        ALOGW("Stream %s did not recover after %u connection resets, resetting the stream", pStream->name, pStream->attempt);
+        pStream->action = RECOVERY_ACTION_RESET_STREAM;
+    }
+
+    pStream->dueTime = now + recoveryBackoff(pRecovery, pStream->attempt);
+    recoverySetState(pStream, RECOVERY_STATE_BACKOFF);
+}
+
+STATIC PVOID recoveryRoutine(PVOID args)
+{
+    PRecovery pRecovery = (PRecovery) args;
+    PRecoveryStream pStream, pDue;
+    RECOVERY_ACTION action;
+    UINT64 now, nextTime;
+    STATUS status;
+    UINT32 i;
+
+    MUTEX_LOCK(pRecovery->lock);
+
+    while (!pRecovery->shutdown) {
+        now = pacerGetTime();
+        nextTime = INFINITE_TIME_VALUE;
+        pDue = NULL;
+
+        for (i = 0; i < pRecovery->streamCount; i++) {
+            pStream = pRecovery->pStreams[i];
+            if (pStream->state == RECOVERY_STATE_VERIFYING && pStream->dueTime <= now) {
+                ALOGW("Stream %s did not get an ack within %" PRIu64 " ms of its reset", pStream->name,
+                      (UINT64) RECOVERY_VERIFY_TIMEOUT / HUNDREDS_OF_NANOS_IN_A_MILLISECOND);
+                recoveryRetry(pStream, now);
+            }
+
+            if (pStream->state == RECOVERY_STATE_BACKOFF && pStream->dueTime <= now && pDue == NULL) {
+                pDue = pStream;
+            } else if (pStream->state == RECOVERY_STATE_BACKOFF || pStream->state == RECOVERY_STATE_VERIFYING) {
+                nextTime = MIN(nextTime, pStream->dueTime);
+            }
+        }
+
+        if (pDue != NULL) {
+            action = pDue->action;
+            pDue->dueTime = now + RECOVERY_VERIFY_TIMEOUT;
+            pDue->stats.resets[action]++;
+            recoverySetState(pDue, RECOVERY_STATE_VERIFYING);
+
+            // the SDK may report errors from inside the reset
+            MUTEX_UNLOCK(pRecovery->lock);
+            ALOGI("Stream %s: %s reset, attempt %u", pDue->name, gRecoveryActionNames[action], pDue->attempt + 1);
+            status = pDue->resetFn(pDue->customData, action);
+            MUTEX_LOCK(pRecovery->lock);
+
+            if (STATUS_FAILED(status) && pDue->state == RECOVERY_STATE_VERIFYING) {
+                ALOGW("Stream %s: %s reset failed with 0x%08x", pDue->name, gRecoveryActionNames[action], status);
+                recoveryRetry(pDue, pacerGetTime());
+            }
+
+            continue;
+        }
+
+        CVAR_WAIT(pRecovery->wakeCvar, pRecovery->lock, nextTime == INFINITE_TIME_VALUE ? INFINITE_TIME_VALUE : nextTime - now);
+    }
+
+    MUTEX_UNLOCK(pRecovery->lock);
+
+    return NULL;
+}
+
+STATUS createRecovery(UINT64 baseBackoff, UINT64 maxBackoff, PRecovery* ppRecovery)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    PRecovery pRecovery = NULL;
+
+    CHK(ppRecovery != NULL, STATUS_NULL_ARG);
+    CHK(baseBackoff != 0, STATUS_INVALID_ARG);
+
+    CHK(NULL != (pRecovery = (PRecovery) MEMCALLOC(1, SIZEOF(Recovery))), STATUS_NOT_ENOUGH_MEMORY);
+    pRecovery->baseBackoff = baseBackoff;
+    pRecovery->maxBackoff = MAX(baseBackoff, maxBackoff);
+    pRecovery->randomSeed = (UINT32) GETTIME();
+    pRecovery->tid = INVALID_TID_VALUE;
+    pRecovery->lock = MUTEX_CREATE(FALSE);
+    pRecovery->wakeCvar = CVAR_CREATE();
+    CHK(IS_VALID_MUTEX_VALUE(pRecovery->lock) && IS_VALID_CVAR_VALUE(pRecovery->wakeCvar), STATUS_NOT_ENOUGH_MEMORY);
+    CHK_STATUS(THREAD_CREATE(&pRecovery->tid, recoveryRoutine, (PVOID) pRecovery));
+
+CleanUp:
+
+    if (STATUS_FAILED(retStatus)) {
+        freeRecovery(&pRecovery);
+    }
+
+    if (ppRecovery != NULL) {
+        *ppRecovery = pRecovery;
+    }
+
+    return retStatus;
+}
+
+STATUS freeRecovery(PRecovery* ppRecovery)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    PRecovery pRecovery;
+
+    CHK(ppRecovery != NULL, STATUS_NULL_ARG);
+
+    pRecovery = *ppRecovery;
+    CHK(pRecovery != NULL, retStatus);
+
+    if (IS_VALID_TID_VALUE(pRecovery->tid)) {
+        MUTEX_LOCK(pRecovery->lock);
+        pRecovery->shutdown = TRUE;
+        CVAR_SIGNAL(pRecovery->wakeCvar);
+        MUTEX_UNLOCK(pRecovery->lock);
+        THREAD_JOIN(pRecovery->tid, NULL);
+    }
+
+    if (IS_VALID_MUTEX_VALUE(pRecovery->lock)) {
+        MUTEX_FREE(pRecovery->lock);
+    }
+
+    if (IS_VALID_CVAR_VALUE(pRecovery->wakeCvar)) {
+        CVAR_FREE(pRecovery->wakeCvar);
+    }
+
+    MEMFREE(pRecovery);
+    *ppRecovery = NULL;
+
+CleanUp:
+
+    return retStatus;
+}
+
+STATUS recoveryAddStream(PRecovery pRecovery, PRecoveryStream pStream, PCHAR name, RecoveryResetFunc resetFn, UINT64 customData)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    BOOL locked = FALSE;
+
+    CHK(pRecovery != NULL && pStream != NULL && resetFn != NULL, STATUS_NULL_ARG);
+
+    MUTEX_LOCK(pRecovery->lock);
+    locked = TRUE;
+    CHK(pRecovery->streamCount < RECOVERY_MAX_STREAMS, STATUS_INVALID_OPERATION);
+
+    MEMSET(pStream, 0x00, SIZEOF(RecoveryStream));
+    pStream->pRecovery = pRecovery;
+    pStream->name = name;
+    pStream->resetFn = resetFn;
+    pStream->customData = customData;
+    recoverySetState(pStream, RECOVERY_STATE_HEALTHY);
+    pRecovery->pStreams[pRecovery->streamCount++] = pStream;
+
+CleanUp:
+
+    if (locked) {
+        MUTEX_UNLOCK(pRecovery->lock);
+    }
+
+    return retStatus;
+}
+
+VOID recoveryReportError(PRecoveryStream pStream, STATUS status)
+{
+    PRecovery pRecovery = pStream->pRecovery;
+    RECOVERY_ACTION action = recoveryClassifyError(status);
+    UINT64 now = pacerGetTime();
+
+    if (pRecovery == NULL || action == RECOVERY_ACTION_NONE) {
+        return;
+    }
+
+    MUTEX_LOCK(pRecovery->lock);
+
+    pStream->stats.errors++;
+    pStream->lastError = status;
+    switch (pStream->state) {
+        case RECOVERY_STATE_HEALTHY:
+            pStream->errorTime = now;
+            pStream->attempt = 0;
+            pStream->action = action;
+            if (action != RECOVERY_ACTION_FATAL) {
+                pStream->dueTime = now + recoveryBackoff(pRecovery, 0);
+                recoverySetState(pStream, RECOVERY_STATE_BACKOFF);
+            }
+            break;
+
+        case RECOVERY_STATE_BACKOFF:
+            // the errors of an episode come in bursts, the worst one decides
+            pStream->action = MAX(pStream->action, action);
+            break;
+
+        case RECOVERY_STATE_VERIFYING:
+            pStream->action = MAX(pStream->action, action);
+            if (action != RECOVERY_ACTION_FATAL) {
+                recoveryRetry(pStream, now);
+            }
+            break;
+
+        default:
+            break;
+    }
+
+    if (pStream->action == RECOVERY_ACTION_FATAL && pStream->state != RECOVERY_STATE_FAILED) {
+        ALOGE("Stream %s failed with 0x%08x, which retrying can not fix", pStream->name, status);
+        recoverySetState(pStream, RECOVERY_STATE_FAILED);
+    }
+
+    CVAR_SIGNAL(pRecovery->wakeCvar);
+    MUTEX_UNLOCK(pRecovery->lock);
+}
+
+VOID recoveryReportAck(PRecoveryStream pStream)
+{
+    PRecovery pRecovery = pStream->pRecovery;
+    UINT64 duration;
+
+    // only ever changed under the lock, a stale read just takes the lock for nothing
+    if (pRecovery == NULL || pStream->state != RECOVERY_STATE_VERIFYING) {
+        return;
+    }
+
+    MUTEX_LOCK(pRecovery->lock);
+
+    if (pStream->state == RECOVERY_STATE_VERIFYING) {
+        duration = pacerGetTime() - pStream->errorTime;
+        pStream->stats.recoveries++;
+        pStream->stats.lastRecoveryTime = (SIZE_T) duration;
+        pStream->stats.maxRecoveryTime = MAX(pStream->stats.maxRecoveryTime, (SIZE_T) duration);
+        pStream->stats.totalRecoveryTime += (SIZE_T) duration;
+        recoverySetState(pStream, RECOVERY_STATE_HEALTHY);
+        ALOGI("Stream %s recovered in %" PRIu64 " ms after %u resets", pStream->name, duration / HUNDREDS_OF_NANOS_IN_A_MILLISECOND,
+              pStream->attempt + 1);
+    }
+
+    MUTEX_UNLOCK(pRecovery->lock);
+}
+
+VOID recoveryReportFrameLost(PRecoveryStream pStream)
+{
+    if (pStream->pRecovery != NULL && ATOMIC_LOAD(&pStream->stats.state) != RECOVERY_STATE_HEALTHY) {
+        ATOMIC_INCREMENT(&pStream->stats.framesLost);
+    }
+}
+
+VOID recoveryPrintStats(PRecoveryStream pStream)
+{
+    UINT64 recoveries = (UINT64) pStream->stats.recoveries;
+
+    if (pStream->pRecovery == NULL) {
+        return;
+    }
+
+    printf("Stream %s recovery: %s, %" PRIu64 " errors, %" PRIu64 " connection and %" PRIu64 " stream resets, %" PRIu64
+           " recoveries taking %" PRIu64 " ms on average and %" PRIu64 " ms at most, %" PRIu64 " frames lost\n",
+           pStream->name, recoveryGetStateName((RECOVERY_STATE) pStream->stats.state), (UINT64) pStream->stats.errors,
+           (UINT64) pStream->stats.resets[RECOVERY_ACTION_RESET_CONNECTION], (UINT64) pStream->stats.resets[RECOVERY_ACTION_RESET_STREAM],
+           recoveries, recoveries == 0 ? 0 : (UINT64) (pStream->stats.totalRecoveryTime / recoveries / HUNDREDS_OF_NANOS_IN_A_MILLISECOND),
+           (UINT64) (pStream->stats.maxRecoveryTime / HUNDREDS_OF_NANOS_IN_A_MILLISECOND), (UINT64) pStream->stats.framesLost);
+}
@@ -0,0 +1,152 @@
+/*
+ * Copyright (C) 2020 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __KVS_RECOVERY_H__
+#define __KVS_RECOVERY_H__
+
+#include "KvsApp.h"
+
+#define DEFAULT_RECOVERY_BASE_BACKOFF       (250 * HUNDREDS_OF_NANOS_IN_A_MILLISECOND)
+#define DEFAULT_RECOVERY_MAX_BACKOFF        (30 * HUNDREDS_OF_NANOS_IN_A_SECOND)
+// connection resets failing in a row before the whole stream is reset instead
+#define RECOVERY_CONNECTION_ATTEMPTS        3
+// a reset without an ack this long after it failed
+#define RECOVERY_VERIFY_TIMEOUT             (10 * HUNDREDS_OF_NANOS_IN_A_SECOND)
+#define RECOVERY_MAX_STREAMS                128
+
+typedef enum {
+    // nothing to do
+    RECOVERY_ACTION_NONE,
+    // a new session replaying from the last acked fragment, the buffered frames are kept
+    RECOVERY_ACTION_RESET_CONNECTION,
+    // the stream starts over with new headers, only its own buffered frames are lost
+    RECOVERY_ACTION_RESET_STREAM,
+    // credentials, permissions or a deleted stream, retrying does not help
+    RECOVERY_ACTION_FATAL,
+    RECOVERY_ACTION_COUNT,
+} RECOVERY_ACTION;
+
+typedef enum {
+    RECOVERY_STATE_HEALTHY,
+    // waiting out the backoff before the next reset
+    RECOVERY_STATE_BACKOFF,
+    // reset, waiting for the first ack
+    RECOVERY_STATE_VERIFYING,
+    RECOVERY_STATE_FAILED,
+} RECOVERY_STATE;
+
+/**
+ * Resets the stream or its connection, called from the recovery thread with the custom data of the stream
+ */
+typedef STATUS (*RecoveryResetFunc)(UINT64, RECOVERY_ACTION);
+
+/**
+ * Read by the metrics server, times in 100ns
+ */
+typedef struct {
+    volatile SIZE_T state;
+    volatile SIZE_T errors;
+    volatile SIZE_T resets[RECOVERY_ACTION_COUNT];
+    volatile SIZE_T recoveries;
+    // from the first error to the first ack after the reset
+    volatile SIZE_T lastRecoveryTime;
+    volatile SIZE_T maxRecoveryTime;
+    volatile SIZE_T totalRecoveryTime;
+    // dropped while not healthy
+    volatile SIZE_T framesLost;
+} RecoveryStats, *PRecoveryStats;
+
+typedef struct __Recovery Recovery, *PRecovery;
+
+typedef struct {
+    PRecovery pRecovery;
+    PCHAR name;
+    RecoveryResetFunc resetFn;
+    UINT64 customData;
+
+    // guarded by the lock of the recovery
+    RECOVERY_ACTION action;
+    UINT32 attempt;
+    RECOVERY_STATE state;
+    // first error of the episode, when the current state ends, both pacerGetTime() so a wall clock step neither fires
+    // nor holds back a reset
+    UINT64 errorTime;
+    UINT64 dueTime;
+    STATUS lastError;
+    RecoveryStats stats;
+} RecoveryStream, *PRecoveryStream;
+
+/**
+ * Recovers streams in place after errors instead of restarting the process.
+ *
+ * The SDK callbacks report errors, stale connections and acks. An error is classified: most only need a new
+ * connection, which replays from the last acked fragment with the buffered frames kept, a broken stream is reset on
+ * its own, and errors retrying cannot fix leave the stream failed. Resets wait out an exponential backoff with jitter
+ * so a fleet does not reconnect in step, and are made on a thread of their own, never from inside an SDK callback. The
+ * first ack after a reset ends the episode, an error or no ack for a while instead backs off again, escalating to a
+ * stream reset once connection resets keep failing.
+ */
+struct __Recovery {
+    UINT64 baseBackoff;
+    UINT64 maxBackoff;
+    MUTEX lock;
+    CVAR wakeCvar;
+    TID tid;
+    BOOL shutdown;
+    UINT32 randomSeed;
+    PRecoveryStream pStreams[RECOVERY_MAX_STREAMS];
+    UINT32 streamCount;
+};
+
+/**
+ * Starts the recovery thread, backoffs in 100ns
+ */
+STATUS createRecovery(UINT64, UINT64, PRecovery*);
+STATUS freeRecovery(PRecovery*);
+
+/**
+ * Adds a stream before its first error can be reported
+ */
+STATUS recoveryAddStream(PRecovery, PRecoveryStream, PCHAR, RecoveryResetFunc, UINT64);
+
+RECOVERY_ACTION recoveryClassifyError(STATUS);
+
+/**
+ * Takes an error of the stream from the SDK callbacks
+ */
+VOID recoveryReportError(PRecoveryStream, STATUS);
+
+/**
+ * Takes a non error ack, ends the episode of a stream which was reset
+ */
+VOID recoveryReportAck(PRecoveryStream);
+
+/**
+ * Takes a frame dropped, counted as lost while the stream is not healthy. Safe from any thread.
+ */
+VOID recoveryReportFrameLost(PRecoveryStream);
+
+PCHAR recoveryGetStateName(RECOVERY_STATE);
+
+VOID recoveryPrintStats(PRecoveryStream);
+
+#endif /* __KVS_RECOVERY_H__ */
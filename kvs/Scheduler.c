@@ -0,0 +1,522 @@
+/*
+ * Copyright (C) 2020 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+#include "AsyncLog.h"
+#include "MemoryArena.h"
+#include "Scheduler.h"
+
+#define SCHEDULER_INITIAL_TRACK_CAPACITY    4
+// frames a free running scheduler puts before it looks at the sources and the stop time again
+#define SCHEDULER_FREE_RUNNING_BATCH        64
+
+STATIC VOID schedulerQueuePush(PScheduler pScheduler, PSchedulerTrack pTrack)
+{
+    UINT32 i = pScheduler->queueSize++, parent;
+
+    for (; i > 0; i = parent) {
+        parent = (i - 1) / 2;
+        if (pScheduler->ppQueue[parent]->dueTime <= pTrack->dueTime) {
+            break;
+        }
+
+        pScheduler->ppQueue[i] = pScheduler->ppQueue[parent];
+    }
+
+    pScheduler->ppQueue[i] = pTrack;
+    pTrack->state = SCHEDULER_TRACK_STATE_QUEUED;
+}
+
+/**
+ * Takes the track at the index out of the queue, the last entry fills the hole
+ */
+STATIC PSchedulerTrack schedulerQueueRemove(PScheduler pScheduler, UINT32 index)
+{
+    PSchedulerTrack pTrack = pScheduler->ppQueue[index], pLast;
+    UINT32 i = index, parent, child;
+
+    pLast = pScheduler->ppQueue[--pScheduler->queueSize];
+    if (index != pScheduler->queueSize) {
+        for (; i > 0 && pScheduler->ppQueue[parent = (i - 1) / 2]->dueTime > pLast->dueTime; i = parent) {
+            pScheduler->ppQueue[i] = pScheduler->ppQueue[parent];
+        }
+
+        // an entry that moved up is due before everything under the hole
+        if (i == index) {
+            for (; (child = 2 * i + 1) < pScheduler->queueSize; i = child) {
+                if (child + 1 < pScheduler->queueSize && pScheduler->ppQueue[child + 1]->dueTime < pScheduler->ppQueue[child]->dueTime) {
+                    child++;
+                }
+
+                if (pScheduler->ppQueue[child]->dueTime >= pLast->dueTime) {
+                    break;
+                }
+
+                pScheduler->ppQueue[i] = pScheduler->ppQueue[child];
+            }
+        }
+
+        pScheduler->ppQueue[i] = pLast;
+    }
+
+    pTrack->state = SCHEDULER_TRACK_STATE_IDLE;
+
+    return pTrack;
+}
+
+/**
+ * Index of a queued track with its frame due within its coalescing window, queueSize when there is none
+ */
+STATIC UINT32 schedulerFindCoalesced(PScheduler pScheduler, UINT64 now)
+{
+    PSchedulerTrack pTrack;
+    UINT32 i;
+
+    for (i = 0; i < pScheduler->queueSize; i++) {
+        pTrack = pScheduler->ppQueue[i];
+        if (pTrack->dueTime <= now + pTrack->coalesceWindow) {
+            break;
+        }
+    }
+
+    return i;
+}
+
+STATIC VOID schedulerEnqueueFrame(PScheduler pScheduler, PSchedulerTrack pTrack, UINT64 now)
+{
+    if (pTrack->pDependency != NULL && !pTrack->pDependency->started) {
+        pTrack->state = SCHEDULER_TRACK_STATE_BLOCKED;
+        return;
+    }
+
+    if (pScheduler->freeRunning) {
+        pTrack->dueTime = pTrack->frame.presentationTs;
+    } else {
+        pTrack->dueTime = pTrack->paced ? pacerGetFrameDeadline(&pTrack->pacer, &pTrack->frame) : now;
+    }
+    schedulerQueuePush(pScheduler, pTrack);
+}
+
+/**
+ * Asks the source for the next frame and files the track accordingly
+ */
+STATIC STATUS schedulerPrepareTrack(PScheduler pScheduler, PSchedulerTrack pTrack, UINT64 now)
+{
+    STATUS retStatus = STATUS_SUCCESS, status;
+
+    // Clear before asking, a notification racing with a pending answer is then seen on the next wakeup
+    ATOMIC_STORE_BOOL(&pTrack->notified, FALSE);
+
+    status = pTrack->nextFrameFn(pTrack, &pTrack->frame);
+    if (status == STATUS_SCHEDULER_FRAME_PENDING) {
+        pTrack->state = SCHEDULER_TRACK_STATE_PENDING;
+    } else if (status == STATUS_SCHEDULER_TRACK_FINISHED) {
+        pTrack->state = SCHEDULER_TRACK_STATE_FINISHED;
+    } else {
+        CHK_STATUS(status);
+        schedulerEnqueueFrame(pScheduler, pTrack, now);
+    }
+
+CleanUp:
+
+    return retStatus;
+}
+
+STATIC STATUS schedulerDispatch(PScheduler pScheduler, PSchedulerTrack pTrack, UINT64 now)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    BOOL drop = FALSE;
+    UINT32 i;
+
+    if (pTrack->paced) {
+        CHK_STATUS(pacerCheckFrame(&pTrack->pacer, &pTrack->frame, now, &drop));
+    }
+
+    CHK_STATUS(pTrack->putFrameFn(pTrack, &pTrack->frame, drop));
+    ATOMIC_INCREMENT(&pScheduler->stats.dispatchedFrames);
+    if (pTrack->dueTime > now) {
+        ATOMIC_INCREMENT(&pScheduler->stats.coalescedFrames);
+    }
+
+    if (!drop && !pTrack->started) {
+        pTrack->started = TRUE;
+        // The dependency is satisfied, release the tracks gated on it
+        for (i = 0; i < pScheduler->trackCount; i++) {
+            if (pScheduler->ppTracks[i]->pDependency == pTrack && pScheduler->ppTracks[i]->state == SCHEDULER_TRACK_STATE_BLOCKED) {
+                schedulerEnqueueFrame(pScheduler, pScheduler->ppTracks[i], now);
+            }
+        }
+    }
+
+    CHK_STATUS(schedulerPrepareTrack(pScheduler, pTrack, now));
+
+CleanUp:
+
+    return retStatus;
+}
+
+STATIC BOOL schedulerHasWork(PScheduler pScheduler)
+{
+    UINT32 i;
+
+    if (pScheduler->queueSize != 0) {
+        return TRUE;
+    }
+
+    for (i = 0; i < pScheduler->trackCount; i++) {
+        if (pScheduler->ppTracks[i]->state == SCHEDULER_TRACK_STATE_PENDING) {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+STATIC PVOID schedulerRoutine(PVOID args)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    PScheduler pScheduler = (PScheduler) args;
+    PSchedulerTrack pTrack;
+    struct itimerspec timerSpec;
+    struct pollfd pollFds[2];
+    UINT64 now, wakeupTime, value;
+    UINT32 i, dispatched;
+    INT32 timeout;
+
+    // what the SDK allocates inside the puts is charged to kvs, not to the SDK's own threads
+    memoryArenaSetTag(MEMORY_TAG_APP);
+
+    MEMSET(&timerSpec, 0x00, SIZEOF(timerSpec));
+    pollFds[0].fd = pScheduler->timerFd;
+    pollFds[0].events = POLLIN;
+    pollFds[1].fd = pScheduler->eventFd;
+    pollFds[1].events = POLLIN;
+
+    now = pacerGetTime();
+    for (i = 0; i < pScheduler->trackCount; i++) {
+        CHK_STATUS(schedulerPrepareTrack(pScheduler, pScheduler->ppTracks[i], now));
+    }
+
+    while (!ATOMIC_LOAD_BOOL(&pScheduler->shutdown) && (now = pacerGetTime()) < pScheduler->stopTime) {
+        for (dispatched = 0; pScheduler->queueSize != 0 &&
+             (pScheduler->freeRunning ? dispatched < SCHEDULER_FREE_RUNNING_BATCH : pScheduler->ppQueue[0]->dueTime <= now);
+             dispatched++) {
+            CHK_STATUS(schedulerDispatch(pScheduler, schedulerQueueRemove(pScheduler, 0), now));
+        }
+
+        // while awake, frames falling due shortly go out as well and save a wakeup of their own
+        if (pScheduler->maxCoalesceWindow != 0) {
+            while ((i = schedulerFindCoalesced(pScheduler, now)) < pScheduler->queueSize) {
+                CHK_STATUS(schedulerDispatch(pScheduler, schedulerQueueRemove(pScheduler, i), now));
+            }
+        }
+
+        // Tracks blocked on a dependency that finished never start
+        if (!schedulerHasWork(pScheduler)) {
+            break;
+        }
+
+        // free running frames are never waited for, only the sources are looked at before the next batch
+        wakeupTime = pScheduler->stopTime;
+        timeout = pScheduler->freeRunning && pScheduler->queueSize != 0 ? 0 : -1;
+        if (pScheduler->queueSize != 0 && !pScheduler->freeRunning) {
+            wakeupTime = MIN(wakeupTime, pScheduler->ppQueue[0]->dueTime);
+        }
+
+        if (pacerWait(timeout == 0 ? now : wakeupTime)) {
+            // a virtual clock moved while waited on, the sources are only looked at
+            timeout = 0;
+        } else {
+            timerSpec.it_value.tv_sec = (time_t) (wakeupTime / HUNDREDS_OF_NANOS_IN_A_SECOND);
+            timerSpec.it_value.tv_nsec = (long) (wakeupTime % HUNDREDS_OF_NANOS_IN_A_SECOND * DEFAULT_TIME_UNIT_IN_NANOS);
+            CHK(timerfd_settime(pScheduler->timerFd, TFD_TIMER_ABSTIME, &timerSpec, NULL) == 0, STATUS_INVALID_OPERATION);
+        }
+
+        if (poll(pollFds, 2, timeout) < 0) {
+            CHK(errno == EINTR, STATUS_INVALID_OPERATION);
+            continue;
+        }
+
+        ATOMIC_INCREMENT(&pScheduler->stats.wakeups);
+
+        if ((pollFds[0].revents & POLLIN) != 0 && read(pScheduler->timerFd, &value, SIZEOF(value)) < 0) {
+            CHK(errno == EAGAIN || errno == EINTR, STATUS_INVALID_OPERATION);
+        }
+
+        if ((pollFds[1].revents & POLLIN) != 0) {
+            if (read(pScheduler->eventFd, &value, SIZEOF(value)) < 0) {
+                CHK(errno == EAGAIN || errno == EINTR, STATUS_INVALID_OPERATION);
+            }
+
+            now = pacerGetTime();
+            for (i = 0; i < pScheduler->trackCount; i++) {
+                pTrack = pScheduler->ppTracks[i];
+                if (pTrack->state == SCHEDULER_TRACK_STATE_PENDING && ATOMIC_LOAD_BOOL(&pTrack->notified)) {
+                    CHK_STATUS(schedulerPrepareTrack(pScheduler, pTrack, now));
+                }
+            }
+        }
+    }
+
+CleanUp:
+
+    if (STATUS_FAILED(retStatus)) {
+        ALOGE("Scheduler failed with 0x%08x", retStatus);
+    }
+
+    return (PVOID) (ULONG_PTR) retStatus;
+}
+
+STATUS createScheduler(UINT64 stopTime, PScheduler* ppScheduler)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    PScheduler pScheduler = NULL;
+
+    CHK(ppScheduler != NULL, STATUS_NULL_ARG);
+
+    CHK(NULL != (pScheduler = (PScheduler) MEMCALLOC(1, SIZEOF(Scheduler))), STATUS_NOT_ENOUGH_MEMORY);
+    pScheduler->stopTime = stopTime;
+    pScheduler->tid = INVALID_TID_VALUE;
+    pScheduler->eventFd = -1;
+    CHK((pScheduler->timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK)) >= 0, STATUS_INVALID_OPERATION);
+    CHK((pScheduler->eventFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) >= 0, STATUS_INVALID_OPERATION);
+
+CleanUp:
+
+    if (STATUS_FAILED(retStatus)) {
+        freeScheduler(&pScheduler);
+    }
+
+    if (ppScheduler != NULL) {
+        *ppScheduler = pScheduler;
+    }
+
+    return retStatus;
+}
+
+STATUS freeScheduler(PScheduler* ppScheduler)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    PScheduler pScheduler;
+    UINT64 value = 1;
+
+    CHK(ppScheduler != NULL, STATUS_NULL_ARG);
+
+    pScheduler = *ppScheduler;
+    CHK(pScheduler != NULL, retStatus);
+
+    if (IS_VALID_TID_VALUE(pScheduler->tid)) {
+        ATOMIC_STORE_BOOL(&pScheduler->shutdown, TRUE);
+        if (write(pScheduler->eventFd, &value, SIZEOF(value)) != SIZEOF(value)) {
+            ALOGW("Failed to wake up the scheduler");
+        }
+
+        schedulerJoin(pScheduler);
+    }
+
+    if (pScheduler->timerFd >= 0) {
+        close(pScheduler->timerFd);
+    }
+
+    if (pScheduler->eventFd >= 0) {
+        close(pScheduler->eventFd);
+    }
+
+    SAFE_MEMFREE(pScheduler->ppTracks);
+    SAFE_MEMFREE(pScheduler->ppQueue);
+    MEMFREE(pScheduler);
+    *ppScheduler = NULL;
+
+CleanUp:
+
+    return retStatus;
+}
+
+STATUS schedulerTrackInit(PSchedulerTrack pTrack, PCHAR name, UINT64 trackId, SchedulerNextFrameFunc nextFrameFn,
+                          SchedulerPutFrameFunc putFrameFn, UINT64 customData)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+
+    CHK(pTrack != NULL && name != NULL && nextFrameFn != NULL && putFrameFn != NULL, STATUS_NULL_ARG);
+
+    MEMSET(pTrack, 0x00, SIZEOF(SchedulerTrack));
+    STRNCPY(pTrack->name, name, SIZEOF(pTrack->name) - 1);
+    pTrack->nextFrameFn = nextFrameFn;
+    pTrack->putFrameFn = putFrameFn;
+    pTrack->customData = customData;
+    pTrack->frame.version = FRAME_CURRENT_VERSION;
+    pTrack->frame.trackId = trackId;
+
+CleanUp:
+
+    return retStatus;
+}
+
+STATUS schedulerTrackSetPacing(PSchedulerTrack pTrack, UINT64 startTime, PACER_LATE_POLICY latePolicy, UINT64 lateThreshold)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+
+    CHK(pTrack != NULL, STATUS_NULL_ARG);
+
+    CHK_STATUS(pacerInit(&pTrack->pacer, pTrack->name, startTime, latePolicy, lateThreshold));
+    pTrack->paced = TRUE;
+
+CleanUp:
+
+    return retStatus;
+}
+
+STATUS schedulerTrackSetCoalescing(PSchedulerTrack pTrack, UINT64 window)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+
+    CHK(pTrack != NULL, STATUS_NULL_ARG);
+    // unpaced tracks are due as soon as they have a frame, there is nothing to put early
+    CHK(pTrack->paced && pTrack->pScheduler == NULL, STATUS_INVALID_OPERATION);
+
+    pTrack->coalesceWindow = window;
+
+CleanUp:
+
+    return retStatus;
+}
+
+STATUS schedulerSetFreeRunning(PScheduler pScheduler)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+
+    CHK(pScheduler != NULL, STATUS_NULL_ARG);
+    CHK(!IS_VALID_TID_VALUE(pScheduler->tid), STATUS_INVALID_OPERATION);
+
+    pScheduler->freeRunning = TRUE;
+
+CleanUp:
+
+    return retStatus;
+}
+
+STATUS schedulerAddTrack(PScheduler pScheduler, PSchedulerTrack pTrack)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    PSchedulerTrack* ppTracks = NULL;
+    PSchedulerTrack* ppQueue = NULL;
+    UINT32 capacity;
+
+    CHK(pScheduler != NULL && pTrack != NULL, STATUS_NULL_ARG);
+    CHK(!IS_VALID_TID_VALUE(pScheduler->tid), STATUS_INVALID_OPERATION);
+
+    if (pScheduler->trackCount == pScheduler->trackCapacity) {
+        capacity = MAX(SCHEDULER_INITIAL_TRACK_CAPACITY, pScheduler->trackCapacity * 2);
+        CHK(NULL != (ppTracks = (PSchedulerTrack*) MEMALLOC(capacity * SIZEOF(PSchedulerTrack))), STATUS_NOT_ENOUGH_MEMORY);
+        CHK(NULL != (ppQueue = (PSchedulerTrack*) MEMALLOC(capacity * SIZEOF(PSchedulerTrack))), STATUS_NOT_ENOUGH_MEMORY);
+        if (pScheduler->trackCount != 0) {
+            MEMCPY(ppTracks, pScheduler->ppTracks, pScheduler->trackCount * SIZEOF(PSchedulerTrack));
+        }
+
+        SAFE_MEMFREE(pScheduler->ppTracks);
+        SAFE_MEMFREE(pScheduler->ppQueue);
+        pScheduler->ppTracks = ppTracks;
+        pScheduler->ppQueue = ppQueue;
+        pScheduler->trackCapacity = capacity;
+        ppTracks = NULL;
+        ppQueue = NULL;
+    }
+
+    pTrack->pScheduler = pScheduler;
+    pTrack->state = SCHEDULER_TRACK_STATE_IDLE;
+    pScheduler->ppTracks[pScheduler->trackCount++] = pTrack;
+    pScheduler->maxCoalesceWindow = MAX(pScheduler->maxCoalesceWindow, pTrack->coalesceWindow);
+
+CleanUp:
+
+    SAFE_MEMFREE(ppTracks);
+    SAFE_MEMFREE(ppQueue);
+
+    return retStatus;
+}
+
+STATUS schedulerStart(PScheduler pScheduler)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+
+    CHK(pScheduler != NULL, STATUS_NULL_ARG);
+    CHK(!IS_VALID_TID_VALUE(pScheduler->tid), STATUS_INVALID_OPERATION);
+
+    CHK_STATUS(THREAD_CREATE(&pScheduler->tid, schedulerRoutine, (PVOID) pScheduler));
+
+CleanUp:
+
+    return retStatus;
+}
+
+STATUS schedulerJoin(PScheduler pScheduler)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    PVOID threadStatus = NULL;
+
+    CHK(pScheduler != NULL, STATUS_NULL_ARG);
+    CHK(IS_VALID_TID_VALUE(pScheduler->tid), retStatus);
+
+    THREAD_JOIN(pScheduler->tid, &threadStatus);
+    pScheduler->tid = INVALID_TID_VALUE;
+    retStatus = (STATUS) (ULONG_PTR) threadStatus;
+
+CleanUp:
+
+    return retStatus;
+}
+
+STATUS schedulerNotifyTrack(PSchedulerTrack pTrack)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    UINT64 value = 1;
+
+    CHK(pTrack != NULL && pTrack->pScheduler != NULL, STATUS_NULL_ARG);
+
+    ATOMIC_STORE_BOOL(&pTrack->notified, TRUE);
+    CHK(write(pTrack->pScheduler->eventFd, &value, SIZEOF(value)) == SIZEOF(value), STATUS_INVALID_OPERATION);
+
+CleanUp:
+
+    return retStatus;
+}
+
+VOID schedulerPrintStats(PScheduler pScheduler, UINT32 index, UINT64 duration)
+{
+    UINT64 wakeups, frames;
+
+    if (pScheduler == NULL) {
+        return;
+    }
+
+    wakeups = (UINT64) ATOMIC_LOAD(&pScheduler->stats.wakeups);
+    frames = (UINT64) ATOMIC_LOAD(&pScheduler->stats.dispatchedFrames);
+    printf("Scheduler %u: %" PRIu64 " frames dispatched in %" PRIu64 " wakeups, %.1f wakeups/s, %.2f frames per wakeup, %" PRIu64
+           " coalesced\n",
+           index, frames, wakeups, duration == 0 ? 0.0 : (DOUBLE) wakeups * HUNDREDS_OF_NANOS_IN_A_SECOND / duration,
+           wakeups == 0 ? 0.0 : (DOUBLE) frames / wakeups, (UINT64) ATOMIC_LOAD(&pScheduler->stats.coalescedFrames));
+}
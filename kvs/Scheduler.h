@@ -0,0 +1,159 @@
+/*
+ * Copyright (C) 2020 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __KVS_SCHEDULER_H__
+#define __KVS_SCHEDULER_H__
+
+#include "Pacer.h"
+
+typedef struct __SchedulerTrack SchedulerTrack, *PSchedulerTrack;
+typedef struct __Scheduler Scheduler, *PScheduler;
+
+/**
+ * Fills the next frame of the track: frameData, size, flags and duration. Timestamps and index are kept in the frame
+ * between calls and are the source's to advance.
+ *
+ * Returns STATUS_SCHEDULER_FRAME_PENDING when the source has nothing yet, the source then calls
+ * schedulerNotifyTrack once it has. Returns STATUS_SCHEDULER_TRACK_FINISHED at the end of the input.
+ */
+typedef STATUS (*SchedulerNextFrameFunc)(PSchedulerTrack, PFrame);
+
+/**
+ * Puts the frame when it is due, or drops it when the BOOL is set by the late policy.
+ */
+typedef STATUS (*SchedulerPutFrameFunc)(PSchedulerTrack, PFrame, BOOL);
+
+typedef enum {
+    SCHEDULER_TRACK_STATE_IDLE,
+    // frame ready, waiting in the timer queue
+    SCHEDULER_TRACK_STATE_QUEUED,
+    // frame ready, waiting for the dependency to put its first frame
+    SCHEDULER_TRACK_STATE_BLOCKED,
+    // waiting for the source to notify
+    SCHEDULER_TRACK_STATE_PENDING,
+    SCHEDULER_TRACK_STATE_FINISHED,
+} SCHEDULER_TRACK_STATE;
+
+struct __SchedulerTrack {
+    CHAR name[32];
+    UINT64 customData;
+    SchedulerNextFrameFunc nextFrameFn;
+    SchedulerPutFrameFunc putFrameFn;
+    // no frame of this track is dispatched before the dependency put its first frame
+    PSchedulerTrack pDependency;
+    // unpaced tracks are due as soon as the source has a frame
+    BOOL paced;
+    Pacer pacer;
+    // frames due within this long are put on an earlier wakeup of the scheduler rather than on one of their own
+    UINT64 coalesceWindow;
+
+    // owned by the scheduler
+    Frame frame;
+    UINT64 dueTime;
+    SCHEDULER_TRACK_STATE state;
+    BOOL started;
+    volatile ATOMIC_BOOL notified;
+    PScheduler pScheduler;
+};
+
+typedef struct {
+    volatile SIZE_T wakeups;
+    volatile SIZE_T dispatchedFrames;
+    // put ahead of their due time within the coalescing window of their track
+    volatile SIZE_T coalescedFrames;
+} SchedulerStats, *PSchedulerStats;
+
+/**
+ * Dispatches the puts of any number of tracks from one thread.
+ *
+ * Every track with a frame ready sits in a min-heap keyed on its due time. The thread sleeps on a timerfd armed with
+ * the absolute deadline at the top of the heap and on an eventfd sources use to announce new frames, so it wakes only
+ * when there is work to do. On a virtual pacer clock it waits through pacerWait and polls the eventfd. Once awake it also puts the frames falling due within the coalescing window of their track,
+ * so high rate tracks share the wakeups of the others.
+ */
+struct __Scheduler {
+    // monotonic stop time in 100ns, see pacerGetTime
+    UINT64 stopTime;
+    TID tid;
+    INT32 timerFd;
+    INT32 eventFd;
+    volatile ATOMIC_BOOL shutdown;
+    PSchedulerTrack* ppTracks;
+    UINT32 trackCount;
+    UINT32 trackCapacity;
+    PSchedulerTrack* ppQueue;
+    UINT32 queueSize;
+    // largest coalescing window of the tracks, 0 skips looking for frames to coalesce
+    UINT64 maxCoalesceWindow;
+    // every queued frame is due, they go out in the order of their timestamps
+    BOOL freeRunning;
+    SchedulerStats stats;
+};
+
+STATUS createScheduler(UINT64, PScheduler*);
+STATUS freeScheduler(PScheduler*);
+
+/**
+ * Sets up a track before it is added. The frame is zeroed and gets the track id.
+ */
+STATUS schedulerTrackInit(PSchedulerTrack, PCHAR, UINT64, SchedulerNextFrameFunc, SchedulerPutFrameFunc, UINT64);
+
+/**
+ * Paces the track against absolute deadlines, see Pacer.h
+ */
+STATUS schedulerTrackSetPacing(PSchedulerTrack, UINT64, PACER_LATE_POLICY, UINT64);
+
+/**
+ * Lets the frames of a paced track be put up to the window ahead of their deadline when the scheduler is awake anyway.
+ * The frames keep their timestamps, only the put happens early. Set before the track is added.
+ */
+STATUS schedulerTrackSetCoalescing(PSchedulerTrack, UINT64);
+
+/**
+ * Puts the frames back to back as fast as the puts return instead of at their due time, the tracks interleaved by
+ * presentation timestamp. A put which blocks holds back all the tracks of the scheduler. Set before the scheduler starts.
+ */
+STATUS schedulerSetFreeRunning(PScheduler);
+
+/**
+ * Tracks are owned by the caller and have to be added before the scheduler starts.
+ */
+STATUS schedulerAddTrack(PScheduler, PSchedulerTrack);
+
+STATUS schedulerStart(PScheduler);
+
+/**
+ * Waits until the stop time passes or every track finished.
+ */
+STATUS schedulerJoin(PScheduler);
+
+/**
+ * Tells the scheduler a pending track has a frame. Safe to call from any thread.
+ */
+STATUS schedulerNotifyTrack(PSchedulerTrack);
+
+/**
+ * Prints the wakeups per second and the frames put on each over the given duration
+ */
+VOID schedulerPrintStats(PScheduler, UINT32, UINT64);
+
+#endif /* __KVS_SCHEDULER_H__ */
@@ -0,0 +1,413 @@
+/*
+ * Copyright (C) 2020 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+#include "SegmentWatcher.h"
+
+#define SEGMENT_WATCHER_SLOT(pWatcher, sequence)    (&(pWatcher)->segments[(sequence) % SEGMENT_WATCHER_MAX_SEGMENTS])
+
+STATIC BOOL isSegmentName(PCHAR name)
+{
+    SIZE_T length = STRLEN(name), extensionLength = STRLEN(SEGMENT_WATCHER_EXTENSION);
+
+    return length > extensionLength && STRCMP(name + length - extensionLength, SEGMENT_WATCHER_EXTENSION) == 0;
+}
+
+STATIC STATUS segmentPath(PSegmentWatcher pWatcher, PSegment pSegment, PCHAR suffix, PCHAR path)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+
+    CHK(SNPRINTF(path, MAX_PATH_LEN + 1, "%s/%s%s", pWatcher->directory, pSegment->name, suffix) <= MAX_PATH_LEN,
+        STATUS_INVALID_ARG_LEN);
+
+CleanUp:
+
+    return retStatus;
+}
+
+/**
+ * Has to be called with the lock held
+ */
+STATIC VOID queueSegment(PSegmentWatcher pWatcher, PCHAR name, BOOL closed)
+{
+    PSegment pSegment;
+
+    if (pWatcher->nextSequence - pWatcher->firstSequence == SEGMENT_WATCHER_MAX_SEGMENTS) {
+        if (pWatcher->firstSequence >= pWatcher->readSequence) {
+            // the recorder is that far ahead of the reader, better leave the segment for a later run than block
+            DLOGE("Segment %s/%s skipped, %u segments are waiting to be read", pWatcher->directory, name, SEGMENT_WATCHER_MAX_SEGMENTS);
+            return;
+        }
+
+        // the oldest read one stops waiting for its fragments
+        pWatcher->firstSequence++;
+        ATOMIC_INCREMENT(&pWatcher->stats.kept);
+    }
+
+    pSegment = SEGMENT_WATCHER_SLOT(pWatcher, pWatcher->nextSequence);
+    MEMSET(pSegment, 0x00, SIZEOF(Segment));
+    STRNCPY(pSegment->name, name, NAME_MAX);
+    pSegment->closed = closed;
+    pWatcher->nextSequence++;
+}
+
+/**
+ * Has to be called with the lock held
+ */
+STATIC VOID closeSegment(PSegmentWatcher pWatcher, PCHAR name)
+{
+    UINT32 sequence;
+
+    for (sequence = pWatcher->firstSequence; sequence < pWatcher->nextSequence; sequence++) {
+        if (STRCMP(SEGMENT_WATCHER_SLOT(pWatcher, sequence)->name, name) == 0) {
+            SEGMENT_WATCHER_SLOT(pWatcher, sequence)->closed = TRUE;
+        }
+    }
+}
+
+/**
+ * Keeps the segments with frames put which are not persisted yet. Has to be called with the lock held.
+ */
+STATIC VOID keepSegmentsInFlight(PSegmentWatcher pWatcher)
+{
+    PSegment pSegment;
+    UINT32 sequence;
+
+    for (sequence = pWatcher->firstSequence; sequence <= pWatcher->putSequence && sequence < pWatcher->nextSequence; sequence++) {
+        pSegment = SEGMENT_WATCHER_SLOT(pWatcher, sequence);
+        if (pSegment->uploaded && !pSegment->dropped) {
+            DLOGW("Segment %s/%s is kept, frames of the stream were lost", pWatcher->directory, pSegment->name);
+            pSegment->dropped = TRUE;
+        }
+    }
+}
+
+/**
+ * Deletes or renames the segments whose fragments are all persisted, in order. Has to be called with the lock held.
+ */
+STATIC VOID retireSegments(PSegmentWatcher pWatcher)
+{
+    PSegment pSegment;
+    CHAR path[MAX_PATH_LEN + 1], donePath[MAX_PATH_LEN + 1];
+    BOOL retired;
+
+    // a later segment has frames put, so every frame of the older ones has been
+    while (pWatcher->firstSequence < pWatcher->putSequence) {
+        pSegment = SEGMENT_WATCHER_SLOT(pWatcher, pWatcher->firstSequence);
+        retired = FALSE;
+        if (pWatcher->doneAction != SEGMENT_DONE_ACTION_KEEP && pSegment->uploaded && !pSegment->dropped) {
+            if (pSegment->lastFragment > pWatcher->fragmentsPersisted) {
+                break;
+            }
+
+            if (STATUS_SUCCEEDED(segmentPath(pWatcher, pSegment, (PCHAR) "", path))) {
+                if (pWatcher->doneAction == SEGMENT_DONE_ACTION_DELETE) {
+                    retired = unlink(path) == 0;
+                } else {
+                    retired = STATUS_SUCCEEDED(segmentPath(pWatcher, pSegment, (PCHAR) SEGMENT_WATCHER_DONE_SUFFIX, donePath)) &&
+                        rename(path, donePath) == 0;
+                }
+
+                if (!retired) {
+                    DLOGW("Failed to retire segment %s: %s", path, strerror(errno));
+                }
+            }
+        }
+
+        ATOMIC_INCREMENT(retired ? &pWatcher->stats.retired : &pWatcher->stats.kept);
+        pWatcher->firstSequence++;
+    }
+}
+
+STATUS createSegmentWatcher(PCHAR directory, PSegmentWatcher* ppWatcher)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    PSegmentWatcher pWatcher = NULL;
+    DIR* pDir = NULL;
+    struct dirent* pEntry;
+    struct stat fileStat;
+    CHAR path[MAX_PATH_LEN + 1], newest[NAME_MAX + 1];
+    struct timespec newestTime = {0};
+
+    CHK(directory != NULL && ppWatcher != NULL, STATUS_NULL_ARG);
+    CHK(STRLEN(directory) <= MAX_PATH_LEN, STATUS_INVALID_ARG_LEN);
+
+    CHK(NULL != (pWatcher = (PSegmentWatcher) MEMCALLOC(1, SIZEOF(SegmentWatcher))), STATUS_NOT_ENOUGH_MEMORY);
+    STRCPY(pWatcher->directory, directory);
+    pWatcher->inotifyFd = -1;
+    pWatcher->firstSequence = 1;
+    pWatcher->nextSequence = 1;
+    pWatcher->lock = MUTEX_CREATE(FALSE);
+    CHK(IS_VALID_MUTEX_VALUE(pWatcher->lock), STATUS_NOT_ENOUGH_MEMORY);
+
+    // watched before the directory is listed so a segment created in between is not missed
+    CHK((pWatcher->inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) >= 0, STATUS_INVALID_OPERATION);
+    CHK(inotify_add_watch(pWatcher->inotifyFd, directory, IN_CREATE | IN_MOVED_TO | IN_CLOSE_WRITE | IN_MODIFY | IN_ONLYDIR) >= 0,
+        STATUS_OPEN_FILE_FAILED);
+
+    // the recorder is most likely writing the newest segment, the older ones were uploaded by an earlier run or never will be
+    CHK(NULL != (pDir = opendir(directory)), STATUS_OPEN_FILE_FAILED);
+    newest[0] = '\0';
+    while ((pEntry = readdir(pDir)) != NULL) {
+        if (!isSegmentName(pEntry->d_name) || SNPRINTF(path, SIZEOF(path), "%s/%s", directory, pEntry->d_name) >= (INT32) SIZEOF(path) ||
+            stat(path, &fileStat) != 0 || !S_ISREG(fileStat.st_mode)) {
+            continue;
+        }
+
+        if (newest[0] == '\0' || fileStat.st_mtim.tv_sec > newestTime.tv_sec ||
+            (fileStat.st_mtim.tv_sec == newestTime.tv_sec && fileStat.st_mtim.tv_nsec > newestTime.tv_nsec)) {
+            STRNCPY(newest, pEntry->d_name, NAME_MAX);
+            newest[NAME_MAX] = '\0';
+            newestTime = fileStat.st_mtim;
+        }
+    }
+
+    if (newest[0] != '\0') {
+        queueSegment(pWatcher, newest, FALSE);
+    }
+
+    DLOGI("Watching %s for %s segments%s%s", directory, SEGMENT_WATCHER_EXTENSION, newest[0] != '\0' ? ", starting with " : "", newest);
+
+CleanUp:
+
+    if (pDir != NULL) {
+        closedir(pDir);
+    }
+
+    if (STATUS_FAILED(retStatus)) {
+        DLOGE("Failed to watch %s for segments with 0x%08x", directory == NULL ? "" : directory, retStatus);
+        freeSegmentWatcher(&pWatcher);
+    }
+
+    if (ppWatcher != NULL) {
+        *ppWatcher = pWatcher;
+    }
+
+    return retStatus;
+}
+
+STATUS freeSegmentWatcher(PSegmentWatcher* ppWatcher)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    PSegmentWatcher pWatcher;
+
+    CHK(ppWatcher != NULL, STATUS_NULL_ARG);
+
+    pWatcher = *ppWatcher;
+    CHK(pWatcher != NULL, retStatus);
+
+    if (pWatcher->inotifyFd >= 0) {
+        close(pWatcher->inotifyFd);
+    }
+
+    if (IS_VALID_MUTEX_VALUE(pWatcher->lock)) {
+        MUTEX_FREE(pWatcher->lock);
+    }
+
+    MEMFREE(pWatcher);
+    *ppWatcher = NULL;
+
+CleanUp:
+
+    return retStatus;
+}
+
+INT32 segmentWatcherGetFd(PSegmentWatcher pWatcher)
+{
+    return pWatcher == NULL ? -1 : pWatcher->inotifyFd;
+}
+
+STATUS segmentWatcherProcessEvents(PSegmentWatcher pWatcher)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    BYTE buffer[SEGMENT_WATCHER_EVENT_BUFFER_SIZE] __attribute__((aligned(__alignof__(struct inotify_event))));
+    struct inotify_event* pEvent;
+    ssize_t length;
+    UINT32 offset;
+    BOOL locked = FALSE;
+
+    CHK(pWatcher != NULL, STATUS_NULL_ARG);
+
+    MUTEX_LOCK(pWatcher->lock);
+    locked = TRUE;
+
+    while (TRUE) {
+        length = read(pWatcher->inotifyFd, buffer, SIZEOF(buffer));
+        if (length < 0) {
+            CHK(errno == EINTR || errno == EAGAIN, STATUS_READ_FILE_FAILED);
+            CHK(errno == EINTR, retStatus);
+            continue;
+        }
+
+        for (offset = 0; offset < (UINT32) length; offset += SIZEOF(struct inotify_event) + pEvent->len) {
+            pEvent = (struct inotify_event*) (buffer + offset);
+            if ((pEvent->mask & IN_Q_OVERFLOW) != 0) {
+                DLOGW("Events of %s overflowed, segments may have been missed", pWatcher->directory);
+            }
+
+            // IN_MODIFY only wakes up a reader tailing a segment
+            if (pEvent->len == 0 || (pEvent->mask & IN_ISDIR) != 0 || !isSegmentName(pEvent->name)) {
+                continue;
+            }
+
+            if ((pEvent->mask & IN_CREATE) != 0) {
+                queueSegment(pWatcher, pEvent->name, FALSE);
+            } else if ((pEvent->mask & IN_MOVED_TO) != 0) {
+                // written somewhere else and moved in once complete
+                queueSegment(pWatcher, pEvent->name, TRUE);
+            } else if ((pEvent->mask & IN_CLOSE_WRITE) != 0) {
+                closeSegment(pWatcher, pEvent->name);
+            }
+        }
+    }
+
+CleanUp:
+
+    if (locked) {
+        MUTEX_UNLOCK(pWatcher->lock);
+    }
+
+    return retStatus;
+}
+
+BOOL segmentWatcherIsReadDone(PSegmentWatcher pWatcher)
+{
+    BOOL done;
+
+    MUTEX_LOCK(pWatcher->lock);
+    done = pWatcher->readSequence + 1 < pWatcher->nextSequence || SEGMENT_WATCHER_SLOT(pWatcher, pWatcher->readSequence)->closed;
+    MUTEX_UNLOCK(pWatcher->lock);
+
+    return done;
+}
+
+STATUS segmentWatcherOpenNext(PSegmentWatcher pWatcher, PINT32 pFd, PUINT32 pSequence)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    PSegment pSegment;
+    CHAR path[MAX_PATH_LEN + 1];
+    BOOL locked = FALSE;
+
+    CHK(pWatcher != NULL && pFd != NULL && pSequence != NULL, STATUS_NULL_ARG);
+
+    *pFd = -1;
+
+    MUTEX_LOCK(pWatcher->lock);
+    locked = TRUE;
+
+    while (*pFd < 0 && pWatcher->readSequence + 1 < pWatcher->nextSequence) {
+        pWatcher->readSequence++;
+        pSegment = SEGMENT_WATCHER_SLOT(pWatcher, pWatcher->readSequence);
+        if (STATUS_FAILED(segmentPath(pWatcher, pSegment, (PCHAR) "", path)) || (*pFd = open(path, O_RDONLY | O_CLOEXEC)) < 0) {
+            // deleted or moved away before it was read, nothing of it is put
+            DLOGW("Segment %s/%s is gone: %s", pWatcher->directory, pSegment->name, strerror(errno));
+            pSegment->dropped = TRUE;
+            continue;
+        }
+
+        ATOMIC_INCREMENT(&pWatcher->stats.segments);
+        *pSequence = pWatcher->readSequence;
+        DLOGI("Reading segment %s", path);
+    }
+
+CleanUp:
+
+    if (locked) {
+        MUTEX_UNLOCK(pWatcher->lock);
+    }
+
+    return retStatus;
+}
+
+VOID segmentWatcherFramePut(PSegmentWatcher pWatcher, UINT32 sequence, BOOL keyFrame, BOOL put)
+{
+    PSegment pSegment;
+
+    MUTEX_LOCK(pWatcher->lock);
+
+    if (sequence >= pWatcher->firstSequence && sequence < pWatcher->nextSequence) {
+        pSegment = SEGMENT_WATCHER_SLOT(pWatcher, sequence);
+        if (!put) {
+            pSegment->dropped = TRUE;
+        } else {
+            if (keyFrame) {
+                pWatcher->fragmentsPut++;
+            }
+
+            pSegment->uploaded = TRUE;
+            pSegment->lastFragment = pWatcher->fragmentsPut;
+        }
+
+        pWatcher->putSequence = MAX(pWatcher->putSequence, sequence);
+        retireSegments(pWatcher);
+    }
+
+    MUTEX_UNLOCK(pWatcher->lock);
+}
+
+VOID segmentWatcherFragmentPersisted(PSegmentWatcher pWatcher, UINT64 timestamp)
+{
+    MUTEX_LOCK(pWatcher->lock);
+    if (!pWatcher->persistedTimestampValid || timestamp > pWatcher->lastPersistedTimestamp) {
+        pWatcher->persistedTimestampValid = TRUE;
+        pWatcher->lastPersistedTimestamp = timestamp;
+        pWatcher->fragmentsPersisted++;
+        retireSegments(pWatcher);
+    }
+    MUTEX_UNLOCK(pWatcher->lock);
+}
+
+VOID segmentWatcherFramesLost(PSegmentWatcher pWatcher)
+{
+    MUTEX_LOCK(pWatcher->lock);
+    keepSegmentsInFlight(pWatcher);
+    retireSegments(pWatcher);
+    MUTEX_UNLOCK(pWatcher->lock);
+}
+
+VOID segmentWatcherResync(PSegmentWatcher pWatcher)
+{
+    MUTEX_LOCK(pWatcher->lock);
+    keepSegmentsInFlight(pWatcher);
+    // the new stream acks from its first fragment on
+    pWatcher->fragmentsPersisted = pWatcher->fragmentsPut;
+    pWatcher->persistedTimestampValid = FALSE;
+    retireSegments(pWatcher);
+    MUTEX_UNLOCK(pWatcher->lock);
+}
+
+VOID segmentWatcherPrintStats(PSegmentWatcher pWatcher, PCHAR name)
+{
+    if (pWatcher == NULL) {
+        return;
+    }
+
+    printf("Channel %s segments: %" PRIu64 " read, %" PRIu64 " retired, %" PRIu64 " kept, %u waiting for their fragments\n", name,
+           (UINT64) pWatcher->stats.segments, (UINT64) pWatcher->stats.retired, (UINT64) pWatcher->stats.kept,
+           pWatcher->readSequence > pWatcher->firstSequence ? pWatcher->readSequence - pWatcher->firstSequence : 0);
+}
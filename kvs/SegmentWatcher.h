@@ -0,0 +1,148 @@
+/*
+ * Copyright (C) 2020 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __KVS_SEGMENT_WATCHER_H__
+#define __KVS_SEGMENT_WATCHER_H__
+
+#include <limits.h>
+
+#include "KvsApp.h"
+
+#define SEGMENT_WATCHER_EXTENSION           ".h264"
+// appended to the name of an uploaded segment with --segment-done mark
+#define SEGMENT_WATCHER_DONE_SUFFIX         ".done"
+// segments read but not retired yet plus the ones queued, a recorder rolling every few seconds needs a handful
+#define SEGMENT_WATCHER_MAX_SEGMENTS        64
+#define SEGMENT_WATCHER_EVENT_BUFFER_SIZE   (4 * 1024)
+
+/**
+ * What happens to a segment once all of its fragments are persisted
+ */
+typedef enum {
+    SEGMENT_DONE_ACTION_KEEP,
+    SEGMENT_DONE_ACTION_DELETE,
+    SEGMENT_DONE_ACTION_MARK,
+} SEGMENT_DONE_ACTION;
+
+typedef struct {
+    CHAR name[NAME_MAX + 1];
+    // the recorder closed it or moved it into the directory complete
+    BOOL closed;
+    // a frame of it was put, one was dropped or spooled
+    BOOL uploaded;
+    BOOL dropped;
+    // fragment of its last frame put, counted from 1 by key frames put
+    UINT64 lastFragment;
+} Segment, *PSegment;
+
+/**
+ * Read by the metrics server
+ */
+typedef struct {
+    volatile SIZE_T segments;
+    volatile SIZE_T retired;
+    // read but never retired: a frame of it was not uploaded, the stream failed or nothing was to be done
+    volatile SIZE_T kept;
+} SegmentWatcherStats, *PSegmentWatcherStats;
+
+/**
+ * Follows a directory a recorder writes rolling .h264 segments to. inotify reports the segments as they are created
+ * and closed, nothing polls the directory. The reader opens them in the order they were created and tails the
+ * newest one while it is written. A segment is read to its end once it is closed or a newer one showed up.
+ *
+ * Segments are numbered from 1 in that order. The put side reports every frame with its segment and the ack side
+ * every persisted fragment, a segment is retired once the fragment of its last frame is persisted. When frames are lost
+ * only the segments with fragments in flight are kept, the ones read after go on being retired.
+ */
+typedef struct {
+    CHAR directory[MAX_PATH_LEN + 1];
+    INT32 inotifyFd;
+    SEGMENT_DONE_ACTION doneAction;
+    MUTEX lock;
+    // guarded by lock. Segment n lives in slot n % SEGMENT_WATCHER_MAX_SEGMENTS, the ones in [firstSequence,
+    // nextSequence) are tracked: read ones waiting to be retired, the one being read and the queued ones.
+    Segment segments[SEGMENT_WATCHER_MAX_SEGMENTS];
+    UINT32 firstSequence;
+    UINT32 readSequence;
+    UINT32 nextSequence;
+    // segment of the last frame put, frames are put in order so every older one is complete
+    UINT32 putSequence;
+    UINT64 fragmentsPut;
+    UINT64 fragmentsPersisted;
+    // ack timestamp of the last fragment counted as persisted, a new session replays the fragments not acked yet
+    BOOL persistedTimestampValid;
+    UINT64 lastPersistedTimestamp;
+    SegmentWatcherStats stats;
+} SegmentWatcher, *PSegmentWatcher;
+
+/**
+ * Starts watching the directory and queues the newest segment already in it, read from its start.
+ */
+STATUS createSegmentWatcher(PCHAR, PSegmentWatcher*);
+STATUS freeSegmentWatcher(PSegmentWatcher*);
+
+/**
+ * Readable when the directory changed, segmentWatcherProcessEvents has to be called then
+ */
+INT32 segmentWatcherGetFd(PSegmentWatcher);
+
+/**
+ * Drains the pending inotify events without blocking
+ */
+STATUS segmentWatcherProcessEvents(PSegmentWatcher);
+
+/**
+ * Whether the end of the segment being read is final, it is closed or a newer one showed up
+ */
+BOOL segmentWatcherIsReadDone(PSegmentWatcher);
+
+/**
+ * Opens the next queued segment. Returns -1 in the fd when there is none yet, skips the ones gone meanwhile.
+ */
+STATUS segmentWatcherOpenNext(PSegmentWatcher, PINT32, PUINT32);
+
+/**
+ * Reports a frame of the segment as put or as dropped. Key frames put start the next fragment.
+ */
+VOID segmentWatcherFramePut(PSegmentWatcher, UINT32, BOOL, BOOL);
+
+/**
+ * Reports the next fragment of the stream as persisted, in order. Acks with a timestamp not past the last one counted
+ * are replays of a new session and are ignored.
+ */
+VOID segmentWatcherFragmentPersisted(PSegmentWatcher, UINT64);
+
+/**
+ * Reports frames of the stream dropped, every segment with a fragment not persisted yet is kept. A fragment dropped
+ * whole is never acked, the segments after are then retired that many fragments late.
+ */
+VOID segmentWatcherFramesLost(PSegmentWatcher);
+
+/**
+ * Reports the stream reset with its buffered frames gone. The segments in flight are kept and the count of persisted
+ * fragments starts over from the fragments put.
+ */
+VOID segmentWatcherResync(PSegmentWatcher);
+
+VOID segmentWatcherPrintStats(PSegmentWatcher, PCHAR);
+
+#endif /* __KVS_SEGMENT_WATCHER_H__ */
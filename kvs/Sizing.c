@@ -0,0 +1,203 @@
+/*
+ * Copyright (C) 2020 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "Sizing.h"
+#include "Pacer.h"
+
+typedef struct {
+    PAnnexBReader pReader;
+    PSizingSample pSample;
+    UINT64 deadline;
+    TID tid;
+    STATUS status;
+} SizingMeasurement, *PSizingMeasurement;
+
+VOID sizingSampleAdd(PSizingSample pSample, UINT32 size, UINT64 time)
+{
+    if (!pSample->started || time >= pSample->windowStart + SIZING_RATE_WINDOW) {
+        pSample->peakWindowBytes = MAX(pSample->peakWindowBytes, pSample->windowBytes);
+        pSample->windowStart = time;
+        pSample->windowBytes = 0;
+        pSample->started = TRUE;
+    }
+
+    pSample->windowBytes += size;
+    pSample->bytes += size;
+    pSample->frames++;
+}
+
+UINT64 sizingSampleGetByteRate(PSizingSample pSample)
+{
+    UINT64 peak = MAX(pSample->peakWindowBytes, pSample->windowBytes), average = 0;
+
+    if (pSample->duration != 0) {
+        average = pSample->bytes * HUNDREDS_OF_NANOS_IN_A_SECOND / pSample->duration;
+    }
+
+    // a window shorter than a second holds less than a second worth of bytes, the average covers that case
+    return pSample->duration < SIZING_RATE_WINDOW ? average : MAX(peak, average);
+}
+
+STATUS sizingMeasureArchive(PFrameArchive pArchive, PSizingSample pSample)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    UINT64 videoTime = 0, audioTime = 0;
+    PUINT64 pTime;
+    UINT32 i;
+
+    CHK(pArchive != NULL && pSample != NULL, STATUS_NULL_ARG);
+
+    MEMSET(pSample, 0x00, SIZEOF(SizingSample));
+    // frames are interleaved in timestamp order, so the windows only move forward
+    for (i = 0; i < pArchive->frameCount; i++) {
+        pTime = pArchive->pIndex[i].trackId == DEFAULT_VIDEO_TRACK_ID ? &videoTime : &audioTime;
+        sizingSampleAdd(pSample, pArchive->pIndex[i].size, *pTime);
+        *pTime += pArchive->pIndex[i].duration;
+    }
+
+    pSample->duration = MAX(videoTime, audioTime);
+
+CleanUp:
+
+    return retStatus;
+}
+
+STATIC PVOID sizingMeasureRoutine(PVOID args)
+{
+    PSizingMeasurement pMeasurement = (PSizingMeasurement) args;
+    PAnnexBAccessUnit pUnit;
+    UINT64 startTime = pacerGetTime(), now;
+    STATUS status;
+
+    for (now = startTime; now < pMeasurement->deadline; now = pacerGetTime()) {
+        status = annexBReaderAcquire(pMeasurement->pReader, pMeasurement->deadline - now, &pUnit);
+        if (status == STATUS_OPERATION_TIMED_OUT) {
+            continue;
+        } else if (STATUS_FAILED(status)) {
+            pMeasurement->status = status;
+            break;
+        }
+
+        sizingSampleAdd(pMeasurement->pSample, pUnit->size, pUnit->captureTime);
+        annexBReaderRelease(pMeasurement->pReader);
+    }
+
+    pMeasurement->pSample->duration = now - startTime;
+
+    return NULL;
+}
+
+STATUS sizingMeasureAnnexB(PAnnexBReader* ppReaders, PSizingSample* ppSamples, UINT32 count, UINT64 window)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    PSizingMeasurement pMeasurements = NULL;
+    UINT64 deadline = pacerGetTime() + window;
+    UINT32 i;
+
+    CHK(ppReaders != NULL && ppSamples != NULL, STATUS_NULL_ARG);
+    CHK(count != 0, retStatus);
+
+    CHK(NULL != (pMeasurements = (PSizingMeasurement) MEMCALLOC(count, SIZEOF(SizingMeasurement))), STATUS_NOT_ENOUGH_MEMORY);
+    for (i = 0; i < count; i++) {
+        pMeasurements[i].pReader = ppReaders[i];
+        pMeasurements[i].pSample = ppSamples[i];
+        pMeasurements[i].deadline = deadline;
+        pMeasurements[i].tid = INVALID_TID_VALUE;
+        MEMSET(ppSamples[i], 0x00, SIZEOF(SizingSample));
+    }
+
+    for (i = 0; i < count; i++) {
+        CHK_STATUS(THREAD_CREATE(&pMeasurements[i].tid, sizingMeasureRoutine, (PVOID) &pMeasurements[i]));
+    }
+
+CleanUp:
+
+    for (i = 0; pMeasurements != NULL && i < count; i++) {
+        if (IS_VALID_TID_VALUE(pMeasurements[i].tid)) {
+            THREAD_JOIN(pMeasurements[i].tid, NULL);
+        }
+
+        if (STATUS_SUCCEEDED(retStatus)) {
+            retStatus = pMeasurements[i].status;
+        }
+    }
+
+    SAFE_MEMFREE(pMeasurements);
+
+    return retStatus;
+}
+
+STATUS sizingPlan(PSizingSample pSamples, UINT32 count, UINT64 outageDuration, UINT64 ramCeiling, PSizingPlan pPlan)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    UINT64 byteRate = 0, budget, storageSize;
+    UINT32 i;
+
+    CHK(pSamples != NULL && pPlan != NULL, STATUS_NULL_ARG);
+    CHK(count != 0 && outageDuration != 0, STATUS_INVALID_ARG);
+
+    MEMSET(pPlan, 0x00, SIZEOF(SizingPlan));
+    for (i = 0; i < count; i++) {
+        byteRate += sizingSampleGetByteRate(&pSamples[i]);
+    }
+    // a silent input still gets a usable store
+    byteRate = MAX(byteRate, 1);
+    pPlan->peakByteRate = byteRate;
+
+    CHK_ERR(ramCeiling > SIZING_HEAP_RESERVE + MIN_STORAGE_ALLOCATION_SIZE, STATUS_SIZING_RAM_CEILING_TOO_LOW,
+            "RAM ceiling of %" PRIu64 " KB leaves no room for the content store", ramCeiling / 1024);
+    budget = ramCeiling - SIZING_HEAP_RESERVE;
+
+    // every channel fills its share of the store at its own rate, so all of them run out at the same time
+    storageSize = byteRate * (outageDuration + SIZING_PIPELINE_SLACK) / HUNDREDS_OF_NANOS_IN_A_SECOND * (100 + SIZING_STORE_OVERHEAD_PERCENT) / 100;
+    if (storageSize > budget) {
+        storageSize = budget;
+        pPlan->capped = TRUE;
+        outageDuration = storageSize * 100 / (100 + SIZING_STORE_OVERHEAD_PERCENT) * HUNDREDS_OF_NANOS_IN_A_SECOND / byteRate;
+        CHK_ERR(outageDuration >= SIZING_PIPELINE_SLACK + SIZING_MIN_OUTAGE_DURATION, STATUS_SIZING_RAM_CEILING_TOO_LOW,
+                "RAM ceiling of %" PRIu64 " KB cannot buffer %" PRIu64 " KB/s for %u second", ramCeiling / 1024, byteRate / 1024,
+                (UINT32) (SIZING_MIN_OUTAGE_DURATION / HUNDREDS_OF_NANOS_IN_A_SECOND));
+        outageDuration -= SIZING_PIPELINE_SLACK;
+    }
+
+    pPlan->storageSize = MAX(storageSize, MIN_STORAGE_ALLOCATION_SIZE);
+    pPlan->outageDuration = outageDuration;
+    // the buffer duration pressure fires when the store would be full anyway, and everything still buffered after
+    // a reconnect is replayed
+    pPlan->bufferDuration = outageDuration + SIZING_PIPELINE_SLACK;
+    pPlan->replayDuration = pPlan->bufferDuration;
+
+CleanUp:
+
+    return retStatus;
+}
+
+VOID sizingPrintPlan(PSizingPlan pPlan, UINT64 targetOutageDuration)
+{
+    printf("Auto-sizing: %" PRIu64 " KB/s peak, %" PRIu64 " KB content store, %" PRIu64 " s buffer and replay duration\n",
+           pPlan->peakByteRate / 1024, pPlan->storageSize / 1024, (UINT64) (pPlan->bufferDuration / HUNDREDS_OF_NANOS_IN_A_SECOND));
+    if (pPlan->capped) {
+        printf("Auto-sizing: RAM ceiling allows surviving a %" PRIu64 " s outage instead of %" PRIu64 " s\n",
+               (UINT64) (pPlan->outageDuration / HUNDREDS_OF_NANOS_IN_A_SECOND),
+               (UINT64) (targetOutageDuration / HUNDREDS_OF_NANOS_IN_A_SECOND));
+    }
+}
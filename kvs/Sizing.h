@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2020 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __KVS_SIZING_H__
+#define __KVS_SIZING_H__
+
+#include "KvsApp.h"
+#include "AnnexB.h"
+#include "FrameArchive.h"
+
+#define DEFAULT_SIZING_WARM_UP_DURATION     (5 * HUNDREDS_OF_NANOS_IN_A_SECOND)
+// the RAM budget of the README
+#define DEFAULT_SIZING_RAM_CEILING          (4 * 1024 * 1024)
+// client, streams, MKV generator and connection state living outside the content store
+#define SIZING_HEAP_RESERVE                 (256 * 1024)
+// content heap allocation headers and fragmentation
+#define SIZING_STORE_OVERHEAD_PERCENT       10
+// the fragment being built and the one waiting for its ack stay buffered on top of the outage
+#define SIZING_PIPELINE_SLACK               (4 * HUNDREDS_OF_NANOS_IN_A_SECOND)
+// shortest outage worth streaming with, below this the ceiling is too low for the bitrate
+#define SIZING_MIN_OUTAGE_DURATION          (1 * HUNDREDS_OF_NANOS_IN_A_SECOND)
+#define SIZING_RATE_WINDOW                  HUNDREDS_OF_NANOS_IN_A_SECOND
+
+/**
+ * Bitrate of one channel, measured over the warm-up window or over the whole frame archive
+ */
+typedef struct {
+    UINT64 bytes;
+    UINT64 frames;
+    UINT64 duration;
+    // largest byte count of any one second window, key frames make the average too optimistic
+    UINT64 peakWindowBytes;
+    UINT64 windowStart;
+    UINT64 windowBytes;
+    BOOL started;
+} SizingSample, *PSizingSample;
+
+/**
+ * What the measured bitrates buy within the RAM ceiling
+ */
+typedef struct {
+    // whole content store shared by the channels
+    UINT64 storageSize;
+    // outage every channel survives, below the target when the ceiling capped the store
+    UINT64 outageDuration;
+    UINT64 bufferDuration;
+    UINT64 replayDuration;
+    // sum of the peak rates of the channels in bytes per second
+    UINT64 peakByteRate;
+    BOOL capped;
+} SizingPlan, *PSizingPlan;
+
+VOID sizingSampleAdd(PSizingSample, UINT32, UINT64);
+
+/**
+ * Byte rate of the sample in bytes per second, the peak window or the average whichever is higher
+ */
+UINT64 sizingSampleGetByteRate(PSizingSample);
+
+/**
+ * Measures the archive in one pass over its index, the whole archive is the warm-up window
+ */
+STATUS sizingMeasureArchive(PFrameArchive, PSizingSample);
+
+/**
+ * Consumes live access units from every reader for the warm-up window, one thread per reader so all channels are
+ * measured at once. The units are released unput, the stream does not exist yet.
+ */
+STATUS sizingMeasureAnnexB(PAnnexBReader*, PSizingSample*, UINT32, UINT64);
+
+/**
+ * Derives the content store size, buffer duration and replay duration surviving the target outage, shrinking the
+ * outage when the store would not fit the RAM ceiling
+ */
+STATUS sizingPlan(PSizingSample, UINT32, UINT64, UINT64, PSizingPlan);
+
+VOID sizingPrintPlan(PSizingPlan, UINT64);
+
+#endif /* __KVS_SIZING_H__ */
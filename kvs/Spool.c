@@ -0,0 +1,353 @@
+/*
+ * Copyright (C) 2020 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "Pacer.h"
+#include "Spool.h"
+
+#define SPOOL_RECORD_SIZE(payload) ROUND_UP(SIZEOF(SpoolRecord) + (UINT64) (payload), SPOOL_RECORD_ALIGNMENT)
+
+// Where a record written at the offset really starts, past the end of a block too short for its header
+static UINT64 spoolRecordStart(UINT64 offset)
+{
+    if (SPOOL_BLOCK_SIZE - offset % SPOOL_BLOCK_SIZE < SIZEOF(SpoolRecord)) {
+        offset = ROUND_UP(offset, SPOOL_BLOCK_SIZE);
+    }
+
+    return offset;
+}
+
+// Records from flushedHead on are only in the staged block yet
+static PSpoolRecord spoolRecordAt(PSpool pSpool, UINT64 offset)
+{
+    if (offset >= pSpool->flushedHead) {
+        return (PSpoolRecord) (pSpool->pBlock + (offset - pSpool->flushedHead));
+    }
+
+    return (PSpoolRecord) (pSpool->pMapping + offset % pSpool->size);
+}
+
+// Writes out the staged block, the next one starts empty
+static STATUS spoolWriteBlock(PSpool pSpool)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+
+    CHK(pwrite(pSpool->fd, pSpool->pBlock, SPOOL_BLOCK_SIZE, (off_t) (pSpool->flushedHead % pSpool->size)) == SPOOL_BLOCK_SIZE,
+        STATUS_WRITE_TO_FILE_FAILED);
+
+    pSpool->budgetTokens -= SPOOL_BLOCK_SIZE;
+    ATOMIC_INCREMENT(&pSpool->stats.blocksWritten);
+
+CleanUp:
+
+    // A failed block is lost either way, carry on with the next one so the offsets stay consistent
+    pSpool->flushedHead += SPOOL_BLOCK_SIZE;
+    MEMSET(pSpool->pBlock, 0x00, SPOOL_BLOCK_SIZE);
+
+    return retStatus;
+}
+
+// Appends the bytes, or zeros without a source, to the staged block
+static STATUS spoolAppend(PSpool pSpool, PBYTE pSrc, UINT64 size)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    UINT64 count;
+
+    while (size > 0) {
+        count = MIN(size, pSpool->flushedHead + SPOOL_BLOCK_SIZE - pSpool->head);
+        if (pSrc != NULL) {
+            MEMCPY(pSpool->pBlock + (pSpool->head - pSpool->flushedHead), pSrc, count);
+            pSrc += count;
+        }
+
+        pSpool->head += count;
+        size -= count;
+        if (pSpool->head == pSpool->flushedHead + SPOOL_BLOCK_SIZE) {
+            CHK_STATUS(spoolWriteBlock(pSpool));
+        }
+    }
+
+CleanUp:
+
+    return retStatus;
+}
+
+// Moves the head forward over bytes nobody reads, blocks skipped entirely are not written at all
+static STATUS spoolSkip(PSpool pSpool, UINT64 offset)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+
+    if (offset < pSpool->flushedHead + SPOOL_BLOCK_SIZE) {
+        pSpool->head = offset;
+        CHK(FALSE, retStatus);
+    }
+
+    CHK_STATUS(spoolWriteBlock(pSpool));
+    pSpool->flushedHead = ROUND_DOWN(offset, SPOOL_BLOCK_SIZE);
+    pSpool->head = offset;
+
+CleanUp:
+
+    return retStatus;
+}
+
+// Writes out a partially filled block so its records can be read through the mapping
+static STATUS spoolFlush(PSpool pSpool)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+
+    if (pSpool->head != pSpool->flushedHead) {
+        CHK_STATUS(spoolSkip(pSpool, pSpool->flushedHead + SPOOL_BLOCK_SIZE));
+    }
+
+CleanUp:
+
+    return retStatus;
+}
+
+// Whether the bytes up to the offset can be written without overwriting the block of the oldest record
+static BOOL spoolHasRoom(PSpool pSpool, UINT64 offset)
+{
+    return ROUND_UP(offset, SPOOL_BLOCK_SIZE) - ROUND_DOWN(pSpool->tail, SPOOL_BLOCK_SIZE) <= pSpool->size;
+}
+
+STATUS createSpool(PCHAR path, UINT64 size, UINT64 writeBudget, PSpool* ppSpool)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    PSpool pSpool = NULL;
+    PVOID pMapping = MAP_FAILED;
+    INT32 fd = -1;
+
+    CHK(path != NULL && ppSpool != NULL, STATUS_NULL_ARG);
+    CHK(STRLEN(path) <= MAX_PATH_LEN, STATUS_INVALID_ARG_LEN);
+
+    // A ring of whole blocks with room for a block being written next to the one being read
+    size = ROUND_DOWN(size, SPOOL_BLOCK_SIZE);
+    CHK(size >= 4 * SPOOL_BLOCK_SIZE && writeBudget > 0, STATUS_INVALID_ARG);
+
+    CHK((fd = open(path, O_RDWR | O_CREAT, 0600)) >= 0, STATUS_OPEN_FILE_FAILED);
+    CHK(ftruncate(fd, (off_t) size) == 0, STATUS_WRITE_TO_FILE_FAILED);
+    // Allocate every block up front, a full flash file system must not fail a write in the middle of an outage
+    CHK(posix_fallocate(fd, 0, (off_t) size) == 0, STATUS_WRITE_TO_FILE_FAILED);
+
+    pMapping = mmap(NULL, (SIZE_T) size, PROT_READ, MAP_SHARED, fd, 0);
+    CHK(pMapping != MAP_FAILED, STATUS_WRITE_TO_FILE_FAILED);
+
+    // Records are read back once, in order
+    madvise(pMapping, (SIZE_T) size, MADV_SEQUENTIAL);
+
+    pSpool = (PSpool) MEMCALLOC(1, SIZEOF(Spool) + SPOOL_BLOCK_SIZE);
+    CHK(pSpool != NULL, STATUS_NOT_ENOUGH_MEMORY);
+
+    STRCPY(pSpool->path, path);
+    pSpool->fd = fd;
+    pSpool->pMapping = (PBYTE) pMapping;
+    pSpool->size = size;
+    pSpool->writeBudget = writeBudget;
+    pSpool->pBlock = (PBYTE) (pSpool + 1);
+    // Whatever an earlier run left is not trusted, the offsets start over and every record read was written by this run
+    pSpool->budgetTokens = (INT64) (writeBudget * SPOOL_WRITE_BURST);
+    pSpool->budgetTime = pacerGetTime();
+
+    DLOGI("Spooling to %s, %" PRIu64 " KB at most %" PRIu64 " KB/s", path, size / 1024, writeBudget / 1024);
+
+CleanUp:
+
+    if (STATUS_FAILED(retStatus)) {
+        DLOGE("Failed to create spool %s with 0x%08x", path == NULL ? "" : path, retStatus);
+        if (pMapping != MAP_FAILED) {
+            munmap(pMapping, (SIZE_T) size);
+        }
+
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+
+    if (ppSpool != NULL) {
+        *ppSpool = pSpool;
+    }
+
+    return retStatus;
+}
+
+STATUS freeSpool(PSpool* ppSpool)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    PSpool pSpool;
+
+    CHK(ppSpool != NULL, STATUS_NULL_ARG);
+
+    pSpool = *ppSpool;
+    CHK(pSpool != NULL, retStatus);
+
+    munmap(pSpool->pMapping, (SIZE_T) pSpool->size);
+    close(pSpool->fd);
+    MEMFREE(pSpool);
+    *ppSpool = NULL;
+
+CleanUp:
+
+    return retStatus;
+}
+
+BOOL spoolBeginGop(PSpool pSpool, UINT64 now)
+{
+    UINT64 elapsed;
+    BOOL begin;
+
+    if (pSpool == NULL) {
+        return FALSE;
+    }
+
+    elapsed = MIN(now - pSpool->budgetTime, SPOOL_WRITE_BURST * HUNDREDS_OF_NANOS_IN_A_SECOND);
+    pSpool->budgetTime = now;
+    pSpool->budgetTokens =
+        MIN(pSpool->budgetTokens + (INT64) (elapsed * pSpool->writeBudget / HUNDREDS_OF_NANOS_IN_A_SECOND), (INT64) (pSpool->writeBudget * SPOOL_WRITE_BURST));
+
+    // Only start GOPs the budget and the ring can take a block of, a GOP cut short can not be decoded
+    begin = pSpool->budgetTokens >= SPOOL_BLOCK_SIZE && spoolHasRoom(pSpool, pSpool->head + SPOOL_BLOCK_SIZE);
+    if (!begin) {
+        ATOMIC_INCREMENT(&pSpool->stats.refusedGops);
+    }
+
+    return begin;
+}
+
+STATUS spoolWriteFrame(PSpool pSpool, PFrame pFrame)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    SpoolRecord record;
+    UINT64 start, recordSize;
+
+    CHK(pSpool != NULL && pFrame != NULL, STATUS_NULL_ARG);
+
+    recordSize = SPOOL_RECORD_SIZE(pFrame->size);
+    start = spoolRecordStart(pSpool->head);
+    // Records never wrap, the rest of the ring is padded when the record would run over its end
+    if (pSpool->size - start % pSpool->size < recordSize) {
+        start = start - start % pSpool->size + pSpool->size;
+    }
+
+    CHK(recordSize <= pSpool->size - SPOOL_BLOCK_SIZE && spoolHasRoom(pSpool, start + recordSize), STATUS_SPOOL_FULL);
+
+    MEMSET(&record, 0x00, SIZEOF(SpoolRecord));
+    if (start != spoolRecordStart(pSpool->head)) {
+        CHK_STATUS(spoolSkip(pSpool, spoolRecordStart(pSpool->head)));
+        record.magic = SPOOL_PAD_MAGIC;
+        record.size = (UINT32) (start - pSpool->head - SIZEOF(SpoolRecord));
+        CHK_STATUS(spoolAppend(pSpool, (PBYTE) &record, SIZEOF(SpoolRecord)));
+    }
+
+    CHK_STATUS(spoolSkip(pSpool, start));
+
+    record.magic = SPOOL_RECORD_MAGIC;
+    record.size = pFrame->size;
+    record.trackId = (UINT32) pFrame->trackId;
+    record.flags = (UINT32) pFrame->flags;
+    record.presentationTs = pFrame->presentationTs;
+    record.decodingTs = pFrame->decodingTs;
+    record.duration = pFrame->duration;
+    CHK_STATUS(spoolAppend(pSpool, (PBYTE) &record, SIZEOF(SpoolRecord)));
+    CHK_STATUS(spoolAppend(pSpool, pFrame->frameData, pFrame->size));
+    CHK_STATUS(spoolAppend(pSpool, NULL, recordSize - SIZEOF(SpoolRecord) - pFrame->size));
+
+    ATOMIC_INCREMENT(&pSpool->stats.spooledFrames);
+    ATOMIC_ADD(&pSpool->stats.spooledBytes, (SIZE_T) pFrame->size);
+    ATOMIC_STORE(&pSpool->stats.usedBytes, (SIZE_T) (pSpool->head - pSpool->tail));
+
+CleanUp:
+
+    return retStatus;
+}
+
+BOOL spoolIsEmpty(PSpool pSpool)
+{
+    return pSpool == NULL || spoolRecordStart(pSpool->tail) >= pSpool->head;
+}
+
+STATUS spoolPeekFrame(PSpool pSpool, PFrame pFrame)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    PSpoolRecord pRecord;
+
+    CHK(pSpool != NULL && pFrame != NULL, STATUS_NULL_ARG);
+
+    while (TRUE) {
+        // The head may sit in the last bytes of a block too, never move the tail past it
+        CHK(spoolRecordStart(pSpool->tail) < pSpool->head, STATUS_SPOOL_EMPTY);
+        pSpool->tail = spoolRecordStart(pSpool->tail);
+
+        pRecord = spoolRecordAt(pSpool, pSpool->tail);
+        if (pRecord->magic == SPOOL_RECORD_MAGIC) {
+            break;
+        } else if (pRecord->magic == SPOOL_PAD_MAGIC) {
+            pSpool->tail += SIZEOF(SpoolRecord) + pRecord->size;
+        } else {
+            // The zeros a flush left at the end of its block
+            pSpool->tail = ROUND_DOWN(pSpool->tail, SPOOL_BLOCK_SIZE) + SPOOL_BLOCK_SIZE;
+        }
+    }
+
+    // A record read from the staged block is read in place, only one running into it from the file is not contiguous
+    if (pSpool->tail < pSpool->flushedHead && pSpool->tail + SIZEOF(SpoolRecord) + pRecord->size > pSpool->flushedHead) {
+        CHK_STATUS(spoolFlush(pSpool));
+    }
+
+    pFrame->frameData = (PBYTE) (pRecord + 1);
+    pFrame->size = pRecord->size;
+    pFrame->trackId = pRecord->trackId;
+    pFrame->flags = (FRAME_FLAGS) pRecord->flags;
+    pFrame->presentationTs = pRecord->presentationTs;
+    pFrame->decodingTs = pRecord->decodingTs;
+    pFrame->duration = pRecord->duration;
+
+CleanUp:
+
+    return retStatus;
+}
+
+VOID spoolRelease(PSpool pSpool)
+{
+    if (spoolIsEmpty(pSpool)) {
+        return;
+    }
+
+    pSpool->tail += SPOOL_RECORD_SIZE(spoolRecordAt(pSpool, pSpool->tail)->size);
+    ATOMIC_INCREMENT(&pSpool->stats.replayedFrames);
+    ATOMIC_STORE(&pSpool->stats.usedBytes, (SIZE_T) (pSpool->head - pSpool->tail));
+}
+
+VOID spoolPrintStats(PSpool pSpool, PCHAR name)
+{
+    if (pSpool == NULL) {
+        return;
+    }
+
+    printf("Channel %s spool: %" PRIu64 " frames and %" PRIu64 " KB spooled, %" PRIu64 " replayed, %" PRIu64 " GOPs refused, %" PRIu64
+           " blocks written, %" PRIu64 " KB left\n",
+           name, (UINT64) pSpool->stats.spooledFrames, (UINT64) pSpool->stats.spooledBytes / 1024, (UINT64) pSpool->stats.replayedFrames,
+           (UINT64) pSpool->stats.refusedGops, (UINT64) pSpool->stats.blocksWritten, (UINT64) pSpool->stats.usedBytes / 1024);
+}
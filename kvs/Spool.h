@@ -0,0 +1,135 @@
+/*
+ * Copyright (C) 2020 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __KVS_SPOOL_H__
+#define __KVS_SPOOL_H__
+
+#include "KvsApp.h"
+
+/**
+ * Ring file the frames a channel cannot put during an outage are kept in.
+ *
+ * The file is preallocated once and only ever written whole blocks at a time, in order, so the flash sees long
+ * sequential writes and every block is written once per lap of the ring. Records are staged in a block buffer and
+ * read back through a shared read-only mapping once written, a replayed frame points straight into either.
+ *
+ *  +--------------+-----------------+-----+--------------+-----------------+-----+----------------------+
+ *  | SpoolRecord  | frame payload   | pad | SpoolRecord  | frame payload   | pad | ... up to the block  |
+ *  +--------------+-----------------+-----+--------------+-----------------+-----+----------------------+
+ *
+ * Records are 8 byte aligned and may span blocks but never the end of the ring, a pad record fills the ring up to
+ * its end instead. A record header never starts in the last bytes of a block too short to hold it.
+ */
+#define SPOOL_BLOCK_SIZE                    (64 * 1024)
+#define SPOOL_RECORD_ALIGNMENT              8
+#define SPOOL_RECORD_MAGIC                  0x4c4f4f50
+#define SPOOL_PAD_MAGIC                     0x44415050
+#define SPOOL_FILE_EXTENSION                ".spool"
+#define DEFAULT_SPOOL_SIZE                  (64 * 1024 * 1024)
+// bytes written to the file per second
+#define DEFAULT_SPOOL_WRITE_BUDGET          (1024 * 1024)
+// seconds of write budget which can be saved up while nothing is spooled
+#define SPOOL_WRITE_BURST                   2
+
+typedef struct {
+    UINT32 magic;
+    // payload bytes following the header, the padding for a pad record
+    UINT32 size;
+    UINT32 trackId;
+    UINT32 flags;
+    // as they were meant for the stream, 100ns
+    UINT64 presentationTs;
+    UINT64 decodingTs;
+    UINT64 duration;
+} SpoolRecord, *PSpoolRecord;
+
+/**
+ * Written by the thread owning the spool, read by the metrics server
+ */
+typedef struct {
+    volatile SIZE_T spooledFrames;
+    volatile SIZE_T spooledBytes;
+    volatile SIZE_T replayedFrames;
+    // GOPs refused because the ring was full or the write budget was spent
+    volatile SIZE_T refusedGops;
+    volatile SIZE_T blocksWritten;
+    volatile SIZE_T usedBytes;
+} SpoolStats, *PSpoolStats;
+
+/**
+ * Not thread safe, a channel spools and replays from its scheduler thread
+ */
+typedef struct {
+    CHAR path[MAX_PATH_LEN + 1];
+    INT32 fd;
+    PBYTE pMapping;
+    UINT64 size;
+    UINT64 writeBudget;
+    // offsets into an endless file, the ring position is the offset modulo the size
+    UINT64 head;
+    UINT64 tail;
+    // everything before it is in the file
+    UINT64 flushedHead;
+    // the block at flushedHead, written out once full
+    PBYTE pBlock;
+    // token bucket of the write budget, in bytes, negative when a GOP overdrew it
+    INT64 budgetTokens;
+    // pacerGetTime() of the last refill
+    UINT64 budgetTime;
+    SpoolStats stats;
+} Spool, *PSpool;
+
+/**
+ * Creates or reuses the file at the path and preallocates it. Whatever an earlier run left in it is discarded.
+ */
+STATUS createSpool(PCHAR, UINT64, UINT64, PSpool*);
+STATUS freeSpool(PSpool*);
+
+/**
+ * Called at the key frame of every GOP which would be dropped. Returns whether the GOP is spooled, the write budget
+ * and the room for a first block decide. A GOP once started is spooled to its end even over the budget.
+ */
+BOOL spoolBeginGop(PSpool, UINT64);
+
+/**
+ * Appends the frame. Returns STATUS_SPOOL_FULL when it does not fit, the rest of the GOP is then dropped.
+ */
+STATUS spoolWriteFrame(PSpool, PFrame);
+
+BOOL spoolIsEmpty(PSpool);
+
+/**
+ * Points the frame at the oldest record, in the mapping or still in the staged block. The data is valid up to the next
+ * write, peek again before using it after one. Only a record running from the file into the staged block has the
+ * block written out first. Sets frameData, size, flags, trackId, the timestamps and duration. Returns
+ * STATUS_SPOOL_EMPTY when there is nothing.
+ */
+STATUS spoolPeekFrame(PSpool, PFrame);
+
+/**
+ * Drops the oldest record once it was put
+ */
+VOID spoolRelease(PSpool);
+
+VOID spoolPrintStats(PSpool, PCHAR);
+
+#endif /* __KVS_SPOOL_H__ */
@@ -0,0 +1,459 @@
+/*
+ * Copyright (C) 2020 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <ctype.h>
+
+#include "AsyncLog.h"
+#include "StartupCache.h"
+
+#define STARTUP_CACHE_COMMENT               '#'
+
+// the SDK result events, linked with --wrap so the answers of the service can be seen on their way in. Without the
+// wrapping kvs refuses --startup-cache, the cache is never created and the wrappers are left unused.
+#ifdef KVS_NO_STARTUP_CACHE
+#define __real_describeStreamResultEvent    describeStreamResultEvent
+#define __real_getStreamingEndpointResultEvent getStreamingEndpointResultEvent
+#else
+STATUS __real_describeStreamResultEvent(UINT64, SERVICE_CALL_RESULT, PStreamDescription);
+STATUS __real_getStreamingEndpointResultEvent(UINT64, SERVICE_CALL_RESULT, PCHAR);
+#endif
+STATUS __wrap_describeStreamResultEvent(UINT64, SERVICE_CALL_RESULT, PStreamDescription);
+STATUS __wrap_getStreamingEndpointResultEvent(UINT64, SERVICE_CALL_RESULT, PCHAR);
+
+// the client callbacks carry no custom data of ours
+static PStartupCache gpStartupCache = NULL;
+
+STATIC PCHAR startupCacheNextToken(PCHAR* ppCur)
+{
+    PCHAR pStart = *ppCur, pEnd;
+
+    while (*pStart != '\0' && isspace((BYTE) *pStart)) {
+        pStart++;
+    }
+
+    if (*pStart == '\0') {
+        *ppCur = pStart;
+        return NULL;
+    }
+
+    for (pEnd = pStart; *pEnd != '\0' && !isspace((BYTE) *pEnd); pEnd++);
+    if (*pEnd != '\0') {
+        *pEnd++ = '\0';
+    }
+
+    *ppCur = pEnd;
+
+    return pStart;
+}
+
+STATIC PStartupCacheEntry startupCacheFindEntry(PStartupCache pCache, PCHAR streamName, BOOL create)
+{
+    PStartupCacheEntry pEntry;
+    UINT32 i;
+
+    for (i = 0; i < pCache->entryCount; i++) {
+        if (STRCMP(pCache->entries[i].streamName, streamName) == 0) {
+            return &pCache->entries[i];
+        }
+    }
+
+    if (!create || pCache->entryCount == STARTUP_CACHE_MAX_ENTRIES || STRLEN(streamName) > MAX_STREAM_NAME_LEN) {
+        return NULL;
+    }
+
+    pEntry = &pCache->entries[pCache->entryCount++];
+    MEMSET(pEntry, 0x00, SIZEOF(StartupCacheEntry));
+    STRCPY(pEntry->streamName, streamName);
+
+    return pEntry;
+}
+
+/**
+ * Entry the SDK can be answered from, NULL when the service has to be asked
+ */
+STATIC PStartupCacheEntry startupCacheServableEntry(PStartupCache pCache, PCHAR streamName)
+{
+    PStartupCacheEntry pEntry = startupCacheFindEntry(pCache, streamName, FALSE);
+
+    if (pEntry == NULL || !pEntry->valid || pEntry->bypassed || pEntry->expiration <= GETTIME() || pEntry->streamArn[0] == '\0' ||
+        pEntry->endpoint[0] == '\0') {
+        return NULL;
+    }
+
+    return pEntry;
+}
+
+STATIC STATUS startupCacheLoad(PStartupCache pCache)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    FILE* pFile = NULL;
+    CHAR line[STARTUP_CACHE_LINE_LEN];
+    PCHAR pCur, pName, pExpiration, pArn, pEndpoint;
+    PStartupCacheEntry pEntry;
+    UINT64 expiration, now = GETTIME();
+    UINT32 lineNumber = 0;
+
+    // no file yet is a cold start, not an error
+    CHK(NULL != (pFile = FOPEN(pCache->path, "r")), retStatus);
+
+    while (fgets(line, SIZEOF(line), pFile) != NULL) {
+        lineNumber++;
+        pCur = line;
+        pName = startupCacheNextToken(&pCur);
+        if (pName == NULL || *pName == STARTUP_CACHE_COMMENT) {
+            continue;
+        }
+
+        pExpiration = startupCacheNextToken(&pCur);
+        pArn = startupCacheNextToken(&pCur);
+        pEndpoint = startupCacheNextToken(&pCur);
+        if (pEndpoint == NULL || startupCacheNextToken(&pCur) != NULL || STATUS_FAILED(STRTOUI64(pExpiration, NULL, 10, &expiration)) ||
+            STRLEN(pArn) > MAX_ARN_LEN || STRLEN(pEndpoint) > STARTUP_CACHE_MAX_ENDPOINT_LEN) {
+            DLOGW("%s:%u: skipping malformed startup cache entry", pCache->path, lineNumber);
+            continue;
+        }
+
+        expiration *= HUNDREDS_OF_NANOS_IN_A_SECOND;
+        if (expiration <= now || NULL == (pEntry = startupCacheFindEntry(pCache, pName, TRUE))) {
+            continue;
+        }
+
+        STRCPY(pEntry->streamArn, pArn);
+        STRCPY(pEntry->endpoint, pEndpoint);
+        pEntry->expiration = expiration;
+        pEntry->valid = TRUE;
+    }
+
+CleanUp:
+
+    if (pFile != NULL) {
+        FCLOSE(pFile);
+    }
+
+    return retStatus;
+}
+
+/**
+ * Rewrites the whole file through a temporary one, a crash never leaves half an entry behind. Called with the lock held.
+ */
+STATIC STATUS startupCacheSave(PStartupCache pCache)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    CHAR tempPath[MAX_PATH_LEN + 8];
+    FILE* pFile = NULL;
+    PStartupCacheEntry pEntry;
+    UINT32 i;
+
+    SNPRINTF(tempPath, SIZEOF(tempPath), "%s.tmp", pCache->path);
+    CHK(NULL != (pFile = FOPEN(tempPath, "w")), STATUS_OPEN_FILE_FAILED);
+
+    fprintf(pFile, "%c <stream-name> <expiration-epoch-seconds> <stream-arn> <data-endpoint>\n", STARTUP_CACHE_COMMENT);
+    for (i = 0; i < pCache->entryCount; i++) {
+        pEntry = &pCache->entries[i];
+        if (pEntry->valid) {
+            fprintf(pFile, "%s %" PRIu64 " %s %s\n", pEntry->streamName, (UINT64) (pEntry->expiration / HUNDREDS_OF_NANOS_IN_A_SECOND),
+                    pEntry->streamArn, pEntry->endpoint);
+        }
+    }
+
+    CHK(fflush(pFile) == 0, STATUS_WRITE_TO_FILE_FAILED);
+    FCLOSE(pFile);
+    pFile = NULL;
+    CHK(rename(tempPath, pCache->path) == 0, STATUS_WRITE_TO_FILE_FAILED);
+    pCache->stats.saves++;
+
+CleanUp:
+
+    if (pFile != NULL) {
+        FCLOSE(pFile);
+    }
+
+    if (STATUS_FAILED(retStatus)) {
+        DLOGW("Failed to save the startup cache to %s with 0x%08x", pCache->path, retStatus);
+    }
+
+    return retStatus;
+}
+
+STATIC STATUS startupCacheDescribeStream(UINT64 customData, PCHAR streamName, PServiceCallContext pServiceCallContext)
+{
+    PStartupCache pCache = gpStartupCache;
+    PStartupCacheEntry pEntry;
+    StreamDescription description;
+
+    MUTEX_LOCK(pCache->lock);
+    pEntry = startupCacheServableEntry(pCache, streamName);
+    if (pEntry == NULL) {
+        pCache->stats.misses++;
+        MUTEX_UNLOCK(pCache->lock);
+        return pCache->describeStreamFn(customData, streamName, pServiceCallContext);
+    }
+
+    pCache->stats.hits++;
+    pEntry->served = TRUE;
+    pEntry->confirmed = FALSE;
+    MEMSET(&description, 0x00, SIZEOF(StreamDescription));
+    description.version = STREAM_DESCRIPTION_CURRENT_VERSION;
+    STRCPY(description.streamName, pEntry->streamName);
+    STRCPY(description.streamArn, pEntry->streamArn);
+    description.streamStatus = STREAM_STATUS_ACTIVE;
+    MUTEX_UNLOCK(pCache->lock);
+
+    ALOGI("Describing stream %s from the startup cache", streamName);
+
+    // answered in place, the same way the SDK serves its own API call cache
+    return __real_describeStreamResultEvent(pServiceCallContext->customData, SERVICE_CALL_RESULT_OK, &description);
+}
+
+STATIC STATUS startupCacheGetStreamingEndpoint(UINT64 customData, PCHAR streamName, PCHAR apiName, PServiceCallContext pServiceCallContext)
+{
+    PStartupCache pCache = gpStartupCache;
+    PStartupCacheEntry pEntry;
+    PStartupCacheCall pCall = NULL;
+    CHAR endpoint[STARTUP_CACHE_MAX_ENDPOINT_LEN + 1];
+    UINT32 i;
+
+    MUTEX_LOCK(pCache->lock);
+    pEntry = startupCacheServableEntry(pCache, streamName);
+    if (pEntry == NULL) {
+        // remember whose lookup it is, the result only carries the custom data of the call
+        for (i = 0; i < pCache->callCount && pCache->calls[i].callCustomData != pServiceCallContext->customData; i++);
+        if (i < STARTUP_CACHE_MAX_ENTRIES && STRLEN(streamName) <= MAX_STREAM_NAME_LEN) {
+            pCall = &pCache->calls[i];
+            pCall->callCustomData = pServiceCallContext->customData;
+            STRCPY(pCall->streamName, streamName);
+            pCache->callCount = MAX(pCache->callCount, i + 1);
+        }
+
+        MUTEX_UNLOCK(pCache->lock);
+        return pCache->getStreamingEndpointFn(customData, streamName, apiName, pServiceCallContext);
+    }
+
+    pEntry->served = TRUE;
+    STRCPY(endpoint, pEntry->endpoint);
+    MUTEX_UNLOCK(pCache->lock);
+
+    return __real_getStreamingEndpointResultEvent(pServiceCallContext->customData, SERVICE_CALL_RESULT_OK, endpoint);
+}
+
+STATUS __wrap_describeStreamResultEvent(UINT64 customData, SERVICE_CALL_RESULT callResult, PStreamDescription pStreamDescription)
+{
+    PStartupCache pCache = gpStartupCache;
+    PStartupCacheEntry pEntry;
+
+    if (pCache != NULL && callResult == SERVICE_CALL_RESULT_OK && pStreamDescription != NULL &&
+        pStreamDescription->streamStatus == STREAM_STATUS_ACTIVE) {
+        MUTEX_LOCK(pCache->lock);
+        pEntry = startupCacheFindEntry(pCache, pStreamDescription->streamName, TRUE);
+        if (pEntry != NULL) {
+            STRCPY(pEntry->streamArn, pStreamDescription->streamArn);
+            pEntry->updated = TRUE;
+            pEntry->confirmed = FALSE;
+        }
+        MUTEX_UNLOCK(pCache->lock);
+    }
+
+    return __real_describeStreamResultEvent(customData, callResult, pStreamDescription);
+}
+
+STATUS __wrap_getStreamingEndpointResultEvent(UINT64 customData, SERVICE_CALL_RESULT callResult, PCHAR pEndpoint)
+{
+    PStartupCache pCache = gpStartupCache;
+    PStartupCacheEntry pEntry;
+    UINT32 i;
+
+    if (pCache != NULL && callResult == SERVICE_CALL_RESULT_OK && pEndpoint != NULL && STRLEN(pEndpoint) <= STARTUP_CACHE_MAX_ENDPOINT_LEN) {
+        MUTEX_LOCK(pCache->lock);
+        for (i = 0; i < pCache->callCount; i++) {
+            if (pCache->calls[i].callCustomData == customData) {
+                pEntry = startupCacheFindEntry(pCache, pCache->calls[i].streamName, TRUE);
+                if (pEntry != NULL) {
+                    STRCPY(pEntry->endpoint, pEndpoint);
+                    pEntry->updated = TRUE;
+                    pEntry->confirmed = FALSE;
+                }
+                break;
+            }
+        }
+        MUTEX_UNLOCK(pCache->lock);
+    }
+
+    return __real_getStreamingEndpointResultEvent(customData, callResult, pEndpoint);
+}
+
+STATUS createStartupCache(PCHAR path, UINT64 ttl, PStartupCache* ppCache)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    PStartupCache pCache = NULL;
+
+    CHK(path != NULL && ppCache != NULL, STATUS_NULL_ARG);
+    CHK(path[0] != '\0' && STRLEN(path) <= MAX_PATH_LEN && ttl != 0, STATUS_INVALID_ARG);
+
+    CHK(NULL != (pCache = (PStartupCache) MEMCALLOC(1, SIZEOF(StartupCache))), STATUS_NOT_ENOUGH_MEMORY);
+    STRCPY(pCache->path, path);
+    pCache->ttl = ttl;
+    pCache->lock = MUTEX_CREATE(FALSE);
+    CHK(IS_VALID_MUTEX_VALUE(pCache->lock), STATUS_INVALID_OPERATION);
+
+    CHK_STATUS(startupCacheLoad(pCache));
+
+CleanUp:
+
+    if (STATUS_FAILED(retStatus)) {
+        freeStartupCache(&pCache);
+    }
+
+    if (ppCache != NULL) {
+        *ppCache = pCache;
+    }
+
+    return retStatus;
+}
+
+STATUS freeStartupCache(PStartupCache* ppCache)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    PStartupCache pCache;
+
+    CHK(ppCache != NULL, STATUS_NULL_ARG);
+    pCache = *ppCache;
+    CHK(pCache != NULL, retStatus);
+
+    if (gpStartupCache == pCache) {
+        gpStartupCache = NULL;
+    }
+
+    if (IS_VALID_MUTEX_VALUE(pCache->lock)) {
+        MUTEX_FREE(pCache->lock);
+    }
+
+    MEMFREE(pCache);
+    *ppCache = NULL;
+
+CleanUp:
+
+    return retStatus;
+}
+
+STATUS startupCacheInstall(PStartupCache pCache, PClientCallbacks pClientCallbacks)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+
+    CHK(pCache != NULL && pClientCallbacks != NULL, STATUS_NULL_ARG);
+    CHK(gpStartupCache == NULL && pClientCallbacks->describeStreamFn != NULL && pClientCallbacks->getStreamingEndpointFn != NULL,
+        STATUS_INVALID_OPERATION);
+
+    pCache->describeStreamFn = pClientCallbacks->describeStreamFn;
+    pCache->getStreamingEndpointFn = pClientCallbacks->getStreamingEndpointFn;
+    pClientCallbacks->describeStreamFn = startupCacheDescribeStream;
+    pClientCallbacks->getStreamingEndpointFn = startupCacheGetStreamingEndpoint;
+    gpStartupCache = pCache;
+
+CleanUp:
+
+    return retStatus;
+}
+
+BOOL startupCacheServed(PStartupCache pCache, PCHAR streamName)
+{
+    PStartupCacheEntry pEntry;
+    BOOL served = FALSE;
+
+    if (pCache != NULL) {
+        MUTEX_LOCK(pCache->lock);
+        pEntry = startupCacheFindEntry(pCache, streamName, FALSE);
+        served = pEntry != NULL && pEntry->served;
+        MUTEX_UNLOCK(pCache->lock);
+    }
+
+    return served;
+}
+
+STATUS startupCacheConfirm(PStartupCache pCache, PCHAR streamName)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    PStartupCacheEntry pEntry;
+    BOOL locked = FALSE;
+
+    CHK(pCache != NULL && streamName != NULL, STATUS_NULL_ARG);
+
+    MUTEX_LOCK(pCache->lock);
+    locked = TRUE;
+
+    pEntry = startupCacheFindEntry(pCache, streamName, FALSE);
+    CHK(pEntry != NULL && !pEntry->confirmed, retStatus);
+    pEntry->confirmed = TRUE;
+
+    // a served entry keeps its expiration, the service is asked again once per ttl
+    CHK(pEntry->updated && pEntry->streamArn[0] != '\0' && pEntry->endpoint[0] != '\0', retStatus);
+    pEntry->updated = FALSE;
+    pEntry->valid = TRUE;
+    pEntry->bypassed = FALSE;
+    pEntry->expiration = GETTIME() + pCache->ttl;
+    CHK_STATUS(startupCacheSave(pCache));
+
+CleanUp:
+
+    if (locked) {
+        MUTEX_UNLOCK(pCache->lock);
+    }
+
+    return retStatus;
+}
+
+STATUS startupCacheInvalidate(PStartupCache pCache, PCHAR streamName)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    PStartupCacheEntry pEntry;
+    BOOL locked = FALSE;
+
+    CHK(pCache != NULL && streamName != NULL, STATUS_NULL_ARG);
+
+    MUTEX_LOCK(pCache->lock);
+    locked = TRUE;
+
+    pEntry = startupCacheFindEntry(pCache, streamName, FALSE);
+    CHK(pEntry != NULL && pEntry->served && !pEntry->bypassed, retStatus);
+    pEntry->bypassed = TRUE;
+    pCache->stats.invalidations++;
+    DLOGW("Stream %s failed with the cached description, asking the service from now on", streamName);
+
+    // what worked once in this run stays for the next one
+    CHK(!pEntry->confirmed, retStatus);
+    pEntry->valid = FALSE;
+    CHK_STATUS(startupCacheSave(pCache));
+
+CleanUp:
+
+    if (locked) {
+        MUTEX_UNLOCK(pCache->lock);
+    }
+
+    return retStatus;
+}
+
+VOID startupCacheGetStats(PStartupCache pCache, PStartupCacheStats pStats)
+{
+    MUTEX_LOCK(pCache->lock);
+    *pStats = pCache->stats;
+    MUTEX_UNLOCK(pCache->lock);
+}
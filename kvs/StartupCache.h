@@ -0,0 +1,119 @@
+/*
+ * Copyright (C) 2020 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __KVS_STARTUP_CACHE_H__
+#define __KVS_STARTUP_CACHE_H__
+
+#include "KvsApp.h"
+
+#define STARTUP_CACHE_MAX_ENTRIES           64
+#define STARTUP_CACHE_MAX_ENDPOINT_LEN      256
+#define STARTUP_CACHE_LINE_LEN              (MAX_STREAM_NAME_LEN + MAX_ARN_LEN + STARTUP_CACHE_MAX_ENDPOINT_LEN + 64)
+#define DEFAULT_STARTUP_CACHE_TTL           (1 * HUNDREDS_OF_NANOS_IN_AN_HOUR)
+
+/**
+ * What the control plane said about one stream the last time it was asked
+ */
+typedef struct {
+    CHAR streamName[MAX_STREAM_NAME_LEN + 1];
+    CHAR streamArn[MAX_ARN_LEN + 1];
+    CHAR endpoint[STARTUP_CACHE_MAX_ENDPOINT_LEN + 1];
+    // wall clock time in 100ns the entry is no longer served after, see GETTIME
+    UINT64 expiration;
+    // loaded from the file or confirmed by an ack, handed to the SDK instead of asking the service
+    BOOL valid;
+    // this run streams with the description and endpoint of the entry
+    BOOL served;
+    // an error came in while serving it, the rest of the run asks the service
+    BOOL bypassed;
+    // the service answered with a description or an endpoint, saved once an ack confirms it
+    BOOL updated;
+    // an ack arrived since the entry was served or updated
+    BOOL confirmed;
+} StartupCacheEntry, *PStartupCacheEntry;
+
+/**
+ * Service call context of an endpoint lookup, the result carries no stream name
+ */
+typedef struct {
+    UINT64 callCustomData;
+    CHAR streamName[MAX_STREAM_NAME_LEN + 1];
+} StartupCacheCall, *PStartupCacheCall;
+
+typedef struct {
+    UINT64 hits;
+    UINT64 misses;
+    UINT64 invalidations;
+    UINT64 saves;
+} StartupCacheStats, *PStartupCacheStats;
+
+/**
+ * Stream descriptions and data endpoints kept in a file across restarts.
+ *
+ * Installed in front of the describe stream and get streaming endpoint callbacks of the client, so a restart goes
+ * straight to the token and PutMedia with what the previous run learned instead of two control plane round trips per
+ * stream. The first PutMedia session validates the entry: its first ack confirms it, an error before that drops it and
+ * the SDK recovers through the real calls. Answers of the service are saved once an ack confirmed them.
+ */
+typedef struct {
+    CHAR path[MAX_PATH_LEN + 1];
+    UINT64 ttl;
+    MUTEX lock;
+    StartupCacheEntry entries[STARTUP_CACHE_MAX_ENTRIES];
+    UINT32 entryCount;
+    StartupCacheCall calls[STARTUP_CACHE_MAX_ENTRIES];
+    UINT32 callCount;
+    StartupCacheStats stats;
+    // the callbacks of the provider, called on a miss
+    DescribeStreamFunc describeStreamFn;
+    GetStreamingEndpointFunc getStreamingEndpointFn;
+} StartupCache, *PStartupCache;
+
+/**
+ * Loads the file at the path if there is one. Expired and malformed entries are skipped.
+ */
+STATUS createStartupCache(PCHAR, UINT64, PStartupCache*);
+STATUS freeStartupCache(PStartupCache*);
+
+/**
+ * Puts the cache in front of the client callbacks before the client is created. One cache per process.
+ */
+STATUS startupCacheInstall(PStartupCache, PClientCallbacks);
+
+/**
+ * Whether the stream was described from the cache in this run
+ */
+BOOL startupCacheServed(PStartupCache, PCHAR);
+
+/**
+ * Called on every ack of the stream. Saves the file when the service answered with something new.
+ */
+STATUS startupCacheConfirm(PStartupCache, PCHAR);
+
+/**
+ * Called on every stream error. Stops serving the entry and drops it from the file unless an ack confirmed it.
+ */
+STATUS startupCacheInvalidate(PStartupCache, PCHAR);
+
+VOID startupCacheGetStats(PStartupCache, PStartupCacheStats);
+
+#endif /* __KVS_STARTUP_CACHE_H__ */
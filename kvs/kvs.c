@@ -22,246 +22,1469 @@
 
 #include <unistd.h>
 #include <getopt.h>
-#include <com/amazonaws/kinesis/video/cproducer/Include.h>
+
+#include "FrameArchive.h"
+#include "AnnexB.h"
+#include "FramePool.h"
+#include "Scheduler.h"
+#include "Channel.h"
+#include "Admission.h"
+#include "Metrics.h"
+#include "Sizing.h"
+#include "AsyncLog.h"
+#include "StartupCache.h"
+#include "Spool.h"
+#include "CaptureClock.h"
+#include "FragmentController.h"
+#include "BandwidthEstimator.h"
+#include "EncoderControl.h"
+#include "Recovery.h"
+#include "SegmentWatcher.h"
+#include "Placement.h"
+#include "MemoryArena.h"
 
 #define DEFAULT_RETENTION_PERIOD            2 * HUNDREDS_OF_NANOS_IN_AN_HOUR
 #define DEFAULT_BUFFER_DURATION             120 * HUNDREDS_OF_NANOS_IN_A_SECOND
-#define DEFAULT_KEY_FRAME_INTERVAL          45
-#define DEFAULT_FPS_VALUE                   25
 #define DEFAULT_STREAM_DURATION             20 * HUNDREDS_OF_NANOS_IN_A_SECOND
 #define DEFAULT_STORAGE_SIZE                2 * 1024 * 1024
 #define DEFAULT_MEDIA_DIRECTORY             "../" 
 #define DEFAULT_CHANNEL_NAME                "your-kvs-name" 
-#define SAMPLE_AUDIO_FRAME_DURATION         (20 * HUNDREDS_OF_NANOS_IN_A_MILLISECOND)
-#define SAMPLE_VIDEO_FRAME_DURATION         (HUNDREDS_OF_NANOS_IN_A_SECOND / DEFAULT_FPS_VALUE)
 #define AUDIO_TRACK_SAMPLING_RATE           48000
 #define AUDIO_TRACK_CHANNEL_CONFIG          2
-#define MAX_KVS_HEAP_SIZE                   256 * 1024
 
-#define NUMBER_OF_H264_FRAME_FILES          90
-#define NUMBER_OF_AAC_FRAME_FILES           299
+#define DEFAULT_LOG_LEVEL                   LOG_LEVEL_INFO
+#define FILE_LOGGING_BUFFER_SIZE            (100 * 1024)
+#define MAX_NUMBER_OF_LOG_FILES             5
+
+#define DEFAULT_SPOOL_REPLAY_SPEED          4
+// spooled timestamps further apart belong to different outages, each one is replayed from its own start
+#define SPOOL_REPLAY_MAX_GAP                (5 * HUNDREDS_OF_NANOS_IN_A_SECOND)
+// archive payloads read ahead of the frame being put with --backfill
+#define BACKFILL_READ_AHEAD                 (4 * 1024 * 1024)
+
+// kvssim links kvs in under another name and runs it against a model of the SDK on a virtual clock
+#ifndef KVS_MAIN
+#define KVS_MAIN                            main
+#endif
+
+typedef struct __SampleChannel SampleChannel, *PSampleChannel;
+
+/**
+ * Where a scheduler track gets its frames from
+ */
+typedef struct {
+    PSampleChannel pChannel;
+    FrameArchiveCursor cursor;
+    // live access unit acquired from the reader, released once put
+    PAnnexBAccessUnit pUnit;
+    BOOL started;
+    // timestamps of the track in --timestamps capture mode
+    CaptureTrackClock clock;
+} TrackSource, *PTrackSource;
+
+/**
+ * One stream of the shared client
+ */
+struct __SampleChannel {
+    PChannelConfig pConfig;
+    ChannelMetrics metrics;
+    // process start, the startup milestones are measured from it
+    UINT64 startTime;
+    // wall time of presentationTs 0 of the tracks
+    UINT64 streamStartTime;
+    PCaptureClock pCaptureClock;
+    // frames are put at the wall time they were captured instead of relative to the stream start
+    BOOL captureTimestamps;
+    // --backfill puts the archive once as fast as it is taken, streamStartTime is then when it was recorded
+    BOOL backfill;
+    // archive time put so far with --backfill, in ms so a 32 bit SIZE_T holds weeks of it
+    volatile SIZE_T backfillMediaTime;
+    STREAM_HANDLE streamHandle;
+    // set by the SDK once the stream can take frames, the tracks stay pending until then
+    volatile ATOMIC_BOOL streamReady;
+    CLIENT_HANDLE clientHandle;
+    PStreamInfo pStreamInfo;
+    PFrameArchive pFrameArchive;
+    PAnnexBReader pAnnexBReader;
+    AdmissionController admission;
+    SchedulerTrack videoTrack;
+    SchedulerTrack audioTrack;
+    TrackSource videoSource;
+    TrackSource audioSource;
+    BYTE audioCpd[KVS_AAC_CPD_SIZE_BYTE];
+    // avcC of a live input, built from the last IDR frame carrying other SPS and PPS than the one before
+    BYTE videoCpd[ANNEXB_MAX_AVCC_CPD_SIZE];
+    UINT32 videoCpdSize;
+    // NULL without --spool, only touched from the scheduler thread of the channel
+    PSpool pSpool;
+    // the live stream keeps the outage as a gap, the spooled frames go to this one next to it
+    CHAR spoolStreamName[MAX_STREAM_NAME_LEN + 1];
+    STREAM_HANDLE spoolStreamHandle;
+    PStreamInfo pSpoolStreamInfo;
+    volatile ATOMIC_BOOL spoolStreamReady;
+    SchedulerTrack spoolTrack;
+    // the GOP being dropped is written to the spool
+    BOOL spooling;
+    // the spool track is pending, an admitted frame wakes it up
+    BOOL spoolWaiting;
+    // the oldest spooled frame with the timestamps it is put with
+    Frame spoolFrame;
+    // the spool stream of a live input got the avcC
+    BOOL spoolCpdSet;
+    UINT64 replaySpeed;
+    BOOL replaying;
+    // pacing time the replay of the current outage started at and the first and last timestamps replayed since
+    UINT64 replayBase;
+    UINT64 replayFirstTs;
+    UINT64 replayLastTs;
+    // picks the fragment duration from the acks with --fragment-duration
+    BOOL fragmentControl;
+    FragmentController fragmentController;
+    // NULL unless the encoder of the live input takes requests
+    PEncoderControl pEncoderControl;
+    // picks the bitrate asked of the encoder with --bitrate-range
+    BOOL bitrateControl;
+    BandwidthEstimator bandwidthEstimator;
+    // a key frame was asked for since the channel started dropping, owned by the put thread
+    BOOL keyFrameRequested;
+    // NULL unless the live input is a directory of segments, owned by the reader
+    PSegmentWatcher pSegmentWatcher;
+    // not added with '--recovery off', the live stream only
+    RecoveryStream recovery;
+};
+
+/**
+ * Handed to the SDK callbacks
+ */
+typedef struct {
+    PSampleChannel pChannels;
+    UINT32 channelCount;
+    CLIENT_HANDLE clientHandle;
+    // live input buffers of all channels, NULL without live inputs
+    PFramePool pFramePool;
+    // NULL without --startup-cache
+    PStartupCache pStartupCache;
+    // streams which got ready inside createKinesisVideoStream, before their handle was known
+    MUTEX startupLock;
+    STREAM_HANDLE earlyReadyHandles[2 * MAX_CHANNEL_COUNT];
+    UINT32 earlyReadyCount;
+    // NULL with '--recovery off', the SDK recovers the streams itself then
+    PRecovery pRecovery;
+    // what the metrics server exports, the schedulers are counted up once each is created
+    MetricsSources metricsSources;
+} SampleCustomData, *PSampleCustomData;
+
+static struct option long_options[] = {
+    /*   NAME           ARGUMENT            FLAG    SHORTNAME */
+    {"channel-name",    required_argument,  NULL,   'n'},
+    {"channel-list",    required_argument,  NULL,   'c'},
+    {"workers",         required_argument,  NULL,   'w'},
+    {"metrics",         required_argument,  NULL,   'M'},
+    {"endpoint",        required_argument,  NULL,   'e'},
+    {"directory",       required_argument,  NULL,   'd'},
+    {"duration",        required_argument,  NULL,   'D'},
+    {"size",            required_argument,  NULL,   's'},
+    {"auto-size",       required_argument,  NULL,   'A'},
+    {"ram-ceiling",     required_argument,  NULL,   'r'},
+    {"warm-up",         required_argument,  NULL,   'W'},
+    {"archive",         required_argument,  NULL,   'a'},
+    {"video-input",     required_argument,  NULL,   'i'},
+    {"max-frame-size",  required_argument,  NULL,   'm'},
+    {"frame-pool",      required_argument,  NULL,   'P'},
+    {"late-policy",     required_argument,  NULL,   'l'},
+    {"late-threshold",  required_argument,  NULL,   't'},
+    {"log-mode",        required_argument,  NULL,   'L'},
+    {"log-level",       required_argument,  NULL,   'v'},
+    {"startup-cache",   required_argument,  NULL,   'S'},
+    {"startup-cache-ttl", required_argument, NULL,  'T'},
+    {"spool",           required_argument,  NULL,   'o'},
+    {"spool-size",      required_argument,  NULL,   'O'},
+    {"spool-write-budget", required_argument, NULL, 'B'},
+    {"spool-replay-speed", required_argument, NULL, 'R'},
+    {"spool-stream",    required_argument,  NULL,   'Q'},
+    {"timestamps",      required_argument,  NULL,   'C'},
+    {"coalesce",        required_argument,  NULL,   'k'},
+    {"fragment-duration", required_argument, NULL,  'F'},
+    {"fragment-overhead", required_argument, NULL,  'G'},
+    {"encoder-control", required_argument,  NULL,   'E'},
+    {"backfill",        required_argument,  NULL,   'b'},
+    {"segment-done",    required_argument,  NULL,   'g'},
+    {"frame-rate",      required_argument,  NULL,   'f'},
+    {"put-cpus",        required_argument,  NULL,   'p'},
+    {"put-policy",      required_argument,  NULL,   'y'},
+    {"network-cpus",    required_argument,  NULL,   'N'},
+    {"lock-memory",     no_argument,        NULL,   'K'},
+    {"memory-arena",    required_argument,  NULL,   'x'},
+    {"bitrate-range",   required_argument,  NULL,   'u'},
+    {"recovery",        required_argument,  NULL,   'j'},
+    {"help",            no_argument,        NULL,   'h'},
+    {NULL,              0,                  NULL,   0}
+};
+
+void displayUsage( int err )
+{
+    printf ("Ingest video to the Amazon Kinesis Video Streams service.\n");
+    printf ("Usage: \n");
+    printf ("AWS_ACCESS_KEY_ID=SAMPLEKEY AWS_SECRET_ACCESS_KEY=SAMPLESECRET\n");
+    printf ("kvs [options...]\n");
+    printf ("\n");
+    printf ("-n, --channel-name     stream channel name, repeat to stream several channels from one client\n");
+    printf ("                       -d, -a and -i apply to the last channel named\n");
+    printf ("                       default to 'your-kvs-name'\n");
+    printf ("-c, --channel-list     file with one '<channel-name> <directory|archive.kva|file.mp4|file.mkv|%s<directory>|live-input>' per line\n",
+            CHANNEL_SEGMENTS_PREFIX);
+    printf ("-w, --workers          threads putting the frames of all channels\n");
+    printf ("                       default to %d, at most one per channel\n", DEFAULT_CHANNEL_WORKER_COUNT);
+    printf ("-M, --metrics          serve Prometheus metrics over HTTP on 127.0.0.1:<port> or on a Unix socket path\n");
+    printf ("-e, --endpoint         control plane URL instead of the one of the region, e.g. a local mock endpoint\n");
+    printf ("-d, --directory        streaming media directory\n");
+    printf ("                       default to '../'\n");
+    printf ("-a, --archive          frame archive created by kvspack\n");
+    printf ("                       default to '<directory>/%s'\n", DEFAULT_FRAME_ARCHIVE_NAME);
+    printf ("-i, --video-input      live H.264 Annex-B elementary stream, a FIFO, a file, '-' for stdin or a directory\n");
+    printf ("                       a recorder writes rolling '%s' segments to, streams video only and ignores the archive\n",
+            SEGMENT_WATCHER_EXTENSION);
+    printf ("-m, --max-frame-size   largest live video frame in KB\n");
+    printf ("                       default to %d\n", DEFAULT_ANNEXB_MAX_FRAME_SIZE / 1024);
+    printf ("-P, --frame-pool       live frame buffer classes shared by all channels, '<KB>x<count>,...' ascending\n");
+    printf ("                       default to sizes from 1/32 of --max-frame-size up to it, by live input count\n");
+    printf ("-l, --late-policy      what to do with frames later than the late threshold\n");
+    printf ("                       'catch-up' puts them back to back, 'skip' drops them,\n");
+    printf ("                       'key-frame' drops up to the next key frame, default to 'catch-up'\n");
+    printf ("-t, --late-threshold   late threshold in milliseconds\n");
+    printf ("                       default to %d\n", (INT32) (DEFAULT_PACER_LATE_THRESHOLD / HUNDREDS_OF_NANOS_IN_A_MILLISECOND));
+    printf ("-D, --duration         streaming duration in second\n");
+    printf ("                       default to 600\n");
+    printf ("-s, --size             stream buffer size in KB per channel\n");
+    printf ("                       default to 2048, minimal to 1024\n");
+    printf ("-A, --auto-size        size the content store, buffer and replay duration to survive an outage of\n");
+    printf ("                       this many seconds at the measured bitrate, instead of --size\n");
+    printf ("-r, --ram-ceiling      largest content store plus SDK heap in KB when auto-sizing\n");
+    printf ("                       default to %d\n", DEFAULT_SIZING_RAM_CEILING / 1024);
+    printf ("-W, --warm-up          seconds of live input measured before auto-sizing\n");
+    printf ("                       default to %d\n", (INT32) (DEFAULT_SIZING_WARM_UP_DURATION / HUNDREDS_OF_NANOS_IN_A_SECOND));
+    printf ("-L, --log-mode         'async' formats and writes the log on a background thread, 'sync' on the logging thread\n");
+    printf ("                       default to 'async'\n");
+    printf ("-v, --log-level        'verbose', 'debug', 'info', 'warn', 'error', 'fatal' or 'silent'\n");
+    printf ("                       default to 'info'\n");
+    printf ("-S, --startup-cache    file keeping stream descriptions and data endpoints across restarts\n");
+    printf ("-T, --startup-cache-ttl\n");
+    printf ("                       seconds a cached stream description is used before asking the service again\n");
+    printf ("                       default to %d\n", (INT32) (DEFAULT_STARTUP_CACHE_TTL / HUNDREDS_OF_NANOS_IN_A_SECOND));
+    printf ("-o, --spool            directory of one ring file per channel keeping the GOPs dropped during an outage,\n");
+    printf ("                       replayed to the stream named by --spool-stream once the outage is over\n");
+    printf ("-O, --spool-size       spool file size in MB per channel\n");
+    printf ("                       default to %d\n", DEFAULT_SPOOL_SIZE / (1024 * 1024));
+    printf ("-B, --spool-write-budget\n");
+    printf ("                       KB per second written to a spool file at most\n");
+    printf ("                       default to %d\n", DEFAULT_SPOOL_WRITE_BUDGET / 1024);
+    printf ("-R, --spool-replay-speed\n");
+    printf ("                       how many times faster than real time spooled frames are replayed\n");
+    printf ("                       default to %d\n", DEFAULT_SPOOL_REPLAY_SPEED);
+    printf ("-Q, --spool-stream     suffix appended to the channel name for the stream the spool is replayed to,\n");
+    printf ("                       required by --spool. The live stream keeps the outage as a gap\n");
+    printf ("-C, --timestamps       'relative' counts from the stream start by the frame durations,\n");
+    printf ("                       'capture' puts frames at the wall time they were captured, default to 'relative'\n");
+    printf ("-k, --coalesce         'audio=<ms>,video=<ms>', frames of archive tracks due within this many milliseconds\n");
+    printf ("                       are put on an earlier wakeup, fewer wakeups for a little latency, default to 0\n");
+    printf ("-F, --fragment-duration\n");
+    printf ("                       fragment duration in milliseconds, or 'auto' to pick it from the acks between %d and %d ms\n",
+            (INT32) (DEFAULT_FRAGMENT_MIN_DURATION / HUNDREDS_OF_NANOS_IN_A_MILLISECOND),
+            (INT32) (DEFAULT_FRAGMENT_MAX_DURATION / HUNDREDS_OF_NANOS_IN_A_MILLISECOND));
+    printf ("                       asked of the encoders with --encoder-control, default to the key frames of the input\n");
+    printf ("-G, --fragment-overhead\n");
+    printf ("                       percent of a fragment the per fragment overhead may take with '--fragment-duration auto'\n");
+    printf ("                       default to %d\n", DEFAULT_FRAGMENT_OVERHEAD_PERCENT);
+    printf ("-E, --encoder-control  directory of one '<channel-name>%s' Unix datagram socket per live input\n", ENCODER_CONTROL_FILE_EXTENSION);
+    printf ("                       the encoder listens on for key frame interval, bitrate and key frame requests\n");
+    printf ("-u, --bitrate-range    '<min>-<max>' kbps the encoders of --encoder-control are asked for from the upload\n");
+    printf ("                       bandwidth estimated from the acks, default to leaving the bitrate to the encoder\n");
+    printf ("-b, --backfill         upload the archives once as fast as the network takes them instead of streaming them,\n");
+    printf ("                       timestamped from this Unix time in seconds the recording started at, ignores --duration\n");
+    printf ("-g, --segment-done     what happens to a segment of a --video-input directory once its fragments are persisted,\n");
+    printf ("                       'keep', 'delete' or 'mark' to rename it to '<segment>%s', default to 'keep'\n", SEGMENT_WATCHER_DONE_SUFFIX);
+    printf ("-f, --frame-rate       frames per second of the segments of a --video-input directory\n");
+    printf ("                       default to %d\n", DEFAULT_ANNEXB_SEGMENT_FRAME_RATE);
+    printf ("-p, --put-cpus         CPUs the put threads run on, the scheduler and the live input threads, e.g. '2-3'\n");
+    printf ("-y, --put-policy       '<fifo|rr>[:<priority>]' real-time policy of the put threads, priority default to %d\n",
+            DEFAULT_PLACEMENT_PRIORITY);
+    printf ("-N, --network-cpus     CPUs every other thread runs on, the upload threads of the SDK among them, e.g. '0-1'\n");
+    printf ("-K, --lock-memory      lock and prefault all the memory of the process so the put path never page faults,\n");
+    printf ("                       of the --memory-arena reservation only the slabs carved out of it\n");
+    printf ("-j, --recovery         '<base>-<max>' milliseconds of backoff before resetting a failed stream or its connection,\n");
+    printf ("                       doubled by attempt up to the max, or 'off' to leave recovery to the SDK\n");
+    printf ("                       default to '%d-%d'\n", (INT32) (DEFAULT_RECOVERY_BASE_BACKOFF / HUNDREDS_OF_NANOS_IN_A_MILLISECOND),
+            (INT32) (DEFAULT_RECOVERY_MAX_BACKOFF / HUNDREDS_OF_NANOS_IN_A_MILLISECOND));
+    printf ("-x, --memory-arena     MB reserved for the small allocations of kvs and the SDK, 0 for the system allocator\n");
+    printf ("                       default to %d\n", DEFAULT_MEMORY_ARENA_SIZE / 1024 / 1024);
+    printf ("\n");
+    printf ("Exit status:\n \
+    0  if OK,\n \
+    1  if minor problems (e.g., missing argument),\n \
+    others  if serious trouble, please check 'Include.h' files.\n");
+    exit (err);
+}
+
+/**
+ * Whether the channel puts an audio track, live inputs and containers without AAC carry none
+ */
+BOOL channelHasAudio(PSampleChannel pChannel)
+{
+    return pChannel->pFrameArchive != NULL && frameArchiveGetTrack(pChannel->pFrameArchive, DEFAULT_AUDIO_TRACK_ID) != NULL;
+}
+
+/**
+ * Returns whether the SDK took the frame
+ */
+BOOL putChannelFrame(PSampleChannel pChannel, PSchedulerTrack pTrack, PFrame pFrame)
+{
+    UINT64 startCpuTime = channelGetThreadCpuTime(), startTime = pacerGetTime();
+    STATUS status;
+
+    status = putKinesisVideoFrame(pChannel->streamHandle, pFrame);
+
+    if (STATUS_FAILED(status)) {
+        // never blocks the put thread, repeated failures are rate limited
+        ALOGE("putKinesisVideoFrame for %s %s failed with 0x%08x", pChannel->pConfig->name, pTrack->name, status);
+        channelMetricsRecordError(&pChannel->metrics, status);
+    } else {
+        channelMetricsRecordPut(&pChannel->metrics, pFrame->trackId == DEFAULT_AUDIO_TRACK_ID ? METRICS_TRACK_AUDIO : METRICS_TRACK_VIDEO,
+                                pFrame->size, pacerGetTime() - startTime, channelGetThreadCpuTime() - startCpuTime);
+        if (METRICS_ATOMIC_LOAD(&pChannel->metrics.startupTimes[METRICS_STARTUP_FIRST_PUT]) == 0) {
+            channelMetricsRecordStartup(&pChannel->metrics, METRICS_STARTUP_FIRST_PUT, startTime - pChannel->startTime);
+        }
+    }
+
+    pTrack->frame.index++;
+
+    return STATUS_SUCCEEDED(status);
+}
+
+VOID dropChannelFrame(PSampleChannel pChannel, ADMISSION_REASON reason)
+{
+    channelMetricsRecordDrop(&pChannel->metrics, reason == ADMISSION_REASON_STORAGE_PRESSURE ? METRICS_DROP_REASON_STORAGE_PRESSURE
+                                                                                             : METRICS_DROP_REASON_BUFFER_DURATION_PRESSURE);
+    recoveryReportFrameLost(&pChannel->recovery);
+}
+
+/**
+ * Writes a frame admission turned away to the spool instead, returns whether it was. Whole GOPs are spooled from their
+ * key frame on, audio only along with them.
+ */
+BOOL spoolChannelFrame(PSampleChannel pChannel, PFrame pFrame)
+{
+    Frame frame;
+
+    if (pChannel->pSpool == NULL) {
+        return FALSE;
+    }
+
+    if (pFrame->trackId == DEFAULT_VIDEO_TRACK_ID && (pFrame->flags & FRAME_FLAG_KEY_FRAME) != 0) {
+        pChannel->spooling = spoolBeginGop(pChannel->pSpool, pacerGetTime());
+    }
+
+    if (!pChannel->spooling) {
+        return FALSE;
+    }
+
+    // replayed to a stream of absolute timestamps, the live stream may count from its start
+    frame = *pFrame;
+    if (!pChannel->captureTimestamps) {
+        frame.presentationTs += pChannel->streamStartTime;
+        frame.decodingTs += pChannel->streamStartTime;
+    }
+    if (STATUS_FAILED(spoolWriteFrame(pChannel->pSpool, &frame))) {
+        // the spool is full, the rest of the GOP is dropped
+        if (pFrame->trackId == DEFAULT_VIDEO_TRACK_ID) {
+            pChannel->spooling = FALSE;
+        }
+
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/**
+ * The frame as it is put. In capture mode its timestamps are the capture time mapped onto wall time, slewed so the
+ * track neither drifts from the capture clock nor jumps. A backfilled recording keeps the time it was recorded at.
+ */
+VOID stampChannelFrame(PSampleChannel pChannel, PTrackSource pSource, UINT64 captureTime, PFrame pFrame)
+{
+    BOOL discontinuity;
+    UINT64 timestamp;
+
+    if (pChannel->backfill) {
+        pFrame->presentationTs += pChannel->streamStartTime;
+        pFrame->decodingTs += pChannel->streamStartTime;
+        return;
+    }
+
+    if (!pChannel->captureTimestamps) {
+        return;
+    }
+
+    // live frames carry no duration, the clock goes by their intervals
+    timestamp = captureTrackClockStamp(&pSource->clock, captureTime, pSource->pUnit != NULL ? 0 : pFrame->duration,
+                                       pFrame->trackId == DEFAULT_AUDIO_TRACK_ID || (pFrame->flags & FRAME_FLAG_KEY_FRAME) != 0,
+                                       &discontinuity);
+    if (discontinuity) {
+        ALOGW("Capture clock of %s track %" PRIu64 " jumped ahead, timestamps continue from the capture time", pChannel->pConfig->name,
+              pFrame->trackId);
+    }
+
+    pFrame->presentationTs = timestamp;
+    pFrame->decodingTs = timestamp;
+}
+
+/**
+ * Live video goes through again, replay what the outage left in the spool
+ */
+VOID resumeChannelSpool(PSampleChannel pChannel)
+{
+    pChannel->spooling = FALSE;
+    if (pChannel->spoolWaiting && !spoolIsEmpty(pChannel->pSpool)) {
+        pChannel->spoolWaiting = FALSE;
+        schedulerNotifyTrack(&pChannel->spoolTrack);
+    }
+}
+
+STATUS getArchiveFrame(PSchedulerTrack pTrack, PFrame pFrame)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    PTrackSource pSource = (PTrackSource) pTrack->customData;
+
+    // a backfilled recording is put once, otherwise the archive loops
+    CHK(!pSource->pChannel->backfill || pSource->cursor.laps == 0, STATUS_SCHEDULER_TRACK_FINISHED);
+
+    // the archive is mapped already, its frames catch up once the stream is ready
+    CHK(ATOMIC_LOAD_BOOL(&pSource->pChannel->streamReady), STATUS_SCHEDULER_FRAME_PENDING);
+
+    // frame data points straight into the archive mapping.
+    // video track is used to mark new fragment. A new fragment is generated for every frame with FRAME_FLAG_KEY_FRAME
+    CHK_STATUS(frameArchiveCursorGetFrame(&pSource->cursor, pFrame));
+    if (pFrame->trackId == DEFAULT_AUDIO_TRACK_ID) {
+        pFrame->flags = FRAME_FLAG_NONE; // audio track is not used to cut fragment
+    }
+
+CleanUp:
+
+    return retStatus;
+}
+
+STATUS putArchiveFrame(PSchedulerTrack pTrack, PFrame pFrame, BOOL drop)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    PTrackSource pSource = (PTrackSource) pTrack->customData;
+    PSampleChannel pChannel = pSource->pChannel;
+    UINT64 now = pacerGetTime();
+    Frame frame;
+    BOOL admit;
+
+    // the track keeps pacing by the archive durations, the stream gets the frame captured now
+    frame = *pFrame;
+    stampChannelFrame(pChannel, pSource, now, &frame);
+
+    if (pChannel->backfill) {
+        // nothing is dropped, the offline stream blocks the put until the content store has room. The kernel reads
+        // the frames ahead meanwhile.
+        frameArchivePrefetch(pChannel->pFrameArchive, (UINT64) (pFrame->frameData - pChannel->pFrameArchive->pBase), BACKFILL_READ_AHEAD);
+        putChannelFrame(pChannel, pTrack, &frame);
+        if (frame.trackId == DEFAULT_VIDEO_TRACK_ID) {
+            ATOMIC_STORE(&pChannel->backfillMediaTime, (SIZE_T) ((pFrame->presentationTs + pFrame->duration) / HUNDREDS_OF_NANOS_IN_A_MILLISECOND));
+        }
+    } else if (drop) {
+        channelMetricsRecordDrop(&pChannel->metrics, METRICS_DROP_REASON_LATE);
+    } else if (frame.trackId == DEFAULT_VIDEO_TRACK_ID) {
+        // the SDK callbacks decide, nothing is polled per frame
+        admit = admissionAdmitVideoFrame(&pChannel->admission, &frame, now);
+        if (admit) {
+            putChannelFrame(pChannel, pTrack, &frame);
+            resumeChannelSpool(pChannel);
+        } else if (!spoolChannelFrame(pChannel, &frame)) {
+            dropChannelFrame(pChannel, pChannel->admission.dropReason);
+        }
+    } else {
+        admit = admissionAdmitAudioFrame(&pChannel->admission, &frame);
+        if (admit) {
+            putChannelFrame(pChannel, pTrack, &frame);
+        } else if (!spoolChannelFrame(pChannel, &frame)) {
+            dropChannelFrame(pChannel, pChannel->admission.audioDropReason);
+        }
+    }
+
+    pFrame->presentationTs += pFrame->duration;
+    pFrame->decodingTs = pFrame->presentationTs;
+
+    CHK_STATUS(frameArchiveCursorAdvance(&pSource->cursor));
+
+CleanUp:
+
+    return retStatus;
+}
+
+/**
+ * Builds the avcC of a live input from a key frame and hands it to the stream when it differs from the one it has:
+ * before the first frame, and again once a restarted or reconfigured encoder sends other parameter sets
+ */
+STATUS setLiveVideoCpd(PSampleChannel pChannel, PAnnexBAccessUnit pUnit)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    BYTE cpd[ANNEXB_MAX_AVCC_CPD_SIZE];
+    UINT32 cpdSize = SIZEOF(cpd);
+
+    retStatus = annexBGetAvccCpd(pUnit->buffer, pUnit->size, cpd, &cpdSize);
+    if (retStatus == STATUS_ANNEXB_MISSING_PARAMETER_SETS && pChannel->videoCpdSize == 0) {
+        ALOGW("Skipping a key frame of %s without SPS and PPS", pChannel->pConfig->name);
+    }
+    CHK_STATUS(retStatus);
+    CHK(cpdSize != pChannel->videoCpdSize || MEMCMP(cpd, pChannel->videoCpd, cpdSize) != 0, retStatus);
+
+    if (pChannel->videoCpdSize != 0) {
+        ALOGI("Parameter sets of %s changed, updating the codec private data", pChannel->pConfig->name);
+    }
+    CHK_STATUS(kinesisVideoStreamFormatChanged(pChannel->streamHandle, cpdSize, cpd, DEFAULT_VIDEO_TRACK_ID));
+    MEMCPY(pChannel->videoCpd, cpd, cpdSize);
+    pChannel->videoCpdSize = cpdSize;
+    // the spool stream takes it with its next frame
+    pChannel->spoolCpdSet = FALSE;
+
+CleanUp:
+
+    if (STATUS_FAILED(retStatus) && retStatus != STATUS_ANNEXB_MISSING_PARAMETER_SETS) {
+        ALOGE("Setting the codec private data of %s failed with 0x%08x", pChannel->pConfig->name, retStatus);
+    }
+
+    return retStatus;
+}
+
+STATUS getLiveFrame(PSchedulerTrack pTrack, PFrame pFrame)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    PTrackSource pSource = (PTrackSource) pTrack->customData;
+    PSampleChannel pChannel = pSource->pChannel;
+    PAnnexBAccessUnit pUnit;
+    STATUS status;
+    UINT64 timestamp;
+
+    // live input queues up in the frame pool while the stream is being created
+    CHK(ATOMIC_LOAD_BOOL(&pChannel->streamReady), STATUS_SCHEDULER_FRAME_PENDING);
+
+    while (TRUE) {
+        status = annexBReaderAcquire(pChannel->pAnnexBReader, 0, &pUnit);
+        if (status == STATUS_OPERATION_TIMED_OUT) {
+            CHK(FALSE, STATUS_SCHEDULER_FRAME_PENDING);
+        } else if (status == STATUS_ANNEXB_END_OF_STREAM) {
+            ALOGI("Live video input of %s ended.", pChannel->pConfig->name);
+            // the spool track finishes once nothing more can be replayed
+            if (pChannel->pSpool != NULL) {
+                schedulerNotifyTrack(&pChannel->spoolTrack);
+            }
+            CHK(FALSE, STATUS_SCHEDULER_TRACK_FINISHED);
+        }
+        CHK_STATUS(status);
+
+        // a fragment has to start with a key frame, skip whatever arrives before the first IDR carrying SPS and PPS.
+        // Every later IDR is checked as well, SPS and PPS change when the encoder restarts or takes a new bitrate.
+        status = pUnit->keyFrame ? setLiveVideoCpd(pChannel, pUnit) : STATUS_ANNEXB_MISSING_PARAMETER_SETS;
+        if (pSource->started || STATUS_SUCCEEDED(status)) {
+            break;
+        }
+
+        CHK_STATUS(annexBReaderRelease(pChannel->pAnnexBReader));
+    }
+
+    // the encoder paces live input, timestamps follow the time each frame arrived
+    timestamp = captureClockGetWallTime(pChannel->pCaptureClock, pUnit->captureTime);
+    timestamp = timestamp > pChannel->streamStartTime ? timestamp - pChannel->streamStartTime : 0;
+    if (pSource->started && timestamp <= pFrame->presentationTs) {
+        timestamp = pFrame->presentationTs + 1;
+    }
+
+    pSource->started = TRUE;
+    pSource->pUnit = pUnit;
+    pFrame->frameData = pUnit->buffer;
+    pFrame->size = pUnit->size;
+    pFrame->flags = pUnit->keyFrame ? FRAME_FLAG_KEY_FRAME : FRAME_FLAG_NONE;
+    pFrame->presentationTs = timestamp;
+    pFrame->decodingTs = timestamp;
+
+CleanUp:
+
+    return retStatus;
+}
+
+STATUS putLiveFrame(PSchedulerTrack pTrack, PFrame pFrame, BOOL drop)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    PTrackSource pSource = (PTrackSource) pTrack->customData;
+    PSampleChannel pChannel = pSource->pChannel;
+    Frame frame;
+    BOOL put = FALSE;
+    UINT64 now = pacerGetTime();
+
+    UNUSED_PARAM(drop);
+
+    frame = *pFrame;
+    stampChannelFrame(pChannel, pSource, pSource->pUnit->captureTime, &frame);
+
+    if (admissionAdmitVideoFrame(&pChannel->admission, &frame, now)) {
+        put = putChannelFrame(pChannel, pTrack, &frame);
+        if (put && pChannel->bitrateControl) {
+            bandwidthEstimatorObservePut(&pChannel->bandwidthEstimator, &frame, now);
+        }
+        pChannel->keyFrameRequested = FALSE;
+        resumeChannelSpool(pChannel);
+    } else {
+        if (!spoolChannelFrame(pChannel, &frame)) {
+            dropChannelFrame(pChannel, pChannel->admission.dropReason);
+        }
+
+        // the drop ends at the next key frame, the encoder makes one now instead of at the end of its GOP
+        if (pChannel->pEncoderControl != NULL && !pChannel->keyFrameRequested && admissionAwaitingKeyFrame(&pChannel->admission, now)) {
+            pChannel->keyFrameRequested = TRUE;
+            encoderControlRequestKeyFrame(pChannel->pEncoderControl);
+        }
+    }
+
+    // a spooled frame goes to another stream, its segment is kept like the one of a dropped frame
+    if (pChannel->pSegmentWatcher != NULL) {
+        segmentWatcherFramePut(pChannel->pSegmentWatcher, pSource->pUnit->segment, (frame.flags & FRAME_FLAG_KEY_FRAME) != 0, put);
+    }
+
+    pSource->pUnit = NULL;
+    CHK_STATUS(annexBReaderRelease(pSource->pChannel->pAnnexBReader));
+
+CleanUp:
+
+    return retStatus;
+}
+
+STATUS getSpoolFrame(PSchedulerTrack pTrack, PFrame pFrame)
+{
+    STATUS retStatus = STATUS_SUCCESS, status = STATUS_SPOOL_EMPTY;
+    PSampleChannel pChannel = (PSampleChannel) pTrack->customData;
+    UINT64 timestamp;
+
+    // replay only while live frames go through, both compete for the content store
+    if (ATOMIC_LOAD_BOOL(&pChannel->spoolStreamReady) && pChannel->admission.dropReason == ADMISSION_REASON_NONE) {
+        status = spoolPeekFrame(pChannel->pSpool, &pChannel->spoolFrame);
+    }
+
+    if (STATUS_FAILED(status)) {
+        // nothing is replayed after the live input ended
+        CHK(pChannel->videoTrack.state != SCHEDULER_TRACK_STATE_FINISHED, STATUS_SCHEDULER_TRACK_FINISHED);
+        CHK(status == STATUS_SPOOL_EMPTY, status);
+        pChannel->replaying = FALSE;
+        pChannel->spoolWaiting = TRUE;
+        CHK(FALSE, STATUS_SCHEDULER_FRAME_PENDING);
+    }
+
+    // every outage is replayed from now on, faster than it was captured
+    timestamp = pChannel->spoolFrame.presentationTs;
+    if (!pChannel->replaying || timestamp + SPOOL_REPLAY_MAX_GAP < pChannel->replayLastTs ||
+        timestamp > pChannel->replayLastTs + SPOOL_REPLAY_MAX_GAP) {
+        pChannel->replaying = TRUE;
+        pChannel->replayBase = pacerGetTime() - pTrack->pacer.startTime;
+        pChannel->replayFirstTs = timestamp;
+    }
+
+    pChannel->replayLastTs = timestamp;
+    *pFrame = pChannel->spoolFrame;
+    pFrame->presentationTs = pChannel->replayBase +
+        (timestamp > pChannel->replayFirstTs ? (timestamp - pChannel->replayFirstTs) / pChannel->replaySpeed : 0);
+    pFrame->decodingTs = pFrame->presentationTs;
+
+CleanUp:
+
+    return retStatus;
+}
+
+STATUS putSpoolFrame(PSchedulerTrack pTrack, PFrame pFrame, BOOL drop)
+{
+    PSampleChannel pChannel = (PSampleChannel) pTrack->customData;
+    STATUS status;
+
+    UNUSED_PARAM(pFrame);
+    UNUSED_PARAM(drop);
+
+    // only frames put after the avcC of a live input was built are spooled
+    if (pChannel->videoCpdSize != 0 && !pChannel->spoolCpdSet) {
+        status = kinesisVideoStreamFormatChanged(pChannel->spoolStreamHandle, pChannel->videoCpdSize, pChannel->videoCpd, DEFAULT_VIDEO_TRACK_ID);
+        pChannel->spoolCpdSet = STATUS_SUCCEEDED(status);
+        if (STATUS_FAILED(status)) {
+            ALOGE("kinesisVideoStreamFormatChanged for %s failed with 0x%08x", pChannel->spoolStreamName, status);
+        }
+    }
+
+    // spooling since the peek may have written the staged block the record was read from out to the file
+    status = spoolPeekFrame(pChannel->pSpool, &pChannel->spoolFrame);
+
+    // the frame data is put straight from the spool with the timestamps it was captured at
+    if (STATUS_SUCCEEDED(status)) {
+        status = putKinesisVideoFrame(pChannel->spoolStreamHandle, &pChannel->spoolFrame);
+    }
+
+    if (STATUS_FAILED(status)) {
+        ALOGE("putKinesisVideoFrame for %s failed with 0x%08x", pChannel->spoolStreamName, status);
+        channelMetricsRecordError(&pChannel->metrics, status);
+    }
+
+    spoolRelease(pChannel->pSpool);
+
+    return STATUS_SUCCESS;
+}
+
+PSampleChannel findChannel(PSampleCustomData data, STREAM_HANDLE streamHandle)
+{
+    UINT32 i;
+
+    for (i = 0; i < data->channelCount; i++) {
+        if (data->pChannels[i].streamHandle == streamHandle) {
+            return &data->pChannels[i];
+        }
+    }
+
+    return NULL;
+}
+
+PSampleChannel findSpoolChannel(PSampleCustomData data, STREAM_HANDLE streamHandle)
+{
+    UINT32 i;
+
+    for (i = 0; i < data->channelCount; i++) {
+        if (data->pChannels[i].pSpool != NULL && data->pChannels[i].spoolStreamHandle == streamHandle) {
+            return &data->pChannels[i];
+        }
+    }
+
+    return NULL;
+}
+
+STATUS storageOverflowPressure(UINT64 customData, UINT64 remainingBytes)
+{
+    PSampleCustomData data = (PSampleCustomData) customData;
+    UINT32 i;
+
+    UNUSED_PARAM(remainingBytes);
+
+    // the content store is shared, every channel backs off
+    for (i = 0; i < data->channelCount; i++) {
+        admissionSignalPressure(&data->pChannels[i].admission, ADMISSION_REASON_STORAGE_PRESSURE);
+    }
+
+    return STATUS_SUCCESS;
+}
+
+STATUS bufferDurationOverflowPressure(UINT64 customData, STREAM_HANDLE streamHandle, UINT64 remainingDuration)
+{
+    PSampleChannel pChannel = findChannel((PSampleCustomData) customData, streamHandle);
+
+    UNUSED_PARAM(remainingDuration);
+
+    if (pChannel != NULL) {
+        admissionSignalPressure(&pChannel->admission, ADMISSION_REASON_BUFFER_DURATION_PRESSURE);
+    }
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * Measures the room a dropping channel got back for admission. Only asked while the channel drops, at its key frames.
+ */
+BOOL channelHasHeadroom(UINT64 customData, ADMISSION_REASON reason)
+{
+    PSampleChannel pChannel = (PSampleChannel) customData;
+    ClientMetrics clientMetrics;
+    StreamMetrics streamMetrics;
+    UINT64 bufferDuration;
+
+    // without a measurement the hold time alone decides
+    if (reason == ADMISSION_REASON_STORAGE_PRESSURE) {
+        clientMetrics.version = CLIENT_METRICS_CURRENT_VERSION;
+        return STATUS_FAILED(getKinesisVideoMetrics(pChannel->clientHandle, &clientMetrics)) ||
+            clientMetrics.contentStoreAvailableSize * 100 >= clientMetrics.contentStoreSize * ADMISSION_RESUME_HEADROOM_PERCENT;
+    }
+
+    streamMetrics.version = STREAM_METRICS_CURRENT_VERSION;
+    bufferDuration = pChannel->pStreamInfo->streamCaps.bufferDuration;
+    return STATUS_FAILED(getKinesisVideoStreamMetrics(pChannel->streamHandle, &streamMetrics)) ||
+        (bufferDuration - MIN(streamMetrics.currentViewDuration, bufferDuration)) * 100 >= bufferDuration * ADMISSION_RESUME_HEADROOM_PERCENT;
+}
+
+/**
+ * Opens the tracks of a channel once its stream can take frames
+ */
+VOID setChannelReady(PSampleCustomData data, PSampleChannel pChannel)
+{
+    if (!channelMetricsRecordStartup(&pChannel->metrics, METRICS_STARTUP_STREAM_READY, pacerGetTime() - pChannel->startTime)) {
+        return;
+    }
+
+    ALOGI("Stream %s ready after %" PRIu64 " ms%s", pChannel->pConfig->name,
+          (UINT64) METRICS_ATOMIC_LOAD(&pChannel->metrics.startupTimes[METRICS_STARTUP_STREAM_READY]) / 1000,
+          startupCacheServed(data->pStartupCache, pChannel->pConfig->name) ? " from the startup cache" : "");
+
+    // before the notification, a track asking in between sees the stream ready
+    ATOMIC_STORE_BOOL(&pChannel->streamReady, TRUE);
+    // fails for tracks not added to a scheduler yet, they ask for their first frame once it starts
+    schedulerNotifyTrack(&pChannel->videoTrack);
+    schedulerNotifyTrack(&pChannel->audioTrack);
+}
+
+VOID setSpoolReady(PSampleChannel pChannel)
+{
+    ATOMIC_STORE_BOOL(&pChannel->spoolStreamReady, TRUE);
+    schedulerNotifyTrack(&pChannel->spoolTrack);
+}
+
+STATUS streamReady(UINT64 customData, STREAM_HANDLE streamHandle)
+{
+    PSampleCustomData data = (PSampleCustomData) customData;
+    PSampleChannel pChannel, pSpoolChannel = NULL;
+
+    // answered from the startup cache the stream gets ready inside createKinesisVideoStream
+    MUTEX_LOCK(data->startupLock);
+    pChannel = findChannel(data, streamHandle);
+    if (pChannel == NULL) {
+        pSpoolChannel = findSpoolChannel(data, streamHandle);
+    }
+    if (pChannel == NULL && pSpoolChannel == NULL && data->earlyReadyCount < ARRAY_SIZE(data->earlyReadyHandles)) {
+        data->earlyReadyHandles[data->earlyReadyCount++] = streamHandle;
+    }
+    MUTEX_UNLOCK(data->startupLock);
+
+    if (pChannel != NULL) {
+        setChannelReady(data, pChannel);
+    } else if (pSpoolChannel != NULL) {
+        setSpoolReady(pSpoolChannel);
+    }
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * Feeds the acks to the fragment controller and passes its decisions on to the encoder
+ */
+VOID updateFragmentDuration(PSampleChannel pChannel, PFragmentAck pFragmentAck, UINT64 latency)
+{
+    PFragmentController pController = &pChannel->fragmentController;
+
+    if (pFragmentAck->ackType == FRAGMENT_ACK_TYPE_BUFFERING) {
+        fragmentControllerObserveFragment(pController, pFragmentAck->timestamp);
+    } else if (pFragmentAck->ackType == FRAGMENT_ACK_TYPE_PERSISTED && latency != 0) {
+        if (fragmentControllerObserveLatency(pController, latency)) {
+            ALOGI("Stream %s asks for %" PRIu64 " ms fragments, %" PRIu64 " ms overhead per fragment", pChannel->pConfig->name,
+                  fragmentControllerGetDuration(pController) / HUNDREDS_OF_NANOS_IN_A_MILLISECOND,
+                  pController->overhead / HUNDREDS_OF_NANOS_IN_A_MILLISECOND);
+        }
+
+        // also sends again what an encoder which was not listening yet missed
+        if (pChannel->pEncoderControl != NULL) {
+            encoderControlSetKeyFrameInterval(pChannel->pEncoderControl, fragmentControllerGetDuration(pController));
+        }
+    }
+}
+
+/**
+ * Feeds the acks to the bandwidth estimator and passes its decisions on to the encoder
+ */
+VOID updateBitrate(PSampleChannel pChannel, PFragmentAck pFragmentAck, UINT64 now)
+{
+    PBandwidthEstimator pEstimator = &pChannel->bandwidthEstimator;
+
+    if (pFragmentAck->ackType == FRAGMENT_ACK_TYPE_ERROR) {
+        // the SDK resends the fragments in flight, their acks no longer match the key frames put
+        bandwidthEstimatorReset(pEstimator);
+    } else if (pFragmentAck->ackType == FRAGMENT_ACK_TYPE_BUFFERING) {
+        if (bandwidthEstimatorObserveAck(pEstimator, now)) {
+            ALOGI("Stream %s asks for %" PRIu64 " kbps, %" PRIu64 " kbps delivered with %" PRIu64 " ms queued", pChannel->pConfig->name,
+                  bandwidthEstimatorGetBitrate(pEstimator) / 1000, (UINT64) ATOMIC_LOAD(&pEstimator->stats.estimate) / 1000,
+                  (UINT64) ATOMIC_LOAD(&pEstimator->stats.queueDelay) / HUNDREDS_OF_NANOS_IN_A_MILLISECOND);
+        }
+
+        // also sends again what an encoder which was not listening yet missed
+        encoderControlSetBitrate(pChannel->pEncoderControl, bandwidthEstimatorGetBitrate(pEstimator));
+    }
+}
+
+STATUS fragmentAckReceived(UINT64 customData, STREAM_HANDLE streamHandle, UPLOAD_HANDLE uploadHandle, PFragmentAck pFragmentAck)
+{
+    PSampleCustomData data = (PSampleCustomData) customData;
+    PSampleChannel pChannel = findChannel(data, streamHandle);
+    UINT64 now = pacerGetTime();
+
+    UINT64 latency;
+
+    UNUSED_PARAM(uploadHandle);
+
+    if (pChannel != NULL) {
+        latency = channelMetricsRecordAck(&pChannel->metrics, pFragmentAck, now);
+        if (pChannel->fragmentControl) {
+            updateFragmentDuration(pChannel, pFragmentAck, latency);
+        }
+
+        if (pChannel->bitrateControl) {
+            updateBitrate(pChannel, pFragmentAck, now);
+        }
+
+        // a fragment acked with an error is sent again by the new session, nothing is lost yet
+        if (pChannel->pSegmentWatcher != NULL && pFragmentAck->ackType == FRAGMENT_ACK_TYPE_PERSISTED) {
+            segmentWatcherFragmentPersisted(pChannel->pSegmentWatcher, pFragmentAck->timestamp);
+        }
+
+        if (pFragmentAck->ackType != FRAGMENT_ACK_TYPE_ERROR) {
+            recoveryReportAck(&pChannel->recovery);
+            if (channelMetricsRecordStartup(&pChannel->metrics, METRICS_STARTUP_FIRST_ACK, now - pChannel->startTime)) {
+                ALOGI("Stream %s got its first ack after %" PRIu64 " ms", pChannel->pConfig->name,
+                      (now - pChannel->startTime) / HUNDREDS_OF_NANOS_IN_A_MILLISECOND);
+            }
+
+            // the endpoint took the fragment, what the stream was started with is good to keep
+            if (data->pStartupCache != NULL) {
+                startupCacheConfirm(data->pStartupCache, pChannel->pConfig->name);
+            }
+        }
+    }
+
+    return STATUS_SUCCESS;
+}
+
+STATUS streamErrorReport(UINT64 customData, STREAM_HANDLE streamHandle, UPLOAD_HANDLE uploadHandle, UINT64 fragmentTimecode,
+                         STATUS errorStatus)
+{
+    PSampleCustomData data = (PSampleCustomData) customData;
+    PSampleChannel pChannel = findChannel(data, streamHandle);
+
+    UNUSED_PARAM(uploadHandle);
+    UNUSED_PARAM(fragmentTimecode);
+
+    if (pChannel != NULL) {
+        channelMetricsRecordError(&pChannel->metrics, errorStatus);
+        // recovery keeps the buffered frames through a connection reset and resyncs the segments on a stream reset,
+        // the SDK recovering on its own may drop them
+        if (pChannel->pSegmentWatcher != NULL && data->pRecovery == NULL) {
+            segmentWatcherFramesLost(pChannel->pSegmentWatcher);
+        }
+        // a stale description or endpoint shows up as the first error, the SDK recovers through the real calls
+        if (data->pStartupCache != NULL) {
+            startupCacheInvalidate(data->pStartupCache, pChannel->pConfig->name);
+        }
+        if (data->pRecovery != NULL) {
+            recoveryReportError(&pChannel->recovery, errorStatus);
+        }
+    } else if ((pChannel = findSpoolChannel(data, streamHandle)) != NULL) {
+        channelMetricsRecordError(&pChannel->metrics, errorStatus);
+    }
+
+    return STATUS_SUCCESS;
+}
+
+STATUS droppedFrameReport(UINT64 customData, STREAM_HANDLE streamHandle, UINT64 frameTimecode)
+{
+    PSampleChannel pChannel = findChannel((PSampleCustomData) customData, streamHandle);
+
+    UNUSED_PARAM(frameTimecode);
+
+    if (pChannel != NULL) {
+        channelMetricsRecordDrop(&pChannel->metrics, METRICS_DROP_REASON_SDK);
+        recoveryReportFrameLost(&pChannel->recovery);
+        if (pChannel->pSegmentWatcher != NULL) {
+            segmentWatcherFramesLost(pChannel->pSegmentWatcher);
+        }
+    }
+
+    return STATUS_SUCCESS;
+}
+
+STATUS streamConnectionStale(UINT64 customData, STREAM_HANDLE streamHandle, UINT64 lastAckDuration)
+{
+    PSampleCustomData data = (PSampleCustomData) customData;
+    PSampleChannel pChannel = findChannel(data, streamHandle);
+
+    if (pChannel != NULL && data->pRecovery != NULL) {
+        ALOGW("Stream %s got no ack for %" PRIu64 " ms", pChannel->pConfig->name, lastAckDuration / HUNDREDS_OF_NANOS_IN_A_MILLISECOND);
+        recoveryReportError(&pChannel->recovery, STATUS_CONNECTION_STALE);
+    }
+
+    return STATUS_SUCCESS;
+}
+
+/**
+ * Called from the recovery thread once the backoff of a failed stream is over
+ */
+STATUS resetChannelStream(UINT64 customData, RECOVERY_ACTION action)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    PSampleChannel pChannel = (PSampleChannel) customData;
+
+    if (action == RECOVERY_ACTION_RESET_CONNECTION) {
+        // a new session picks up from the last acked fragment, nothing buffered is lost
+        CHK_STATUS(kinesisVideoStreamResetConnection(pChannel->streamHandle));
+    } else {
+        // the buffered frames of the stream go, the next fragment needs a key frame and the other streams keep going
+        CHK_STATUS(kinesisVideoStreamResetStream(pChannel->streamHandle));
+        if (pChannel->pSegmentWatcher != NULL) {
+            segmentWatcherResync(pChannel->pSegmentWatcher);
+        }
+        if (pChannel->pEncoderControl != NULL) {
+            encoderControlRequestKeyFrame(pChannel->pEncoderControl);
+        }
+    }
+
+CleanUp:
+
+    return retStatus;
+}
+
+/**
+ * Points the metrics exporter at the parts of each channel kvs runs, once the streams are created
+ */
+VOID setMetricsSources(PSampleCustomData data)
+{
+    PMetricsSources pSources = &data->metricsSources;
+    PMetricsChannel pSource;
+    PSampleChannel pChannel;
+    UINT32 i;
+
+    pSources->clientHandle = data->clientHandle;
+    pSources->channelCount = data->channelCount;
+    pSources->pFramePool = data->pFramePool;
+
+    for (i = 0; i < data->channelCount; i++) {
+        pChannel = &data->pChannels[i];
+        pSource = &pSources->channels[i];
+        MEMSET(pSource, 0x00, SIZEOF(MetricsChannel));
+        pSource->name = pChannel->pConfig->name;
+        pSource->pMetrics = &pChannel->metrics;
+        pSource->streamHandle = pChannel->streamHandle;
+        pSource->bufferDuration = pChannel->pStreamInfo->streamCaps.bufferDuration;
+        pSource->pSpool = pChannel->pSpool;
+        if (pChannel->captureTimestamps) {
+            pSource->pClocks[METRICS_TRACK_VIDEO] = &pChannel->videoSource.clock;
+            if (channelHasAudio(pChannel)) {
+                pSource->pClocks[METRICS_TRACK_AUDIO] = &pChannel->audioSource.clock;
+            }
+        }
+        if (pChannel->bitrateControl) {
+            pSource->pBandwidthEstimator = &pChannel->bandwidthEstimator;
+        }
+        pSource->pEncoderControl = pChannel->pEncoderControl;
+        if (pChannel->fragmentControl) {
+            pSource->pFragmentController = &pChannel->fragmentController;
+        }
+        if (data->pRecovery != NULL) {
+            pSource->pRecoveryStream = &pChannel->recovery;
+        }
+        if (pChannel->backfill) {
+            pSource->pBackfillMediaTime = &pChannel->backfillMediaTime;
+        }
+        pSource->pSegmentWatcher = pChannel->pSegmentWatcher;
+    }
+}
+
+VOID liveFrameReady(UINT64 customData)
+{
+    schedulerNotifyTrack((PSchedulerTrack) customData);
+}
+
+STATUS parseLogLevel(PCHAR value, PUINT32 pLevel)
+{
+    static const CHAR* levelNames[] = {"verbose", "debug", "info", "warn", "error", "fatal", "silent"};
+    UINT32 i;
+
+    for (i = 0; i < ARRAY_SIZE(levelNames); i++) {
+        if (STRCMPI(value, (PCHAR) levelNames[i]) == 0) {
+            *pLevel = LOG_LEVEL_VERBOSE + i;
+            return STATUS_SUCCESS;
+        }
+    }
+
+    return STATUS_INVALID_ARG;
+}
+
+/**
+ * Coalescing windows of the archive tracks from 'audio=<ms>,video=<ms>', either one can be left out
+ */
+STATUS parseCoalesce(PCHAR value, PUINT64 pAudioWindow, PUINT64 pVideoWindow)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    PCHAR pCur = value, pEnd;
+    PUINT64 pWindow;
+
+    while (pCur != NULL) {
+        if (STRNCMP(pCur, "audio=", 6) == 0) {
+            pWindow = pAudioWindow;
+        } else if (STRNCMP(pCur, "video=", 6) == 0) {
+            pWindow = pVideoWindow;
+        } else {
+            CHK(FALSE, STATUS_INVALID_ARG);
+        }
+
+        pCur += 6;
+        pEnd = STRCHR(pCur, ',');
+        CHK_STATUS(STRTOUI64(pCur, pEnd, 10, pWindow));
+        CHK(*pWindow <= MAX_UINT64 / HUNDREDS_OF_NANOS_IN_A_MILLISECOND, STATUS_INVALID_ARG);
+        *pWindow *= HUNDREDS_OF_NANOS_IN_A_MILLISECOND;
+        pCur = pEnd == NULL ? NULL : pEnd + 1;
+    }
+
+CleanUp:
+
+    return retStatus;
+}
+
+/**
+ * A channel name starts a new channel, the other channel options apply to the last one
+ */
+PChannelConfig getOptionChannel(PChannelConfig pConfigs, PUINT32 pCount, BOOL naming)
+{
+    if (*pCount == 0 || (naming && pConfigs[*pCount - 1].name[0] != '\0')) {
+        if (*pCount == MAX_CHANNEL_COUNT) {
+            fprintf(stderr, "at most %d channels are supported\n", MAX_CHANNEL_COUNT);
+            displayUsage(1);
+        }
 
-#define DEFAULT_LOG_LEVEL                   LOG_LEVEL_INFO
-#define FILE_LOGGING_BUFFER_SIZE            (100 * 1024)
-#define MAX_NUMBER_OF_LOG_FILES             5
+        (*pCount)++;
+    }
 
-typedef struct {
-    PBYTE buffer;
-    UINT32 size;
-} FrameData, *PFrameData;
+    return &pConfigs[*pCount - 1];
+}
 
-typedef struct {
-    volatile ATOMIC_BOOL firstVideoFramePut;
-    UINT64 streamStopTime;
-    UINT64 streamStartTime;
-    STREAM_HANDLE streamHandle;
-    CLIENT_HANDLE clientHandle;
-    CHAR sampleDir[MAX_PATH_LEN + 1];
-    FrameData audioFrames;
-    FrameData videoFrames;
-} SampleCustomData, *PSampleCustomData;
+VOID setOptionPath(PCHAR path, PCHAR value)
+{
+    if (STRLEN(value) > MAX_PATH_LEN) {
+        fprintf(stderr, "path '%s' is too long\n", value);
+        displayUsage(1);
+    }
 
-static struct option long_options[] = {
-    /*   NAME           ARGUMENT            FLAG    SHORTNAME */
-    {"channel-name",    required_argument,  NULL,   'n'},
-    {"directory",       required_argument,  NULL,   'd'},
-    {"duration",        required_argument,  NULL,   'D'},
-    {"size",            required_argument,  NULL,   's'},
-    {"help",            no_argument,        NULL,   'h'},
-    {NULL,              0,                  NULL,   0}
-};
+    STRCPY(path, value);
+}
 
-void displayUsage( int err )
+PTrackInfo getStreamTrackInfo(PStreamInfo pStreamInfo, UINT64 trackId)
 {
-    printf ("Ingest video to the Amazon Kinesis Video Streams service.\n");
-    printf ("Usage: \n");
-    printf ("AWS_ACCESS_KEY_ID=SAMPLEKEY AWS_SECRET_ACCESS_KEY=SAMPLESECRET\n");
-    printf ("kvs [options...]\n");
-    printf ("\n");
-    printf ("-n, --channel-name     stream channel name\n");
-    printf ("                       default to 'your-kvs-name'\n");
-    printf ("-d, --directory        streaming media directory\n");
-    printf ("                       default to '../'\n");
-    printf ("-D, --duration         streaming duration in second\n");
-    printf ("                       default to 600\n");
-    printf ("-s, --size             stream buffer size in KB\n");
-    printf ("                       default to 2048, minimal to 1024\n");
-    printf ("\n");
-    printf ("Exit status:\n \
-    0  if OK,\n \
-    1  if minor problems (e.g., missing argument),\n \
-    others  if serious trouble, please check 'Include.h' files.\n");
-    exit (err);
+    return pStreamInfo->streamCaps.trackInfoList[0].trackId == trackId ? &pStreamInfo->streamCaps.trackInfoList[0]
+                                                                        : &pStreamInfo->streamCaps.trackInfoList[1];
 }
 
-PVOID putVideoFrameRoutine(PVOID args)
+/**
+ * Stream info of a channel, the live stream and the spool stream carry the same tracks
+ */
+STATUS createChannelStreamInfo(PSampleChannel pChannel, PCHAR name, UINT64 bufferDuration, UINT64 replayDuration, PStreamInfo* ppStreamInfo)
 {
     STATUS retStatus = STATUS_SUCCESS;
-    PSampleCustomData data = (PSampleCustomData) args;
-    Frame frame;
-    UINT32 videoFileIndex= 0;
-    STATUS status;
-    UINT64 runningTime, fileSize;
-    CHAR filePath[MAX_PATH_LEN + 1];
+    PTrackInfo pAudioTrack = NULL, pVideoTrack = NULL;
+    PFrameArchiveTrack pArchiveAudio = NULL, pArchiveVideo = NULL;
+    PStreamInfo pStreamInfo = NULL;
 
-    CHK(data != NULL, STATUS_NULL_ARG);
+    if (pChannel->pConfig->videoInputPath[0] != '\0') {
+        // live input carries no audio. The reader converts the frames to length prefixed NAL units and the avcC is
+        // set from the SPS/PPS of the first IDR frame, so the SDK does not adapt them again.
+        CHK_STATUS(createRealtimeVideoStreamInfoProvider(name, DEFAULT_RETENTION_PERIOD, bufferDuration, &pStreamInfo));
+        pStreamInfo->streamCaps.nalAdaptationFlags = NAL_ADAPTATION_FLAG_NONE;
+    } else {
+        pArchiveVideo = frameArchiveGetTrack(pChannel->pFrameArchive, DEFAULT_VIDEO_TRACK_ID);
+        pArchiveAudio = frameArchiveGetTrack(pChannel->pFrameArchive, DEFAULT_AUDIO_TRACK_ID);
+        if (pChannel->backfill) {
+            // an offline stream holds the puts back instead of dropping frames when the content store fills up
+            if (pArchiveAudio != NULL) {
+                CHK_STATUS(createOfflineAudioVideoStreamInfoProvider(name, DEFAULT_RETENTION_PERIOD, bufferDuration, &pStreamInfo));
+            } else {
+                CHK_STATUS(createOfflineVideoStreamInfoProvider(name, DEFAULT_RETENTION_PERIOD, bufferDuration, &pStreamInfo));
+            }
+        } else if (pArchiveAudio != NULL) {
+            CHK_STATUS(createRealtimeAudioVideoStreamInfoProvider(name, DEFAULT_RETENTION_PERIOD, bufferDuration, &pStreamInfo));
+        } else {
+            CHK_STATUS(createRealtimeVideoStreamInfoProvider(name, DEFAULT_RETENTION_PERIOD, bufferDuration, &pStreamInfo));
+        }
 
-    frame.version = FRAME_CURRENT_VERSION;
-    frame.trackId = DEFAULT_VIDEO_TRACK_ID;
-    frame.duration = 0;
-    frame.decodingTs = 0;
-    frame.presentationTs = 0;
-    frame.index = 0;
+        // adjust members of pStreamInfo here if needed
+        pVideoTrack = getStreamTrackInfo(pStreamInfo, DEFAULT_VIDEO_TRACK_ID);
+        if (pArchiveVideo != NULL && pArchiveVideo->codecPrivateData != NULL) {
+            // the avcC of a container, its samples are length prefixed already
+            pVideoTrack->codecPrivateData = pArchiveVideo->codecPrivateData;
+            pVideoTrack->codecPrivateDataSize = pArchiveVideo->codecPrivateDataSize;
+            pStreamInfo->streamCaps.nalAdaptationFlags = NAL_ADAPTATION_FLAG_NONE;
+        }
 
-    ClientMetrics kinesisVideoClientMetrics;
-    kinesisVideoClientMetrics.version = CLIENT_METRICS_CURRENT_VERSION;
+        // set up audio cpd.
+        if (pArchiveAudio != NULL) {
+            pAudioTrack = getStreamTrackInfo(pStreamInfo, DEFAULT_AUDIO_TRACK_ID);
+            if (pArchiveAudio->codecPrivateData != NULL) {
+                pAudioTrack->codecPrivateData = pArchiveAudio->codecPrivateData;
+                pAudioTrack->codecPrivateDataSize = pArchiveAudio->codecPrivateDataSize;
+            } else {
+                // generate audio cpd
+                pAudioTrack->codecPrivateData = pChannel->audioCpd;
+                pAudioTrack->codecPrivateDataSize = KVS_AAC_CPD_SIZE_BYTE;
+                CHK_STATUS(mkvgenGenerateAacCpd(AAC_LC, AUDIO_TRACK_SAMPLING_RATE, AUDIO_TRACK_CHANNEL_CONFIG, pAudioTrack->codecPrivateData,
+                                                pAudioTrack->codecPrivateDataSize));
+            }
+        }
+    }
 
-    while (defaultGetTime() < data->streamStopTime) {
-        SNPRINTF(filePath, MAX_PATH_LEN, "%s/h264SampleFrames/frame-%03d.h264", data->sampleDir, videoFileIndex + 1);
-        CHK_STATUS(readFile(filePath, TRUE, NULL, &fileSize));
-        data->videoFrames.buffer = (PBYTE) MEMALLOC(fileSize);
-        data->videoFrames.size = fileSize;
-        CHK_STATUS(readFile(filePath, TRUE, data->videoFrames.buffer, &fileSize));
+    if (replayDuration != 0) {
+        pStreamInfo->streamCaps.replayDuration = replayDuration;
+    }
 
-        frame.frameData = data->videoFrames.buffer;
-        frame.size = data->videoFrames.size;
+CleanUp:
 
-        // video track is used to mark new fragment. A new fragment is generated for every frame with FRAME_FLAG_KEY_FRAME
-        frame.flags = videoFileIndex% DEFAULT_KEY_FRAME_INTERVAL == 0 ? FRAME_FLAG_KEY_FRAME : FRAME_FLAG_NONE;
+    if (STATUS_FAILED(retStatus)) {
+        freeStreamInfoProvider(&pStreamInfo);
+    }
 
-        CHK_STATUS(getKinesisVideoMetrics(data->clientHandle, &kinesisVideoClientMetrics));
+    *ppStreamInfo = pStreamInfo;
 
-        printf("Overall storage size:%d KB, Available:%d KB and this Video frame size:%d KB.\n", \
-                kinesisVideoClientMetrics.contentStoreSize >> 10, \
-                (kinesisVideoClientMetrics.contentStoreAvailableSize - MAX_KVS_HEAP_SIZE) >> 10, \
-                frame.size >> 10 \
-        );
+    return retStatus;
+}
 
-        if(frame.size > kinesisVideoClientMetrics.contentStoreAvailableSize - MAX_KVS_HEAP_SIZE )
-        {
-            printf("No enough buffer for video data.\n");
-            THREAD_SLEEP(frame.duration);
-            continue;
-        }
+/**
+ * Starts creating the stream of a channel without waiting for it, streamReady opens the tracks
+ */
+STATUS createChannelStream(PSampleCustomData data, PSampleChannel pChannel, CLIENT_HANDLE clientHandle, UINT64 bufferDuration,
+                           UINT64 replayDuration)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    PChannelConfig pConfig = pChannel->pConfig;
+    STREAM_HANDLE streamHandle = INVALID_STREAM_HANDLE_VALUE, spoolStreamHandle = INVALID_STREAM_HANDLE_VALUE;
+    BOOL ready = FALSE, spoolReady = FALSE;
+    UINT32 i;
 
-        status = putKinesisVideoFrame(data->streamHandle, &frame);
-        ATOMIC_STORE_BOOL(&data->firstVideoFramePut, TRUE);
-        if (STATUS_FAILED(status)) {
-            printf("putKinesisVideoFrame failed with 0x%08x\n", status);
-            status = STATUS_SUCCESS;
-        }
+    CHK_STATUS(createChannelStreamInfo(pChannel, pConfig->name, bufferDuration, replayDuration, &pChannel->pStreamInfo));
+    // relative time mode counts from 0, capture and backfill put wall times
+    pChannel->pStreamInfo->streamCaps.absoluteFragmentTimes = pChannel->captureTimestamps || pChannel->backfill;
+    // the stream is reset in place from the recovery thread instead
+    if (data->pRecovery != NULL) {
+        pChannel->pStreamInfo->streamCaps.recoverOnError = FALSE;
+    }
 
-        frame.presentationTs += SAMPLE_VIDEO_FRAME_DURATION;
-        frame.decodingTs = frame.presentationTs;
-        frame.index++;
+    // every stream describes itself, gets its endpoint and its token at the same time
+    CHK_STATUS(createKinesisVideoStream(clientHandle, pChannel->pStreamInfo, &streamHandle));
+    pChannel->clientHandle = clientHandle;
 
-        videoFileIndex++;
-        if(videoFileIndex == NUMBER_OF_H264_FRAME_FILES)
-            videoFileIndex = 0;
+    if (pChannel->pSpool != NULL) {
+        // spooled frames keep the time they were captured at, on a stream of their own both timelines stay monotonic
+        CHK_STATUS(createChannelStreamInfo(pChannel, pChannel->spoolStreamName, bufferDuration, replayDuration, &pChannel->pSpoolStreamInfo));
+        pChannel->pSpoolStreamInfo->streamCaps.absoluteFragmentTimes = TRUE;
+        CHK_STATUS(createKinesisVideoStream(clientHandle, pChannel->pSpoolStreamInfo, &spoolStreamHandle));
+    }
 
-        SAFE_MEMFREE(data->videoFrames.buffer);
-        // synchronize putKinesisVideoFrame to running time
-        runningTime = defaultGetTime() - data->streamStartTime;
-        if (runningTime < frame.presentationTs) {
-            // reduce sleep time a little for smoother video
-            THREAD_SLEEP((frame.presentationTs - runningTime) * 0.9);
-        }
+    MUTEX_LOCK(data->startupLock);
+    pChannel->streamHandle = streamHandle;
+    pChannel->spoolStreamHandle = spoolStreamHandle;
+    for (i = 0; i < data->earlyReadyCount; i++) {
+        ready = ready || data->earlyReadyHandles[i] == streamHandle;
+        spoolReady = spoolReady || (IS_VALID_STREAM_HANDLE(spoolStreamHandle) && data->earlyReadyHandles[i] == spoolStreamHandle);
     }
+    MUTEX_UNLOCK(data->startupLock);
 
-CleanUp:
+    if (ready) {
+        setChannelReady(data, pChannel);
+    }
 
-    if (retStatus != STATUS_SUCCESS) {
-        printf("putVideoFrameRoutine failed with 0x%08x", retStatus);
+    if (spoolReady) {
+        setSpoolReady(pChannel);
     }
 
-    return (PVOID) (ULONG_PTR) retStatus;
+CleanUp:
+
+    return retStatus;
 }
 
-PVOID putAudioFrameRoutine(PVOID args)
+/**
+ * Measures the bitrate of every channel, archives from their index and live inputs over the warm-up window
+ */
+STATUS measureChannels(PSampleChannel pChannels, UINT32 channelCount, PSizingSample pSamples, UINT64 warmUpDuration)
 {
     STATUS retStatus = STATUS_SUCCESS;
-    PSampleCustomData data = (PSampleCustomData) args;
-    Frame frame;
-    UINT32 audioFileIndex = 0;
-    STATUS status;
-    UINT64 runningTime, fileSize;
-    CHAR filePath[MAX_PATH_LEN + 1];
+    PAnnexBReader pReaders[MAX_CHANNEL_COUNT];
+    PSizingSample pLiveSamples[MAX_CHANNEL_COUNT];
+    UINT32 liveCount = 0, i;
 
-    CHK(data != NULL, STATUS_NULL_ARG);
+    for (i = 0; i < channelCount; i++) {
+        if (pChannels[i].pAnnexBReader != NULL) {
+            pReaders[liveCount] = pChannels[i].pAnnexBReader;
+            pLiveSamples[liveCount++] = &pSamples[i];
+        } else {
+            CHK_STATUS(sizingMeasureArchive(pChannels[i].pFrameArchive, &pSamples[i]));
+        }
+    }
 
-    frame.version = FRAME_CURRENT_VERSION;
-    frame.trackId = DEFAULT_AUDIO_TRACK_ID;
-    frame.duration = 0;
-    frame.decodingTs = 0; // relative time mode
-    frame.presentationTs = 0; // relative time mode
-    frame.index = 0;
-    frame.flags = FRAME_FLAG_NONE; // audio track is not used to cut fragment
+    if (liveCount != 0) {
+        printf("Measuring %u live inputs for %" PRIu64 " seconds\n", liveCount, (UINT64) (warmUpDuration / HUNDREDS_OF_NANOS_IN_A_SECOND));
+        CHK_STATUS(sizingMeasureAnnexB(pReaders, pLiveSamples, liveCount, warmUpDuration));
+    }
 
-    while (defaultGetTime() < data->streamStopTime) {
-        // no audio can be put until first video frame is put
-        if (ATOMIC_LOAD_BOOL(&data->firstVideoFramePut)) {
-            SNPRINTF(filePath, MAX_PATH_LEN, "%s/aacSampleFrames/sample-%03d.aac", data->sampleDir, audioFileIndex + 1);
-            CHK_STATUS(readFile(filePath, TRUE, NULL, &fileSize));
-            data->audioFrames.buffer = (PBYTE) MEMALLOC(fileSize);
-            data->audioFrames.size = fileSize;
-            CHK_STATUS(readFile(filePath, TRUE, data->audioFrames.buffer, &fileSize));
+    for (i = 0; i < channelCount; i++) {
+        printf("Channel %s: %" PRIu64 " frames, %" PRIu64 " KB/s\n", pChannels[i].pConfig->name, pSamples[i].frames,
+               sizingSampleGetByteRate(&pSamples[i]) / 1024);
+    }
 
-            frame.frameData = data->audioFrames.buffer;
-            frame.size = data->audioFrames.size;
+CleanUp:
 
-            status = putKinesisVideoFrame(data->streamHandle, &frame);
-            if (STATUS_FAILED(status)) {
-                printf("putKinesisVideoFrame for audio failed with 0x%08x\n", status);
-                status = STATUS_SUCCESS;
-            }
+    return retStatus;
+}
 
-            frame.presentationTs += SAMPLE_AUDIO_FRAME_DURATION;
-            frame.decodingTs = frame.presentationTs;
-            frame.index++;
+STATUS addChannelTracks(PSampleChannel pChannel, PScheduler pScheduler, UINT64 pacerStartTime, PACER_LATE_POLICY latePolicy,
+                        UINT64 lateThreshold, UINT64 audioCoalesceWindow, UINT64 videoCoalesceWindow)
+{
+    STATUS retStatus = STATUS_SUCCESS;
 
-            audioFileIndex++;
-            if(audioFileIndex == NUMBER_OF_AAC_FRAME_FILES)
-                audioFileIndex = 0;
+    pChannel->videoSource.pChannel = pChannel;
+    pChannel->audioSource.pChannel = pChannel;
+    if (!pChannel->backfill) {
+        pChannel->streamStartTime = captureClockGetWallTime(pChannel->pCaptureClock, pacerStartTime);
+    }
+    // both tracks slew towards the same capture clock, which keeps them aligned
+    captureTrackClockInit(&pChannel->videoSource.clock, pChannel->pCaptureClock, DEFAULT_CAPTURE_CLOCK_MAX_SLEW_PPM,
+                          DEFAULT_CAPTURE_CLOCK_DISCONTINUITY);
+    captureTrackClockInit(&pChannel->audioSource.clock, pChannel->pCaptureClock, DEFAULT_CAPTURE_CLOCK_MAX_SLEW_PPM,
+                          DEFAULT_CAPTURE_CLOCK_DISCONTINUITY);
 
-            SAFE_MEMFREE(data->audioFrames.buffer);
+    if (pChannel->pConfig->videoInputPath[0] != '\0') {
+        // live frames are put as soon as they arrive, the reader wakes the scheduler up
+        CHK_STATUS(schedulerTrackInit(&pChannel->videoTrack, (PCHAR) "Video", DEFAULT_VIDEO_TRACK_ID, getLiveFrame, putLiveFrame,
+                                      (UINT64) &pChannel->videoSource));
+        CHK_STATUS(schedulerAddTrack(pScheduler, &pChannel->videoTrack));
+    } else {
+        CHK_STATUS(frameArchiveCursorInit(pChannel->pFrameArchive, DEFAULT_VIDEO_TRACK_ID, &pChannel->videoSource.cursor));
+        CHK_STATUS(schedulerTrackInit(&pChannel->videoTrack, (PCHAR) "Video", DEFAULT_VIDEO_TRACK_ID, getArchiveFrame, putArchiveFrame,
+                                      (UINT64) &pChannel->videoSource));
+        // a backfill is not paced, its scheduler puts the frames as fast as they are taken
+        if (!pChannel->backfill) {
+            CHK_STATUS(schedulerTrackSetPacing(&pChannel->videoTrack, pacerStartTime, latePolicy, lateThreshold));
+            CHK_STATUS(schedulerTrackSetCoalescing(&pChannel->videoTrack, videoCoalesceWindow));
+        }
+        CHK_STATUS(schedulerAddTrack(pScheduler, &pChannel->videoTrack));
+    }
 
-            // synchronize putKinesisVideoFrame to running time
-            runningTime = defaultGetTime() - data->streamStartTime;
-            if (runningTime < frame.presentationTs) {
-                THREAD_SLEEP(frame.presentationTs - runningTime);
-            }
+    if (channelHasAudio(pChannel)) {
+        CHK_STATUS(frameArchiveCursorInit(pChannel->pFrameArchive, DEFAULT_AUDIO_TRACK_ID, &pChannel->audioSource.cursor));
+        CHK_STATUS(schedulerTrackInit(&pChannel->audioTrack, (PCHAR) "Audio", DEFAULT_AUDIO_TRACK_ID, getArchiveFrame, putArchiveFrame,
+                                      (UINT64) &pChannel->audioSource));
+        if (!pChannel->backfill) {
+            // both tracks share one anchor so their deadlines stay aligned
+            CHK_STATUS(schedulerTrackSetPacing(&pChannel->audioTrack, pacerStartTime, latePolicy, lateThreshold));
+            // the small audio frames ride along on the wakeups of the video frames
+            CHK_STATUS(schedulerTrackSetCoalescing(&pChannel->audioTrack, audioCoalesceWindow));
         }
+        // no audio can be put until first video frame is put
+        pChannel->audioTrack.pDependency = &pChannel->videoTrack;
+        CHK_STATUS(schedulerAddTrack(pScheduler, &pChannel->audioTrack));
+    }
+
+    if (pChannel->pSpool != NULL) {
+        // on the scheduler of the live tracks, spooling and replay never run at the same time
+        CHK_STATUS(schedulerTrackInit(&pChannel->spoolTrack, (PCHAR) "Spool", DEFAULT_VIDEO_TRACK_ID, getSpoolFrame, putSpoolFrame,
+                                      (UINT64) pChannel));
+        // replay is paced faster than real time, a backlog goes out back to back
+        CHK_STATUS(schedulerTrackSetPacing(&pChannel->spoolTrack, pacerStartTime, PACER_LATE_POLICY_CATCH_UP, lateThreshold));
+        CHK_STATUS(schedulerAddTrack(pScheduler, &pChannel->spoolTrack));
     }
 
 CleanUp:
 
-    if (retStatus != STATUS_SUCCESS) {
-        printf("putAudioFrameRoutine failed with 0x%08x", retStatus);
+    return retStatus;
+}
+
+VOID printChannelStats(PSampleChannel pChannel, UINT64 duration)
+{
+    AnnexBReaderStats annexBStats;
+
+    channelMetricsPrintSummary(&pChannel->metrics, pChannel->pConfig->name, duration);
+    channelMetricsPrintStartup(&pChannel->metrics, pChannel->pConfig->name);
+    admissionPrintStats(&pChannel->admission);
+    spoolPrintStats(pChannel->pSpool, pChannel->pConfig->name);
+    if (pChannel->fragmentControl) {
+        fragmentControllerPrintStats(&pChannel->fragmentController, pChannel->pConfig->name);
+    }
+    encoderControlPrintStats(pChannel->pEncoderControl, pChannel->pConfig->name);
+    if (pChannel->bitrateControl) {
+        bandwidthEstimatorPrintStats(&pChannel->bandwidthEstimator, pChannel->pConfig->name);
+    }
+    recoveryPrintStats(&pChannel->recovery);
+    segmentWatcherPrintStats(pChannel->pSegmentWatcher, pChannel->pConfig->name);
+    if (pChannel->captureTimestamps) {
+        captureTrackClockPrintStats(&pChannel->videoSource.clock, pChannel->pConfig->name, (PCHAR) "video");
+        if (channelHasAudio(pChannel)) {
+            captureTrackClockPrintStats(&pChannel->audioSource.clock, pChannel->pConfig->name, (PCHAR) "audio");
+        }
     }
 
-    return (PVOID) (ULONG_PTR) retStatus;
+    if (pChannel->pAnnexBReader != NULL) {
+        annexBReaderGetStats(pChannel->pAnnexBReader, &annexBStats);
+        printf("Annex-B splitter: %" PRIu64 " frames, %" PRIu64 " key frames, %" PRIu64 " dropped oversized and %" PRIu64
+               " after them up to the next key frame, %" PRIu64 " KB read\n",
+               annexBStats.accessUnits, annexBStats.keyFrames, annexBStats.droppedOversizedFrames, annexBStats.droppedDependentFrames,
+               annexBStats.bytesRead >> 10);
+        printf("Annex-B splitter: scanned %" PRIu64 " MB/s per core, ingest thread used %.3f%% of a core\n",
+               annexBStats.scanCpuTimeNs == 0 ? 0 : annexBStats.bytesRead * 1000 / annexBStats.scanCpuTimeNs,
+               annexBStats.threadWallTimeNs == 0 ? 0.0 : 100.0 * annexBStats.threadCpuTimeNs / annexBStats.threadWallTimeNs);
+    } else if (!pChannel->backfill) {
+        pacerPrintStats(&pChannel->videoTrack.pacer);
+        if (channelHasAudio(pChannel)) {
+            pacerPrintStats(&pChannel->audioTrack.pacer);
+        }
+    }
 }
 
-INT32 main(INT32 argc, CHAR *argv[])
+INT32 KVS_MAIN(INT32 argc, CHAR *argv[])
 {
     PDeviceInfo pDeviceInfo = NULL;
-    PStreamInfo pStreamInfo = NULL;
     PClientCallbacks pClientCallbacks = NULL;
     PStreamCallbacks pStreamCallbacks = NULL;
+    ProducerCallbacks producerCallbacks;
+    SampleCustomData data;
     CLIENT_HANDLE clientHandle = INVALID_CLIENT_HANDLE_VALUE;
-    STREAM_HANDLE streamHandle = INVALID_STREAM_HANDLE_VALUE;
     STATUS retStatus = STATUS_SUCCESS;
     PCHAR accessKey = NULL, secretKey = NULL, sessionToken = NULL, region = NULL, cacertPath = NULL;
-    PCHAR streamName = DEFAULT_CHANNEL_NAME, mediaDirectory = DEFAULT_MEDIA_DIRECTORY;
-    UINT64 streamStopTime, fileSize = 0, choice, option_index = 0;
-    UINT64 streamingDuration = DEFAULT_STREAM_DURATION, bufferSize = DEFAULT_STORAGE_SIZE;
-    TID audioSendTid, videoSendTid;
-    PTrackInfo pAudioTrack = NULL;
-    BYTE audioCpd[KVS_AAC_CPD_SIZE_BYTE];
+    PCHAR mediaDirectory = DEFAULT_MEDIA_DIRECTORY, metricsAddress = NULL, endpoint = NULL, startupCachePath = NULL, spoolDirectory = NULL;
+    PCHAR encoderControlDirectory = NULL, spoolStreamSuffix = NULL;
+    PAuthCallbacks pAuthCallbacks = NULL;
+    PMetricsServer pMetricsServer = NULL;
+    INT32 choice, option_index = 0;
+    UINT64 streamingDuration = DEFAULT_STREAM_DURATION, bufferSize = DEFAULT_STORAGE_SIZE, maxFrameSize = DEFAULT_ANNEXB_MAX_FRAME_SIZE;
+    UINT64 lateThreshold = DEFAULT_PACER_LATE_THRESHOLD, pacerStartTime = 0, workerCount = DEFAULT_CHANNEL_WORKER_COUNT;
+    UINT64 outageDuration = 0, ramCeiling = DEFAULT_SIZING_RAM_CEILING, warmUpDuration = DEFAULT_SIZING_WARM_UP_DURATION;
+    UINT64 bufferDuration = DEFAULT_BUFFER_DURATION, replayDuration = 0, startupCacheTtl = DEFAULT_STARTUP_CACHE_TTL;
+    UINT64 spoolSize = DEFAULT_SPOOL_SIZE, spoolWriteBudget = DEFAULT_SPOOL_WRITE_BUDGET, spoolReplaySpeed = DEFAULT_SPOOL_REPLAY_SPEED;
+    UINT64 audioCoalesceWindow = 0, videoCoalesceWindow = 0;
+    UINT64 minFragmentDuration = 0, maxFragmentDuration = 0, fragmentOverhead = DEFAULT_FRAGMENT_OVERHEAD_PERCENT;
+    UINT64 backfillStartTime = 0, stopTime, elapsed, segmentFrameRate = DEFAULT_ANNEXB_SEGMENT_FRAME_RATE;
+    UINT64 memoryArenaSize = DEFAULT_MEMORY_ARENA_SIZE, minBitrate = 0, maxBitrate = 0;
+    UINT64 recoveryBaseBackoff = DEFAULT_RECOVERY_BASE_BACKOFF, recoveryMaxBackoff = DEFAULT_RECOVERY_MAX_BACKOFF;
+    UINT64 startTime = pacerGetTime();
+    CHAR spoolPath[MAX_PATH_LEN + 1], encoderControlPath[MAX_PATH_LEN + 1];
+    CaptureClock captureClock;
+    PACER_LATE_POLICY latePolicy = PACER_LATE_POLICY_CATCH_UP;
+    SEGMENT_DONE_ACTION segmentDoneAction = SEGMENT_DONE_ACTION_KEEP;
+    ThreadPlacement putPlacement, networkPlacement;
+    CHAR putPlacementText[128], networkPlacementText[128];
+    PChannelConfig pConfigs = NULL, pConfig;
+    PSampleChannel pChannels = NULL, pChannel;
+    PScheduler pSchedulers[MAX_CHANNEL_COUNT];
+    PSizingSample pSamples = NULL;
+    PFramePool pFramePool = NULL;
+    PStartupCache pStartupCache = NULL;
+    PRecovery pRecovery = NULL;
+    StartupCacheStats startupCacheStats;
+    FramePoolClassConfig poolClasses[FRAME_POOL_MAX_CLASS_COUNT];
+    UINT32 poolClassCount = 0, liveCount = 0;
+    SizingPlan plan;
+    UINT32 channelCount = 0, logLevel = DEFAULT_LOG_LEVEL, i, j;
+    BOOL asyncLog = TRUE, captureTimestamps = FALSE, lockMemory = FALSE;
 
-    SampleCustomData data;
+    // the one mapping of the monotonic clock onto wall time for the whole run
+    captureClockInit(&captureClock);
+    MEMSET(pSchedulers, 0x00, SIZEOF(pSchedulers));
+    MEMSET(&data, 0x00, SIZEOF(SampleCustomData));
+    MEMSET(&putPlacement, 0x00, SIZEOF(putPlacement));
+    MEMSET(&networkPlacement, 0x00, SIZEOF(networkPlacement));
+    data.startupLock = INVALID_MUTEX_VALUE;
+    data.metricsSources.ppSchedulers = pSchedulers;
+    CHK(NULL != (pConfigs = (PChannelConfig) MEMCALLOC(MAX_CHANNEL_COUNT, SIZEOF(ChannelConfig))), STATUS_NOT_ENOUGH_MEMORY);
 
-    while ((choice = getopt_long(argc, argv, ":n:d:D:s:h",
+    while ((choice = getopt_long(argc, argv, ":n:c:w:M:e:d:D:s:A:r:W:a:i:m:P:l:t:L:v:S:T:o:O:B:R:Q:C:k:F:G:E:b:g:f:p:y:N:Kx:u:j:h",
                  long_options, &option_index)) != -1) {
         switch (choice) {
         case 0:
@@ -271,21 +1494,248 @@ INT32 main(INT32 argc, CHAR *argv[])
             printf ("\n");
             break;
         case 'n':
-            streamName = optarg;
-            printf ("KVS channel name is '%s'\n", streamName);
+            if (STRLEN(optarg) > MAX_STREAM_NAME_LEN) {
+                fprintf(stderr, "%s: channel name '%s' is too long\n", argv[0], optarg);
+                displayUsage(1);
+            }
+            pConfig = getOptionChannel(pConfigs, &channelCount, TRUE);
+            STRCPY(pConfig->name, optarg);
+            printf ("KVS channel name is '%s'\n", optarg);
+            break;
+        case 'c':
+            if (STATUS_FAILED(channelListParseFile(optarg, pConfigs, MAX_CHANNEL_COUNT, &channelCount))) {
+                fprintf(stderr, "%s: failed to read channel list '%s'\n", argv[0], optarg);
+                displayUsage(1);
+            }
+            break;
+        case 'w':
+            CHK_STATUS(STRTOUI64(optarg, NULL, 10, &workerCount));
+            if (workerCount == 0) {
+                displayUsage(1);
+            }
+            break;
+        case 'M':
+            metricsAddress = optarg;
+            break;
+        case 'e':
+            endpoint = optarg;
+            printf ("KVS control plane endpoint is '%s'\n", endpoint);
             break;
         case 'd':
-            mediaDirectory = optarg;
-            printf ("KVS stream media from '%s'\n", mediaDirectory);
+            // before any channel it is the default for channels without a source of their own
+            if (channelCount == 0) {
+                mediaDirectory = optarg;
+            } else {
+                setOptionPath(pConfigs[channelCount - 1].directory, optarg);
+            }
+            printf ("KVS stream media from '%s'\n", optarg);
             break;
         case 'D':
             CHK_STATUS(STRTOUI64(optarg, NULL, 10, &streamingDuration));
-            printf ("KVS streaming for %d seconds\n", streamingDuration);
+            printf ("KVS streaming for %" PRIu64 " seconds\n", streamingDuration);
             break;
         case 's':
             CHK_STATUS(STRTOUI64(optarg, NULL, 10, &bufferSize));
             bufferSize *= 1024;
-            printf ("KVS video buffer size is %d Bytes\n", bufferSize);
+            printf ("KVS video buffer size is %" PRIu64 " Bytes\n", bufferSize);
+            break;
+        case 'A':
+            CHK_STATUS(STRTOUI64(optarg, NULL, 10, &outageDuration));
+            outageDuration *= HUNDREDS_OF_NANOS_IN_A_SECOND;
+            break;
+        case 'r':
+            CHK_STATUS(STRTOUI64(optarg, NULL, 10, &ramCeiling));
+            ramCeiling *= 1024;
+            break;
+        case 'W':
+            CHK_STATUS(STRTOUI64(optarg, NULL, 10, &warmUpDuration));
+            warmUpDuration *= HUNDREDS_OF_NANOS_IN_A_SECOND;
+            break;
+        case 'a':
+            setOptionPath(getOptionChannel(pConfigs, &channelCount, FALSE)->archivePath, optarg);
+            printf ("KVS stream frames from archive '%s'\n", optarg);
+            break;
+        case 'i':
+            setOptionPath(getOptionChannel(pConfigs, &channelCount, FALSE)->videoInputPath, optarg);
+            printf ("KVS stream live video from '%s'\n", optarg);
+            break;
+        case 'm':
+            CHK_STATUS(STRTOUI64(optarg, NULL, 10, &maxFrameSize));
+            CHK(maxFrameSize != 0 && maxFrameSize <= MAX_UINT32 / 1024, STATUS_INVALID_ARG);
+            maxFrameSize *= 1024;
+            break;
+        case 'P':
+            if (STATUS_FAILED(framePoolParseConfig(optarg, poolClasses, &poolClassCount))) {
+                fprintf(stderr, "%s: invalid frame pool '%s'\n", argv[0], optarg);
+                displayUsage(1);
+            }
+            break;
+        case 'l':
+            if (STATUS_FAILED(pacerParseLatePolicy(optarg, &latePolicy))) {
+                fprintf(stderr, "%s: unknown late policy '%s'\n", argv[0], optarg);
+                displayUsage(1);
+            }
+            break;
+        case 't':
+            CHK_STATUS(STRTOUI64(optarg, NULL, 10, &lateThreshold));
+            lateThreshold *= HUNDREDS_OF_NANOS_IN_A_MILLISECOND;
+            break;
+        case 'L':
+            if (STRCMPI(optarg, "async") == 0 || STRCMPI(optarg, "sync") == 0) {
+                asyncLog = STRCMPI(optarg, "async") == 0;
+            } else {
+                fprintf(stderr, "%s: unknown log mode '%s'\n", argv[0], optarg);
+                displayUsage(1);
+            }
+            break;
+        case 'v':
+            if (STATUS_FAILED(parseLogLevel(optarg, &logLevel))) {
+                fprintf(stderr, "%s: unknown log level '%s'\n", argv[0], optarg);
+                displayUsage(1);
+            }
+            break;
+        case 'S':
+#ifdef KVS_NO_STARTUP_CACHE
+            fprintf(stderr, "%s: --startup-cache needs the SDK linked statically, this kvs was built against a shared one\n", argv[0]);
+            displayUsage(1);
+#endif
+            startupCachePath = optarg;
+            break;
+        case 'T':
+            CHK_STATUS(STRTOUI64(optarg, NULL, 10, &startupCacheTtl));
+            if (startupCacheTtl == 0) {
+                displayUsage(1);
+            }
+            startupCacheTtl *= HUNDREDS_OF_NANOS_IN_A_SECOND;
+            break;
+        case 'o':
+            spoolDirectory = optarg;
+            break;
+        case 'O':
+            CHK_STATUS(STRTOUI64(optarg, NULL, 10, &spoolSize));
+            spoolSize *= 1024 * 1024;
+            break;
+        case 'B':
+            CHK_STATUS(STRTOUI64(optarg, NULL, 10, &spoolWriteBudget));
+            spoolWriteBudget *= 1024;
+            break;
+        case 'R':
+            CHK_STATUS(STRTOUI64(optarg, NULL, 10, &spoolReplaySpeed));
+            if (spoolReplaySpeed == 0) {
+                displayUsage(1);
+            }
+            break;
+        case 'Q':
+            spoolStreamSuffix = optarg;
+            break;
+        case 'C':
+            if (STRCMPI(optarg, "relative") == 0 || STRCMPI(optarg, "capture") == 0) {
+                captureTimestamps = STRCMPI(optarg, "capture") == 0;
+            } else {
+                fprintf(stderr, "%s: unknown timestamp mode '%s'\n", argv[0], optarg);
+                displayUsage(1);
+            }
+            break;
+        case 'k':
+            if (STATUS_FAILED(parseCoalesce(optarg, &audioCoalesceWindow, &videoCoalesceWindow))) {
+                fprintf(stderr, "%s: invalid coalescing windows '%s'\n", argv[0], optarg);
+                displayUsage(1);
+            }
+            break;
+        case 'F':
+            if (STRCMPI(optarg, "auto") == 0) {
+                minFragmentDuration = DEFAULT_FRAGMENT_MIN_DURATION;
+                maxFragmentDuration = DEFAULT_FRAGMENT_MAX_DURATION;
+            } else if (STATUS_SUCCEEDED(STRTOUI64(optarg, NULL, 10, &minFragmentDuration)) && minFragmentDuration != 0 &&
+                       minFragmentDuration <= MAX_UINT32) {
+                minFragmentDuration *= HUNDREDS_OF_NANOS_IN_A_MILLISECOND;
+                maxFragmentDuration = minFragmentDuration;
+            } else {
+                fprintf(stderr, "%s: invalid fragment duration '%s'\n", argv[0], optarg);
+                displayUsage(1);
+            }
+            break;
+        case 'G':
+            CHK_STATUS(STRTOUI64(optarg, NULL, 10, &fragmentOverhead));
+            if (fragmentOverhead == 0 || fragmentOverhead > 100) {
+                displayUsage(1);
+            }
+            break;
+        case 'E':
+            encoderControlDirectory = optarg;
+            break;
+        case 'b':
+            CHK_STATUS(STRTOUI64(optarg, NULL, 10, &backfillStartTime));
+            if (backfillStartTime == 0 || backfillStartTime > MAX_UINT64 / HUNDREDS_OF_NANOS_IN_A_SECOND) {
+                displayUsage(1);
+            }
+            backfillStartTime *= HUNDREDS_OF_NANOS_IN_A_SECOND;
+            break;
+        case 'g':
+            if (STRCMPI(optarg, "keep") == 0) {
+                segmentDoneAction = SEGMENT_DONE_ACTION_KEEP;
+            } else if (STRCMPI(optarg, "delete") == 0) {
+                segmentDoneAction = SEGMENT_DONE_ACTION_DELETE;
+            } else if (STRCMPI(optarg, "mark") == 0) {
+                segmentDoneAction = SEGMENT_DONE_ACTION_MARK;
+            } else {
+                fprintf(stderr, "%s: unknown segment action '%s'\n", argv[0], optarg);
+                displayUsage(1);
+            }
+            break;
+        case 'f':
+            CHK_STATUS(STRTOUI64(optarg, NULL, 10, &segmentFrameRate));
+            if (segmentFrameRate == 0 || segmentFrameRate > HUNDREDS_OF_NANOS_IN_A_SECOND) {
+                displayUsage(1);
+            }
+            break;
+        case 'p':
+            if (STATUS_FAILED(placementParseCpus(optarg, &putPlacement))) {
+                fprintf(stderr, "%s: invalid CPU list '%s'\n", argv[0], optarg);
+                displayUsage(1);
+            }
+            break;
+        case 'y':
+            if (STATUS_FAILED(placementParsePolicy(optarg, &putPlacement))) {
+                fprintf(stderr, "%s: invalid policy '%s'\n", argv[0], optarg);
+                displayUsage(1);
+            }
+            break;
+        case 'N':
+            if (STATUS_FAILED(placementParseCpus(optarg, &networkPlacement))) {
+                fprintf(stderr, "%s: invalid CPU list '%s'\n", argv[0], optarg);
+                displayUsage(1);
+            }
+            break;
+        case 'K':
+            lockMemory = TRUE;
+            break;
+        case 'x':
+            CHK_STATUS(STRTOUI64(optarg, NULL, 10, &memoryArenaSize));
+            memoryArenaSize *= 1024 * 1024;
+            break;
+        case 'u':
+            if (STRCHR(optarg, '-') == NULL || STATUS_FAILED(STRTOUI64(optarg, STRCHR(optarg, '-'), 10, &minBitrate)) ||
+                STATUS_FAILED(STRTOUI64(STRCHR(optarg, '-') + 1, NULL, 10, &maxBitrate)) || minBitrate == 0 || maxBitrate < minBitrate ||
+                maxBitrate > MAX_UINT32) {
+                fprintf(stderr, "%s: invalid bitrate range '%s'\n", argv[0], optarg);
+                displayUsage(1);
+            }
+            minBitrate *= 1000;
+            maxBitrate *= 1000;
+            break;
+        case 'j':
+            if (STRCMP(optarg, "off") == 0) {
+                recoveryBaseBackoff = 0;
+            } else if (STRCHR(optarg, '-') == NULL || STATUS_FAILED(STRTOUI64(optarg, STRCHR(optarg, '-'), 10, &recoveryBaseBackoff)) ||
+                       STATUS_FAILED(STRTOUI64(STRCHR(optarg, '-') + 1, NULL, 10, &recoveryMaxBackoff)) || recoveryBaseBackoff == 0 ||
+                       recoveryMaxBackoff < recoveryBaseBackoff) {
+                fprintf(stderr, "%s: invalid recovery backoff '%s'\n", argv[0], optarg);
+                displayUsage(1);
+            } else {
+                recoveryBaseBackoff *= HUNDREDS_OF_NANOS_IN_A_MILLISECOND;
+                recoveryMaxBackoff *= HUNDREDS_OF_NANOS_IN_A_MILLISECOND;
+            }
             break;
         case 'h':
             displayUsage(0);
@@ -305,6 +1755,29 @@ INT32 main(INT32 argc, CHAR *argv[])
         }
     }
 
+    if (channelCount == 0) {
+        channelCount = 1;
+    }
+
+    for (i = 0; i < channelCount; i++) {
+        if (pConfigs[i].name[0] == '\0') {
+            if (channelCount != 1) {
+                fprintf(stderr, "%s: every channel needs a name when streaming several channels\n", argv[0]);
+                displayUsage(1);
+            }
+            STRCPY(pConfigs[i].name, DEFAULT_CHANNEL_NAME);
+        }
+
+        for (j = 0; j < i; j++) {
+            if (STRCMP(pConfigs[i].name, pConfigs[j].name) == 0) {
+                fprintf(stderr, "%s: channel '%s' is given twice\n", argv[0], pConfigs[i].name);
+                displayUsage(1);
+            }
+        }
+
+        CHK_STATUS(channelConfigResolve(&pConfigs[i], mediaDirectory));
+    }
+
     if ((accessKey = getenv(ACCESS_KEY_ENV_VAR)) == NULL || (secretKey = getenv(SECRET_KEY_ENV_VAR)) == NULL) {
         printf("Error missing credentials\n");
         CHK(FALSE, STATUS_INVALID_ARG);
@@ -315,14 +1788,131 @@ INT32 main(INT32 argc, CHAR *argv[])
         region = (PCHAR) DEFAULT_AWS_REGION;
     }
 
-    MEMSET(&data, 0x00, SIZEOF(SampleCustomData));
-    STRNCPY(data.sampleDir, mediaDirectory, MAX_PATH_LEN);
-    if (data.sampleDir[STRLEN(data.sampleDir) - 1] == '/') {
-        data.sampleDir[STRLEN(data.sampleDir) - 1] = '\0';
+    for (i = 0; i < channelCount; i++) {
+        if (pConfigs[i].videoInputPath[0] != '\0') {
+            liveCount++;
+        }
+    }
+
+    if (backfillStartTime != 0 && (liveCount != 0 || spoolDirectory != NULL || captureTimestamps)) {
+        // a live input has no recording time and nothing is dropped to spool, the timestamps are the recording's
+        fprintf(stderr, "%s: --backfill takes archives only and no --video-input, --spool or '--timestamps capture'\n", argv[0]);
+        displayUsage(1);
+    }
+
+    if (spoolDirectory != NULL && spoolStreamSuffix == NULL) {
+        // KVS takes no fragment older than the last one, the outage can not be filled in on the live stream
+        fprintf(stderr, "%s: --spool replays to a stream of its own, name it with --spool-stream\n", argv[0]);
+        displayUsage(1);
+    }
+
+    if (maxBitrate != 0 && encoderControlDirectory == NULL) {
+        fprintf(stderr, "%s: --bitrate-range asks the encoders of --encoder-control\n", argv[0]);
+        displayUsage(1);
+    }
+
+    if (memoryArenaSize != 0) {
+        // before the SDK allocates anything, what was allocated so far goes back to the system allocator
+        CHK_STATUS(memoryArenaStart(memoryArenaSize));
+    }
+    // threads left untagged are the SDK's, counted as sdk
+    memoryArenaSetTag(MEMORY_TAG_APP);
+
+    // every thread created from here on inherits the network CPUs, the SDK's included, only the put threads are moved off
+    CHK_STATUS(placementApply(&networkPlacement, GETTID()));
+    if (putPlacement.cpuCount != 0 || putPlacement.policy != PLACEMENT_POLICY_DEFAULT || networkPlacement.cpuCount != 0 || lockMemory) {
+        placementDescribe(&putPlacement, putPlacementText, SIZEOF(putPlacementText));
+        placementDescribe(&networkPlacement, networkPlacementText, SIZEOF(networkPlacementText));
+        printf("Put threads: %s, network threads: %s%s\n", putPlacementText, networkPlacementText, lockMemory ? ", memory locked" : "");
+    }
+
+    if (liveCount != 0) {
+        // every live frame lives in one of these buffers from the read to the end of the put
+        if (poolClassCount == 0) {
+            framePoolDefaultConfig((UINT32) maxFrameSize, liveCount, poolClasses, &poolClassCount);
+        }
+        memoryArenaSetTag(MEMORY_TAG_FRAMES);
+        CHK_STATUS(createFramePool(poolClasses, poolClassCount, &pFramePool));
+        memoryArenaSetTag(MEMORY_TAG_APP);
+        data.pFramePool = pFramePool;
+    }
+
+    CHK(NULL != (pChannels = (PSampleChannel) MEMCALLOC(channelCount, SIZEOF(SampleChannel))), STATUS_NOT_ENOUGH_MEMORY);
+    for (i = 0; i < channelCount; i++) {
+        pChannel = &pChannels[i];
+        pChannel->pConfig = &pConfigs[i];
+        pChannel->startTime = startTime;
+        pChannel->streamHandle = INVALID_STREAM_HANDLE_VALUE;
+        pChannel->spoolStreamHandle = INVALID_STREAM_HANDLE_VALUE;
+        pChannel->replaySpeed = spoolReplaySpeed;
+        pChannel->pCaptureClock = &captureClock;
+        pChannel->captureTimestamps = captureTimestamps;
+        pChannel->backfill = backfillStartTime != 0;
+        pChannel->streamStartTime = backfillStartTime;
+        CHK_STATUS(admissionInit(&pChannel->admission, DEFAULT_ADMISSION_HOLD_TIME, channelHasHeadroom, (UINT64) pChannel));
+        channelMetricsInit(&pChannel->metrics);
+        if (pConfigs[i].videoInputPath[0] == '\0') {
+            // map all the frames once, the put routines never touch the file system
+            memoryArenaSetTag(MEMORY_TAG_FRAMES);
+            CHK_STATUS(openFrameArchive(pConfigs[i].archivePath, &pChannel->pFrameArchive));
+            memoryArenaSetTag(MEMORY_TAG_APP);
+        } else {
+            // the reader only wakes the scheduler up once the track is added to one
+            CHK_STATUS(createAnnexBReader(pConfigs[i].videoInputPath, HUNDREDS_OF_NANOS_IN_A_SECOND / segmentFrameRate, pFramePool,
+                                          liveFrameReady, (UINT64) &pChannel->videoTrack, &pChannel->pAnnexBReader));
+            CHK_STATUS(placementApply(&putPlacement, pChannel->pAnnexBReader->ingestTid));
+            // nothing is retired before the first ack
+            if ((pChannel->pSegmentWatcher = pChannel->pAnnexBReader->pWatcher) != NULL) {
+                pChannel->pSegmentWatcher->doneAction = segmentDoneAction;
+            }
+        }
+
+        if (spoolDirectory != NULL) {
+            // an outage longer than the content store holds goes to flash instead of being dropped
+            CHK(SNPRINTF(spoolPath, SIZEOF(spoolPath), "%s/%s%s", spoolDirectory, pConfigs[i].name, SPOOL_FILE_EXTENSION) <
+                    (INT32) SIZEOF(spoolPath),
+                STATUS_INVALID_ARG_LEN);
+            memoryArenaSetTag(MEMORY_TAG_FRAMES);
+            CHK_STATUS(createSpool(spoolPath, spoolSize, spoolWriteBudget, &pChannel->pSpool));
+            memoryArenaSetTag(MEMORY_TAG_APP);
+            CHK(SNPRINTF(pChannel->spoolStreamName, SIZEOF(pChannel->spoolStreamName), "%s%s", pConfigs[i].name, spoolStreamSuffix) <
+                    (INT32) SIZEOF(pChannel->spoolStreamName),
+                STATUS_INVALID_ARG_LEN);
+        }
+
+        if (minFragmentDuration != 0) {
+            pChannel->fragmentControl = TRUE;
+            fragmentControllerInit(&pChannel->fragmentController, minFragmentDuration, maxFragmentDuration, (UINT32) fragmentOverhead);
+        }
+
+        if (encoderControlDirectory != NULL && pConfigs[i].videoInputPath[0] != '\0') {
+            // the key frames of an archive are set in stone, a live encoder can be asked for others
+            CHK(SNPRINTF(encoderControlPath, SIZEOF(encoderControlPath), "%s/%s%s", encoderControlDirectory, pConfigs[i].name,
+                         ENCODER_CONTROL_FILE_EXTENSION) < (INT32) SIZEOF(encoderControlPath),
+                STATUS_INVALID_ARG_LEN);
+            CHK_STATUS(createEncoderControl(encoderControlPath, &pChannel->pEncoderControl));
+            // a fixed duration is known before the first ack
+            encoderControlSetKeyFrameInterval(pChannel->pEncoderControl, fragmentControllerGetDuration(&pChannel->fragmentController));
+            if (maxBitrate != 0) {
+                pChannel->bitrateControl = TRUE;
+                bandwidthEstimatorInit(&pChannel->bandwidthEstimator, minBitrate, maxBitrate);
+                encoderControlSetBitrate(pChannel->pEncoderControl, bandwidthEstimatorGetBitrate(&pChannel->bandwidthEstimator));
+            }
+        }
     }
 
-    // Get the duration and convert to an integer
-    streamStopTime = defaultGetTime() + streamingDuration*HUNDREDS_OF_NANOS_IN_A_SECOND;
+    if (outageDuration != 0) {
+        CHK(NULL != (pSamples = (PSizingSample) MEMCALLOC(channelCount, SIZEOF(SizingSample))), STATUS_NOT_ENOUGH_MEMORY);
+        CHK_STATUS(measureChannels(pChannels, channelCount, pSamples, warmUpDuration));
+        CHK_STATUS(sizingPlan(pSamples, channelCount, outageDuration, ramCeiling, &plan));
+        sizingPrintPlan(&plan, outageDuration);
+        bufferSize = plan.storageSize;
+        bufferDuration = plan.bufferDuration;
+        replayDuration = plan.replayDuration;
+    } else {
+        // one content store for all the channels, each channel brings its own buffer size
+        bufferSize *= channelCount;
+    }
 
     // default storage size is 128MB. Use setDeviceInfoStorageSize after create to change storage size.
     CHK_STATUS(createDefaultDeviceInfo(&pDeviceInfo));
@@ -332,33 +1922,34 @@ INT32 main(INT32 argc, CHAR *argv[])
                                            MIN_STORAGE_ALLOCATION_SIZE;
     // change storage size.
     CHK_STATUS(setDeviceInfoStorageSize(pDeviceInfo, pDeviceInfo->storageInfo.storageSize));
+    // a spool stream next to every live one
+    pDeviceInfo->streamCount = MAX(pDeviceInfo->streamCount, spoolDirectory != NULL ? 2 * channelCount : channelCount);
     // adjust members of pDeviceInfo here if needed
-    pDeviceInfo->clientInfo.loggerLogLevel = DEFAULT_LOG_LEVEL;
-
-    CHK_STATUS(createRealtimeAudioVideoStreamInfoProvider(streamName, DEFAULT_RETENTION_PERIOD, DEFAULT_BUFFER_DURATION, &pStreamInfo));
-
-    // adjust members of pStreamInfo here if needed
-    // set up audio cpd.
-    pAudioTrack = pStreamInfo->streamCaps.trackInfoList[0].trackId == DEFAULT_AUDIO_TRACK_ID ?
-                  &pStreamInfo->streamCaps.trackInfoList[0] :
-                  &pStreamInfo->streamCaps.trackInfoList[1];
-    // generate audio cpd
-    pAudioTrack->codecPrivateData = audioCpd;
-    pAudioTrack->codecPrivateDataSize = KVS_AAC_CPD_SIZE_BYTE;
-    CHK_STATUS(mkvgenGenerateAacCpd(AAC_LC, AUDIO_TRACK_SAMPLING_RATE, AUDIO_TRACK_CHANNEL_CONFIG, pAudioTrack->codecPrivateData, pAudioTrack->codecPrivateDataSize));
-
-    // use relative time mode. Buffer timestamps start from 0
-    pStreamInfo->streamCaps.absoluteFragmentTimes = FALSE;
-
-    CHK_STATUS(createDefaultCallbacksProviderWithAwsCredentials(accessKey,
-                                                                secretKey,
-                                                                sessionToken,
-                                                                MAX_UINT64,
-                                                                region,
-                                                                cacertPath,
-                                                                NULL,
-                                                                NULL,
-                                                                &pClientCallbacks));
+    pDeviceInfo->clientInfo.loggerLogLevel = logLevel;
+
+    if (endpoint != NULL) {
+        // same chain as the default provider with the control plane URL overridden, e.g. a local mock endpoint
+        CHK_STATUS(createAbstractDefaultCallbacksProvider(DEFAULT_CALLBACK_CHAIN_COUNT,
+                                                          API_CALL_CACHE_TYPE_NONE,
+                                                          ENDPOINT_UPDATE_PERIOD_SENTINEL_VALUE,
+                                                          region,
+                                                          endpoint,
+                                                          cacertPath,
+                                                          NULL,
+                                                          NULL,
+                                                          &pClientCallbacks));
+        CHK_STATUS(createStaticAuthCallbacks(pClientCallbacks, accessKey, secretKey, sessionToken, MAX_UINT64, &pAuthCallbacks));
+    } else {
+        CHK_STATUS(createDefaultCallbacksProviderWithAwsCredentials(accessKey,
+                                                                    secretKey,
+                                                                    sessionToken,
+                                                                    MAX_UINT64,
+                                                                    region,
+                                                                    cacertPath,
+                                                                    NULL,
+                                                                    NULL,
+                                                                    &pClientCallbacks));
+    }
 
     if(NULL != getenv(ENABLE_FILE_LOGGING)) {
         if((retStatus = addFileLoggerPlatformCallbacksProvider(pClientCallbacks,
@@ -370,42 +1961,209 @@ INT32 main(INT32 argc, CHAR *argv[])
         }
     }
 
+    data.pChannels = pChannels;
+    data.channelCount = channelCount;
+    data.startupLock = MUTEX_CREATE(FALSE);
+    CHK(IS_VALID_MUTEX_VALUE(data.startupLock), STATUS_INVALID_OPERATION);
+
+    // backpressure comes from the SDK, frames are dropped a GOP at a time while it lasts
     CHK_STATUS(createStreamCallbacks(&pStreamCallbacks));
+    pStreamCallbacks->customData = (UINT64) &data;
+    pStreamCallbacks->bufferDurationOverflowPressureFn = bufferDurationOverflowPressure;
+    pStreamCallbacks->fragmentAckReceivedFn = fragmentAckReceived;
+    pStreamCallbacks->streamErrorReportFn = streamErrorReport;
+    pStreamCallbacks->droppedFrameReportFn = droppedFrameReport;
+    pStreamCallbacks->streamConnectionStaleFn = streamConnectionStale;
+    pStreamCallbacks->streamReadyFn = streamReady;
     CHK_STATUS(addStreamCallbacks(pClientCallbacks, pStreamCallbacks));
 
-    CHK_STATUS(createKinesisVideoClient(pDeviceInfo, pClientCallbacks, &clientHandle));
-    CHK_STATUS(createKinesisVideoStreamSync(clientHandle, pStreamInfo, &streamHandle));
+    MEMSET(&producerCallbacks, 0x00, SIZEOF(ProducerCallbacks));
+    producerCallbacks.version = PRODUCER_CALLBACKS_CURRENT_VERSION;
+    producerCallbacks.customData = (UINT64) &data;
+    producerCallbacks.storageOverflowPressureFn = storageOverflowPressure;
+    CHK_STATUS(addProducerCallbacks(pClientCallbacks, &producerCallbacks));
+
+    if (startupCachePath != NULL) {
+        // a restart skips describing the streams and looking up their endpoints
+        CHK_STATUS(createStartupCache(startupCachePath, startupCacheTtl, &pStartupCache));
+        CHK_STATUS(startupCacheInstall(pStartupCache, pClientCallbacks));
+        data.pStartupCache = pStartupCache;
+    }
 
-    data.streamStopTime = streamStopTime;
-    data.streamHandle = streamHandle;
+    // the SDK allocates its content store with the client
+    memoryArenaSetTag(MEMORY_TAG_CONTENT_STORE);
+    CHK_STATUS(createKinesisVideoClient(pDeviceInfo, pClientCallbacks, &clientHandle));
+    memoryArenaSetTag(MEMORY_TAG_APP);
     data.clientHandle = clientHandle;
-    data.streamStartTime = defaultGetTime();
-    ATOMIC_STORE_BOOL(&data.firstVideoFramePut, FALSE);
 
-    THREAD_CREATE(&videoSendTid, putVideoFrameRoutine,
-                          (PVOID) &data);
-    THREAD_CREATE(&audioSendTid, putAudioFrameRoutine,
-                          (PVOID) &data);
+    // in front of whatever logger the client ended up with, the console or the file logger
+    if (asyncLog) {
+        memoryArenaSetTag(MEMORY_TAG_LOGGING);
+        CHK_STATUS(asyncLogStart());
+        memoryArenaSetTag(MEMORY_TAG_APP);
+    }
+
+    if (recoveryBaseBackoff != 0) {
+        CHK_STATUS(createRecovery(recoveryBaseBackoff, recoveryMaxBackoff, &pRecovery));
+        data.pRecovery = pRecovery;
+    }
+
+    // the archives are mapped and the live inputs are being read while the streams get ready
+    for (i = 0; i < channelCount; i++) {
+        if (pRecovery != NULL) {
+            CHK_STATUS(recoveryAddStream(pRecovery, &pChannels[i].recovery, pChannels[i].pConfig->name, resetChannelStream,
+                                         (UINT64) &pChannels[i]));
+        }
+        CHK_STATUS(createChannelStream(&data, &pChannels[i], clientHandle, bufferDuration, replayDuration));
+    }
+
+    if (metricsAddress != NULL) {
+        setMetricsSources(&data);
+        CHK_STATUS(createMetricsServer(metricsAddress, metricsWriteSources, metricsSampleSources, (UINT64) &data.metricsSources,
+                                       &pMetricsServer));
+        printf("Serving metrics on %s\n", metricsAddress);
+    }
+
+    if (lockMemory) {
+        // the archives, the frame pool and the content store are mapped by now, the scheduler stacks are faulted in as created
+        CHK_STATUS(placementLockMemory(DEFAULT_PLACEMENT_HEAP_RESERVE));
+    }
+
+    // every put happens on a bounded set of scheduler threads, each one sleeps until the next frame of its channels is due
+    workerCount = MIN(workerCount, channelCount);
+    pacerStartTime = pacerGetTime();
+    // a backfill runs until the archives are put
+    stopTime = backfillStartTime != 0 ? MAX_UINT64 : pacerStartTime + streamingDuration * HUNDREDS_OF_NANOS_IN_A_SECOND;
+    for (i = 0; i < workerCount; i++) {
+        CHK_STATUS(createScheduler(stopTime, &pSchedulers[i]));
+        if (backfillStartTime != 0) {
+            CHK_STATUS(schedulerSetFreeRunning(pSchedulers[i]));
+        }
+        ATOMIC_STORE(&data.metricsSources.schedulerCount, i + 1);
+    }
+
+    for (i = 0; i < channelCount; i++) {
+        CHK_STATUS(addChannelTracks(&pChannels[i], pSchedulers[i % workerCount], pacerStartTime, latePolicy, lateThreshold,
+                                    audioCoalesceWindow, videoCoalesceWindow));
+    }
+
+    for (i = 0; i < workerCount; i++) {
+        CHK_STATUS(schedulerStart(pSchedulers[i]));
+        CHK_STATUS(placementApply(&putPlacement, pSchedulers[i]->tid));
+    }
+
+    for (i = 0; i < workerCount; i++) {
+        schedulerJoin(pSchedulers[i]);
+    }
+
+    // whatever the put threads logged goes before the summaries
+    asyncLogFlush();
+    for (i = 0; i < workerCount; i++) {
+        schedulerPrintStats(pSchedulers[i], i, pacerGetTime() - pacerStartTime);
+    }
+
+    for (i = 0; i < channelCount; i++) {
+        pChannel = &pChannels[i];
+        if (pChannel->pAnnexBReader != NULL) {
+            // hand back the unit still held by the track so the ingest thread can wind down
+            if (pChannel->videoSource.pUnit != NULL) {
+                annexBReaderRelease(pChannel->pAnnexBReader);
+            }
+
+            annexBReaderStop(pChannel->pAnnexBReader);
+        }
+
+        printChannelStats(pChannel, pacerGetTime() - pacerStartTime);
+    }
+
+    if (pFramePool != NULL) {
+        framePoolPrintStats(pFramePool);
+    }
+
+    asyncLogPrintStats();
+    memoryArenaPrintStats();
 
-    THREAD_JOIN(videoSendTid, NULL);
-    THREAD_JOIN(audioSendTid, NULL);
+    if (pStartupCache != NULL) {
+        startupCacheGetStats(pStartupCache, &startupCacheStats);
+        printf("Startup cache: %" PRIu64 " hits, %" PRIu64 " misses, %" PRIu64 " invalidated, %" PRIu64 " saves\n", startupCacheStats.hits,
+               startupCacheStats.misses, startupCacheStats.invalidations, startupCacheStats.saves);
+    }
+
+    channelPrintProcessUsage(channelCount, pacerGetTime() - pacerStartTime);
+
+    // the server samples the streams and the recovery resets them, both go before them
+    freeMetricsServer(&pMetricsServer);
+    freeRecovery(&pRecovery);
+    for (i = 0; i < channelCount; i++) {
+        CHK_STATUS(stopKinesisVideoStreamSync(pChannels[i].streamHandle));
+        CHK_STATUS(freeKinesisVideoStream(&pChannels[i].streamHandle));
+        // whatever was not replayed yet stays behind, the spool starts over on the next run
+        if (pChannels[i].pSpool != NULL) {
+            CHK_STATUS(stopKinesisVideoStreamSync(pChannels[i].spoolStreamHandle));
+            CHK_STATUS(freeKinesisVideoStream(&pChannels[i].spoolStreamHandle));
+        }
+    }
 
-    CHK_STATUS(stopKinesisVideoStreamSync(streamHandle));
-    CHK_STATUS(freeKinesisVideoStream(&streamHandle));
+    // stopping a stream waits for what is left in the content store, the backfill is done only then
+    elapsed = pacerGetTime() - pacerStartTime;
+    for (i = 0; backfillStartTime != 0 && i < channelCount; i++) {
+        printf("Backfill of %s: %.1f s of recording uploaded in %.1f s, %.2fx real time\n", pChannels[i].pConfig->name,
+               (DOUBLE) pChannels[i].backfillMediaTime / 1000, (DOUBLE) elapsed / HUNDREDS_OF_NANOS_IN_A_SECOND,
+               elapsed == 0 ? 0.0 : (DOUBLE) pChannels[i].backfillMediaTime * HUNDREDS_OF_NANOS_IN_A_MILLISECOND / elapsed);
+    }
     CHK_STATUS(freeKinesisVideoClient(&clientHandle));
 
 CleanUp:
 
+    asyncLogFlush();
     if (STATUS_FAILED(retStatus)) {
         printf("Failed with status 0x%08x\n", retStatus);
     }
 
+    // the readers notify the schedulers and the schedulers read from the readers, stop the ingest threads first
+    for (i = 0; pChannels != NULL && i < channelCount; i++) {
+        if (pChannels[i].pAnnexBReader != NULL) {
+            annexBReaderStop(pChannels[i].pAnnexBReader);
+        }
+    }
+
+    for (i = 0; i < MAX_CHANNEL_COUNT; i++) {
+        freeScheduler(&pSchedulers[i]);
+    }
+
+    freeMetricsServer(&pMetricsServer);
+    freeRecovery(&pRecovery);
+
+    for (i = 0; pChannels != NULL && i < channelCount; i++) {
+        freeKinesisVideoStream(&pChannels[i].streamHandle);
+        freeStreamInfoProvider(&pChannels[i].pStreamInfo);
+        if (pChannels[i].pSpool != NULL) {
+            freeKinesisVideoStream(&pChannels[i].spoolStreamHandle);
+        }
+        freeStreamInfoProvider(&pChannels[i].pSpoolStreamInfo);
+        // after the schedulers, the spool is theirs
+        freeSpool(&pChannels[i].pSpool);
+        freeEncoderControl(&pChannels[i].pEncoderControl);
+        closeFrameArchive(&pChannels[i].pFrameArchive);
+        freeAnnexBReader(&pChannels[i].pAnnexBReader);
+    }
+
+    // after the readers, they hand their buffers back
+    freeFramePool(&pFramePool);
 
     freeDeviceInfo(&pDeviceInfo);
-    freeStreamInfoProvider(&pStreamInfo);
-    freeKinesisVideoStream(&streamHandle);
+    SAFE_MEMFREE(pSamples);
     freeKinesisVideoClient(&clientHandle);
+    // the client callbacks went with the client
+    freeStartupCache(&pStartupCache);
+    if (IS_VALID_MUTEX_VALUE(data.startupLock)) {
+        MUTEX_FREE(data.startupLock);
+    }
+    // every thread which logs is gone by now, the file logger goes with the callbacks
+    asyncLogStop();
     freeCallbacksProvider(&pClientCallbacks);
+    SAFE_MEMFREE(pChannels);
+    SAFE_MEMFREE(pConfigs);
 
     return (INT32) retStatus;
 }